@@ -179,6 +179,39 @@ public:
 		return size;
 	}
 
+	static void	ReadByteVectorFromStream(std::istream &ioIStream,
+					std::vector<unsigned char> &outVector)
+	{
+		unsigned int	size;
+
+		ioIStream.read((char *)&size, sizeof(unsigned int));
+		outVector.resize(size);
+
+		if (size != 0)
+			ioIStream.read((char *)&(outVector[0]), size);
+	}
+
+	static void	WriteByteVectorToStream(std::ostream &ioOStream,
+					const std::vector<unsigned char> &inVector)
+	{
+		unsigned int	size;
+
+		size = (unsigned int )inVector.size();
+		ioOStream.write((char *)&size, sizeof(unsigned int));
+
+		if (size != 0)
+			ioOStream.write((const char *)&(inVector[0]), size);
+	}
+
+	static unsigned int	CalcByteVectorStreamSize(const std::vector<unsigned char> &inVector)
+	{
+		unsigned int	size;
+
+		size = sizeof(int);
+		size += (unsigned int )inVector.size();
+		return size;
+	}
+
 	static void	ReadDoubleVectorListFromStream(std::istream &ioIStream,
 					std::vector<ublas::vector<double> > &outList)
 	{
@@ -0,0 +1,311 @@
+// =============================================================================
+//  GridExtractionEngine.hpp
+//
+//  MIT License
+//
+//  Copyright (c) 2007-2018 Dairoku Sekiguchi
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+// =============================================================================
+/*!
+	\file		GridExtractionEngine.hpp
+	\author		Dairoku Sekiguchi
+	\version	1.0
+	\date		2018/06/16
+	\brief
+
+	Runs the grid extraction (load, extraction and store) of all the images
+	in an ImageFolderNode as one parallel job, or as a tracked video sequence
+*/
+#ifndef __GRID_EXTRACTION_ENGINE_H
+#define __GRID_EXTRACTION_ENGINE_H
+
+
+// -----------------------------------------------------------------------------
+// 	include files
+// -----------------------------------------------------------------------------
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "ImageFolderNode.hpp"
+#include "InputImageNode.hpp"
+#include "ImageData.hpp"
+#include "ParallelTask.hpp"
+
+
+// -----------------------------------------------------------------------------
+// 	macros
+// -----------------------------------------------------------------------------
+
+
+// -----------------------------------------------------------------------------
+//	GridExtractionEngine class
+// -----------------------------------------------------------------------------
+//
+//	Every InputImageNode of the folder is one task: the bitmap is loaded,
+//	the grid is extracted and the result is stored in the node. The tasks
+//	run on the ParallelTask workers, so the loading of one image overlaps
+//	with the extraction of the others. The nodes are touched only by their
+//	own task, and findGrid runs on a single thread inside each task.
+//
+//	With the tracking enabled, the images are the frames of a video sequence.
+//	Each frame is seeded by the corners of the previous frame
+//	(InputImageNode::ExecCornerTracker) and the full detection runs only
+//	for the first frame and when the board is lost. The frames are processed
+//	in order and the corners of a frame are refined on the workers instead.
+//
+class GridExtractionEngine : public ParallelTask
+{
+public:
+	const static int		STATUS_NOT_PROCESSED	= 0;
+	const static int		STATUS_SUCCEEDED		= 1;
+	const static int		STATUS_OPEN_FAILED		= 2;	// can't open the bitmap file
+	const static int		STATUS_NO_INPUT			= 3;	// the four grid extractor inputs are not set
+	const static int		STATUS_NOT_FOUND		= 4;	// the checkerboard (circle grid) is not found
+
+	struct ImageResult
+	{
+		InputImageNode	*node;
+		int		status;
+		int		cornerNum;			// extracted corners
+		int		foundCornerNum;		// corners refined by findCorner
+		double	loadTime;			// [ms]
+		double	extractionTime;		// [ms]
+		bool	isTracked;			// the corners are tracked from the previous frame
+	};
+
+	GridExtractionEngine()
+	{
+		mWorkerNum = 0;
+		mIsAutoDetectionEnabled = true;
+		mIsTrackingEnabled = false;
+		mIsCircleGridEnabled = false;
+		mPyramidLevelNum = 0;
+		mPredictionMethod = CornerFinder::GRID_PREDICTION_HOMOGRAPHY;
+		mTotalTime = 0;
+	}
+
+	virtual ~GridExtractionEngine()
+	{
+	}
+
+	//	inNum <= 0 means the number of the hardware threads
+	void	SetWorkerNum(int inNum) { mWorkerNum = inNum; };
+	int		GetWorkerNum() { return mWorkerNum; };
+
+	//	true:	findChessboard finds the board (no manual inputs are needed)
+	//	false:	the four grid extractor inputs of each image are used
+	void	EnableAutoDetection(bool inEnable) { mIsAutoDetectionEnabled = inEnable; };
+	bool	IsAutoDetectionEnabled() { return mIsAutoDetectionEnabled; };
+
+	//	true:	the auto detection finds the grid of the circles instead of the checkerboard
+	//			(the corners of the circle grids are not tracked)
+	void	EnableCircleGrid(bool inEnable) { mIsCircleGridEnabled = inEnable; };
+	bool	IsCircleGridEnabled() { return mIsCircleGridEnabled; };
+
+	//	true:	the images are a video sequence (see above)
+	void	EnableTracking(bool inEnable) { mIsTrackingEnabled = inEnable; };
+	bool	IsTrackingEnabled() { return mIsTrackingEnabled; };
+
+	//	The pyramid level number of ExecGridExtractor and ExecAutoGridExtractor (0 means the full resolution only)
+	void	SetPyramidLevelNum(int inNum) { mPyramidLevelNum = inNum; };
+	int		GetPyramidLevelNum() { return mPyramidLevelNum; };
+
+	//	CornerFinder::GridPredictionMethod of ExecGridExtractor and ExecAutoGridExtractor
+	void	SetPredictionMethod(int inMethod) { mPredictionMethod = inMethod; };
+	int		GetPredictionMethod() { return mPredictionMethod; };
+
+	//	Returns the number of the images succeeded
+	int		Exec(ImageFolderNode *inImageFolderNode)
+	{
+		mResults.clear();
+		for (int i = 0; i < inImageFolderNode->GetChildNodeNum(); i++)
+		{
+			ImageResult	result;
+			result.node = (InputImageNode *)(inImageFolderNode->GetChildNode(i));
+			result.status = STATUS_NOT_PROCESSED;
+			result.cornerNum = 0;
+			result.foundCornerNum = 0;
+			result.loadTime = 0;
+			result.extractionTime = 0;
+			result.isTracked = false;
+			mResults.push_back(result);
+		}
+
+		std::chrono::steady_clock::time_point	start = std::chrono::steady_clock::now();
+		if (mIsTrackingEnabled)
+		{
+			InputImageNode	*prevNode = NULL;
+			for (int i = 0; i < (int )mResults.size(); i++)
+			{
+				ExtractImage(i, prevNode, mWorkerNum);
+				prevNode = (mResults[i].status == STATUS_SUCCEEDED) ? mResults[i].node : NULL;
+			}
+		}
+		else
+		{
+			ParallelTask::Run(this, (int )mResults.size(), mWorkerNum);
+		}
+		mTotalTime = ElapsedTime(start);
+
+		return GetSucceededNum();
+	}
+
+	int		GetResultNum() { return (int )mResults.size(); }
+	const ImageResult	&GetResult(int inIndex) { return mResults[inIndex]; }
+	double	GetTotalTime() { return mTotalTime; }
+
+	int		GetSucceededNum()
+	{
+		int	num = 0;
+		for (int i = 0; i < (int )mResults.size(); i++)
+			if (mResults[i].status == STATUS_SUCCEEDED)
+				num++;
+		return num;
+	}
+
+	int		GetTrackedNum()
+	{
+		int	num = 0;
+		for (int i = 0; i < (int )mResults.size(); i++)
+			if (mResults[i].isTracked)
+				num++;
+		return num;
+	}
+
+	static const char	*GetStatusString(int inStatus)
+	{
+		switch (inStatus)
+		{
+			case STATUS_SUCCEEDED:		return "OK";
+			case STATUS_OPEN_FAILED:	return "Can't open the file";
+			case STATUS_NO_INPUT:		return "No grid extractor input";
+			case STATUS_NOT_FOUND:		return "Grid not found";
+		}
+		return "Not processed";
+	}
+
+	void	DumpResults()
+	{
+		printf("[Grid Extraction Results]\n");
+		for (int i = 0; i < (int )mResults.size(); i++)
+		{
+			const ImageResult	&result = mResults[i];
+			printf(" %ls: %s%s (%d/%d corners) load %.1f ms, extraction %.1f ms\n",
+				result.node->GetName().c_str(),
+				GetStatusString(result.status),
+				result.isTracked ? " (tracked)" : "",
+				result.foundCornerNum, result.cornerNum,
+				result.loadTime, result.extractionTime);
+		}
+		printf(" %d of %d images succeeded in %.1f ms (%d workers)\n",
+			GetSucceededNum(), (int )mResults.size(), mTotalTime,
+			mWorkerNum > 0 ? mWorkerNum : ParallelTask::GetDefaultWorkerNum());
+		if (mIsTrackingEnabled)
+			printf(" %d images tracked\n", GetTrackedNum());
+	}
+
+	virtual void	ExecTask(int inIndex)
+	{
+		ExtractImage(inIndex, NULL, 1);
+	}
+
+private:
+	std::vector<ImageResult>	mResults;
+	int		mWorkerNum;
+	bool	mIsAutoDetectionEnabled;
+	bool	mIsTrackingEnabled;
+	bool	mIsCircleGridEnabled;
+	int		mPyramidLevelNum;
+	int		mPredictionMethod;
+	double	mTotalTime;
+
+	//	inPrevNode is the previous frame to track (NULL: the full detection)
+	void	ExtractImage(int inIndex, InputImageNode *inPrevNode, int inWorkerNum)
+	{
+		ImageResult	&result = mResults[inIndex];
+		InputImageNode	*node = result.node;
+
+		if (inPrevNode == NULL &&
+			mIsAutoDetectionEnabled == false && node->GetGridExtractorInputNum() != 4)
+		{
+			result.status = STATUS_NO_INPUT;
+			return;
+		}
+
+		std::chrono::steady_clock::time_point	start = std::chrono::steady_clock::now();
+		ImageData	image;
+		bool	isOpened = image.OpenBitmapFile(node->GetCachedFilePath().c_str());
+		result.loadTime = ElapsedTime(start);
+		if (isOpened == false)
+		{
+			result.status = STATUS_OPEN_FAILED;
+			return;
+		}
+
+		start = std::chrono::steady_clock::now();
+		if (inPrevNode != NULL && mIsCircleGridEnabled == false &&
+			node->ExecCornerTracker(image, *inPrevNode, inWorkerNum))
+		{
+			result.status = STATUS_SUCCEEDED;
+			result.isTracked = true;
+		}
+		else if (mIsAutoDetectionEnabled && mIsCircleGridEnabled)
+		{
+			if (node->ExecCircleGridExtractor(image) == false)
+				result.status = STATUS_NOT_FOUND;
+			else
+				result.status = STATUS_SUCCEEDED;
+		}
+		else if (mIsAutoDetectionEnabled)
+		{
+			if (node->ExecAutoGridExtractor(image, inWorkerNum, mPyramidLevelNum, mPredictionMethod) == false)
+				result.status = STATUS_NOT_FOUND;
+			else
+				result.status = STATUS_SUCCEEDED;
+		}
+		else if (node->GetGridExtractorInputNum() != 4)
+		{
+			result.status = STATUS_NO_INPUT;
+		}
+		else
+		{
+			node->ExecGridExtractor(image, inWorkerNum, mPyramidLevelNum, mPredictionMethod);
+			result.status = STATUS_SUCCEEDED;
+		}
+		result.extractionTime = ElapsedTime(start);
+
+		if (result.status != STATUS_SUCCEEDED)
+			return;
+
+		result.cornerNum = node->GetExtractedCornerNum();
+		for (int i = 0; i < result.cornerNum; i++)
+			if (node->GetExtractionResult(i))
+				result.foundCornerNum++;
+	}
+
+	static double	ElapsedTime(const std::chrono::steady_clock::time_point &inStart)
+	{
+		return std::chrono::duration<double, std::milli>(
+					std::chrono::steady_clock::now() - inStart).count();
+	}
+};
+
+#endif	// #ifdef __GRID_EXTRACTION_ENGINE_H
@@ -194,9 +194,9 @@ public:
 		unsigned char	*dataPtr = GetImageBufferPtr();
 
 		outMat.resize(GetImageHeight(), GetImageWidth());
-		for (int i = 0; i < GetImageHeight(); i++)
-			for (int j = 0; j < GetImageWidth(); j++, dataPtr++)
-				outMat(i, j) = *dataPtr;
+		for (int i = 0; i < GetImageHeight(); i++, dataPtr += GetImageStride())
+			for (int j = 0; j < GetImageWidth(); j++)
+				outMat(i, j) = dataPtr[j];
 	}
 
 	void	DumpBitmapInfo()
@@ -414,6 +414,22 @@ public:
 			return 0;
 		return mBitmapInfo->biBitCount;
 	}
+
+	//	The rows of a DIB are padded to 4 bytes
+	int	GetImageStride()
+	{
+		if (mBitmapInfo == NULL)
+			return 0;
+		return ((mBitmapInfo->biWidth * mBitmapInfo->biBitCount + 31) / 32) * 4;
+	}
+
+	bool	IsBottomUp()
+	{
+		if (mBitmapInfo == NULL)
+			return false;
+		return (mBitmapInfo->biHeight > 0);
+	}
+
 	unsigned char	*GetImageBufferPtr()
 	{
 		return mBitmapBits;
@@ -536,7 +552,7 @@ private:
 				bitmapInfo->RGBQuad[i].rgbReserved	= 0;
 			}
 
-			mBitmapBitsSize = abs(inWidth * inHeight);
+			mBitmapBitsSize = GetImageStride() * abs(inHeight);
 		}
 
 		return doCreateBitmapInfo;
@@ -584,7 +600,7 @@ private:
 			mBitmapInfo->biClrUsed			= 0;
 			mBitmapInfo->biClrImportant		= 0;
 
-			mBitmapBitsSize = abs(inWidth * inHeight * 3);
+			mBitmapBitsSize = GetImageStride() * abs(inHeight);
 		}
 
 		return doCreateBitmapInfo;
@@ -50,6 +50,7 @@
 // -----------------------------------------------------------------------------
 // 	macros
 // -----------------------------------------------------------------------------
+#define	CORNER_TRACKER_FOUND_RATIO		0.9		//	the board is lost below this ratio of the found corners
 
 
 // -----------------------------------------------------------------------------
@@ -64,6 +65,8 @@ public:
 	const static int		GRID_EXTRACTION_METHOD		= 10;
 	const static int		CORNER_FIND_METHOD			= 11;
 	const static int		REPROJECTION_METHOD			= 12;
+	const static int		TRACKING_METHOD				= 13;
+	const static int		CIRCLE_GRID_METHOD			= 14;
 
 	InputImageNode()
 	{
@@ -204,8 +207,7 @@ public:
 			return;
 
 		double	x, y;
-		ublas::matrix<unsigned char, ublas::column_major>	I;
-		inImage.GetuBLASMatrix(I);
+		ImageBufferView	I = GetImageBufferView(inImage);
 
 		//	Caution!! this function expect Matlab corrdinate system as input and output
 		mExtractionResult(inIndex) = CornerFinder::findCorner(
@@ -218,14 +220,19 @@ public:
 		mExtractedCorner(1, inIndex) = y - 1;
 	}
 
-	void	ExecGridExtractor(ImageData &inImage)
+	//	inWorkerNum is the number of the threads used in findGrid (<= 0 means all the cores)
+	//	inPyramidLevelNum > 0 extracts the grid coarse to fine (findGridPyramid), which
+	//	tolerates larger errors of the inputs without enlarging the corner finder window
+	//	inPredictionMethod is CornerFinder::GridPredictionMethod (PROPAGATION for the lenses
+	//	with a large distortion)
+	void	ExecGridExtractor(ImageData &inImage, int inWorkerNum = 0, int inPyramidLevelNum = 0,
+					int inPredictionMethod = CornerFinder::GRID_PREDICTION_HOMOGRAPHY)
 	{
 		if (GetGridExtractorInputNum()!= 4)
 			return;
 
 		ublas::matrix<double, ublas::column_major>	input = mGridExtractorInput;
-		ublas::matrix<unsigned char, ublas::column_major>	I;
-		inImage.GetuBLASMatrix(I);
+		ImageBufferView	I = GetImageBufferView(inImage);
 
 		int	n_sq_x1, n_sq_x2, n_sq_y1, n_sq_y2;
 
@@ -240,30 +247,120 @@ public:
 			n_sq_x1 = mGridNumX;
 			n_sq_y1 = mGridNumY;
 		}
-		
-		int	extractedCornerNum = (n_sq_x1 + 1) * (n_sq_y1 + 1);
-		mCornerFinderCenter.resize(2, extractedCornerNum);
-		mExtractedCorner.resize(2, extractedCornerNum);
-		mExtractedCornerWorldCoordinate.resize(3, extractedCornerNum);
+
+		ExtractGrid(I, input, n_sq_x1, n_sq_y1, inWorkerNum, inPyramidLevelNum, inPredictionMethod);
+	}
+
+	//	Finds the checkerboard without the four grid extractor inputs.
+	//	The detected corners are stored as the grid extractor inputs
+	//	(in the order of the clicks), so ExecGridExtractor works on them too.
+	//	inPyramidLevelNum and inPredictionMethod are the same as ExecGridExtractor
+	bool	ExecAutoGridExtractor(ImageData &inImage, int inWorkerNum = 0, int inPyramidLevelNum = 0,
+					int inPredictionMethod = CornerFinder::GRID_PREDICTION_HOMOGRAPHY)
+	{
+		ublas::matrix<double, ublas::column_major>	input;
+		ImageBufferView	I = GetImageBufferView(inImage);
+
+		int	n_sq_x, n_sq_y;
+
+		//	Caution!! this function returns the corners in Matlab corrdinate system
+		if (CornerFinder::findChessboard(I, input, &n_sq_x, &n_sq_y) == false)
+			return false;
+
+		//	findRectangle puts the first click at the end, so the last corner is the first click
+		for (int i = 0; i < 4; i++)
+			SetGridExtractorInput(i, input(0, (i + 3) % 4) - 1, input(1, (i + 3) % 4) - 1);
+		SetGridExtractorInputNum(4);
+
+		ExtractGrid(I, input, n_sq_x, n_sq_y, inWorkerNum, inPyramidLevelNum, inPredictionMethod);
+		return true;
+	}
+
+	//	Finds the grid of the circles (dark circles on a bright board) instead of
+	//	the checkerboard. The circle centers are stored as the extracted corners
+	//	(the grid real size is the distance between the centers) and the grid
+	//	extractor inputs are not used.
+	bool	ExecCircleGridExtractor(ImageData &inImage)
+	{
+		ublas::matrix<double, ublas::column_major>	center, corner, world;
+		ublas::vector<int>	result;
+		ImageBufferView	I = GetImageBufferView(inImage);
+
+		int	n_sq_x, n_sq_y;
+
+		if (CornerFinder::findCircleGrid(
+				I,
+				mGridRealSizeX, mGridRealSizeY,
+				center, corner, world, result,
+				&n_sq_x, &n_sq_y) == false)
+			return false;
+
+		int	extractedCornerNum = (n_sq_x + 1) * (n_sq_y + 1);
+		mCornerFinderCenter = center;
+		mExtractedCorner = corner;
+		mExtractedCornerWorldCoordinate = world;
+		mExtractionResult = result;
 		mCornerFinderWindowSize.resize(2, extractedCornerNum);
-		mExtractionResult.resize(extractedCornerNum);
 		mExtractionMethod.resize(extractedCornerNum);
+		for (int i = 0; i < extractedCornerNum; i++)
+		{
+			mExtractionMethod(i) = CIRCLE_GRID_METHOD;
+			mCornerFinderWindowSize(0, i) = mCornerFinderWindowX;
+			mCornerFinderWindowSize(1, i) = mCornerFinderWindowY;
+		}
+		return true;
+	}
 
-		CornerFinder::findGrid(
-			I,
-			input,
+	//	Tracks the corners of inPrevNode (the previous frame of a video sequence).
+	//	The extracted corners of inPrevNode are the corner finder centers of this
+	//	frame and only findCorner runs, so the corner finder window has to cover
+	//	the motion between the frames. Returns false if the board is lost (the
+	//	corners of this node are not changed then, use the full detection).
+	bool	ExecCornerTracker(ImageData &inImage, InputImageNode &inPrevNode, int inWorkerNum = 0)
+	{
+		int	cornerNum = inPrevNode.GetExtractedCornerNum();
+		if (cornerNum == 0)
+			return false;
+
+		//	Caution!! findCorners expects Matlab corrdinate system as input
+		ublas::matrix<double, ublas::column_major>	input = inPrevNode.mExtractedCorner;
+		for (int i = 0; i < cornerNum; i++)
+		{
+			input(0, i) += 1;
+			input(1, i) += 1;
+		}
+
+		ublas::matrix<double, ublas::column_major>	center(2, cornerNum);
+		ublas::matrix<double, ublas::column_major>	corner(2, cornerNum);
+		ublas::vector<int>	result(cornerNum);
+		ImageBufferView	I = GetImageBufferView(inImage);
+
+		CornerFinder::findCorners(
+			I, input,
 			mCornerFinderWindowX, mCornerFinderWindowY,
-			mGridRealSizeX, mGridRealSizeY,
-			n_sq_x1, n_sq_y1,
-			mCornerFinderCenter, mExtractedCorner,
-			mExtractedCornerWorldCoordinate, mExtractionResult);
+			center, corner, result,
+			inWorkerNum);
+
+		int	foundNum = 0;
+		for (int i = 0; i < cornerNum; i++)
+			if (result(i))
+				foundNum++;
+		if (foundNum < cornerNum * CORNER_TRACKER_FOUND_RATIO)
+			return false;
 
-		for (int i = 0; i < extractedCornerNum; i++)
+		mCornerFinderCenter = center;
+		mExtractedCorner = corner;
+		mExtractedCornerWorldCoordinate = inPrevNode.mExtractedCornerWorldCoordinate;
+		mCornerFinderWindowSize.resize(2, cornerNum);
+		mExtractionResult = result;
+		mExtractionMethod.resize(cornerNum);
+		for (int i = 0; i < cornerNum; i++)
 		{
-			mExtractionMethod(i) = GRID_EXTRACTION_METHOD;
+			mExtractionMethod(i) = TRACKING_METHOD;
 			mCornerFinderWindowSize(0, i) = mCornerFinderWindowX;
 			mCornerFinderWindowSize(1, i) = mCornerFinderWindowY;
 		}
+		return true;
 	}
 
 	virtual void	ReadFromStream(std::istream &ioIStream)
@@ -344,6 +441,58 @@ private:
 	double	mGridRealSizeX, mGridRealSizeY;
 	bool	mEnableGridNumAutoDetector;
 
+	//	The view refers to the (8bit mono) buffer of inImage without copying it
+	static ImageBufferView	GetImageBufferView(ImageData &inImage)
+	{
+		return ImageBufferView(
+				inImage.GetImageBufferPtr(),
+				inImage.GetImageWidth(), inImage.GetImageHeight(),
+				inImage.GetImageStride(), inImage.IsBottomUp());
+	}
+
+	void	ExtractGrid(
+				const ImageBufferView &inI,
+				const ublas::matrix<double, ublas::column_major> &inInput,
+				int n_sq_x1, int n_sq_y1, int inWorkerNum, int inPyramidLevelNum = 0,
+				int inPredictionMethod = CornerFinder::GRID_PREDICTION_HOMOGRAPHY)
+	{
+		int	extractedCornerNum = (n_sq_x1 + 1) * (n_sq_y1 + 1);
+		mCornerFinderCenter.resize(2, extractedCornerNum);
+		mExtractedCorner.resize(2, extractedCornerNum);
+		mExtractedCornerWorldCoordinate.resize(3, extractedCornerNum);
+		mCornerFinderWindowSize.resize(2, extractedCornerNum);
+		mExtractionResult.resize(extractedCornerNum);
+		mExtractionMethod.resize(extractedCornerNum);
+
+		if (inPyramidLevelNum > 0)
+			CornerFinder::findGridPyramid(
+				inI,
+				inInput,
+				mCornerFinderWindowX, mCornerFinderWindowY,
+				mGridRealSizeX, mGridRealSizeY,
+				n_sq_x1, n_sq_y1,
+				mCornerFinderCenter, mExtractedCorner,
+				mExtractedCornerWorldCoordinate, mExtractionResult,
+				inPyramidLevelNum, inWorkerNum, inPredictionMethod);
+		else
+			CornerFinder::findGrid(
+				inI,
+				inInput,
+				mCornerFinderWindowX, mCornerFinderWindowY,
+				mGridRealSizeX, mGridRealSizeY,
+				n_sq_x1, n_sq_y1,
+				mCornerFinderCenter, mExtractedCorner,
+				mExtractedCornerWorldCoordinate, mExtractionResult,
+				inWorkerNum, inPredictionMethod);
+
+		for (int i = 0; i < extractedCornerNum; i++)
+		{
+			mExtractionMethod(i) = GRID_EXTRACTION_METHOD;
+			mCornerFinderWindowSize(0, i) = mCornerFinderWindowX;
+			mCornerFinderWindowSize(1, i) = mCornerFinderWindowY;
+		}
+	}
+
 	void	Initialize()
 	{
 		mGridInputNum = 0;
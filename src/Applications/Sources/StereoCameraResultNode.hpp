@@ -55,17 +55,30 @@
 class StereoCameraResultNode : public CalibrationResultNode
 {
 public:
+	//	Old files have the size of a1_left (the old rect_index) instead of these tags
+	const static unsigned int	RECTIFY_MAP_SECTION_TAG	= 0xFFFFFFFF;
+	//	The maps followed by the size, the scale, the alpha and the ROIs of the rectification
+	const static unsigned int	RECTIFY_MAP_SECTION_TAG2	= 0xFFFFFFFE;
+
 	StereoCameraResultNode()
 		:	mStereoCalibration(DEFAULT_IMAGE_WIDTH, DEFAULT_IMAGE_HEIGHT)
 	{
+		mIsRectifyMapStored = false;
 	}
 
 	StereoCameraResultNode(int inWidth, int inHeight, const std::wstring &inCalibrationResultName)
 		:	mStereoCalibration(inWidth, inHeight),
 			CalibrationResultNode(inCalibrationResultName)
 	{
+		mIsRectifyMapStored = false;
 	}
 
+	//	true:	the rectification maps are stored in the file (RectifyMap::Encode)
+	//	false:	the maps are not stored and UpdateRectifyIndex rebuilds them from
+	//			om, T and the intrinsic parameters when they are needed
+	void	EnableRectifyMapStore(bool inEnable) { mIsRectifyMapStored = inEnable; };
+	bool	IsRectifyMapStoreEnabled() const { return mIsRectifyMapStored; };
+
 	virtual bool	ChildNodeCheck(CalibraNode *inNode) const
 	{
 		//if (inNode is CalibrationResultNode)
@@ -126,34 +139,71 @@ public:
 		CalibraFileUtil::ReadMatrixFromStream(ioIStream, mStereoCalibration.T_error);
 		CalibraFileUtil::ReadMatrixFromStream(ioIStream, mStereoCalibration.om_error);
 
-		CalibraFileUtil::ReadDoubleVectorFromStream(ioIStream, mStereoCalibration.a1_left);
-		CalibraFileUtil::ReadDoubleVectorFromStream(ioIStream, mStereoCalibration.a2_left);
-		CalibraFileUtil::ReadDoubleVectorFromStream(ioIStream, mStereoCalibration.a3_left);
-		CalibraFileUtil::ReadDoubleVectorFromStream(ioIStream, mStereoCalibration.a4_left);
-
-		CalibraFileUtil::ReadIntVectorFromStream(ioIStream, mStereoCalibration.ind_new_left);
-		CalibraFileUtil::ReadIntVectorFromStream(ioIStream, mStereoCalibration.ind_1_left);
-		CalibraFileUtil::ReadIntVectorFromStream(ioIStream, mStereoCalibration.ind_2_left);
-		CalibraFileUtil::ReadIntVectorFromStream(ioIStream, mStereoCalibration.ind_3_left);
-		CalibraFileUtil::ReadIntVectorFromStream(ioIStream, mStereoCalibration.ind_4_left);
-
-		CalibraFileUtil::ReadDoubleVectorFromStream(ioIStream, mStereoCalibration.a1_right);
-		CalibraFileUtil::ReadDoubleVectorFromStream(ioIStream, mStereoCalibration.a2_right);
-		CalibraFileUtil::ReadDoubleVectorFromStream(ioIStream, mStereoCalibration.a3_right);
-		CalibraFileUtil::ReadDoubleVectorFromStream(ioIStream, mStereoCalibration.a4_right);
-
-		CalibraFileUtil::ReadIntVectorFromStream(ioIStream, mStereoCalibration.ind_new_right);
-		CalibraFileUtil::ReadIntVectorFromStream(ioIStream, mStereoCalibration.ind_1_right);
-		CalibraFileUtil::ReadIntVectorFromStream(ioIStream, mStereoCalibration.ind_2_right);
-		CalibraFileUtil::ReadIntVectorFromStream(ioIStream, mStereoCalibration.ind_3_right);
-		CalibraFileUtil::ReadIntVectorFromStream(ioIStream, mStereoCalibration.ind_4_right);
+		unsigned int	tag;
+		ioIStream.read((char *)&tag, sizeof(unsigned int));
+		if (tag == RECTIFY_MAP_SECTION_TAG || tag == RECTIFY_MAP_SECTION_TAG2)
+		{
+			std::lock_guard<std::recursive_mutex>	lock(mStereoCalibration.rect_map_mutex);
+			std::vector<unsigned char>	leftMap, rightMap;
+			CalibraFileUtil::ReadByteVectorFromStream(ioIStream, leftMap);
+			CalibraFileUtil::ReadByteVectorFromStream(ioIStream, rightMap);
+
+			//	RECTIFY_MAP_SECTION_TAG maps have no ROIs (rebuilt)
+			if (tag == RECTIFY_MAP_SECTION_TAG2)
+			{
+				CalibraFileUtil::ReadIntFromStream(ioIStream, &mStereoCalibration.rect_width);
+				CalibraFileUtil::ReadIntFromStream(ioIStream, &mStereoCalibration.rect_height);
+				CalibraFileUtil::ReadDoubleFromStream(ioIStream, &mStereoCalibration.rect_scale);
+				CalibraFileUtil::ReadDoubleFromStream(ioIStream, &mStereoCalibration.rect_alpha);
+				ReadROIFromStream(ioIStream, mStereoCalibration.rect_roi_left);
+				ReadROIFromStream(ioIStream, mStereoCalibration.rect_roi_right);
+				ReadROIFromStream(ioIStream, mStereoCalibration.rect_roi);
+			}
+
+			//	Broken maps are left empty (and rebuilt)
+			mIsRectifyMapStored = (leftMap.empty() == false);
+			mStereoCalibration.rect_map_left.Clear();
+			mStereoCalibration.rect_map_right.Clear();
+			mStereoCalibration.rect_map_hash = 0;
+			if (tag == RECTIFY_MAP_SECTION_TAG2 &&
+				leftMap.empty() == false && rightMap.empty() == false &&
+				mStereoCalibration.rect_map_left.Decode(leftMap) &&
+				mStereoCalibration.rect_map_right.Decode(rightMap))
+				mStereoCalibration.rect_map_hash = mStereoCalibration.CalcRectifyHash(
+					mStereoCalibration.rect_width, mStereoCalibration.rect_height,
+					mStereoCalibration.rect_scale, mStereoCalibration.rect_alpha);
+		}
+		else
+		{
+			//	The a1..a4 and ind_* vectors of the old rect_index (the maps are rebuilt)
+			ioIStream.seekg((std::streamoff )tag * sizeof(double), std::ios_base::cur);
+			for (int i = 0; i < 3; i++)
+				SkipVectorInStream(ioIStream, sizeof(double));
+			for (int i = 0; i < 5; i++)
+				SkipVectorInStream(ioIStream, sizeof(int));
+			for (int i = 0; i < 4; i++)
+				SkipVectorInStream(ioIStream, sizeof(double));
+			for (int i = 0; i < 5; i++)
+				SkipVectorInStream(ioIStream, sizeof(int));
+		}
 
 		CalibrationResultNode::ReadFromStream(ioIStream);
 	}
 
 	virtual void	WriteToStream(std::ostream &ioOStream, bool inIsSuperclass) const
 	{
-		WriteObjectDataHeader(ioOStream, CalcStreamDataSectionSize(),
+		//	The maps and the rect_* members are written as one set
+		std::lock_guard<std::recursive_mutex>	lock(mStereoCalibration.rect_map_mutex);
+		std::vector<unsigned char>	leftMap, rightMap;
+		if (mIsRectifyMapStored &&
+			mStereoCalibration.rect_map_left.IsEmpty() == false &&
+			mStereoCalibration.rect_map_right.IsEmpty() == false)
+		{
+			mStereoCalibration.rect_map_left.Encode(leftMap);
+			mStereoCalibration.rect_map_right.Encode(rightMap);
+		}
+
+		WriteObjectDataHeader(ioOStream, CalcStreamDataSectionSize(leftMap, rightMap),
 									STEREO_CAMERA_RESULT_NODE_OBJECT_ID, inIsSuperclass);
 
 		CalibraFileUtil::WriteDoubleToStream(ioOStream, mStereoCalibration.mImageWidth);
@@ -198,27 +248,17 @@ public:
 		CalibraFileUtil::WriteMatrixToStream(ioOStream, mStereoCalibration.T_error);
 		CalibraFileUtil::WriteMatrixToStream(ioOStream, mStereoCalibration.om_error);
 
-		CalibraFileUtil::WriteDoubleVectorToStream(ioOStream, mStereoCalibration.a1_left);
-		CalibraFileUtil::WriteDoubleVectorToStream(ioOStream, mStereoCalibration.a2_left);
-		CalibraFileUtil::WriteDoubleVectorToStream(ioOStream, mStereoCalibration.a3_left);
-		CalibraFileUtil::WriteDoubleVectorToStream(ioOStream, mStereoCalibration.a4_left);
-
-		CalibraFileUtil::WriteIntVectorToStream(ioOStream, mStereoCalibration.ind_new_left);
-		CalibraFileUtil::WriteIntVectorToStream(ioOStream, mStereoCalibration.ind_1_left);
-		CalibraFileUtil::WriteIntVectorToStream(ioOStream, mStereoCalibration.ind_2_left);
-		CalibraFileUtil::WriteIntVectorToStream(ioOStream, mStereoCalibration.ind_3_left);
-		CalibraFileUtil::WriteIntVectorToStream(ioOStream, mStereoCalibration.ind_4_left);
-
-		CalibraFileUtil::WriteDoubleVectorToStream(ioOStream, mStereoCalibration.a1_right);
-		CalibraFileUtil::WriteDoubleVectorToStream(ioOStream, mStereoCalibration.a2_right);
-		CalibraFileUtil::WriteDoubleVectorToStream(ioOStream, mStereoCalibration.a3_right);
-		CalibraFileUtil::WriteDoubleVectorToStream(ioOStream, mStereoCalibration.a4_right);
-
-		CalibraFileUtil::WriteIntVectorToStream(ioOStream, mStereoCalibration.ind_new_right);
-		CalibraFileUtil::WriteIntVectorToStream(ioOStream, mStereoCalibration.ind_1_right);
-		CalibraFileUtil::WriteIntVectorToStream(ioOStream, mStereoCalibration.ind_2_right);
-		CalibraFileUtil::WriteIntVectorToStream(ioOStream, mStereoCalibration.ind_3_right);
-		CalibraFileUtil::WriteIntVectorToStream(ioOStream, mStereoCalibration.ind_4_right);
+		unsigned int	tag = RECTIFY_MAP_SECTION_TAG2;
+		ioOStream.write((char *)&tag, sizeof(unsigned int));
+		CalibraFileUtil::WriteByteVectorToStream(ioOStream, leftMap);
+		CalibraFileUtil::WriteByteVectorToStream(ioOStream, rightMap);
+		CalibraFileUtil::WriteIntToStream(ioOStream, mStereoCalibration.rect_width);
+		CalibraFileUtil::WriteIntToStream(ioOStream, mStereoCalibration.rect_height);
+		CalibraFileUtil::WriteDoubleToStream(ioOStream, mStereoCalibration.rect_scale);
+		CalibraFileUtil::WriteDoubleToStream(ioOStream, mStereoCalibration.rect_alpha);
+		WriteROIToStream(ioOStream, mStereoCalibration.rect_roi_left);
+		WriteROIToStream(ioOStream, mStereoCalibration.rect_roi_right);
+		WriteROIToStream(ioOStream, mStereoCalibration.rect_roi);
 
 		CalibrationResultNode::WriteToStream(ioOStream, true);
 	}
@@ -226,9 +266,10 @@ public:
 	StereoCalibration	mStereoCalibration;
 
 private:
+	bool	mIsRectifyMapStored;
 
-
-	unsigned int	CalcStreamDataSectionSize() const
+	unsigned int	CalcStreamDataSectionSize(const std::vector<unsigned char> &inLeftMap,
+												const std::vector<unsigned char> &inRightMap) const
 	{
 		unsigned int	size = OBJECT_HEADER_LEN;
 
@@ -274,29 +315,40 @@ private:
 		size += CalibraFileUtil::CalcMatrixStreamSize(mStereoCalibration.T_error);
 		size += CalibraFileUtil::CalcMatrixStreamSize(mStereoCalibration.om_error);
 
-		size += CalibraFileUtil::CalcDoubleVectorStreamSize(mStereoCalibration.a1_left);
-		size += CalibraFileUtil::CalcDoubleVectorStreamSize(mStereoCalibration.a2_left);
-		size += CalibraFileUtil::CalcDoubleVectorStreamSize(mStereoCalibration.a3_left);
-		size += CalibraFileUtil::CalcDoubleVectorStreamSize(mStereoCalibration.a4_left);
+		size += sizeof(unsigned int);	// RECTIFY_MAP_SECTION_TAG2
+		size += CalibraFileUtil::CalcByteVectorStreamSize(inLeftMap);
+		size += CalibraFileUtil::CalcByteVectorStreamSize(inRightMap);
+		size += CalibraFileUtil::CalcIntStreamSize();		// rect_width
+		size += CalibraFileUtil::CalcIntStreamSize();		// rect_height
+		size += CalibraFileUtil::CalcDoubleStreamSize();	// rect_scale
+		size += CalibraFileUtil::CalcDoubleStreamSize();	// rect_alpha
+		size += CalibraFileUtil::CalcIntStreamSize() * 4 * 3;	// rect_roi_left, rect_roi_right, rect_roi
 
-		size += CalibraFileUtil::CalcIntVectorStreamSize(mStereoCalibration.ind_new_left);
-		size += CalibraFileUtil::CalcIntVectorStreamSize(mStereoCalibration.ind_1_left);
-		size += CalibraFileUtil::CalcIntVectorStreamSize(mStereoCalibration.ind_2_left);
-		size += CalibraFileUtil::CalcIntVectorStreamSize(mStereoCalibration.ind_3_left);
-		size += CalibraFileUtil::CalcIntVectorStreamSize(mStereoCalibration.ind_4_left);
+		return size;
+	}
 
-		size += CalibraFileUtil::CalcDoubleVectorStreamSize(mStereoCalibration.a1_right);
-		size += CalibraFileUtil::CalcDoubleVectorStreamSize(mStereoCalibration.a2_right);
-		size += CalibraFileUtil::CalcDoubleVectorStreamSize(mStereoCalibration.a3_right);
-		size += CalibraFileUtil::CalcDoubleVectorStreamSize(mStereoCalibration.a4_right);
+	static void	ReadROIFromStream(std::istream &ioIStream, RectifyROI &outROI)
+	{
+		CalibraFileUtil::ReadIntFromStream(ioIStream, &outROI.x);
+		CalibraFileUtil::ReadIntFromStream(ioIStream, &outROI.y);
+		CalibraFileUtil::ReadIntFromStream(ioIStream, &outROI.width);
+		CalibraFileUtil::ReadIntFromStream(ioIStream, &outROI.height);
+	}
 
-		size += CalibraFileUtil::CalcIntVectorStreamSize(mStereoCalibration.ind_new_right);
-		size += CalibraFileUtil::CalcIntVectorStreamSize(mStereoCalibration.ind_1_right);
-		size += CalibraFileUtil::CalcIntVectorStreamSize(mStereoCalibration.ind_2_right);
-		size += CalibraFileUtil::CalcIntVectorStreamSize(mStereoCalibration.ind_3_right);
-		size += CalibraFileUtil::CalcIntVectorStreamSize(mStereoCalibration.ind_4_right);
+	static void	WriteROIToStream(std::ostream &ioOStream, const RectifyROI &inROI)
+	{
+		CalibraFileUtil::WriteIntToStream(ioOStream, inROI.x);
+		CalibraFileUtil::WriteIntToStream(ioOStream, inROI.y);
+		CalibraFileUtil::WriteIntToStream(ioOStream, inROI.width);
+		CalibraFileUtil::WriteIntToStream(ioOStream, inROI.height);
+	}
 
-		return size;
+	static void	SkipVectorInStream(std::istream &ioIStream, unsigned int inElementSize)
+	{
+		unsigned int	size;
+
+		ioIStream.read((char *)&size, sizeof(unsigned int));
+		ioIStream.seekg((std::streamoff )size * inElementSize, std::ios_base::cur);
 	}
 };
 
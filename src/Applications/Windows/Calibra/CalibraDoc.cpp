@@ -47,6 +47,7 @@
 #include "StereoCalibration.hpp"
 #include "CalibraFile.hpp"
 #include "FilePath.hpp"
+#include "GridExtractionEngine.hpp"
 
 
 // -----------------------------------------------------------------------------
@@ -81,6 +82,7 @@ BEGIN_MESSAGE_MAP(CCalibraDoc, CDocument)
 	ON_COMMAND(ID_TEST_DUMPSINGLECAMERARESULTS, &CCalibraDoc::OnTestDumpsinglecameraresults)
 	ON_COMMAND(ID_TEST_DUMPSTEREOCAMERARESULTS, &CCalibraDoc::OnTestDumpstereocameraresults)
 	ON_COMMAND(ID_TEST_DUMPMULTICAMERARESULTS, &CCalibraDoc::OnTestDumpmulticameraresults)
+	ON_COMMAND(ID_TEST_AUTOGRIDEXTRACTION, &CCalibraDoc::OnTestAutoGridExtraction)
 END_MESSAGE_MAP()
 
 
@@ -646,8 +648,8 @@ void CCalibraDoc::OnTestRunStereoCameraCalibration()
 	node->mStereoCalibration.kc_right = rightResult->mCameraCalibration.kc;
 	node->mStereoCalibration.alpha_c_right = rightResult->mCameraCalibration.alpha_c;
 
+	//	The rectification maps are made when they are used (UpdateRectifyIndex)
 	node->mStereoCalibration.DoCalibration();
-	node->mStereoCalibration.CalcRectifyIndex();
 }
 
 void CCalibraDoc::OnTestDumpstereocameraresults()
@@ -667,6 +669,37 @@ void CCalibraDoc::OnTestDumpstereocameraresults()
 	node->mStereoCalibration.DumpResults();
 }
 
+//	RectifyMap::Remap takes 8bit mono or 24bit BGR images of the map sizes
+//	with the rows packed (the DIB rows are padded to 4 bytes)
+static bool	isRemappable(ImageData &inImage, ImageData &inOutputImage, const RectifyMap &inMap)
+{
+	int	channelNum = inImage.GetImageBitCount() / 8;
+
+	if (channelNum != 1 && channelNum != 3)
+	{
+		printf("Error: %d bit images are not supported (8bit mono or 24bit color only)\n",
+			inImage.GetImageBitCount());
+		return false;
+	}
+	if (inImage.GetImageWidth() != inMap.GetSourceWidth() ||
+		inImage.GetImageHeight() != inMap.GetSourceHeight() ||
+		inOutputImage.GetImageWidth() != inMap.GetWidth() ||
+		inOutputImage.GetImageHeight() != inMap.GetHeight() ||
+		inOutputImage.GetImageBitCount() != inImage.GetImageBitCount())
+	{
+		printf("Error: The image size (%d x %d) is different from the calibration (%d x %d)\n",
+			inImage.GetImageWidth(), inImage.GetImageHeight(),
+			inMap.GetSourceWidth(), inMap.GetSourceHeight());
+		return false;
+	}
+	if (inImage.GetImageStride() != inImage.GetImageWidth() * channelNum)
+	{
+		printf("Error: The image rows are padded (the width must be a multiple of 4 bytes)\n");
+		return false;
+	}
+	return true;
+}
+
 void CCalibraDoc::OnTestRectifyimages()
 {
 	if (mSelectedNode == NULL)
@@ -702,31 +735,30 @@ void CCalibraDoc::OnTestRectifyimages()
 
 	ImageData	inputImage, outputImage;
 
-	inputImage.OpenBitmapFile(leftImageFilePathName);
-	outputImage.OpenBitmapFile(leftImageFilePathName);
-
-	node->mStereoCalibration.rectify_image(
-		inputImage.GetImageWidth(), inputImage.GetImageHeight(),
-		inputImage.GetImageBufferPtr(),
-		node->mStereoCalibration.a1_left, node->mStereoCalibration.a2_left,
-		node->mStereoCalibration.a3_left, node->mStereoCalibration.a4_left,
-		node->mStereoCalibration.ind_new_left,
-		node->mStereoCalibration.ind_1_left, node->mStereoCalibration.ind_2_left,
-		node->mStereoCalibration.ind_3_left, node->mStereoCalibration.ind_4_left,
-		outputImage.GetImageBufferPtr());
+	if (inputImage.OpenBitmapFile(leftImageFilePathName) == false ||
+		outputImage.OpenBitmapFile(leftImageFilePathName) == false)
+		return;
+
+	//	The maps are made at the first use and kept until the parameters change
+	//	(locked until both images are remapped)
+	std::lock_guard<std::recursive_mutex>	lock(node->mStereoCalibration.rect_map_mutex);
+	node->mStereoCalibration.UpdateRectifyIndex();
+
+	if (isRemappable(inputImage, outputImage, node->mStereoCalibration.rect_map_left) == false)
+		return;
+	node->mStereoCalibration.rect_map_left.Remap(
+		inputImage.GetImageBufferPtr(), outputImage.GetImageBufferPtr(),
+		inputImage.GetImageBitCount() / 8);
 	outputImage.SaveBitmapFile(leftOutputFilePathName.c_str());
 
-	inputImage.OpenBitmapFile(rightImageFilePathName);
-
-	node->mStereoCalibration.rectify_image(
-		inputImage.GetImageWidth(), inputImage.GetImageHeight(),
-		inputImage.GetImageBufferPtr(),
-		node->mStereoCalibration.a1_right, node->mStereoCalibration.a2_right,
-		node->mStereoCalibration.a3_right, node->mStereoCalibration.a4_right,
-		node->mStereoCalibration.ind_new_right,
-		node->mStereoCalibration.ind_1_right, node->mStereoCalibration.ind_2_right,
-		node->mStereoCalibration.ind_3_right, node->mStereoCalibration.ind_4_right,
-		outputImage.GetImageBufferPtr());
+	if (inputImage.OpenBitmapFile(rightImageFilePathName) == false)
+		return;
+
+	if (isRemappable(inputImage, outputImage, node->mStereoCalibration.rect_map_right) == false)
+		return;
+	node->mStereoCalibration.rect_map_right.Remap(
+		inputImage.GetImageBufferPtr(), outputImage.GetImageBufferPtr(),
+		inputImage.GetImageBitCount() / 8);
 	outputImage.SaveBitmapFile(rightOutputFilePath.c_str());
 }
 
@@ -817,3 +849,20 @@ void CCalibraDoc::OnTestDumpmulticameraresults()
 
 	node->mMultiCameraCalibration.DumpResults();
 }
+
+void CCalibraDoc::OnTestAutoGridExtraction()
+{
+	if (IsImageFolderNodeSelected() == false)
+	{
+		printf("Internal Error: ImageFolder is not selected\n");
+		return;
+	}
+
+	ImageFolderNode	*imageFolderNode = (ImageFolderNode *)GetSelectedNode();
+
+	GridExtractionEngine	engine;
+	engine.Exec(imageFolderNode);
+	engine.DumpResults();
+
+	UpdateAllViews(NULL);
+}
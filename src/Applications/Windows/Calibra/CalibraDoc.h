@@ -159,4 +159,5 @@ public:
 	afx_msg void OnTestDumpsinglecameraresults();
 	afx_msg void OnTestDumpstereocameraresults();
 	afx_msg void OnTestDumpmulticameraresults();
+	afx_msg void OnTestAutoGridExtraction();
 };
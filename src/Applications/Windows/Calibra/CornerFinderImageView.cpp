@@ -92,6 +92,8 @@ void CCornerFinderImageView::OnDraw(CDC* pDC)
 			switch (mInputImageNode->GetExtractionMethod(i))
 			{
 				case InputImageNode::GRID_EXTRACTION_METHOD:
+				case InputImageNode::TRACKING_METHOD:
+				case InputImageNode::CIRCLE_GRID_METHOD:
 					if (mInputImageNode->GetExtractionResult(i))
 						pDC->SelectObject(&darkGreenPen);
 					else
@@ -114,6 +116,8 @@ void CCornerFinderImageView::OnDraw(CDC* pDC)
 		switch (mInputImageNode->GetExtractionMethod(i))
 		{
 			case InputImageNode::GRID_EXTRACTION_METHOD:
+			case InputImageNode::TRACKING_METHOD:
+			case InputImageNode::CIRCLE_GRID_METHOD:
 				if (mInputImageNode->GetExtractionResult(i))
 					pDC->SelectObject(&greenPen);
 				else
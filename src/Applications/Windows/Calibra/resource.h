@@ -35,13 +35,14 @@
 #define ID_TEST_DUMPSTEREOCAMERARESULTS 32807
 #define ID_TEST_DUMPSINGLECAMERARESULTS 32808
 #define ID_TEST_DUMPMULTICAMERARESULTS  32809
+#define ID_TEST_AUTOGRIDEXTRACTION      32810
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        133
-#define _APS_NEXT_COMMAND_VALUE         32810
+#define _APS_NEXT_COMMAND_VALUE         32811
 #define _APS_NEXT_CONTROL_VALUE         1000
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
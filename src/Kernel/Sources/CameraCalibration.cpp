@@ -60,13 +60,405 @@ namespace ublas = boost::numeric::ublas;
 namespace lapack = boost::numeric::bindings::lapack;
 
 #include "CameraCalibration.hpp"
+#include "ParallelTask.hpp"
+#include "DistortionEngine.hpp"
 
 extern "C" {
 //#define LAPACK_DGETRI dgetri
 void    LAPACK_DGETRI(int *n,double *a,int *lda,int *ipiv,double *work,int *lwork,int *info);
 }
 
-bool	g_debug_enabled = false;
+//bool	g_debug_enabled = false;
+
+//	Number of the points converted to the structure of arrays at once
+//	when a function is delegated to DistortionEngine
+#define	DISTORTION_BLOCK_SIZE	256
+
+#define	COMP_DISTORTION_ITER_MAX	20
+
+
+// -----------------------------------------------------------------------------
+// 	ViewNormalEquationTask class
+// -----------------------------------------------------------------------------
+//
+//	Builds the normal equation blocks of one view for mainOptimization().
+//	A * A' and A * e (and e' * e) are stored per view and summed up afterwards
+//	in the view order, so the result does not depend on the number of the threads.
+//	The task is created once before the iterations and the work matrices of
+//	each view are kept, so the iterations do not allocate anything.
+//
+class	ViewNormalEquationTask : public ParallelTask
+{
+public:
+	ViewNormalEquationTask(
+		CameraCalibration *inCalibration,
+		const ublas::vector<double> &in_param,
+		const ublas::vector<double> &in_f,
+		const ublas::vector<double> &in_c,
+		const ublas::vector<double> &in_k,
+		const double &in_alpha,
+		std::vector<ublas::matrix<double, ublas::column_major> > &out_JJ3_int_list,
+		std::vector<ublas::matrix<double, ublas::column_major> > &out_ex3_int_list,
+		std::vector<ublas::matrix<double, ublas::column_major> > &out_JJ3_ext_list,
+		std::vector<ublas::matrix<double, ublas::column_major> > &out_JJ3_cross_list,
+		std::vector<ublas::matrix<double, ublas::column_major> > &out_ex3_ext_list,
+		std::vector<double> &out_e2_list)
+		: param(in_param), f(in_f), c(in_c), k(in_k), alpha(in_alpha),
+		  JJ3_int_list(out_JJ3_int_list), ex3_int_list(out_ex3_int_list),
+		  JJ3_ext_list(out_JJ3_ext_list), JJ3_cross_list(out_JJ3_cross_list),
+		  ex3_ext_list(out_ex3_ext_list), e2_list(out_e2_list)
+	{
+		mCalibration = inCalibration;
+
+		int	n_ima = (int )mCalibration->X_list.size();
+		mWorkspaceList.resize(n_ima);
+		for (int kk = 0; kk < n_ima; kk++)
+		{
+			int	Np = mCalibration->X_list[kk].size2();
+			ViewWorkspace	&ws = mWorkspaceList[kk];
+
+			ws.x.resize(2, Np, false);
+			ws.dxdom.resize(2 * Np, 3, false);
+			ws.dxdT.resize(2 * Np, 3, false);
+			ws.dxdf.resize(2 * Np, 2, false);
+			ws.dxdc.resize(2 * Np, 2, false);
+			ws.dxdk.resize(2 * Np, 5, false);
+			ws.dxdalpha.resize(2 * Np, 1, false);
+			ws.A.resize(10, 2 * Np, false);
+			ws.B.resize(6, 2 * Np, false);
+			ws.exkk_vec.resize(2 * Np, 1, false);
+			ws.omckk.resize(3, 1, false);
+			ws.Tckk.resize(3, 1, false);
+
+			JJ3_int_list[kk].resize(10, 10, false);
+			ex3_int_list[kk].resize(10, 1, false);
+			JJ3_ext_list[kk].resize(6, 6, false);
+			JJ3_cross_list[kk].resize(10, 6, false);
+			ex3_ext_list[kk].resize(6, 1, false);
+		}
+		e2_list.resize(n_ima);
+	}
+
+	virtual void	ExecTask(int kk)
+	{
+		int	i, j;
+		ViewWorkspace	&ws = mWorkspaceList[kk];
+
+		for (i = 0; i < 3; i++)
+		{
+			ws.omckk(i, 0) = param(15 + kk * 6 + i);
+			ws.Tckk(i, 0) = param(15 + kk * 6 + 3 + i);
+		}
+
+		int	Np = mCalibration->X_list[kk].size2();
+
+		// ToDo: mIsEstimateAspectRatio = falsêƂ̏lȂƃ_
+		CameraCalibration::project_points2(mCalibration->X_list[kk], ws.omckk, ws.Tckk, f, c, k, alpha,
+											ws.x, ws.dxdom, ws.dxdT, ws.dxdf, ws.dxdc, ws.dxdk, ws.dxdalpha);
+		//[x,dxdom,dxdT,dxdf,dxdc,dxdk,dxdalpha] = project_points2(X_kk,omckk,Tckk,f(1),c,k,alpha);
+
+		const ublas::matrix<double, ublas::column_major>	&x_kk = mCalibration->x_list[kk];
+		for (i = 0; i < 2 * Np; i++)
+		{
+			ws.A(0, i) = ws.dxdf(i, 0);
+			ws.A(1, i) = ws.dxdf(i, 1);
+
+			ws.A(2, i) = ws.dxdc(i, 0);
+			ws.A(3, i) = ws.dxdc(i, 1);
+
+			ws.A(4, i) = ws.dxdalpha(i, 0);
+
+			for (j = 0; j < 5; j++)
+				ws.A(5 + j, i) = ws.dxdk(i, j);
+
+			for (j = 0; j < 3; j++)
+				ws.B(j, i) = ws.dxdom(i, j);
+
+			for (j = 0; j < 3; j++)
+				ws.B(3 + j, i) = ws.dxdT(i, j);
+
+			//	exkk = x_kk - x
+			ws.exkk_vec(i, 0) = x_kk(i % 2, i / 2) - ws.x(i % 2, i / 2);
+		}
+
+		//	Contribution of this view to JJ3(0:10, 0:10)
+		ublas::noalias(JJ3_int_list[kk]) = ublas::prod(ws.A, ublas::trans(ws.A));
+
+		//	Diagonal block of the view and the intrinsic-extrinsic cross term
+		ublas::noalias(JJ3_ext_list[kk]) = ublas::prod(ws.B, ublas::trans(ws.B));
+		ublas::noalias(JJ3_cross_list[kk]) = ublas::prod(ws.A, ublas::trans(ws.B));
+
+		ublas::noalias(ex3_int_list[kk]) = ublas::prod(ws.A, ws.exkk_vec);
+		ublas::noalias(ex3_ext_list[kk]) = ublas::prod(ws.B, ws.exkk_vec);
+
+		double	e2 = 0.0;
+		for (i = 0; i < 2 * Np; i++)
+			e2 += ws.exkk_vec(i, 0) * ws.exkk_vec(i, 0);
+		e2_list[kk] = e2;
+	}
+
+private:
+	struct	ViewWorkspace
+	{
+		ublas::matrix<double, ublas::column_major>	x;
+		ublas::matrix<double, ublas::column_major>	dxdom;
+		ublas::matrix<double, ublas::column_major>	dxdT;
+		ublas::matrix<double, ublas::column_major>	dxdf;
+		ublas::matrix<double, ublas::column_major>	dxdc;
+		ublas::matrix<double, ublas::column_major>	dxdk;
+		ublas::matrix<double, ublas::column_major>	dxdalpha;
+		ublas::matrix<double, ublas::column_major>	A;
+		ublas::matrix<double, ublas::column_major>	B;
+		ublas::matrix<double, ublas::column_major>	exkk_vec;
+		ublas::matrix<double, ublas::column_major>	omckk;
+		ublas::matrix<double, ublas::column_major>	Tckk;
+	};
+
+	CameraCalibration	*mCalibration;
+	std::vector<ViewWorkspace>	mWorkspaceList;
+	const ublas::vector<double>	&param;
+	const ublas::vector<double>	&f;
+	const ublas::vector<double>	&c;
+	const ublas::vector<double>	&k;
+	const double				&alpha;
+	std::vector<ublas::matrix<double, ublas::column_major> >	&JJ3_int_list;
+	std::vector<ublas::matrix<double, ublas::column_major> >	&ex3_int_list;
+	std::vector<ublas::matrix<double, ublas::column_major> >	&JJ3_ext_list;
+	std::vector<ublas::matrix<double, ublas::column_major> >	&JJ3_cross_list;
+	std::vector<ublas::matrix<double, ublas::column_major> >	&ex3_ext_list;
+	std::vector<double>			&e2_list;
+};
+
+
+// -----------------------------------------------------------------------------
+// 	ViewReprojectionErrorTask class
+// -----------------------------------------------------------------------------
+//
+//	Sum of the squared reprojection errors of one view with the parameters
+//	in_param (same layout as mainOptimization). Only the projection is done,
+//	for the trial steps of the Levenberg-Marquardt method. The work matrices
+//	of each view are kept like ViewNormalEquationTask, so the trial steps do
+//	not allocate anything.
+//
+class	ViewReprojectionErrorTask : public ParallelTask
+{
+public:
+	ViewReprojectionErrorTask(
+		CameraCalibration *inCalibration,
+		const ublas::vector<double> &in_param,
+		std::vector<double> &out_e2_list)
+		: param(in_param), e2_list(out_e2_list)
+	{
+		mCalibration = inCalibration;
+
+		int	n_ima = (int )mCalibration->X_list.size();
+		mWorkspaceList.resize(n_ima);
+		for (int kk = 0; kk < n_ima; kk++)
+		{
+			ViewWorkspace	&ws = mWorkspaceList[kk];
+
+			ws.f.resize(2, false);
+			ws.c.resize(2, false);
+			ws.k.resize(5, false);
+			ws.x.resize(2, mCalibration->X_list[kk].size2(), false);
+			ws.omckk.resize(3, 1, false);
+			ws.Tckk.resize(3, 1, false);
+		}
+		e2_list.resize(n_ima);
+	}
+
+	virtual void	ExecTask(int kk)
+	{
+		int	i;
+		ViewWorkspace	&ws = mWorkspaceList[kk];
+
+		//	The intrinsic parameters are copied per view (the views run in parallel)
+		ws.f(0) = param(0);
+		ws.f(1) = param(1);
+		ws.c(0) = param(2);
+		ws.c(1) = param(3);
+		for (i = 0; i < 5; i++)
+			ws.k(i) = param(5 + i);
+		for (i = 0; i < 3; i++)
+		{
+			ws.omckk(i, 0) = param(15 + kk * 6 + i);
+			ws.Tckk(i, 0) = param(15 + kk * 6 + 3 + i);
+		}
+
+		CameraCalibration::project_points2(mCalibration->X_list[kk], ws.omckk, ws.Tckk,
+											ws.f, ws.c, ws.k, param(4), ws.x);
+
+		const ublas::matrix<double, ublas::column_major>	&x_kk = mCalibration->x_list[kk];
+		double	e2 = 0.0;
+		for (i = 0; i < (int )ws.x.size2(); i++)
+		{
+			double	ex = x_kk(0, i) - ws.x(0, i);
+			double	ey = x_kk(1, i) - ws.x(1, i);
+			e2 += ex * ex;
+			e2 += ey * ey;
+		}
+		e2_list[kk] = e2;
+	}
+
+private:
+	struct	ViewWorkspace
+	{
+		ublas::vector<double>	f;
+		ublas::vector<double>	c;
+		ublas::vector<double>	k;
+		ublas::matrix<double, ublas::column_major>	x;
+		ublas::matrix<double, ublas::column_major>	omckk;
+		ublas::matrix<double, ublas::column_major>	Tckk;
+	};
+
+	CameraCalibration			*mCalibration;
+	std::vector<ViewWorkspace>	mWorkspaceList;
+	const ublas::vector<double>	&param;
+	std::vector<double>			&e2_list;
+};
+
+
+// -----------------------------------------------------------------------------
+// 	RecomputeExtrinsicTask class
+// -----------------------------------------------------------------------------
+//
+//	Recomputes the pose of one view with the current intrinsic parameters
+//	(fc, cc, kc and alpha_c must be set before Run()) and writes it to param.
+//	The points not converged in the undistortion are counted per view.
+//
+class	RecomputeExtrinsicTask : public ParallelTask
+{
+public:
+	RecomputeExtrinsicTask(CameraCalibration *inCalibration, ublas::vector<double> &io_param)
+		: param(io_param)
+	{
+		mCalibration = inCalibration;
+		mFailedNumList.resize(mCalibration->X_list.size(), 0);
+	}
+
+	int		GetFailedNum() const
+	{
+		int	num = 0;
+		for (size_t i = 0; i < mFailedNumList.size(); i++)
+			num += mFailedNumList[i];
+		return num;
+	}
+
+	virtual void	ExecTask(int kk)
+	{
+		ublas::matrix<double, ublas::column_major>	omc_current(3, 1);
+		ublas::matrix<double, ublas::column_major>	Tc_current(3, 1);
+		ublas::matrix<double, ublas::column_major>	Rckk(3, 3);
+		ublas::matrix<double, ublas::column_major>	JJ_kk(2 * mCalibration->x_list[kk].size2(), 6);
+
+		mFailedNumList[kk] = mCalibration->computeExtrinsicInit(mCalibration->x_list[kk], mCalibration->X_list[kk], omc_current, Tc_current, Rckk);	// Rckk͎g܂DvZ邯
+		mCalibration->computeExtrinsicRefine(mCalibration->x_list[kk], mCalibration->X_list[kk], omc_current, Tc_current, Rckk, JJ_kk);	// MaxIter2Ŏwł悤...
+		//if check_cond,
+		//	if (cond(JJ_kk)> thresh_cond),
+		//		active_images(kk) = 0;
+		//		fprintf(1,'\nWarning: View #%d ill-conditioned. This image is now set inactive. (note: to disactivate this option, set check_cond=0)\n',kk);
+		//		desactivated_images = [desactivated_images kk];
+		//		omckk = NaN*ones(3,1);
+		//		Tckk = NaN*ones(3,1);
+		//	end;
+		//end;
+
+		for (int i = 0; i < 3; i++)
+		{
+			param(15 + kk * 6 + i) = omc_current(i, 0);
+			param(15 + kk * 6 + i + 3) = Tc_current(i, 0);
+		}
+	}
+
+private:
+	CameraCalibration		*mCalibration;
+	ublas::vector<double>	&param;
+	std::vector<int>		mFailedNumList;
+};
+
+
+// -----------------------------------------------------------------------------
+//	extractIntrinsic
+// -----------------------------------------------------------------------------
+//
+static void	extractIntrinsic(
+				const ublas::vector<double> &in_param,
+				ublas::vector<double> &out_f,
+				ublas::vector<double> &out_c,
+				ublas::vector<double> &out_k,
+				double &out_alpha)
+{
+	out_f(0) = in_param(0);
+	out_f(1) = in_param(1);
+	out_c(0) = in_param(2);
+	out_c(1) = in_param(3);
+	out_alpha = in_param(4);
+	for (int i = 0; i < 5; i++)
+		out_k(i) = in_param(5 + i);
+}
+
+
+// -----------------------------------------------------------------------------
+//	assembleNormalEquation
+// -----------------------------------------------------------------------------
+//
+//	Sums up the intrinsic blocks of the views (in the view order) and picks up
+//	the selected intrinsic parameters for schur_solve
+//
+static void	assembleNormalEquation(
+				const std::vector<int> &in_ind_int,
+				const std::vector<ublas::matrix<double, ublas::column_major> > &in_JJ3_int_list,
+				const std::vector<ublas::matrix<double, ublas::column_major> > &in_ex3_int_list,
+				const std::vector<ublas::matrix<double, ublas::column_major> > &in_JJ3_cross_list,
+				ublas::matrix<double, ublas::column_major> &out_JJ3_int_dash,
+				ublas::matrix<double, ublas::column_major> &out_ex3_int_dash,
+				std::vector<ublas::matrix<double, ublas::column_major> > &out_JJ3_cross_dash_list)
+{
+	int	i, j;
+	int	n_ima = (int )in_JJ3_int_list.size();
+	int	n_int = (int )in_ind_int.size();
+	ublas::matrix<double, ublas::column_major>	JJ3_int(10, 10);
+	ublas::matrix<double, ublas::column_major>	ex3_int(10, 1);
+
+	JJ3_int.clear();
+	ex3_int.clear();
+
+	for (int kk = 0; kk < n_ima; kk++)
+	{
+		//	JJ3(0:10, 0:10) += A * A'
+		JJ3_int = JJ3_int + in_JJ3_int_list[kk];
+		ex3_int = ex3_int + in_ex3_int_list[kk];
+
+		//	Check if this view is ill-conditioned:
+		//if check_cond,
+		//	JJ_kk = B'; %[dxdom dxdT];
+		//	if (cond(JJ_kk)> thresh_cond),
+		//		active_images(kk) = 0;
+		//		fprintf(1,'\nWarning: View #%d ill-conditioned. This image is now set inactive. (note: to disactivate this option, set check_cond=0)\n',kk)
+		//		desactivated_images = [desactivated_images kk];
+		//		param(15+6*(kk-1) + 1:15+6*(kk-1) + 6) = NaN*ones(6,1); 
+		//	end;
+		//end;
+	}
+
+//std::cout << "JJ3_int" << JJ3_int << std::endl;
+//std::cout << "ex3_int" << ex3_int << std::endl;
+
+	//	Pick up the selected intrinsic parameters
+	for (i = 0; i < n_int; i++)
+	{
+		for (j = 0; j < n_int; j++)
+			out_JJ3_int_dash(i, j) = JJ3_int(in_ind_int[i], in_ind_int[j]);
+		out_ex3_int_dash(i, 0) = ex3_int(in_ind_int[i], 0);
+	}
+	for (int kk = 0; kk < n_ima; kk++)
+	{
+		out_JJ3_cross_dash_list[kk].resize(n_int, 6, false);
+		for (i = 0; i < n_int; i++)
+			for (j = 0; j < 6; j++)
+				out_JJ3_cross_dash_list[kk](i, j) = in_JJ3_cross_list[kk](in_ind_int[i], j);
+	}
+}
 
 
 //  CameraCalibration class public member functions ===========================
@@ -79,6 +471,11 @@ CameraCalibration::CameraCalibration(int inImageWidth, int inImageHeight)
 	//	̃p[^
 	alpha_c = 0.0;
 	thresh_cond = 1e6;
+	mWorkerThreadNum = 0;
+	mOptimizationMethod = OPTIMIZATION_GAUSS_NEWTON;
+	mOptimizationIterNum = 0;
+	mUndistortTolerance = 0.0;
+	mUndistortFailedNum = 0;
 
 	mImageWidth = inImageWidth;
 	mImageHeight = inImageHeight;
@@ -587,6 +984,8 @@ void	CameraCalibration::computeExtrinsicParam()
 	ublas::matrix<double, ublas::column_major>	Tckk(3, 1);
 	ublas::matrix<double, ublas::column_major>	Rckk(3, 3);
 
+	mUndistortFailedNum = 0;
+
 	//	ikkɕςƂ悢iƂ̐j
 	for (i = 0; i < getImageNum(); i++)
 	{
@@ -595,7 +994,7 @@ std::cout << "Image=" << i << std::endl;
 		//N_points_views(0, i) = x_list[i].size2();
 		ublas::matrix<double, ublas::column_major>	JJ_kk(2 * x_list[i].size2(), 6);
 
-		computeExtrinsicInit(x_list[i], X_list[i], omckk, Tckk, Rckk);	// Rckk͎g܂DvZ邯
+		mUndistortFailedNum += computeExtrinsicInit(x_list[i], X_list[i], omckk, Tckk, Rckk);	// Rckk͎g܂DvZ邯
 
 //std::cout << "compute_extrinsic_init omckk" << omckk << std::endl;
 //std::cout << "compute_extrinsic_init Tckk" << Tckk << std::endl;
@@ -625,7 +1024,10 @@ std::cout << "Image=" << i << std::endl;
 //	computeExtrinsicInit
 // -----------------------------------------------------------------------------
 //
-void	CameraCalibration::computeExtrinsicInit(
+//	Returns the number of the points whose undistortion did not converge
+//	(always 0 with mUndistortTolerance = 0)
+//
+int		CameraCalibration::computeExtrinsicInit(
 										const ublas::matrix<double, ublas::column_major> &x,
 										const ublas::matrix<double, ublas::column_major> &X,
 										ublas::matrix<double, ublas::column_major> &omckk,
@@ -635,7 +1037,9 @@ void	CameraCalibration::computeExtrinsicInit(
 	int		i, j;
 	ublas::matrix<double, ublas::column_major>	xn(2, x.size2());
 
-	normalize_pixel(fc, cc, kc, alpha_c, x, xn);
+	//	Newton steps until the tolerance (the toolbox iterations if it is 0)
+	int		failed_num = normalize_pixel(fc, cc, kc, alpha_c, x, xn, COMP_DISTORTION_ITER_MAX,
+											mUndistortTolerance, mUndistortTolerance > 0);
 
 	int	Np = (int )xn.size2();
 
@@ -798,7 +1202,7 @@ void	CameraCalibration::computeExtrinsicInit(
 //std::cout << "LAST Rckk:" << Rckk << std::endl;
 //std::cout << "jacobian:" << jacobian << std::endl;
 
-		return;
+		return failed_num;
 	}
 
 	//	Computes an initial guess for extrinsic parameters (works for general 3d structure, not planar!!!):
@@ -808,6 +1212,7 @@ std::cout << "Non planar structure detected: r=" << r << std::endl;
 std::cout << "DLT@͖ł" << std::endl;
 
 	//	DLT@͖ł
+	return failed_num;
 }
 
 //	EXTRINSIC_REFINE_ITER_MAXŎwł悤ɂȂƂ߂
@@ -840,10 +1245,6 @@ void	CameraCalibration::computeExtrinsicRefine(
 	ublas::matrix<double, ublas::column_major>	xn(2, n);
 	ublas::matrix<double, ublas::column_major>	dxdom(2 * n, 3);
 	ublas::matrix<double, ublas::column_major>	dxdT(2 * n, 3);
-	ublas::matrix<double, ublas::column_major>	dxdf(2 * n, 2);
-	ublas::matrix<double, ublas::column_major>	dxdc(2 * n, 2);
-	ublas::matrix<double, ublas::column_major>	dxdk(2 * n, 5);
-	ublas::matrix<double, ublas::column_major>	dxdalpha(2 * n, 1);
 
 	ublas::matrix<double, ublas::column_major>	ex(2, n);
 	ublas::matrix<double, ublas::column_major>	ex_vec(2 * n, 1);
@@ -857,7 +1258,8 @@ void	CameraCalibration::computeExtrinsicRefine(
 			iter < EXTRINSIC_REFINE_ITER_MAX)
 	{
 		// ToDo: mIsEstimateAspectRatio = falsêƂ̏lق悢
-		project_points2(X, omckk, Tckk, fc, cc, kc, alpha_c, xn, dxdom, dxdT, dxdf, dxdc, dxdk, dxdalpha);
+		//	Only the extrinsic derivatives are needed here
+		project_points2(X, omckk, Tckk, fc, cc, kc, alpha_c, xn, dxdom, dxdT);
 
 /*if (g_debug_enabled)
 {
@@ -872,10 +1274,6 @@ std::cout << "alpha_c:" << alpha_c << std::endl;
 std::cout << "xn:" << xn << std::endl;
 std::cout << "dxdom:" << dxdom << std::endl;
 std::cout << "dxdT:" << dxdT << std::endl;
-std::cout << "dxdf:" << dxdf << std::endl;
-std::cout << "dxdc:" << dxdc << std::endl;
-std::cout << "dxdk:" << dxdk << std::endl;
-std::cout << "dxdalpha:" << dxdalpha << std::endl;
 }*/
 		ex = x - xn;
 
@@ -921,6 +1319,11 @@ std::cout << "dxdalpha:" << dxdalpha << std::endl;
 #define	MAIN_OPTIMIZATION_CHANGE_MIN	1e-9
 #define	MAIN_OPTIMIZATION_ITER_MAX		30
 
+#define	LM_ITER_MAX			100
+#define	LM_MU_INIT			1e-3
+#define	LM_GRADIENT_MIN		1e-9
+#define	LM_STEP_MIN			1e-10
+
 // -----------------------------------------------------------------------------
 //	mainOptimization
 // -----------------------------------------------------------------------------
@@ -960,287 +1363,262 @@ void	CameraCalibration::mainOptimization()
 	ublas::vector<double>	k(5);
 	double					alpha;
 
-	ublas::matrix<double, ublas::column_major>	omckk(3, 1);
-	ublas::matrix<double, ublas::column_major>	Tckk(3, 1);
-
-	//	MATLABłsparseŊmۂĂ邪Cقǋȍs
-	//	łȂ̂ŕʂɊmۂĂ݂
-	ublas::matrix<double, ublas::column_major>	JJ3(15 + 6 * n_ima, 15 + 6 * n_ima);
-	ublas::matrix<double, ublas::column_major>	ex3(15 + 6 * n_ima, 1);
+	//	JJ3 is an arrow matrix: a dense intrinsic border and 6x6 blocks on the
+	//	diagonal for each view. Only the non-zero blocks are kept here and the
+	//	extrinsic blocks are eliminated by the Schur complement (see schur_solve)
+	std::vector<ublas::matrix<double, ublas::column_major> >	JJ3_ext_list(n_ima);
+	std::vector<ublas::matrix<double, ublas::column_major> >	JJ3_cross_list(n_ima);
+	std::vector<ublas::matrix<double, ublas::column_major> >	ex3_ext_list(n_ima);
+	std::vector<ublas::matrix<double, ublas::column_major> >	JJ3_int_list(n_ima);
+	std::vector<ublas::matrix<double, ublas::column_major> >	ex3_int_list(n_ima);
 
 	//	MATLABł̓[v̒ɂ
 	ublas::vector<double>	selected_variables(15 + 6 * n_ima);
 
+	//	The following vector helps to select the variables to update (for only active images):
+	//ublas::vector<double>	selected_variables(15 + 6 * n_ima);	[v̊Oɏo(2007/04/21)
+	selected_variables.clear();
+	selected_variables(0) = 1.0;	// est_fc
+	selected_variables(1) = 1.0;	// est_fc
+	selected_variables(2) = 1.0;	// center optimizaion x
+	selected_variables(3) = 1.0;	// center optimizaion y
+	selected_variables(4) = 0.0;	// est_alpha
+	//selected_variables(4) = 1.0;	// est_alpha
+	selected_variables(5) = 1.0;	// est_dist
+	selected_variables(6) = 1.0;	// est_dist
+	selected_variables(7) = 1.0;	// est_dist
+	selected_variables(8) = 1.0;	// est_dist
+	selected_variables(9) = 0.0;	// est_dist
+	for (i = 0; i < 5; i++)
+		selected_variables(10 + i) = 0.0;
+	for (i = 0; i < 6 * n_ima; i++)
+		selected_variables(15 + i) = 1.0;	//	activeC[W1ɂق悢
 
-	while (	change > EXTRINSIC_REFINE_CHANGE_MIN &&
-			iter < EXTRINSIC_REFINE_ITER_MAX)
-	{
-
-		f(0) = param(0);
-		f(1) = param(1);
-		c(0) = param(2);
-		c(1) = param(3);
-		alpha = param(4);
-		for (i = 0; i < 5; i++)
-			k(i) = param(5 + i);
-
-		JJ3.clear();
-		ex3.clear();
-
-		//	must check active image first!
+	//	Indices of the selected intrinsic parameters (the extrinsic ones are always selected)
+	std::vector<int>	ind_int;
+	for (i = 0; i < 10; i++)
+		if (selected_variables(i) != 0.0)
+			ind_int.push_back(i);
+	int	n_int = (int )ind_int.size();
+
+	ublas::matrix<double, ublas::column_major>	JJ3_int_dash(n_int, n_int);
+	ublas::matrix<double, ublas::column_major>	ex3_int_dash(n_int, 1);
+	std::vector<ublas::matrix<double, ublas::column_major> >	JJ3_cross_dash_list(n_ima);
+	ublas::matrix<double, ublas::column_major>	param_innov_int(n_int, 1);
+	std::vector<ublas::matrix<double, ublas::column_major> >	param_innov_ext_list(n_ima);
+	ublas::matrix<double, ublas::column_major>	JJ2_int_inv(n_int, n_int);
+	std::vector<ublas::matrix<double, ublas::column_major> >	JJ3_ext_inv_list(n_ima);
+
+	std::vector<double>	e2_list(n_ima);
+
+	//	f, c, k and alpha are referred from the task, so it is created only once
+	ViewNormalEquationTask	view_task(this, param, f, c, k, alpha,
+								JJ3_int_list, ex3_int_list, JJ3_ext_list, JJ3_cross_list, ex3_ext_list, e2_list);
+
+	if (mOptimizationMethod == OPTIMIZATION_LEVENBERG_MARQUARDT)
+	{
+		//	Levenberg-Marquardt: (J'J + mu * diag(J'J)) h = J'e with the damping
+		//	update of Nielsen. The step is taken only when it reduces e'e.
+		//	The extrinsic parameters are not recomputed separately.
+		ublas::vector<double>	param_new(15 + n_ima * 6);
+		std::vector<double>	e2_new_list(n_ima);
+		ViewReprojectionErrorTask	error_task(this, param_new, e2_new_list);
+		ublas::matrix<double, ublas::column_major>	JJ3_int_damp(n_int, n_int);
+		std::vector<ublas::matrix<double, ublas::column_major> >	JJ3_ext_damp_list(n_ima);
+		double	mu = LM_MU_INIT;
+		double	nu = 2.0;
+		double	e2, e2_new;
+
+		extractIntrinsic(param, f, c, k, alpha);
+		ParallelTask::Run(&view_task, n_ima, mWorkerThreadNum);
+		assembleNormalEquation(ind_int, JJ3_int_list, ex3_int_list, JJ3_cross_list,
+								JJ3_int_dash, ex3_int_dash, JJ3_cross_dash_list);
+		e2 = 0.0;
 		for (int kk = 0; kk < n_ima; kk++)
+			e2 += e2_list[kk];
+
+		while (iter < LM_ITER_MAX)
 		{
-			for (i = 0; i < 3; i++)
+			//	Gradient (J'e) test
+			double	g_max = 0.0;
+			for (i = 0; i < n_int; i++)
+				if (fabs(ex3_int_dash(i, 0)) > g_max)
+					g_max = fabs(ex3_int_dash(i, 0));
+			for (int kk = 0; kk < n_ima; kk++)
+				for (j = 0; j < 6; j++)
+					if (fabs(ex3_ext_list[kk](j, 0)) > g_max)
+						g_max = fabs(ex3_ext_list[kk](j, 0));
+			if (g_max <= LM_GRADIENT_MIN)
+				break;
+
+			JJ3_int_damp = JJ3_int_dash;
+			for (i = 0; i < n_int; i++)
+				JJ3_int_damp(i, i) += mu * JJ3_int_dash(i, i);
+			for (int kk = 0; kk < n_ima; kk++)
 			{
-				omckk(i, 0) = param(15 + kk * 6 + i);
-				Tckk(i, 0) = param(15 + kk * 6 + 3 + i);
+				JJ3_ext_damp_list[kk] = JJ3_ext_list[kk];
+				for (j = 0; j < 6; j++)
+					JJ3_ext_damp_list[kk](j, j) += mu * JJ3_ext_list[kk](j, j);
 			}
 
-			int	Np = X_list[kk].size2();
-
-			ublas::matrix<double, ublas::column_major>	x(2, Np);
-			ublas::matrix<double, ublas::column_major>	exkk(2, Np);
-			ublas::matrix<double, ublas::column_major>	dxdom(2 * Np, 3);
-			ublas::matrix<double, ublas::column_major>	dxdT(2 * Np, 3);
-			ublas::matrix<double, ublas::column_major>	dxdf(2 * Np, 2);
-			ublas::matrix<double, ublas::column_major>	dxdc(2 * Np, 2);
-			ublas::matrix<double, ublas::column_major>	dxdk(2 * Np, 5);
-			ublas::matrix<double, ublas::column_major>	dxdalpha(2 * Np, 1);
-
-			// ToDo: mIsEstimateAspectRatio = falsêƂ̏lȂƃ_
-			project_points2(X_list[kk], omckk, Tckk, f, c, k, alpha, x, dxdom, dxdT, dxdf, dxdc, dxdk, dxdalpha);
-			//[x,dxdom,dxdT,dxdf,dxdc,dxdk,dxdalpha] = project_points2(X_kk,omckk,Tckk,f(1),c,k,alpha);
+			schur_solve(JJ3_int_damp, ex3_int_dash, JJ3_ext_damp_list, JJ3_cross_dash_list, ex3_ext_list,
+						param_innov_int, param_innov_ext_list, JJ2_int_inv, JJ3_ext_inv_list);
 
-			exkk = x_list[kk] - x;
-
-			ublas::matrix<double, ublas::column_major>	A(10, 2 * Np);
-			ublas::matrix<double, ublas::column_major>	B(6, 2 * Np);
-			for (i = 0; i < 2 * Np; i++)
+			//	Trial parameters and the predicted reduction h' (J'e + mu * diag(J'J) h)
+			double	h_norm2 = 0.0;
+			double	p_norm2 = 0.0;
+			double	predicted = 0.0;
+			param_new = param;
+			for (i = 0; i < n_int; i++)
 			{
-				A(0, i) = dxdf(i, 0);
-				A(1, i) = dxdf(i, 1);
-
-				A(2, i) = dxdc(i, 0);
-				A(3, i) = dxdc(i, 1);
-
-				A(4, i) = dxdalpha(i, 0);
+				double	h = param_innov_int(i, 0);
+				param_new(ind_int[i]) += h;
+				h_norm2 += h * h;
+				p_norm2 += param(ind_int[i]) * param(ind_int[i]);
+				predicted += h * (ex3_int_dash(i, 0) + mu * JJ3_int_dash(i, i) * h);
+			}
+			for (int kk = 0; kk < n_ima; kk++)
+				for (j = 0; j < 6; j++)
+				{
+					double	h = param_innov_ext_list[kk](j, 0);
+					param_new(15 + kk * 6 + j) += h;
+					h_norm2 += h * h;
+					p_norm2 += param(15 + kk * 6 + j) * param(15 + kk * 6 + j);
+					predicted += h * (ex3_ext_list[kk](j, 0) + mu * JJ3_ext_list[kk](j, j) * h);
+				}
 
-				for (j = 0; j < 5; j++)
-					A(5 + j, i) = dxdk(i, j);
+			//	Step norm test
+			if (sqrt(h_norm2) <= LM_STEP_MIN * (sqrt(p_norm2) + LM_STEP_MIN))
+				break;
 
-				for (j = 0; j < 3; j++)
-					B(j, i) = dxdom(i, j);
+			ParallelTask::Run(&error_task, n_ima, mWorkerThreadNum);
+			e2_new = 0.0;
+			for (int kk = 0; kk < n_ima; kk++)
+				e2_new += e2_new_list[kk];
 
-				for (j = 0; j < 3; j++)
-					B(3 + j, i) = dxdT(i, j);
+			double	rho = (e2 - e2_new) / predicted;
+			if (rho > 0.0)
+			{
+				//	Accepted: the normal equation at the new parameters
+				param = param_new;
+				extractIntrinsic(param, f, c, k, alpha);
+				ParallelTask::Run(&view_task, n_ima, mWorkerThreadNum);
+				assembleNormalEquation(ind_int, JJ3_int_list, ex3_int_list, JJ3_cross_list,
+										JJ3_int_dash, ex3_int_dash, JJ3_cross_dash_list);
+				e2 = 0.0;
+				for (int kk = 0; kk < n_ima; kk++)
+					e2 += e2_list[kk];
+
+				double	scale = 1.0 - pow(2.0 * rho - 1.0, 3.0);
+				mu = mu * ((scale > 1.0 / 3.0) ? scale : 1.0 / 3.0);
+				nu = 2.0;
+			}
+			else
+			{
+				//	Rejected
+				mu = mu * nu;
+				nu = nu * 2.0;
 			}
 
-//std::cout << "A" << A << std::endl;
-//std::cout << "B" << B << std::endl;
-
-			//	_DEF_MAT_RANGE(JJ3_r1, JJ3, 0, 10, 0, 10)@݂ȃ}Nق悢
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				JJ3_r1(JJ3, ublas::range(0, 10), ublas::range(0, 10));
-			JJ3_r1 = JJ3_r1 + ublas::prod(A, ublas::trans(A));
-
-//std::cout << "JJ3_r1" << JJ3_r1 << std::endl;
+			iter++;
+		}
 
-			//	_GET_MAT_RANGE(JJ3, 0, 10, 0, 10)@݂ȃ}Nق悢
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				JJ3_r2(JJ3, ublas::range(15 + kk * 6, 15 + kk * 6 + 6),
-							ublas::range(15 + kk * 6, 15 + kk * 6 + 6));
-			JJ3_r2 = ublas::prod(B, ublas::trans(B));
+		//	inv(S) and inv(V_k) without the damping for the uncertainties
+		schur_solve(JJ3_int_dash, ex3_int_dash, JJ3_ext_list, JJ3_cross_dash_list, ex3_ext_list,
+					param_innov_int, param_innov_ext_list, JJ2_int_inv, JJ3_ext_inv_list);
+	}
+	else
+	{
 
-			ublas::matrix<double, ublas::column_major>	AB(10, 6);
-			AB = ublas::prod(A, ublas::trans(B));
+		while (	change > EXTRINSIC_REFINE_CHANGE_MIN &&
+				iter < EXTRINSIC_REFINE_ITER_MAX)
+		{
 
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				JJ3_r3(JJ3, ublas::range(0, 10),
-							ublas::range(15 + kk * 6, 15 + kk * 6 + 6));
-			JJ3_r3 = AB;
+			extractIntrinsic(param, f, c, k, alpha);
 
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				JJ3_r4(JJ3, ublas::range(15 + kk * 6, 15 + kk * 6 + 6),
-							ublas::range(0, 10));
-			JJ3_r4 = ublas::trans(AB);
+			//	must check active image first!
+			//	The views are independent of each other, so they are processed in parallel
+			ParallelTask::Run(&view_task, n_ima, mWorkerThreadNum);
+			assembleNormalEquation(ind_int, JJ3_int_list, ex3_int_list, JJ3_cross_list,
+									JJ3_int_dash, ex3_int_dash, JJ3_cross_dash_list);
 
-			ublas::matrix<double, ublas::column_major>	exkk_vec(2 * Np, 1);
-			for (i = 0; i < Np; i++)
-			{
-				exkk_vec(i * 2, 0) = exkk(0, i);
-				exkk_vec(i * 2 + 1, 0) = exkk(1, i);
-			}
+			//	Same as param_innov = JJ2_inv * ex3_dash, without building the whole JJ3
+			schur_solve(JJ3_int_dash, ex3_int_dash, JJ3_ext_list, JJ3_cross_dash_list, ex3_ext_list,
+						param_innov_int, param_innov_ext_list, JJ2_int_inv, JJ3_ext_inv_list);
 
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				ex3_r1(ex3, ublas::range(0, 10),
-							ublas::range(0, 1));
-			ex3_r1 = ex3_r1 + ublas::prod(A, exkk_vec);
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				ex3_r2(ex3, ublas::range(15 + kk * 6, 15 + kk * 6 + 6),
-							ublas::range(0, 1));
-			ex3_r2 = ublas::prod(B, exkk_vec);
-
-			//	Check if this view is ill-conditioned:
-			//if check_cond,
-			//	JJ_kk = B'; %[dxdom dxdT];
-			//	if (cond(JJ_kk)> thresh_cond),
-			//		active_images(kk) = 0;
-			//		fprintf(1,'\nWarning: View #%d ill-conditioned. This image is now set inactive. (note: to disactivate this option, set check_cond=0)\n',kk)
-			//		desactivated_images = [desactivated_images kk];
-			//		param(15+6*(kk-1) + 1:15+6*(kk-1) + 6) = NaN*ones(6,1); 
-			//	end;
-			//end;
-		}
+			// Smoothing coefficient:
+			double	alpha_smooth	= 0.4;	// set alpha_smooth = 1; for steepest gradient descent
+			double	alpha_smooth2	= 1.0 - pow((1.0 - alpha_smooth), iter + 1.0);	//	set to 1 to undo any smoothing!
 
-//std::cout << "JJ3" << JJ3 << std::endl;
-//std::cout << "ex3" << ex3 << std::endl;
-
-		//	The following vector helps to select the variables to update (for only active images):
-		//ublas::vector<double>	selected_variables(15 + 6 * n_ima);	[v̊Oɏo(2007/04/21)
-		selected_variables.clear();
-		selected_variables(0) = 1.0;	// est_fc
-		selected_variables(1) = 1.0;	// est_fc
-		selected_variables(2) = 1.0;	// center optimizaion x
-		selected_variables(3) = 1.0;	// center optimizaion y
-		selected_variables(4) = 0.0;	// est_alpha
-		//selected_variables(4) = 1.0;	// est_alpha
-		selected_variables(5) = 1.0;	// est_dist
-		selected_variables(6) = 1.0;	// est_dist
-		selected_variables(7) = 1.0;	// est_dist
-		selected_variables(8) = 1.0;	// est_dist
-		selected_variables(9) = 0.0;	// est_dist
-		for (i = 0; i < 5; i++)
-			selected_variables(10 + i) = 0.0;
-		for (i = 0; i < 6 * n_ima; i++)
-			selected_variables(15 + i) = 1.0;	//	activeC[W1ɂق悢
-
-		int	temp_num = 0;
-		for (i = 0; i < (int )selected_variables.size(); i++)
-			if (selected_variables(i) != 0.0)
-				temp_num++;
-
-		//	̂͏璷Ȃ̂ł܂Ƃ
-		ublas::matrix<double, ublas::column_major>	JJ3_dash(temp_num, temp_num);
-		int	i_dash, j_dash;
-		for(i = 0, i_dash = 0; i < (int )JJ3.size1(); i++)
-		{
-			if (selected_variables(i) != 0.0)
+			for (i = 0; i < n_int; i++)
+				param(ind_int[i]) = param(ind_int[i]) + alpha_smooth2 * param_innov_int(i, 0);
+			for (int kk = 0; kk < n_ima; kk++)
+				for (j = 0; j < 6; j++)
+					param(15 + kk * 6 + j) = param(15 + kk * 6 + j) + alpha_smooth2 * param_innov_ext_list[kk](j, 0);
+
+			//	New intrinsic parameters
+			ublas::vector<double>	fc_current(2);
+			ublas::vector<double>	cc_current(2);
+			ublas::vector<double>	kc_current(5);
+			double					alpha_current;
+
+			fc_current(0) = param(0);
+			fc_current(1) = param(1);
+
+			bool	center_optim = true;
+			if (center_optim && (
+				param(2) < 0 || param(2) > mImageWidth ||
+				param(3) < 0 ||	param(3) > mImageHeight))
 			{
-				for (j = 0, j_dash = 0; j < (int )JJ3.size2(); j++)
-				{
-					if (selected_variables(j) != 0.0)
-					{
-						JJ3_dash(i_dash, j_dash) = JJ3(i, j);
-						j_dash++;
-					}
-				}
-				i_dash++;
+std::cerr << "Warning: it appears that the principal point cannot be estimated. Setting center_optim = 0" << std::endl;
+				center_optim = false;	// <- this dosen't take effect something 
+				cc_current = c;
 			}
-		}
-		ublas::matrix<double, ublas::column_major>	ex3_dash(temp_num, 1);
-		for(i = 0, i_dash = 0; i < (int )ex3.size1(); i++)
-		{
-			if (selected_variables(i) != 0.0)
+			else
 			{
-				ex3_dash(i_dash, 0) = ex3(i, 0);
-				i_dash++;
+				cc_current(0) = param(2);
+				cc_current(1) = param(3);
 			}
-		}
 
-		ublas::matrix<double, ublas::column_major>	JJ2_inv(temp_num, temp_num);
-		JJ2_inv = JJ3_dash;
-		mat_inv(JJ2_inv); 
+			alpha_current = param(4);
+			for (i = 0; i < 5; i++)
+				kc_current(i) = param(5 + i);
 
-//std::cout << "JJ2_inv" << JJ2_inv << std::endl;
-
-		// Smoothing coefficient:
-		double	alpha_smooth	= 0.4;	// set alpha_smooth = 1; for steepest gradient descent
-		double	alpha_smooth2	= 1.0 - pow((1.0 - alpha_smooth), iter + 1.0);	//	set to 1 to undo any smoothing!
-
-		ublas::matrix<double, ublas::column_major>	param_innov(temp_num, 1);	
-		param_innov = alpha_smooth2 * ublas::prod(JJ2_inv, ex3_dash);
-
-		//ublas::matrix<double, ublas::column_major>	param_up(temp_num, 1);	
-		for(i = 0, i_dash = 0; i < (int )param.size(); i++)
-		{
-			if (selected_variables(i) != 0.0)
+			bool	est_aspect_ratio = true;
+			//if (est_aspect_ratio == false && est_fc(0) == 1 && est_fc(1) == 1)
+			if (false)
 			{
-				param(i) = param(i) + param_innov(i_dash, 0);
-				i_dash++;
+				fc_current(1) = fc_current(0);
+				param(1) = param(0);
 			}
-		}
-
-		//	New intrinsic parameters
-		ublas::vector<double>	fc_current(2);
-		ublas::vector<double>	cc_current(2);
-		ublas::vector<double>	kc_current(5);
-		double					alpha_current;
-
-		fc_current(0) = param(0);
-		fc_current(1) = param(1);
-
-		bool	center_optim = true;
-		if (center_optim && (
-			param(2) < 0 || param(2) > mImageWidth ||
-			param(3) < 0 ||	param(3) > mImageHeight))
-		{
-std::cerr << "Warning: it appears that the principal point cannot be estimated. Setting center_optim = 0" << std::endl;
-			center_optim = false;	// <- this dosen't take effect something 
-			cc_current = c;
-		}
-		else
-		{
-			cc_current(0) = param(2);
-			cc_current(1) = param(3);
-		}
-
-		alpha_current = param(4);
-		for (i = 0; i < 5; i++)
-			kc_current(i) = param(5 + i);
 
-		bool	est_aspect_ratio = true;
-		//if (est_aspect_ratio == false && est_fc(0) == 1 && est_fc(1) == 1)
-		if (false)
-		{
-			fc_current(1) = fc_current(0);
-			param(1) = param(0);
-		}
+			//	Change on the intrinsic parameters
+			ublas::vector<double>	temp_vec(4);
+			temp_vec(0) = fc_current(0);
+			temp_vec(1) = fc_current(1);
+			temp_vec(2) = cc_current(0);
+			temp_vec(3) = cc_current(1);
 
-		//	Change on the intrinsic parameters
-		ublas::vector<double>	temp_vec(4);
-		temp_vec(0) = fc_current(0);
-		temp_vec(1) = fc_current(1);
-		temp_vec(2) = cc_current(0);
-		temp_vec(3) = cc_current(1);
+			ublas::vector<double>	temp_vec2(4);
+			temp_vec2(0) = fc_current(0) - f(0);
+			temp_vec2(1) = fc_current(1) - f(1);
+			temp_vec2(2) = cc_current(0) - c(0);
+			temp_vec2(3) = cc_current(1) - c(1);
 
-		ublas::vector<double>	temp_vec2(4);
-		temp_vec2(0) = fc_current(0) - f(0);
-		temp_vec2(1) = fc_current(1) - f(1);
-		temp_vec2(2) = cc_current(0) - c(0);
-		temp_vec2(3) = cc_current(1) - c(1);
-
-		change = mat_norm(temp_vec2) / mat_norm(temp_vec);
+			change = mat_norm(temp_vec2) / mat_norm(temp_vec);
 
 std::cout << "iter:" << iter << std::endl;
 //std::cout << "mat_norm(temp_vec2)" << mat_norm(temp_vec2) << std::endl;
 //std::cout << "mat_norm(temp_vec)" << mat_norm(temp_vec) << std::endl;
 std::cout << "change" << change << std::endl;
 
-		//	Second step: (optional) - It makes convergence faster, and the region of convergence LARGER!!!
-		//	Recompute the extrinsic parameters only using compute_extrinsic.m (this may be useful sometimes)
-		//	The complete gradient descent method is useful to precisely update the intrinsic parameters.
-		bool	recompute_extrinsic = true;
-		if (recompute_extrinsic)
-		{
-			double	MaxIter2 = 20;
-			ublas::matrix<double, ublas::column_major>	omc_current(3, 1);
-			ublas::matrix<double, ublas::column_major>	Tc_current(3, 1);
-			ublas::matrix<double, ublas::column_major>	Rckk(3, 3);
-
-			for (int kk = 0; kk < n_ima; kk++)
+			//	Second step: (optional) - It makes convergence faster, and the region of convergence LARGER!!!
+			//	Recompute the extrinsic parameters only using compute_extrinsic.m (this may be useful sometimes)
+			//	The complete gradient descent method is useful to precisely update the intrinsic parameters.
+			bool	recompute_extrinsic = true;
+			if (recompute_extrinsic)
 			{
-				ublas::matrix<double, ublas::column_major>	JJ_kk(2 * x_list[kk].size2(), 6);
+				double	MaxIter2 = 20;
 
 				//ToDo: ̂悭l
 				fc = fc_current;
@@ -1248,40 +1626,19 @@ std::cout << "change" << change << std::endl;
 				kc = kc_current;
 				alpha_c = alpha_current;
 
-				/*for (i = 0; i < 3; i++)	// MATLAB̃R[hɂ͂邯Ǐ璷
-				{
-					omc_current(i, 0) = param(15 + kk * 6 + i);
-					Tc_current(i, 0) = param(15 + kk * 6 + i + 3);
-				}*/
-				computeExtrinsicInit(x_list[kk], X_list[kk], omc_current, Tc_current, Rckk);	// Rckk͎g܂DvZ邯
-//std::cout << "omc_current" << omc_current << std::endl;
-//std::cout << "Tc_current" << Tc_current << std::endl;
-				g_debug_enabled = true;
-				computeExtrinsicRefine(x_list[kk], X_list[kk], omc_current, Tc_current, Rckk, JJ_kk);	// MaxIter2Ŏwł悤...
-//std::cout << "omc_current 2" << omc_current << std::endl;
-//std::cout << "Tc_current 2" << Tc_current << std::endl;
-				//if check_cond,
-				//	if (cond(JJ_kk)> thresh_cond),
-				//		active_images(kk) = 0;
-				//		fprintf(1,'\nWarning: View #%d ill-conditioned. This image is now set inactive. (note: to disactivate this option, set check_cond=0)\n',kk);
-				//		desactivated_images = [desactivated_images kk];
-				//		omckk = NaN*ones(3,1);
-				//		Tckk = NaN*ones(3,1);
-				//	end;
-				//end;
-
-				for (i = 0; i < 3; i++)
-				{
-					param(15 + kk * 6 + i) = omc_current(i, 0);
-					param(15 + kk * 6 + i + 3) = Tc_current(i, 0);
-				}
+				//	Each view only reads fc, cc, kc and alpha_c and writes its own part of param
+				RecomputeExtrinsicTask	extrinsic_task(this, param);
+				ParallelTask::Run(&extrinsic_task, n_ima, mWorkerThreadNum);
+				mUndistortFailedNum = extrinsic_task.GetFailedNum();
 			}
-		}
 
-		//param_list = [param_list param];͉炩̌`łĂقǂ
-		iter++;
+			//param_list = [param_list param];͉炩̌`łĂقǂ
+			iter++;
+		}
 	}
 
+	mOptimizationIterNum = iter;
+
 std::cout << "done" << std::endl;
 std::cout << "Estimation of uncertainties..." << std::endl;
 
@@ -1328,15 +1685,9 @@ std::cout << "Estimation of uncertainties..." << std::endl;
 	{
 		int	n = X_list[kk].size2();
 		ublas::matrix<double, ublas::column_major>	y(2, n);
-		ublas::matrix<double, ublas::column_major>	dxdom(2 * n, 3);
-		ublas::matrix<double, ublas::column_major>	dxdT(2 * n, 3);
-		ublas::matrix<double, ublas::column_major>	dxdf(2 * n, 2);
-		ublas::matrix<double, ublas::column_major>	dxdc(2 * n, 2);
-		ublas::matrix<double, ublas::column_major>	dxdk(2 * n, 5);
-		ublas::matrix<double, ublas::column_major>	dxdalpha(2 * n, 1);
 		ublas::matrix<double, ublas::column_major>	ex(2, n);
 
-		project_points2(X_list[kk], omc_list[kk], Tc_list[kk], fc, cc, kc, alpha_c, y, dxdom, dxdT, dxdf, dxdc, dxdk, dxdalpha);
+		project_points2(X_list[kk], omc_list[kk], Tc_list[kk], fc, cc, kc, alpha_c, y);
 		ex = x_list[kk] - y;
 
 //std::cout << "y" << y << std::endl;
@@ -1392,44 +1743,21 @@ std::cout << "Estimation of uncertainties..." << std::endl;
 
 	//	MATLABł͂łxCJJ3߂Ă
 	//	璷Ȃ̂ŁCłɋ߂ĂJJ3ėp
-	int	temp_num = 0;
-	for (i = 0; i < (int )selected_variables.size(); i++)
-		if (selected_variables(i) != 0.0)
-			temp_num++;
-
-	//	OƓĈ͏璷Ȃ̂ł܂Ƃ
-	ublas::matrix<double, ublas::column_major>	JJ3_dash(temp_num, temp_num);
-	int	i_dash, j_dash;
-	for(i = 0, i_dash = 0; i < (int )JJ3.size1(); i++)
-	{
-		if (selected_variables(i) != 0.0)
-		{
-			for (j = 0, j_dash = 0; j < (int )JJ3.size2(); j++)
-			{
-				if (selected_variables(j) != 0.0)
-				{
-					JJ3_dash(i_dash, j_dash) = JJ3(i, j);
-					j_dash++;
-				}
-			}
-			i_dash++;
-		}
-	}
-	ublas::matrix<double, ublas::column_major>	JJ2_inv(temp_num, temp_num);
-	JJ2_inv = JJ3_dash;
-	mat_inv(JJ2_inv);
+	//	The intrinsic block of JJ2_inv is the inverse of the Schur complement and
+	//	the extrinsic diagonal comes from inv(V) + inv(V) W' inv(S) W inv(V)
 
 	//	param_error(ind_Jac) =  3*sqrt(full(diag(JJ2_inv)))*sigma_x;
 	ublas::vector<double>	param_error(15 + n_ima * 6);
 	param_error.clear();
-	for (i = 0, i_dash = 0; i < (int )param_error.size(); i++)
+	for (i = 0; i < n_int; i++)
+		param_error(ind_int[i]) = 3.0 * sqrt(JJ2_int_inv(i, i)) * sigma_x;
+
+	ublas::vector<double>	JJ2_ext_diag(6);
+	for (int kk = 0; kk < n_ima; kk++)
 	{
-		if (selected_variables(i) != 0.0)
-		{
-//std::cout << "JJ2_inv" << JJ2_inv(i_dash, i_dash) << std::endl;
-			param_error(i) = 3.0 * sqrt(JJ2_inv(i_dash, i_dash)) * sigma_x;
-			i_dash++;
-		}
+		schur_block_diag(JJ3_cross_dash_list[kk], JJ3_ext_inv_list[kk], JJ2_int_inv, JJ2_ext_diag);
+		for (j = 0; j < 6; j++)
+			param_error(15 + kk * 6 + j) = 3.0 * sqrt(JJ2_ext_diag(j)) * sigma_x;
 	}
 
 
@@ -1497,6 +1825,8 @@ void	CameraCalibration::DumpResults()
 		kc(0), kc(1), kc(2), kc(3), kc(4),
 		kc_error(0), kc_error(1), kc_error(2), kc_error(3), kc_error(4));
 	printf("Pixel error:          err = [ %3.5f   %3.5f ]\n", err_std(0), err_std(1));
+	if (mUndistortTolerance > 0)
+		printf("Undistortion:         %d points not converged (tolerance %g)\n", mUndistortFailedNum, mUndistortTolerance);
 	printf("Note: The numerical errors are approximately three times the standard deviations (for reference).\n");
 	//printf("      For accurate (and stable) error estimates, it is recommended to run Calibration once again.\n");
 
@@ -1546,6 +1876,10 @@ std::cout << "                To reject them from the optimization set est_dist=
 //	project_points2
 // -----------------------------------------------------------------------------
 //
+//	The output matrices must be allocated by the caller with the right size
+//	(2 x n, 2n x 3, 2n x 3, 2n x 2, 2n x 2, 2n x 5, 2n x 1) and can be reused
+//	from call to call. This function does not allocate anything.
+//
 void	CameraCalibration::project_points2(
 										const ublas::matrix<double, ublas::column_major> &in_X,
 										const ublas::matrix<double, ublas::column_major> &in_om,
@@ -1562,411 +1896,56 @@ void	CameraCalibration::project_points2(
 										ublas::matrix<double, ublas::column_major> &out_dxpdk,
 										ublas::matrix<double, ublas::column_major> &out_dxpdalpha)
 {
-	int	i, j;
-	int	m = in_X.size1();
-	int	n = in_X.size2();
+	_project_points2_sub(
+		in_X, in_om, in_T, in_fc, in_cc, in_kc, in_alpha_c, out_xp,
+		&out_dxpdom, &out_dxpdT, &out_dxpdf, &out_dxpdc, &out_dxpdk, &out_dxpdalpha);
+}
 
-	ublas::matrix<double, ublas::column_major>	Y(3, n);
-	ublas::matrix<double, ublas::column_major>	dYdom(3 * n, 3);
-	ublas::matrix<double, ublas::column_major>	dYdT(3 * n, 3);
 
-	rigid_motion(in_X, in_om, in_T, Y, dYdom, dYdT);
+// -----------------------------------------------------------------------------
+//	project_points2
+// -----------------------------------------------------------------------------
+//
+//	Projection only (no derivatives)
+//
+void	CameraCalibration::project_points2(
+										const ublas::matrix<double, ublas::column_major> &in_X,
+										const ublas::matrix<double, ublas::column_major> &in_om,
+										const ublas::matrix<double, ublas::column_major> &in_T,
+										const ublas::vector<double> &in_fc,
+										const ublas::vector<double> &in_cc,
+										const ublas::vector<double> &in_kc,
+										double	in_alpha_c,
+										ublas::matrix<double, ublas::column_major> &out_xp)
+{
+	_project_points2_sub(
+		in_X, in_om, in_T, in_fc, in_cc, in_kc, in_alpha_c, out_xp,
+		NULL, NULL, NULL, NULL, NULL, NULL);
+}
 
-/*if (g_debug_enabled) {
-std::cout << "Y:" << Y << std::endl;
-std::cout << "dYdom:" << dYdom << std::endl;
-std::cout << "dYdT:" << dYdT << std::endl;
-}*/
-	ublas::matrix<double, ublas::column_major>	inv_Z(1, n);
-	for (i = 0; i < n; i++)
-		inv_Z(0, i) = 1.0 / Y(2, i);	// Y(2, i)[łȂƂmFȂƃ_
 
-	ublas::matrix<double, ublas::column_major>	x(2, n);
-	for (i = 0; i < n; i++)
-	{
-		x(0, i) = Y(0, i) * inv_Z(0, i);
-		x(1, i) = Y(1, i) * inv_Z(0, i);
-	}
-
-	ublas::matrix<double, ublas::column_major>	bb(n, 3);
-	ublas::matrix<double, ublas::column_major>	cc(n, 3);	//	o[ϐccƏdȂĂ܂DvύX <-staticokȂ
-	for (i = 0; i < n; i++)
-	{
-		bb(i, 0) = -1.0 * x(0, i) * inv_Z(0, i);
-		bb(i, 1) = bb(i, 0);
-		bb(i, 2) = bb(i, 0);
-		cc(i, 0) = -1.0 * x(1, i) * inv_Z(0, i);
-		cc(i, 1) = cc(i, 0);
-		cc(i, 2) = cc(i, 0);
-	}
-
-	ublas::matrix<double, ublas::column_major>	dxdom(2 * n, 3);
-	for (i = 0; i < n; i++)
-	{
-		dxdom(i * 2, 0) = inv_Z(0, i) * dYdom(i * 3, 0) + bb(i, 0) * dYdom(i * 3 + 2, 0);
-		dxdom(i * 2, 1) = inv_Z(0, i) * dYdom(i * 3, 1) + bb(i, 1) * dYdom(i * 3 + 2, 1);
-		dxdom(i * 2, 2) = inv_Z(0, i) * dYdom(i * 3, 2) + bb(i, 2) * dYdom(i * 3 + 2, 2);
-
-		dxdom(i * 2 + 1, 0) = inv_Z(0, i) * dYdom(i * 3 + 1, 0) + cc(i, 0) * dYdom(i * 3 + 2, 0);
-		dxdom(i * 2 + 1, 1) = inv_Z(0, i) * dYdom(i * 3 + 1, 1) + cc(i, 1) * dYdom(i * 3 + 2, 1);
-		dxdom(i * 2 + 1, 2) = inv_Z(0, i) * dYdom(i * 3 + 1, 2) + cc(i, 2) * dYdom(i * 3 + 2, 2);
-	}
-
-	ublas::matrix<double, ublas::column_major>	dxdT(2 * n, 3);
-	for (i = 0; i < n; i++)
-	{
-		dxdT(i * 2, 0) = inv_Z(0, i) * dYdT(i * 3, 0) + bb(i, 0) * dYdT(i * 3 + 2, 0);
-		dxdT(i * 2, 1) = inv_Z(0, i) * dYdT(i * 3, 1) + bb(i, 1) * dYdT(i * 3 + 2, 1);
-		dxdT(i * 2, 2) = inv_Z(0, i) * dYdT(i * 3, 2) + bb(i, 2) * dYdT(i * 3 + 2, 2);
-
-		dxdT(i * 2 + 1, 0) = inv_Z(0, i) * dYdT(i * 3 + 1, 0) + cc(i, 0) * dYdT(i * 3 + 2, 0);
-		dxdT(i * 2 + 1, 1) = inv_Z(0, i) * dYdT(i * 3 + 1, 1) + cc(i, 1) * dYdT(i * 3 + 2, 1);
-		dxdT(i * 2 + 1, 2) = inv_Z(0, i) * dYdT(i * 3 + 1, 2) + cc(i, 2) * dYdT(i * 3 + 2, 2);
-	}
-
-/*if (g_debug_enabled) {
-//std::cout << "bb:" << bb << std::endl;
-//std::cout << "cc:" << cc << std::endl;
-std::cout << "dxdom:" << dxdom << std::endl;
-std::cout << "dxdT:" << dxdT << std::endl;
-}*/
-
-	//	Add distortion
-	ublas::matrix<double, ublas::column_major>	r2(1, n);
-	for (i = 0; i < n; i++)
-		r2(0, i) = x(0, i) * x(0, i) + x(1, i) * x(1, i);
-
-
-	ublas::matrix<double, ublas::column_major>	dr2dom(n, 3);
-	ublas::matrix<double, ublas::column_major>	dr2dT(n, 3);
-	for (i = 0; i < n; i++)
-	{
-		dr2dom(i, 0) = 2.0 * x(0, i) * dxdom(i * 2, 0) + 2.0 * x(1, i) * dxdom(i * 2 + 1, 0);
-		dr2dom(i, 1) = 2.0 * x(0, i) * dxdom(i * 2, 1) + 2.0 * x(1, i) * dxdom(i * 2 + 1, 1);
-		dr2dom(i, 2) = 2.0 * x(0, i) * dxdom(i * 2, 2) + 2.0 * x(1, i) * dxdom(i * 2 + 1, 2);
-
-		dr2dT(i, 0) = 2.0 * x(0, i) * dxdT(i * 2, 0) + 2.0 * x(1, i) * dxdT(i * 2 + 1, 0);
-		dr2dT(i, 1) = 2.0 * x(0, i) * dxdT(i * 2, 1) + 2.0 * x(1, i) * dxdT(i * 2 + 1, 1);
-		dr2dT(i, 2) = 2.0 * x(0, i) * dxdT(i * 2, 2) + 2.0 * x(1, i) * dxdT(i * 2 + 1, 2);
-	}
-
-	ublas::matrix<double, ublas::column_major>	r4(1, n);
-	for (i = 0; i < n; i++)
-		r4(0, i) = r2(0, i) * r2(0, i);
-
-	ublas::matrix<double, ublas::column_major>	dr4dom(n, 3);
-	ublas::matrix<double, ublas::column_major>	dr4dT(n, 3);
-	for (i = 0; i < n; i++)
-	{
-		dr4dom(i, 0) = 2.0 * r2(0, i) * dr2dom(i, 0);
-		dr4dom(i, 1) = 2.0 * r2(0, i) * dr2dom(i, 1);
-		dr4dom(i, 2) = 2.0 * r2(0, i) * dr2dom(i, 2);
-
-		dr4dT(i, 0) = 2.0 * r2(0, i) * dr2dT(i, 0);
-		dr4dT(i, 1) = 2.0 * r2(0, i) * dr2dT(i, 1);
-		dr4dT(i, 2) = 2.0 * r2(0, i) * dr2dT(i, 2);
-	}
-
-	ublas::matrix<double, ublas::column_major>	r6(1, n);
-	for (i = 0; i < n; i++)
-		r6(0, i) = r2(0, i) * r2(0, i) * r2(0, i);
-
-	ublas::matrix<double, ublas::column_major>	dr6dom(n, 3);
-	ublas::matrix<double, ublas::column_major>	dr6dT(n, 3);
-	for (i = 0; i < n; i++)
-	{
-		double	r2_squre = r2(0, i) * r2(0, i);
-		dr6dom(i, 0) = 3.0 * r2_squre * dr2dom(i, 0);
-		dr6dom(i, 1) = 3.0 * r2_squre * dr2dom(i, 1);
-		dr6dom(i, 2) = 3.0 * r2_squre * dr2dom(i, 2);
-
-		dr6dT(i, 0) = 3.0 * r2_squre * dr2dT(i, 0);
-		dr6dT(i, 1) = 3.0 * r2_squre * dr2dT(i, 1);
-		dr6dT(i, 2) = 3.0 * r2_squre * dr2dT(i, 2);
-	}
-
-
-/*if (g_debug_enabled) {
-std::cout << "dr4dom:" << dr4dom << std::endl;
-std::cout << "dr4dT:" << dr4dT << std::endl;
-std::cout << "dr6dom:" << dr6dom << std::endl;
-std::cout << "dr6dT:" << dr6dT << std::endl;
-}*/
-
-	//	Radial distortion
-	ublas::matrix<double, ublas::column_major>	cdist(1, n);
-	for (i = 0; i < n; i++)
-		cdist(0, i) = 1 + in_kc(0) * r2(0, i) + in_kc(1) * r4(0, i) + in_kc(4) * r6(0, i);
-
-	ublas::matrix<double, ublas::column_major>	dcdistdom(n, 3);
-	ublas::matrix<double, ublas::column_major>	dcdistdT(n, 3);
-	ublas::matrix<double, ublas::column_major>	dcdistdk(n, 5);
-	for (i = 0; i < n; i++)
-	{
-		dcdistdom(i, 0) = in_kc(0) * dr2dom(i, 0) + in_kc(1) * dr4dom(i, 0) + in_kc(4) * dr6dom(i, 0);
-		dcdistdom(i, 1) = in_kc(0) * dr2dom(i, 1) + in_kc(1) * dr4dom(i, 1) + in_kc(4) * dr6dom(i, 1);
-		dcdistdom(i, 2) = in_kc(0) * dr2dom(i, 2) + in_kc(1) * dr4dom(i, 2) + in_kc(4) * dr6dom(i, 2);
-
-		dcdistdT(i, 0) = in_kc(0) * dr2dT(i, 0) + in_kc(1) * dr4dT(i, 0) + in_kc(4) * dr6dT(i, 0);
-		dcdistdT(i, 1) = in_kc(0) * dr2dT(i, 1) + in_kc(1) * dr4dT(i, 1) + in_kc(4) * dr6dT(i, 1);
-		dcdistdT(i, 2) = in_kc(0) * dr2dT(i, 2) + in_kc(1) * dr4dT(i, 2) + in_kc(4) * dr6dT(i, 2);
-
-		dcdistdk(i, 0) = r2(0, i);
-		dcdistdk(i, 1) = r4(0, i);
-		dcdistdk(i, 2) = 0.0;
-		dcdistdk(i, 3) = 0.0;
-		dcdistdk(i, 4) = r6(0, i);
-	}
-
-	ublas::matrix<double, ublas::column_major>	xd1(2, n);
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 2; j++)
-			xd1(j, i) = x(j, i) * cdist(0, i);
-
-	ublas::matrix<double, ublas::column_major>	dxd1dom(2 * n, 3);
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 3; j++)
-		{
-			dxd1dom(i * 2, j) = x(0, i) * dcdistdom(i, j);
-			dxd1dom(i * 2 + 1, j) = x(1, i) * dcdistdom(i, j);
-		}
-
-	ublas::matrix<double, ublas::column_major>	coeff(2 * n, 3);
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 3; j++)
-		{
-			coeff(i * 2, j) = cdist(0, i);
-			coeff(i * 2 + 1, j) = cdist(0, i);
-		}
-
-	for (i = 0; i < 2 * n; i++)
-		for (j = 0; j < 3; j++)
-			dxd1dom(i, j) = dxd1dom(i, j) + coeff(i, j) * dxdom(i, j);
-
-	ublas::matrix<double, ublas::column_major>	dxd1dT(2 * n, 3);
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 3; j++)
-		{
-			dxd1dT(i * 2, j) = x(0, i) * dcdistdT(i, j);
-			dxd1dT(i * 2 + 1, j) = x(1, i) * dcdistdT(i, j);
-		}
-
-	for (i = 0; i < 2 * n; i++)
-		for (j = 0; j < 3; j++)
-			dxd1dT(i, j) = dxd1dT(i, j) + coeff(i, j) * dxdT(i, j);
-
-	ublas::matrix<double, ublas::column_major>	dxd1dk(2 * n, 5);
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 5; j++)
-		{
-			dxd1dk(i * 2, j) = x(0, i) * dcdistdk(i, j);
-			dxd1dk(i * 2 + 1, j) = x(1, i) * dcdistdk(i, j);
-		}
-
-/*if (g_debug_enabled) {
-std::cout << "dxd1dom:" << dxd1dom << std::endl;
-std::cout << "dxd1dT:" << dxd1dT << std::endl;
-std::cout << "dxd1dk:" << dxd1dk << std::endl;
-}*/
-
-
-	//	Tangential distortion
-	ublas::matrix<double, ublas::column_major>	a1(1, n);
-	ublas::matrix<double, ublas::column_major>	a2(1, n);
-	ublas::matrix<double, ublas::column_major>	a3(1, n);
-	for (i = 0; i < n; i++)
-	{
-		a1(0, i) = 2.0 * x(0, i) * x(1, i);
-		a2(0, i) = r2(0, i) + 2.0 * x(0, i) * x(0, i);
-		a3(0, i) = r2(0, i) + 2.0 * x(1, i) * x(1, i);
-	}
-
-	ublas::matrix<double, ublas::column_major>	delta_x(2, n);
-	for (i = 0; i < n; i++)
-	{
-		delta_x(0, i) = in_kc(2) * a1(0, i) + in_kc(3) * a2(0, i);
-		delta_x(1, i) = in_kc(2) * a3(0, i) + in_kc(3) * a1(0, i);
-	}
-
-	ublas::matrix<double, ublas::column_major>	aa(n, 3);
-	//ublas::matrix<double, ublas::column_major>	bb(n, 3);
-	//ublas::matrix<double, ublas::column_major>	cc(n, 3);
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 3; j++)
-		{
-			aa(i, j) = 2.0 * in_kc(2) * x(1, i) + 6.0 * in_kc(3) * x(0, i);
-			bb(i, j) = 2.0 * in_kc(2) * x(0, i) + 2.0 * in_kc(3) * x(1, i);
-			cc(i, j) = 6.0 * in_kc(2) * x(1, i) + 2.0 * in_kc(3) * x(0, i);
-		}
-
-	ublas::matrix<double, ublas::column_major>	ddelta_xdom(2 * n, 3);
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 3; j++)
-		{
-			ddelta_xdom(i * 2, j) = aa(i, j) * dxdom(i * 2, j) + bb(i, j) * dxdom(i * 2 + 1, j);
-			ddelta_xdom(i * 2 + 1, j) = bb(i, j) * dxdom(i * 2, j) + cc(i, j) * dxdom(i * 2 + 1, j);
-		}
-
-	ublas::matrix<double, ublas::column_major>	ddelta_xdT(2 * n, 3);
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 3; j++)
-		{
-			ddelta_xdT(i * 2, j) = aa(i, j) * dxdT(i * 2, j) + bb(i, j) * dxdT(i * 2 + 1, j);
-			ddelta_xdT(i * 2 + 1, j) = bb(i, j) * dxdT(i * 2, j) + cc(i, j) * dxdT(i * 2 + 1, j);
-		}
-
-	ublas::matrix<double, ublas::column_major>	ddelta_xdk(2 * n, 5);
-	ddelta_xdk.clear();
-	for (i = 0; i < n; i++)
-	{
-		ddelta_xdk(i * 2, 2) = a1(0, i);
-		ddelta_xdk(i * 2, 3) = a2(0, i);
-		ddelta_xdk(i * 2 + 1, 2) = a3(0, i);
-		ddelta_xdk(i * 2 + 1, 3) = a1(0, i);
-	}
-
-	ublas::matrix<double, ublas::column_major>	xd2(2, n);
-	xd2 = xd1 + delta_x;
-
-	ublas::matrix<double, ublas::column_major>	dxd2dom(2 * n, 3);
-	ublas::matrix<double, ublas::column_major>	dxd2dT(2 * n, 3);
-	ublas::matrix<double, ublas::column_major>	dxd2dk(2 * n, 5);
-	dxd2dom = dxd1dom + ddelta_xdom;
-	dxd2dT = dxd1dT + ddelta_xdT;
-	dxd2dk = dxd1dk + ddelta_xdk;
-
-/*if (g_debug_enabled) {
-std::cout << "dxd2dom:" << dxd2dom << std::endl;
-std::cout << "dxd2dT:" << dxd2dT << std::endl;
-std::cout << "dxd2dk:" << dxd2dk << std::endl;
-}*/
-
-	//	Add Skew
-	ublas::matrix<double, ublas::column_major>	xd3(2, n);
-	for (i = 0; i < n; i++)
-	{
-		xd3(0, i) = xd2(0, i) + in_alpha_c * xd2(1, i);
-		xd3(1, i) = xd2(1, i);
-	}
-
-	//	Compute: dxd3dom, dxd3dT, dxd3dk, dxd3dalpha
-	ublas::matrix<double, ublas::column_major>	dxd3dom(2 * n, 3);
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 3; j++)
-		{
-			dxd3dom(i * 2, j) = dxd2dom(i * 2, j) + in_alpha_c * dxd2dom(i * 2 + 1, j);
-			dxd3dom(i * 2 + 1, j) = dxd2dom(i * 2 + 1, j);
-		}
-
-	ublas::matrix<double, ublas::column_major>	dxd3dT(2 * n, 3);
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 3; j++)
-		{
-			dxd3dT(i * 2, j) = dxd2dT(i * 2, j) + in_alpha_c * dxd2dT(i * 2 + 1, j);
-			dxd3dT(i * 2 + 1, j) = dxd2dT(i * 2 + 1, j);
-		}
-
-	ublas::matrix<double, ublas::column_major>	dxd3dk(2 * n, 5);
-	dxd3dk.clear();
-	for (i = 0; i < n; i++)
-		for (j = 0; j < 5; j++)
-		{
-			dxd3dk(i * 2, j) = dxd2dk(i * 2, j) + in_alpha_c * dxd2dk(i * 2 + 1, j);
-			dxd3dk(i * 2 + 1, j) = dxd2dk(i * 2 + 1, j);
-		}
-
-	ublas::matrix<double, ublas::column_major>	dxd3dalpha(2 * n, 1);
-	dxd3dalpha.clear();
-	for (i = 0; i < n; i++)
-		dxd3dalpha(i * 2, 0) = xd2(1, i);
-
-/*if (g_debug_enabled) {
-std::cout << "xd1:" << xd1 << std::endl;
-std::cout << "xd2:" << xd2 << std::endl;
-std::cout << "xd3:" << xd3 << std::endl;
-std::cout << "dxd3dom:" << dxd3dom << std::endl;
-std::cout << "dxd3dT:" << dxd3dT << std::endl;
-std::cout << "dxd3dk:" << dxd3dk << std::endl;
-std::cout << "dxd3dalpha:" << dxd3dalpha << std::endl;
-}*/
-
-
-	//	Pixel coordinates
-	if (in_fc.size() > 1)	//	{Iin_fc̒2ȏƂ݂Ȃ
-	{
-		for (i = 0; i < 2; i++)
-			for (j = 0; j < n; j++)
-				out_xp(i, j) = xd3(i, j) * in_fc(i) + in_cc(i);
-
-		ublas::matrix<double, ublas::column_major>	fc_temp(2 * n, 1);
-		for (i = 0; i < n; i++)
-		{
-			fc_temp(i * 2, 0) = in_fc(0);
-			fc_temp(i * 2 + 1, 0) = in_fc(1);
-		}
-
-		for (i = 0; i < 2 * n; i++)
-			for (j = 0; j < 3; j++)
-				out_dxpdom(i, j) = fc_temp(i, 0) * dxd3dom(i, j);
-
-		for (i = 0; i < 2 * n; i++)
-			for (j = 0; j < 3; j++)
-				out_dxpdT(i, j) = fc_temp(i, 0) * dxd3dT(i, j);
-
-		for (i = 0; i < 2 * n; i++)
-			for (j = 0; j < 5; j++)
-				out_dxpdk(i, j) = fc_temp(i, 0) * dxd3dk(i, j);
-
-		for (i = 0; i < 2 * n; i++)
-			for (j = 0; j < 1; j++)
-				out_dxpdalpha(i, j) = fc_temp(i, 0) * dxd3dalpha(i, j);
-
-		out_dxpdf.clear();
-		for (i = 0; i < n; i++)
-		{
-			out_dxpdf(i * 2, 0) = xd3(0, i);
-			out_dxpdf(i * 2 + 1, 1) = xd3(1, i);
-		}
-	}
-	else
-	{
-std::cout << "Warning:!! NO TEST PATH (project_points2)" << std::endl;
-		//	̃R[h͒ʏgȂ낤
-		for (i = 0; i < 2; i++)
-			for (j = 0; j < n; j++)
-				out_xp(i, j) = in_fc(0) * xd3(i, j) + in_cc(i);
-
-		out_dxpdom = in_fc(0) * dxd3dom;
-		out_dxpdT = in_fc(0) * dxd3dT;
-		out_dxpdk = in_fc(0) * dxd3dk;
-		out_dxpdalpha = in_fc(0) * dxd3dalpha;
-
-		out_dxpdf.clear();
-		for (i = 0; i < n; i++)
-		{
-			out_dxpdf(i * 2, 0) = xd3(0, i);
-			out_dxpdf(i * 2 + 1, 0) = xd3(1, i);
-		}
-	}
-
-	out_dxpdc.clear();
-	for (i = 0; i < n; i++)
-	{
-		out_dxpdc(i * 2, 0) = 1.0;
-		out_dxpdc(i * 2 + 1, 1) = 1.0;
-	}
-
-/*if (g_debug_enabled) {
-std::cout << "out_xp:" << out_xp << std::endl;
-std::cout << "out_dxpdom:" << out_dxpdom << std::endl;
-std::cout << "out_dxpdT:" << out_dxpdT << std::endl;
-std::cout << "out_dxpdk:" << out_dxpdk << std::endl;
-std::cout << "out_dxpdalpha:" << out_dxpdalpha << std::endl;
-std::cout << "out_dxpdf:" << out_dxpdf << std::endl;
-std::cout << "out_dxpdc:" << out_dxpdc << std::endl;
-}*/
-
-}
+// -----------------------------------------------------------------------------
+//	project_points2
+// -----------------------------------------------------------------------------
+//
+//	Projection and the extrinsic derivatives only (for computeExtrinsicRefine)
+//
+void	CameraCalibration::project_points2(
+										const ublas::matrix<double, ublas::column_major> &in_X,
+										const ublas::matrix<double, ublas::column_major> &in_om,
+										const ublas::matrix<double, ublas::column_major> &in_T,
+										const ublas::vector<double> &in_fc,
+										const ublas::vector<double> &in_cc,
+										const ublas::vector<double> &in_kc,
+										double	in_alpha_c,
+										ublas::matrix<double, ublas::column_major> &out_xp,
+										ublas::matrix<double, ublas::column_major> &out_dxpdom,
+										ublas::matrix<double, ublas::column_major> &out_dxpdT)
+{
+	_project_points2_sub(
+		in_X, in_om, in_T, in_fc, in_cc, in_kc, in_alpha_c, out_xp,
+		&out_dxpdom, &out_dxpdT, NULL, NULL, NULL, NULL);
+}
 
 
 // -----------------------------------------------------------------------------
@@ -2032,6 +2011,28 @@ void	CameraCalibration::normalize_pixel(
 										const ublas::matrix<double, ublas::column_major> &in_x,
 										ublas::matrix<double, ublas::column_major> &out_x)
 {
+	normalize_pixel(in_fc, in_cc, in_kc, in_alpha_c, in_x, out_x,
+					COMP_DISTORTION_ITER_MAX, 0.0, false);
+}
+
+// -----------------------------------------------------------------------------
+//	normalize_pixel
+// -----------------------------------------------------------------------------
+//	The undistortion options are the same as comp_distortion_oulu.
+//	Returns the number of the points that did not converge.
+int		CameraCalibration::normalize_pixel(
+										const ublas::vector<double> &in_fc,
+										const ublas::vector<double> &in_cc,
+										const ublas::vector<double> &in_kc,
+										double	in_alpha_c,
+										const ublas::matrix<double, ublas::column_major> &in_x,
+										ublas::matrix<double, ublas::column_major> &out_x,
+										int in_iter_max,
+										double in_tolerance,
+										bool in_newton)
+{
+	int	failed_num = 0;
+
 	//	First: Subtract principal point, and divide by the focal length:
 	for (int i = 0; i < (int )in_x.size2(); i++)
 	{
@@ -2047,40 +2048,73 @@ void	CameraCalibration::normalize_pixel(
 	{
 		//	Third: Compensate for lens distortion:
 		ublas::matrix<double, ublas::column_major>	x_distort = out_x;
-		comp_distortion_oulu(in_kc, x_distort, out_x);
+		failed_num = comp_distortion_oulu(in_kc, x_distort, out_x,
+											in_iter_max, in_tolerance, in_newton);
 //std::cout << "out_x" << out_x << std::endl;
 	}
+	return failed_num;
 }
 
 
 // -----------------------------------------------------------------------------
 //	comp_distortion_oulu
 // -----------------------------------------------------------------------------
-//
-void	CameraCalibration::comp_distortion_oulu(
+//	Same as the toolbox (always 20 fixed point iterations)
+int		CameraCalibration::comp_distortion_oulu(
 										const ublas::vector<double> &in_kc,
 										const ublas::matrix<double, ublas::column_major> &in_x,
 										ublas::matrix<double, ublas::column_major> &out_x)
 {
-	double	k1 = in_kc(0);
-    double	k2 = in_kc(1);
-    double	k3 = in_kc(4);
-    double	p1 = in_kc(2);
-    double	p2 = in_kc(3);
-	double	r_2, k_radial, delta_x0, delta_x1;
+	return comp_distortion_oulu(in_kc, in_x, out_x,
+								COMP_DISTORTION_ITER_MAX, 0.0, false);
+}
 
-	out_x = in_x;		//	initial guess
+// -----------------------------------------------------------------------------
+//	comp_distortion_oulu
+// -----------------------------------------------------------------------------
+//	Each point is iterated until its update is smaller than in_tolerance or
+//	in_iter_max times (in_tolerance <= 0: always in_iter_max times).
+//	in_newton selects Newton steps instead of the fixed point iteration.
+//	Returns the number of the points that did not converge.
+int		CameraCalibration::comp_distortion_oulu(
+										const ublas::vector<double> &in_kc,
+										const ublas::matrix<double, ublas::column_major> &in_x,
+										ublas::matrix<double, ublas::column_major> &out_x,
+										int in_iter_max,
+										double in_tolerance,
+										bool in_newton)
+{
+	int		n = in_x.size2();
+	int		failed_num = 0;
+	double	kc[5];
+	double	xd[DISTORTION_BLOCK_SIZE], yd[DISTORTION_BLOCK_SIZE];
+	double	x[DISTORTION_BLOCK_SIZE], y[DISTORTION_BLOCK_SIZE];
+
+	for (int i = 0; i < 5; i++)
+		kc[i] = in_kc(i);
 
-	for (int i = 0; i < 20; i++)
-		for (int j = 0; j < (int )in_x.size2(); j++)
+	out_x.resize(in_x.size1(), n, false);
+
+	//	Iterations from the initial guess x = xd
+	for (int j0 = 0; j0 < n; j0 += DISTORTION_BLOCK_SIZE)
+	{
+		int	num = (n - j0 < DISTORTION_BLOCK_SIZE) ? (n - j0) : DISTORTION_BLOCK_SIZE;
+
+		for (int j = 0; j < num; j++)
+		{
+			xd[j] = in_x(0, j0 + j);
+			yd[j] = in_x(1, j0 + j);
+		}
+		failed_num += DistortionEngine::Undistort(num, xd, yd, kc,
+										in_iter_max, in_tolerance, in_newton, x, y);
+		for (int j = 0; j < num; j++)
 		{
-			r_2 = out_x(0, j) * out_x(0, j) + out_x(1, j) * out_x(1, j);
-			k_radial = 1 + k1 * r_2 + k2 * r_2 * r_2 + k3 * r_2 * r_2 * r_2;
-			delta_x0 = 2 * p1 * out_x(0, j) * out_x(1, j) + p2 * (r_2 + 2 * out_x(0, j) * out_x(0, j));
-			delta_x1 = p1 * (r_2 + 2 * out_x(1, j) * out_x(1, j)) + 2 * p2 * out_x(0, j) * out_x(1, j);
-			out_x(0, j) = (in_x(0, j) - delta_x0) / k_radial;
-			out_x(1, j) = (in_x(1, j) - delta_x1) / k_radial;
+			out_x(0, j0 + j) = x[j];
+			out_x(1, j0 + j) = y[j];
 		}
+	}
+
+	return failed_num;
 }
 
 #define	MATLAB_EPS	2.2204e-016
@@ -2504,10 +2538,141 @@ std::cerr << "WARNING!!!! Jacobian domdR undefined!!!" << std::endl;
 }
 
 
+// -----------------------------------------------------------------------------
+//	rodrigues_fixed
+// -----------------------------------------------------------------------------
+//
+//	Same as the rotation vector -> rotation matrix part of rodrigues(), but
+//	with fixed size matrices so that it can be called from project_points2()
+//	without any heap allocation. The jacobian is not computed when out_dRdom
+//	is NULL.
+//
+void	CameraCalibration::rodrigues_fixed(
+									const ublas::c_vector<double, 3> &in_om,
+									ublas::c_matrix<double, 3, 3> &out_R,
+									ublas::c_matrix<double, 9, 3> *out_dRdom)
+{
+	int		i;
+	double	theta = ublas::norm_2(in_om);
+
+	if (theta < MATLAB_EPS)
+	{
+		out_R = ublas::identity_matrix<double>(3);
+		if (out_dRdom == NULL)
+			return;
+
+		(*out_dRdom)(0, 0) = 0;	(*out_dRdom)(0, 1) = 0;	(*out_dRdom)(0, 2) = 0;
+		(*out_dRdom)(1, 0) = 0;	(*out_dRdom)(1, 1) = 0;	(*out_dRdom)(1, 2) = 1;
+		(*out_dRdom)(2, 0) = 0;	(*out_dRdom)(2, 1) = -1;	(*out_dRdom)(2, 2) = 0;
+		(*out_dRdom)(3, 0) = 0;	(*out_dRdom)(3, 1) = 0;	(*out_dRdom)(3, 2) = -1;
+		(*out_dRdom)(4, 0) = 0;	(*out_dRdom)(4, 1) = 0;	(*out_dRdom)(4, 2) = 0;
+		(*out_dRdom)(5, 0) = 1;	(*out_dRdom)(5, 1) = 0;	(*out_dRdom)(5, 2) = 0;
+		(*out_dRdom)(6, 0) = 0;	(*out_dRdom)(6, 1) = 1;	(*out_dRdom)(6, 2) = 0;
+		(*out_dRdom)(7, 0) = -1;	(*out_dRdom)(7, 1) = 0;	(*out_dRdom)(7, 2) = 0;
+		(*out_dRdom)(8, 0) = 0;	(*out_dRdom)(8, 1) = 0;	(*out_dRdom)(8, 2) = 0;
+		return;
+	}
+
+	ublas::c_vector<double, 3>	omega;
+	omega(0) = in_om(0) / theta;
+	omega(1) = in_om(1) / theta;
+	omega(2) = in_om(2) / theta;
+
+	double	alpha = cos(theta);
+	double	beta = sin(theta);
+	double	gamma = 1 - cos(theta);
+	ublas::c_matrix<double, 3, 3>	omegav;
+	omegav(0, 0) = 0;			omegav(0, 1) = -omega(2);	omegav(0, 2) = omega(1);
+	omegav(1, 0) = omega(2);	omegav(1, 1) = 0;			omegav(1, 2) = -omega(0);
+	omegav(2, 0) = -omega(1);	omegav(2, 1) = omega(0);	omegav(2, 2) = 0;
+
+	ublas::c_matrix<double, 3, 3>	A;
+	A = ublas::outer_prod(omega, omega);
+
+	out_R = ublas::identity_matrix<double>(3);
+	out_R = out_R * alpha + omegav * beta + A * gamma;
+
+	if (out_dRdom == NULL)
+		return;
+
+	ublas::c_matrix<double, 4, 3>	dm3din;
+	dm3din(0, 0) = 1;	dm3din(0, 1) = 0;	dm3din(0, 2) = 0;
+	dm3din(1, 0) = 0;	dm3din(1, 1) = 1;	dm3din(1, 2) = 0;
+	dm3din(2, 0) = 0;	dm3din(2, 1) = 0;	dm3din(2, 2) = 1;
+	dm3din(3, 0) = in_om(0) / theta;
+	dm3din(3, 1) = in_om(1) / theta;
+	dm3din(3, 2) = in_om(2) / theta;
+
+	ublas::c_matrix<double, 4, 4>	dm2dm3;
+	double	t = 1.0 / theta;
+	dm2dm3(0, 0) = t;	dm2dm3(0, 1) = 0;	dm2dm3(0, 2) = 0;
+	dm2dm3(1, 0) = 0;	dm2dm3(1, 1) = t;	dm2dm3(1, 2) = 0;
+	dm2dm3(2, 0) = 0;	dm2dm3(2, 1) = 0;	dm2dm3(2, 2) = t;
+	dm2dm3(0, 3) = -1 * in_om(0) / (theta * theta);
+	dm2dm3(1, 3) = -1 * in_om(1) / (theta * theta);
+	dm2dm3(2, 3) = -1 * in_om(2) / (theta * theta);
+	dm2dm3(3, 0) = 0;
+	dm2dm3(3, 1) = 0;
+	dm2dm3(3, 2) = 0;
+	dm2dm3(3, 3) = 1;
+
+	double	w1 = omega(0);
+	double	w2 = omega(1);
+	double	w3 = omega(2);
+
+	ublas::c_matrix<double, 21, 4>	dm1dm2;
+	dm1dm2.clear();
+	dm1dm2(0, 3) = -sin(theta);
+	dm1dm2(1, 3) = cos(theta);
+	dm1dm2(2, 3) = sin(theta);
+
+	dm1dm2(4, 2) = 1;
+	dm1dm2(5, 1) = -1;
+	dm1dm2(6, 2) = -1;
+	dm1dm2(8, 0) = 1;
+	dm1dm2(9, 1) = 1;
+	dm1dm2(10, 0) = -1;
+
+	dm1dm2(12, 0) = 2*w1;
+	dm1dm2(13, 0) = w2;		dm1dm2(13, 1) = w1;
+	dm1dm2(14, 0) = w3;							dm1dm2(14, 2) = w1;
+	dm1dm2(15, 0) = w2;		dm1dm2(15, 1) = w1;
+							dm1dm2(16, 1) = 2*w2;
+							dm1dm2(17, 1) = w3;		dm1dm2(17, 2) = w2;
+	dm1dm2(18, 0) = w3;							dm1dm2(18, 2) = w1;
+							dm1dm2(19, 1) = w3;		dm1dm2(19, 2) = w2;
+												dm1dm2(20, 2) = 2*w3;
+
+	ublas::c_matrix<double, 9, 21>	dRdm1;
+	dRdm1.clear();
+	dRdm1(0, 0) = 1;	dRdm1(4, 0) = 1;	dRdm1(8, 0) = 1;
+	for (i = 0; i < 9; i++)
+	{
+		dRdm1(i, 1) = omegav(i % 3, i / 3);
+		dRdm1(i, 3 + i) = beta;
+		dRdm1(i, 2) = A(i % 3, i / 3);
+		dRdm1(i, 12 + i) = gamma;
+	}
+
+	ublas::c_matrix<double, 9, 4>	dRdm2;
+	ublas::c_matrix<double, 9, 4>	dRdm3;
+	ublas::noalias(dRdm2) = ublas::prod(dRdm1, dm1dm2);
+	ublas::noalias(dRdm3) = ublas::prod(dRdm2, dm2dm3);
+	ublas::noalias(*out_dRdom) = ublas::prod(dRdm3, dm3din);
+}
+
+
 // -----------------------------------------------------------------------------
 //	rect_index
 // -----------------------------------------------------------------------------
 //
+//	The row major fixed point remap table of the rectification (RectifyMap::Remap
+//	rectifies the images with it). nc, nr is the size of the source image and
+//	in_map_width, in_map_height is the size of the rectified image (0: the same
+//	as the source).
+//	The source points are computed one row at a time, so the temporaries are
+//	of one row, not of the image.
+//
 void	CameraCalibration::rect_index(
 										int nc, int nr,	// xaxis, yaxis
 										const ublas::matrix<double, ublas::column_major> &R,
@@ -2516,265 +2681,179 @@ void	CameraCalibration::rect_index(
 										const ublas::vector<double> &k,
 										double	alpha,
 										const ublas::matrix<double, ublas::column_major> &KK_new,
-										ublas::vector<double> &out_a1,
-										ublas::vector<double> &out_a2,
-										ublas::vector<double> &out_a3,
-										ublas::vector<double> &out_a4,
-										ublas::vector<int> &out_ind_new,
-										ublas::vector<int> &out_ind_1,
-										ublas::vector<int> &out_ind_2,
-										ublas::vector<int> &out_ind_3,
-										ublas::vector<int> &out_ind_4)
+										RectifyMap &out_map,
+										int in_weight_type,
+										int in_map_width, int in_map_height)
 {
-	//	Note: R is the motion of the points in space
-	//	So: X2 = R*X where X: coord in the old reference frame, X2: coord in the new ref frame.
-
-	// [mx,my] = meshgrid(1:nc, 1:nr);
-	// px = reshape(mx',nc*nr,1);
-	// py = reshape(my',nc*nr,1);
-	// rays = inv(KK_new)*[(px - 1)';(py - 1)';ones(1,length(px))];
-	ublas::vector<int>	px(nc * nr);
-	ublas::vector<int>	py(nc * nr);
-
-	for (int i = 0; i < nr; i++)
-		for (int j = 0;j < nc; j++)
-		{
-			px(i * nc + j) = j;
-			py(i * nc + j) = i;
-		}
-
-	ublas::matrix<double, ublas::column_major>	t(3, nr * nc);
-	for (int i = 0; i < nr; i++)
-		for (int j = 0; j < nc; j++)
-		{
-			t(0, i * nc + j) = j;
-			t(1, i * nc + j) = i;
-			t(2, i * nc + j) = 1;
-		}
+	int	width = (in_map_width > 0) ? in_map_width : nc;
+	int	height = (in_map_height > 0) ? in_map_height : nr;
 
 	ublas::matrix<double, ublas::column_major> KK_new_inv = KK_new;
 	mat_inv(KK_new_inv);
-	ublas::matrix<double, ublas::column_major>	rays(3, nr * nc);
-	rays = ublas::prod(KK_new_inv, t);
 
-	// Rotation: (or affine transformation):
-	ublas::matrix<double, ublas::column_major>	rays2(3, nr * nc);
-	rays2 = ublas::prod(ublas::trans(R), rays);
-
-	ublas::matrix<double, ublas::column_major>	x(2, nr * nc);
-	for (int i = 0; i < nc * nr; i++)
+	ublas::matrix<double, ublas::column_major>	t(3, width);
+	ublas::matrix<double, ublas::column_major>	rays(3, width), rays2(3, width);
+	ublas::matrix<double, ublas::column_major>	x(2, width), xd(2, width);
+	for (int j = 0; j < width; j++)
 	{
-		x(0, i) = rays2(0, i) / rays2(2, i);
-		x(1, i) = rays2(1, i) / rays2(2, i);
+		t(0, j) = j;
+		t(2, j) = 1;
 	}
 
-	// Add distortion:
-	ublas::matrix<double, ublas::column_major>	xd(2, nr * nc);
-
-	apply_distortion(x, k, xd);
-
-	// Reconvert in pixels:
-	// Interpolate between the closest pixels:
-	ublas::vector<double>	px2(nc * nr);
-	ublas::vector<double>	py2(nc * nr);
-	ublas::vector<int>	px_0(nc * nr);
-	ublas::vector<int>	py_0(nc * nr);
-	ublas::vector<int>	good_points(nc * nr);
-
-	// ind_new = (px(good_points)-1)*nr + py(good_points); ɏD
-	// IWił͌̕ɏoĂ
-	//ublas::vector<int>	ind_new(nc * nr);
-	out_ind_new.resize(nc * nr);
-
-	int	count = 0;
-	for (int i = 0; i < nc * nr; i++)
+	out_map.Create(width, height, nc, nr, in_weight_type);
+	for (int i = 0; i < height; i++)
 	{
-		px2(count) = f(0) * (xd(0, i) + alpha * xd(1, i)) + c(0);
-		py2(count) = f(1) * xd(1, i) + c(1);
-		px_0(count) = floor(px2(count));
-		py_0(count) = floor(py2(count));
-
-		out_ind_new(count) = px(i) * nr + py(i);
-
-		if (px_0(count) >= 0 && px_0(count) <= (nc - 2) &&
-			py_0(count) >= 0 && py_0(count) <= (nr - 2))
-			count++;
-	}
-std::cout << "count:" << count << std::endl;
-
-	px2.resize(count);
-	py2.resize(count);
-	px_0.resize(count);
-	py_0.resize(count);
-	out_ind_new.resize(count);
+		for (int j = 0; j < width; j++)
+			t(1, j) = i;
 
-	ublas::vector<double>	alpha_x(count);
-	ublas::vector<double>	alpha_y(count);
-
-	alpha_x = px2 - px_0;
-	alpha_y = py2 - py_0;
-
-	out_a1.resize(count);
-	out_a2.resize(count);
-	out_a3.resize(count);
-	out_a4.resize(count);
-
-	for (int i = 0; i < count; i++)
-	{
-		out_a1(i) = (1 - alpha_y(i)) * (1 - alpha_x(i));
-		out_a2(i) = (1 - alpha_y(i)) * alpha_x(i);
-		out_a3(i) = alpha_y(i) * (1 - alpha_x(i));
-		out_a4(i) = alpha_y(i) * alpha_x(i);
-	}
+		ublas::noalias(rays) = ublas::prod(KK_new_inv, t);
+		ublas::noalias(rays2) = ublas::prod(ublas::trans(R), rays);
+		for (int j = 0; j < width; j++)
+		{
+			x(0, j) = rays2(0, j) / rays2(2, j);
+			x(1, j) = rays2(1, j) / rays2(2, j);
+		}
 
-	out_ind_1.resize(count);
-	out_ind_2.resize(count);
-	out_ind_3.resize(count);
-	out_ind_4.resize(count);
+		apply_distortion(x, k, xd);
 
-	//	IWiMatlab̍WnɕϊĂ̂Œ
-	//	摜ꎟzŃANZXiFortranzj
-	for (int i = 0; i < count; i++)
-	{
-		out_ind_1(i) = px_0(i) * nr + py_0(i);
-		out_ind_2(i) = (px_0(i) + 1) * nr + py_0(i);
-		out_ind_3(i) = px_0(i) * nr + (py_0(i) + 1);
-		out_ind_4(i) = (px_0(i) + 1) * nr + (py_0(i) + 1);
+		for (int j = 0; j < width; j++)
+			out_map.SetEntry(j, i,
+				f(0) * (xd(0, j) + alpha * xd(1, j)) + c(0),
+				f(1) * xd(1, j) + c(1));
 	}
-
-	// ̃R[hɂ͈ȉ͖̕ʂȂ̂łł͏Ȃ
-	// Irec(ind_new) = a1 .* I(ind_1) + a2 .* I(ind_2) + a3 .* I(ind_3) + a4 .* I(ind_4);
 }
 
 
 // -----------------------------------------------------------------------------
-//	rectify_image
+//	apply_distortion
 // -----------------------------------------------------------------------------
 //
-void	CameraCalibration::rectify_image(
-										int inWidth, int inHeight,
-										const unsigned char *inImage,
-										const ublas::vector<double> &in_a1,
-										const ublas::vector<double> &in_a2,
-										const ublas::vector<double> &in_a3,
-										const ublas::vector<double> &in_a4,
-										const ublas::vector<int> &in_ind_new,
-										const ublas::vector<int> &in_ind_1,
-										const ublas::vector<int> &in_ind_2,
-										const ublas::vector<int> &in_ind_3,
-										const ublas::vector<int> &in_ind_4,
-										unsigned char *outImage)
+void	CameraCalibration::apply_distortion(
+									 const ublas::matrix<double, ublas::column_major> &x,
+									 const ublas::vector<double> &k,
+									 ublas::matrix<double, ublas::column_major> &out_xd)
 {
-	int	imageSize = inWidth * inHeight;
-	int indexCount = in_ind_1.size();
+	int		m = x.size1();
+	int		n = x.size2();
+	double	kc[5];
+	double	x1[DISTORTION_BLOCK_SIZE], x2[DISTORTION_BLOCK_SIZE];
 
-	for (int i = 0; i < imageSize; i++)
-		outImage[i] = 0;
+	for (int i = 0; i < 5; i++)
+		kc[i] = k(i);
 
-	double	value;
-	int	x, y, ind_new, ind1, ind2, ind3, ind4;
-	for (int i = 0; i < indexCount; i++)
-	{
-		y = in_ind_new[i] % inHeight;
-		x = in_ind_new[i] / inHeight;
-		ind_new = x + y * inWidth;
-
-		y = in_ind_1[i] % inHeight;
-		x = in_ind_1[i] / inHeight;
-		ind1 = x + y * inWidth;
+	out_xd.resize(m, n);
 
-		y = in_ind_2[i] % inHeight;
-		x = in_ind_2[i] / inHeight;
-		ind2 = x + y * inWidth;
+	for (int i0 = 0; i0 < n; i0 += DISTORTION_BLOCK_SIZE)
+	{
+		int	num = (n - i0 < DISTORTION_BLOCK_SIZE) ? (n - i0) : DISTORTION_BLOCK_SIZE;
 
-		y = in_ind_3[i] % inHeight;
-		x = in_ind_3[i] / inHeight;
-		ind3 = x + y * inWidth;
+		for (int i = 0; i < num; i++)
+		{
+			x1[i] = x(0, i0 + i);
+			x2[i] = x(1, i0 + i);
+		}
 
-		y = in_ind_4[i] % inHeight;
-		x = in_ind_4[i] / inHeight;
-		ind4 = x + y * inWidth;
+		// Add distortion (radial and tangential):
+		DistortionEngine::Distort(num, x1, x2, kc, x1, x2);
 
-		value = in_a1[i] * inImage[ind1];
-		value += in_a2[i] * inImage[ind2];
-		value += in_a3[i] * inImage[ind3];
-		value += in_a4[i] * inImage[ind4];
-		outImage[ind_new] = value;
+		for (int i = 0; i < num; i++)
+		{
+			out_xd(0, i0 + i) = x1[i];
+			out_xd(1, i0 + i) = x2[i];
+		}
 	}
 }
 
 
 // -----------------------------------------------------------------------------
-//	apply_distortion
+//	schur_solve
 // -----------------------------------------------------------------------------
 //
-void	CameraCalibration::apply_distortion(
-									 const ublas::matrix<double, ublas::column_major> &x,
-									 const ublas::vector<double> &k,
-									 ublas::matrix<double, ublas::column_major> &out_xd)
+//	Solves the arrow structured normal equation
+//
+//		| U   W_1 ... W_n | | da   |   | ea   |
+//		| W_1' V_1        | | db_1 | = | eb_1 |
+//		| ...       ...   | | ...  |   | ...  |
+//		| W_n'        V_n | | db_n |   | eb_n |
+//
+//	by eliminating the V blocks. S = U - sum(W_k inv(V_k) W_k') is the Schur
+//	complement and its inverse is the upper left block of the inverse of the
+//	whole matrix. inv(S) and inv(V_k) are returned for the uncertainty estimation.
+//
+void	CameraCalibration::schur_solve(
+								const ublas::matrix<double, ublas::column_major> &in_U,
+								const ublas::matrix<double, ublas::column_major> &in_ea,
+								const std::vector<ublas::matrix<double, ublas::column_major> > &in_V_list,
+								const std::vector<ublas::matrix<double, ublas::column_major> > &in_W_list,
+								const std::vector<ublas::matrix<double, ublas::column_major> > &in_eb_list,
+								ublas::matrix<double, ublas::column_major> &out_da,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_db_list,
+								ublas::matrix<double, ublas::column_major> &out_S_inv,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_V_inv_list)
 {
-	int	m = x.size1();
-	int n = x.size2();
-
-	ublas::vector<double>	x1(n);
-	ublas::vector<double>	x2(n);
+	int	n = (int )in_V_list.size();
+	int	m = (int )in_U.size1();
 
-	for (int i = 0; i < n; i++)
-	{
-		x1(i) = x(0, i);
-		x2(i) = x(1, i);
-	}
+	ublas::matrix<double, ublas::column_major>	S(m, m);
+	ublas::matrix<double, ublas::column_major>	ea_dash(m, 1);
+	S = in_U;
+	ea_dash = in_ea;
 
-	// Add distortion:
-	ublas::vector<double>	r2(n);
-	ublas::vector<double>	r4(n);
-	ublas::vector<double>	r6(n);
+	out_V_inv_list.resize(n);
+	out_db_list.resize(n);
 
-	for (int i = 0; i < n; i++)
+	for (int kk = 0; kk < n; kk++)
 	{
-		r2(i) = x1(i) * x1(i) + x2(i) * x2(i);
-		r4(i) = r2(i) * r2(i);
-		r6(i) = r2(i) * r2(i) * r2(i);
-	}
-
-	// Radial distortion:
-	ublas::vector<double>	cdist(n);
-	for (int i = 0; i < n; i++)
-		cdist(i) = 1 + k(0) * r2(i) + k(1) * r4(i) + k(4) * r6(i);
+		out_V_inv_list[kk] = in_V_list[kk];
+		mat_inv(out_V_inv_list[kk]);
 
-	ublas::matrix<double, ublas::column_major>	xd1(m, n);
+		ublas::matrix<double, ublas::column_major>	WV_inv(m, in_V_list[kk].size1());
+		WV_inv = ublas::prod(in_W_list[kk], out_V_inv_list[kk]);
 
-	for (int i = 0; i < n; i++)
-	{
-		xd1(0, i) = x(0, i) * cdist(i);
-		xd1(1, i) = x(1, i) * cdist(i);
+		S = S - ublas::prod(WV_inv, ublas::trans(in_W_list[kk]));
+		ea_dash = ea_dash - ublas::prod(WV_inv, in_eb_list[kk]);
 	}
 
-	// tangential distortion:
-	ublas::vector<double>	a1(n);
-	ublas::vector<double>	a2(n);
-	ublas::vector<double>	a3(n);
+	out_S_inv = S;
+	mat_inv(out_S_inv);
+	out_da = ublas::prod(out_S_inv, ea_dash);
 
-	for (int i = 0; i < n; i++)
+	//	Back substitution: db_k = inv(V_k) (eb_k - W_k' da)
+	for (int kk = 0; kk < n; kk++)
 	{
-		a1(i) = 2 * x1(i) * x2(i);
-		a2(i) = r2(i) + 2 * x1(i) * x1(i);
-		a3(i) = r2(i) + 2 * x2(i) * x2(i);
+		ublas::matrix<double, ublas::column_major>	eb_dash(in_eb_list[kk].size1(), 1);
+		eb_dash = in_eb_list[kk] - ublas::prod(ublas::trans(in_W_list[kk]), out_da);
+		out_db_list[kk] = ublas::prod(out_V_inv_list[kk], eb_dash);
 	}
+}
 
-	ublas::matrix<double, ublas::column_major>	delta_x(2, n);
 
-	for (int i = 0; i < n; i++)
-	{
-		delta_x(0, i) = k(2) * a1(i) + k(3) * a2(i);
-		delta_x(1, i) = k(2) * a3(i) + k(3) * a1(i);
-	}
+// -----------------------------------------------------------------------------
+//	schur_block_diag
+// -----------------------------------------------------------------------------
+//
+//	Diagonal of the V_k block of the inverse of the arrow matrix (see schur_solve)
+//	diag(inv(V_k) + inv(V_k) W_k' inv(S) W_k inv(V_k))
+//
+void	CameraCalibration::schur_block_diag(
+								const ublas::matrix<double, ublas::column_major> &in_W,
+								const ublas::matrix<double, ublas::column_major> &in_V_inv,
+								const ublas::matrix<double, ublas::column_major> &in_S_inv,
+								ublas::vector<double> &out_diag)
+{
+	int	m = (int )in_V_inv.size1();
 
-	out_xd.resize(m, n);
-	for (int i = 0; i < n; i++)
+	ublas::matrix<double, ublas::column_major>	WV_inv(in_W.size1(), m);
+	ublas::matrix<double, ublas::column_major>	S_invWV_inv(in_W.size1(), m);
+	WV_inv = ublas::prod(in_W, in_V_inv);
+	S_invWV_inv = ublas::prod(in_S_inv, WV_inv);
+
+	out_diag.resize(m);
+	for (int i = 0; i < m; i++)
 	{
-		out_xd(0, i) = xd1(0, i) + delta_x(0, i);
-		out_xd(1, i) = xd1(1, i) + delta_x(1, i);
+		out_diag(i) = in_V_inv(i, i);
+		for (int j = 0; j < (int )in_W.size1(); j++)
+			out_diag(i) += WV_inv(j, i) * S_invWV_inv(j, i);
 	}
 }
 
@@ -3307,6 +3386,233 @@ void	CameraCalibration::mat_sum(
 }
 
 
+// -----------------------------------------------------------------------------
+//	_project_points2_sub
+// -----------------------------------------------------------------------------
+//
+//	Body of project_points2(). The points are processed one by one and every
+//	intermediate value of a point (Y, x, r2, cdist, dxdom...) is kept in local
+//	variables. Only the derivative blocks whose pointer is not NULL are
+//	computed, and out_xp does not depend on which blocks are requested.
+//
+void	CameraCalibration::_project_points2_sub(
+										const ublas::matrix<double, ublas::column_major> &in_X,
+										const ublas::matrix<double, ublas::column_major> &in_om,
+										const ublas::matrix<double, ublas::column_major> &in_T,
+										const ublas::vector<double> &in_fc,
+										const ublas::vector<double> &in_cc,
+										const ublas::vector<double> &in_kc,
+										double	in_alpha_c,
+										ublas::matrix<double, ublas::column_major> &out_xp,
+										ublas::matrix<double, ublas::column_major> *out_dxpdom,
+										ublas::matrix<double, ublas::column_major> *out_dxpdT,
+										ublas::matrix<double, ublas::column_major> *out_dxpdf,
+										ublas::matrix<double, ublas::column_major> *out_dxpdc,
+										ublas::matrix<double, ublas::column_major> *out_dxpdk,
+										ublas::matrix<double, ublas::column_major> *out_dxpdalpha)
+{
+	int	i, j;
+	int	n = in_X.size2();
+	bool	need_ext = (out_dxpdom != NULL || out_dxpdT != NULL);
+
+	ublas::c_vector<double, 3>		om;
+	ublas::c_vector<double, 3>		T;
+	ublas::c_matrix<double, 3, 3>	R;
+	ublas::c_matrix<double, 9, 3>	dRdom;
+
+	for (j = 0; j < 3; j++)
+	{
+		om(j) = (in_om.size1() == 3) ? in_om(j, 0) : in_om(0, j);
+		T(j) = (in_T.size1() == 3) ? in_T(j, 0) : in_T(0, j);
+	}
+	rodrigues_fixed(om, R, need_ext ? &dRdom : NULL);
+
+	//	{Iin_fc̒2ȏƂ݂Ȃi1̎͗̎in_fc(0)gj
+	bool	is_fc_vec = (in_fc.size() > 1);
+	double	f[2];
+	f[0] = in_fc(0);
+	f[1] = is_fc_vec ? in_fc(1) : in_fc(0);
+
+	double	k1 = in_kc(0), k2 = in_kc(1), p1 = in_kc(2), p2 = in_kc(3), k3 = in_kc(4);
+
+	//	Projection only: DistortionEngine does the same computation with SIMD
+	if (need_ext == false && out_dxpdf == NULL && out_dxpdc == NULL &&
+		out_dxpdk == NULL && out_dxpdalpha == NULL)
+	{
+		double	R_array[9], T_array[3], c[2], kc[5];
+		double	Xb[DISTORTION_BLOCK_SIZE], Yb[DISTORTION_BLOCK_SIZE], Zb[DISTORTION_BLOCK_SIZE];
+		double	ub[DISTORTION_BLOCK_SIZE], vb[DISTORTION_BLOCK_SIZE];
+
+		for (j = 0; j < 9; j++)
+			R_array[j] = R(j / 3, j % 3);
+		for (j = 0; j < 3; j++)
+			T_array[j] = T(j);
+		c[0] = in_cc(0);
+		c[1] = in_cc(1);
+		for (j = 0; j < 5; j++)
+			kc[j] = in_kc(j);
+
+		for (int i0 = 0; i0 < n; i0 += DISTORTION_BLOCK_SIZE)
+		{
+			int	num = (n - i0 < DISTORTION_BLOCK_SIZE) ? (n - i0) : DISTORTION_BLOCK_SIZE;
+
+			for (i = 0; i < num; i++)
+			{
+				Xb[i] = in_X(0, i0 + i);
+				Yb[i] = in_X(1, i0 + i);
+				Zb[i] = in_X(2, i0 + i);
+			}
+			DistortionEngine::Project(num, Xb, Yb, Zb, R_array, T_array, f, c, kc, in_alpha_c, ub, vb);
+			for (i = 0; i < num; i++)
+			{
+				out_xp(0, i0 + i) = ub[i];
+				out_xp(1, i0 + i) = vb[i];
+			}
+		}
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		double	X[3];
+		double	Y[3];
+
+		X[0] = in_X(0, i);
+		X[1] = in_X(1, i);
+		X[2] = in_X(2, i);
+
+		//	Rigid motion (same as rigid_motion)
+		for (j = 0; j < 3; j++)
+			Y[j] = R(j, 0) * X[0] + R(j, 1) * X[1] + R(j, 2) * X[2] + T(j);
+
+		double	inv_Z = 1.0 / Y[2];	// Y[2][łȂƂmFȂƃ_
+		double	x[2];
+		x[0] = Y[0] * inv_Z;
+		x[1] = Y[1] * inv_Z;
+
+		//	Add distortion
+		double	r2 = x[0] * x[0] + x[1] * x[1];
+		double	r4 = r2 * r2;
+		double	r6 = r2 * r2 * r2;
+
+		//	Radial distortion
+		double	cdist = 1 + k1 * r2 + k2 * r4 + k3 * r6;
+
+		//	Tangential distortion
+		double	a1 = 2.0 * x[0] * x[1];
+		double	a2 = r2 + 2.0 * x[0] * x[0];
+		double	a3 = r2 + 2.0 * x[1] * x[1];
+
+		double	xd2[2];
+		xd2[0] = x[0] * cdist + (p1 * a1 + p2 * a2);
+		xd2[1] = x[1] * cdist + (p1 * a3 + p2 * a1);
+
+		//	Add Skew
+		double	xd3[2];
+		xd3[0] = xd2[0] + in_alpha_c * xd2[1];
+		xd3[1] = xd2[1];
+
+		//	Pixel coordinates
+		for (j = 0; j < 2; j++)
+			out_xp(j, i) = is_fc_vec ? (xd3[j] * f[j] + in_cc(j)) : (f[0] * xd3[j] + in_cc(j));
+
+		if (need_ext)
+		{
+			double	dYdom[3][3];
+			for (j = 0; j < 3; j++)
+				for (int l = 0; l < 3; l++)
+					dYdom[j][l] = X[0] * dRdom(j, l) + X[1] * dRdom(j + 3, l) + X[2] * dRdom(j + 6, l);
+
+			double	bb = -1.0 * x[0] * inv_Z;
+			double	cc = -1.0 * x[1] * inv_Z;
+
+			//	dxdom and dxdT (dYdT is the identity)
+			double	dxdom[2][3];
+			double	dxdT[2][3];
+			for (j = 0; j < 3; j++)
+			{
+				dxdom[0][j] = inv_Z * dYdom[0][j] + bb * dYdom[2][j];
+				dxdom[1][j] = inv_Z * dYdom[1][j] + cc * dYdom[2][j];
+			}
+			dxdT[0][0] = inv_Z;	dxdT[0][1] = 0.0;	dxdT[0][2] = bb;
+			dxdT[1][0] = 0.0;	dxdT[1][1] = inv_Z;	dxdT[1][2] = cc;
+
+			double	r2_squre = r2 * r2;
+			double	aa = 2.0 * p1 * x[1] + 6.0 * p2 * x[0];
+			double	bb2 = 2.0 * p1 * x[0] + 2.0 * p2 * x[1];
+			double	cc2 = 6.0 * p1 * x[1] + 2.0 * p2 * x[0];
+
+			for (j = 0; j < 3; j++)
+			{
+				double	dr2dom = 2.0 * x[0] * dxdom[0][j] + 2.0 * x[1] * dxdom[1][j];
+				double	dr2dT = 2.0 * x[0] * dxdT[0][j] + 2.0 * x[1] * dxdT[1][j];
+				double	dcdistdom = k1 * dr2dom + k2 * (2.0 * r2 * dr2dom) + k3 * (3.0 * r2_squre * dr2dom);
+				double	dcdistdT = k1 * dr2dT + k2 * (2.0 * r2 * dr2dT) + k3 * (3.0 * r2_squre * dr2dT);
+
+				double	dxd2dom[2];
+				double	dxd2dT[2];
+				dxd2dom[0] = (x[0] * dcdistdom + cdist * dxdom[0][j]) + (aa * dxdom[0][j] + bb2 * dxdom[1][j]);
+				dxd2dom[1] = (x[1] * dcdistdom + cdist * dxdom[1][j]) + (bb2 * dxdom[0][j] + cc2 * dxdom[1][j]);
+				dxd2dT[0] = (x[0] * dcdistdT + cdist * dxdT[0][j]) + (aa * dxdT[0][j] + bb2 * dxdT[1][j]);
+				dxd2dT[1] = (x[1] * dcdistdT + cdist * dxdT[1][j]) + (bb2 * dxdT[0][j] + cc2 * dxdT[1][j]);
+
+				if (out_dxpdom != NULL)
+				{
+					(*out_dxpdom)(i * 2, j) = f[0] * (dxd2dom[0] + in_alpha_c * dxd2dom[1]);
+					(*out_dxpdom)(i * 2 + 1, j) = f[1] * dxd2dom[1];
+				}
+				if (out_dxpdT != NULL)
+				{
+					(*out_dxpdT)(i * 2, j) = f[0] * (dxd2dT[0] + in_alpha_c * dxd2dT[1]);
+					(*out_dxpdT)(i * 2 + 1, j) = f[1] * dxd2dT[1];
+				}
+			}
+		}
+
+		if (out_dxpdk != NULL)
+		{
+			double	dxd2dk[2][5];
+			dxd2dk[0][0] = x[0] * r2;	dxd2dk[1][0] = x[1] * r2;
+			dxd2dk[0][1] = x[0] * r4;	dxd2dk[1][1] = x[1] * r4;
+			dxd2dk[0][2] = a1;			dxd2dk[1][2] = a3;
+			dxd2dk[0][3] = a2;			dxd2dk[1][3] = a1;
+			dxd2dk[0][4] = x[0] * r6;	dxd2dk[1][4] = x[1] * r6;
+
+			for (j = 0; j < 5; j++)
+			{
+				(*out_dxpdk)(i * 2, j) = f[0] * (dxd2dk[0][j] + in_alpha_c * dxd2dk[1][j]);
+				(*out_dxpdk)(i * 2 + 1, j) = f[1] * dxd2dk[1][j];
+			}
+		}
+
+		if (out_dxpdalpha != NULL)
+		{
+			(*out_dxpdalpha)(i * 2, 0) = f[0] * xd2[1];
+			(*out_dxpdalpha)(i * 2 + 1, 0) = 0.0;
+		}
+
+		if (out_dxpdf != NULL)
+		{
+			for (j = 0; j < (int )out_dxpdf->size2(); j++)
+			{
+				(*out_dxpdf)(i * 2, j) = 0.0;
+				(*out_dxpdf)(i * 2 + 1, j) = 0.0;
+			}
+			(*out_dxpdf)(i * 2, 0) = xd3[0];
+			(*out_dxpdf)(i * 2 + 1, is_fc_vec ? 1 : 0) = xd3[1];
+		}
+
+		if (out_dxpdc != NULL)
+		{
+			(*out_dxpdc)(i * 2, 0) = 1.0;
+			(*out_dxpdc)(i * 2, 1) = 0.0;
+			(*out_dxpdc)(i * 2 + 1, 0) = 0.0;
+			(*out_dxpdc)(i * 2 + 1, 1) = 1.0;
+		}
+	}
+}
+
+
 // -----------------------------------------------------------------------------
 //	_mat_median_sub
 // -----------------------------------------------------------------------------
@@ -45,6 +45,7 @@
 // -----------------------------------------------------------------------------
 // 	include files
 // -----------------------------------------------------------------------------
+#include "RectifyMap.hpp"
 
 // -----------------------------------------------------------------------------
 // 	macros
@@ -57,6 +58,13 @@
 class	CameraCalibration
 {
 public:
+	//	optimization method of mainOptimization
+	enum OptimizationMethod
+	{
+							OPTIMIZATION_GAUSS_NEWTON		= 0,	// the toolbox (smoothed Gauss-Newton steps)
+							OPTIMIZATION_LEVENBERG_MARQUARDT
+	};
+
 	//	constructor/destructor
 							CameraCalibration(int inImageWidth, int inImageHeight);
 	virtual					~CameraCalibration();
@@ -100,20 +108,26 @@ public:
 	double					alpha_c_error;
 
 	double					thresh_cond;
+	int						mWorkerThreadNum;	// worker threads of the per view (per pair) loops (0: number of cores)
+	int						mOptimizationMethod;	// OptimizationMethod
+	int						mOptimizationIterNum;	// iterations of the last mainOptimization
+	double					mUndistortTolerance;	// tolerance of the undistortion in computeExtrinsicInit
+													// (0: the toolbox, always 20 fixed point iterations)
+	int						mUndistortFailedNum;	// points not converged in the last extrinsic computation
 
 	ublas::matrix<double, ublas::column_major>	KK;
 
 	ublas::matrix<double, ublas::column_major>	N_points_views;
 
 	//	member functions
-	void					computeHomography(
+	static void				computeHomography(
 										const ublas::matrix<double, ublas::column_major> &x,
 										const ublas::matrix<double, ublas::column_major> &X,
 										ublas::matrix<double, ublas::column_major> &H);
 	void					computeIntrisicParam();
 
 	void					computeExtrinsicParam();
-	void					computeExtrinsicInit(
+	int						computeExtrinsicInit(
 										const ublas::matrix<double, ublas::column_major> &x,
 										const ublas::matrix<double, ublas::column_major> &X,
 										ublas::matrix<double, ublas::column_major> &omckk,
@@ -143,6 +157,26 @@ public:
 										ublas::matrix<double, ublas::column_major> &out_dxpdc,
 										ublas::matrix<double, ublas::column_major> &out_dxpdk,
 										ublas::matrix<double, ublas::column_major> &out_dxpdalpha);
+	static void				project_points2(
+										const ublas::matrix<double, ublas::column_major> &in_X,
+										const ublas::matrix<double, ublas::column_major> &in_om,
+										const ublas::matrix<double, ublas::column_major> &in_T,
+										const ublas::vector<double> &in_fc,
+										const ublas::vector<double> &in_cc,
+										const ublas::vector<double> &in_kc,
+										double	in_alpha_c,
+										ublas::matrix<double, ublas::column_major> &out_xp);
+	static void				project_points2(
+										const ublas::matrix<double, ublas::column_major> &in_X,
+										const ublas::matrix<double, ublas::column_major> &in_om,
+										const ublas::matrix<double, ublas::column_major> &in_T,
+										const ublas::vector<double> &in_fc,
+										const ublas::vector<double> &in_cc,
+										const ublas::vector<double> &in_kc,
+										double	in_alpha_c,
+										ublas::matrix<double, ublas::column_major> &out_xp,
+										ublas::matrix<double, ublas::column_major> &out_dxpdom,
+										ublas::matrix<double, ublas::column_major> &out_dxpdT);
 	static void				rigid_motion(
 										const ublas::matrix<double, ublas::column_major> &in_X,
 										const ublas::matrix<double, ublas::column_major> &in_om,
@@ -157,14 +191,35 @@ public:
 										double	in_alpha_c,
 										const ublas::matrix<double, ublas::column_major> &in_x,
 										ublas::matrix<double, ublas::column_major> &out_x);
-	static void				comp_distortion_oulu(
+	static int				normalize_pixel(
+										const ublas::vector<double> &in_fc,
+										const ublas::vector<double> &in_cc,
+										const ublas::vector<double> &in_kc,
+										double	in_alpha_c,
+										const ublas::matrix<double, ublas::column_major> &in_x,
+										ublas::matrix<double, ublas::column_major> &out_x,
+										int in_iter_max,
+										double in_tolerance,
+										bool in_newton);
+	static int				comp_distortion_oulu(
 										const ublas::vector<double> &in_kc,
 										const ublas::matrix<double, ublas::column_major> &in_x,
 										ublas::matrix<double, ublas::column_major> &out_x);
+	static int				comp_distortion_oulu(
+										const ublas::vector<double> &in_kc,
+										const ublas::matrix<double, ublas::column_major> &in_x,
+										ublas::matrix<double, ublas::column_major> &out_x,
+										int in_iter_max,
+										double in_tolerance,
+										bool in_newton);
 	static void				rodrigues(
 									 const ublas::matrix<double, ublas::column_major> &in_mat,
 									 ublas::matrix<double, ublas::column_major> &out_mat,
 									 ublas::matrix<double, ublas::column_major> &out_jacobian);
+	static void				rodrigues_fixed(
+									const ublas::c_vector<double, 3> &in_om,
+									ublas::c_matrix<double, 3, 3> &out_R,
+									ublas::c_matrix<double, 9, 3> *out_dRdom);
 
 	static void				rect_index(
 										int nc, int nr,
@@ -174,34 +229,31 @@ public:
 										const ublas::vector<double> &k,
 										double	alpha,
 										const ublas::matrix<double, ublas::column_major> &KK_new,
-										ublas::vector<double> &out_a1,
-										ublas::vector<double> &out_a2,
-										ublas::vector<double> &out_a3,
-										ublas::vector<double> &out_a4,
-										ublas::vector<int> &out_ind_new,
-										ublas::vector<int> &ind_1,
-										ublas::vector<int> &ind_2,
-										ublas::vector<int> &ind_3,
-										ublas::vector<int> &ind_4);
-	static void				rectify_image(
-										int inWidth, int inHeight,
-										const unsigned char *inImage,
-										const ublas::vector<double> &in_a1,
-										const ublas::vector<double> &in_a2,
-										const ublas::vector<double> &in_a3,
-										const ublas::vector<double> &in_a4,
-										const ublas::vector<int> &in_ind_new,
-										const ublas::vector<int> &in_ind_1,
-										const ublas::vector<int> &in_ind_2,
-										const ublas::vector<int> &in_ind_3,
-										const ublas::vector<int> &in_ind_4,
-										unsigned char *outImage);
+										RectifyMap &out_map,
+										int in_weight_type = RectifyMap::WEIGHT_16BIT,
+										int in_map_width = 0, int in_map_height = 0);
 
 	static void				apply_distortion(
 									 const ublas::matrix<double, ublas::column_major> &x,
 									 const ublas::vector<double> &k,
 									 ublas::matrix<double, ublas::column_major> &out_xd);
 
+	static void				schur_solve(
+								const ublas::matrix<double, ublas::column_major> &in_U,
+								const ublas::matrix<double, ublas::column_major> &in_ea,
+								const std::vector<ublas::matrix<double, ublas::column_major> > &in_V_list,
+								const std::vector<ublas::matrix<double, ublas::column_major> > &in_W_list,
+								const std::vector<ublas::matrix<double, ublas::column_major> > &in_eb_list,
+								ublas::matrix<double, ublas::column_major> &out_da,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_db_list,
+								ublas::matrix<double, ublas::column_major> &out_S_inv,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_V_inv_list);
+	static void				schur_block_diag(
+								const ublas::matrix<double, ublas::column_major> &in_W,
+								const ublas::matrix<double, ublas::column_major> &in_V_inv,
+								const ublas::matrix<double, ublas::column_major> &in_S_inv,
+								ublas::vector<double> &out_diag);
+
 //private:
 	int						getImageNum() { return (int )H_list.size(); };
 
@@ -262,6 +314,22 @@ public:
 								ublas::vector<double> &out_vec);
 
 	static double			_mat_median_sub(const ublas::vector<double> &in_vec);
+	//	The derivative blocks whose pointer is NULL are not computed
+	static void				_project_points2_sub(
+										const ublas::matrix<double, ublas::column_major> &in_X,
+										const ublas::matrix<double, ublas::column_major> &in_om,
+										const ublas::matrix<double, ublas::column_major> &in_T,
+										const ublas::vector<double> &in_fc,
+										const ublas::vector<double> &in_cc,
+										const ublas::vector<double> &in_kc,
+										double	in_alpha_c,
+										ublas::matrix<double, ublas::column_major> &out_xp,
+										ublas::matrix<double, ublas::column_major> *out_dxpdom,
+										ublas::matrix<double, ublas::column_major> *out_dxpdT,
+										ublas::matrix<double, ublas::column_major> *out_dxpdf,
+										ublas::matrix<double, ublas::column_major> *out_dxpdc,
+										ublas::matrix<double, ublas::column_major> *out_dxpdk,
+										ublas::matrix<double, ublas::column_major> *out_dxpdalpha);
 };
 
 
@@ -48,6 +48,12 @@
 #include <stdio.h>
 #include <iostream>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
 #include <boost/numeric/ublas/vector.hpp>
 #include <boost/numeric/ublas/matrix.hpp>
 #include <boost/numeric/ublas/matrix_proxy.hpp>
@@ -60,11 +66,1753 @@ namespace ublas = boost::numeric::ublas;
 namespace lapack = boost::numeric::bindings::lapack;
 
 #include "CornerFinder.hpp"
+#include "ParallelTask.hpp"
 
 
 //bool	g_debug_enabled = false;
 
 
+//	Parameters of the automatic checkerboard detector (findChessboard)
+#define	CHESSBOARD_RING_RADIUS		5		//	radius of the sampling ring of the X-corner response
+#define	CHESSBOARD_NMS_RADIUS		3
+#define	CHESSBOARD_RESPONSE_RATIO	0.1		//	relative to the strongest response in the image
+#define	CHESSBOARD_RESPONSE_MIN		100.0	//	about an X-corner of 12 gray levels contrast
+#define	CHESSBOARD_CANDIDATE_MAX	1024
+#define	CHESSBOARD_SEED_NUM			10
+#define	CHESSBOARD_GROW_TOLERANCE	0.35	//	relative to the local grid step
+#define	CHESSBOARD_GRID_MAX			64
+#define	CHESSBOARD_SQUARE_MIN		3
+#define	CHESSBOARD_CONTRAST_MIN		8.0
+#define	CHESSBOARD_MISMATCH_MAX		0.05
+
+
+// -----------------------------------------------------------------------------
+// 	ChessboardCandidate struct
+// -----------------------------------------------------------------------------
+//
+//	X-corner candidate of findChessboard (C coordinate system, origin is (0, 0))
+//
+struct	ChessboardCandidate
+{
+	double	x, y;
+	double	response;
+};
+
+//	Lattice position (i, j) -> index of the candidate
+typedef std::map<std::pair<int, int>, int>	ChessboardLattice;
+
+//	16 samples on a circle of CHESSBOARD_RING_RADIUS (dx, dy)
+static const int	s_chessboard_ring[16][2] =
+{
+	{ 5,  0}, { 5,  2}, { 4,  4}, { 2,  5}, { 0,  5}, {-2,  5}, {-4,  4}, {-5,  2},
+	{-5,  0}, {-5, -2}, {-4, -4}, {-2, -5}, { 0, -5}, { 2, -5}, { 4, -4}, { 5, -2}
+};
+
+
+// -----------------------------------------------------------------------------
+//	compareCandidateResponse
+// -----------------------------------------------------------------------------
+//
+static bool	compareCandidateResponse(const ChessboardCandidate &a, const ChessboardCandidate &b)
+{
+	return a.response > b.response;
+}
+
+
+// -----------------------------------------------------------------------------
+//	chessboardResponse
+// -----------------------------------------------------------------------------
+//
+//	X-corner response of the ChESS detector. The ring around an X-corner has two
+//	dark and two bright quarters, so the opposite samples agree (sum response)
+//	while the samples half a period apart differ. Edges and the uniform regions
+//	give zero or negative responses.
+//
+static void	chessboardResponse(
+				const ImageBufferView &in_I,
+				ublas::matrix<double, ublas::column_major> &out_R)
+{
+	int	i, k, x, y;
+	int	ny = in_I.size1();
+	int	nx = in_I.size2();
+	int	m = CHESSBOARD_RING_RADIUS;
+	double	s[16];
+
+	out_R.resize(ny, nx, false);
+	out_R.clear();
+
+	for (x = m; x < nx - m; x++)
+		for (y = m; y < ny - m; y++)
+		{
+			double	ring_mean = 0;
+			for (i = 0; i < 16; i++)
+			{
+				s[i] = in_I(y + s_chessboard_ring[i][1], x + s_chessboard_ring[i][0]);
+				ring_mean += s[i];
+			}
+			ring_mean /= 16.0;
+
+			double	sum_resp = 0;
+			for (k = 0; k < 4; k++)
+				sum_resp += fabs(s[k] + s[k + 8] - s[k + 4] - s[k + 12]);
+
+			double	diff_resp = 0;
+			for (k = 0; k < 8; k++)
+				diff_resp += fabs(s[k] - s[k + 8]);
+
+			double	local_mean = ((double )in_I(y, x) +
+					in_I(y - 1, x) + in_I(y + 1, x) + in_I(y, x - 1) + in_I(y, x + 1)) / 5.0;
+
+			out_R(y, x) = sum_resp - diff_resp - 16.0 * fabs(ring_mean - local_mean);
+		}
+}
+
+
+// -----------------------------------------------------------------------------
+//	chessboardCandidates
+// -----------------------------------------------------------------------------
+//
+//	Local maxima of the response (strongest first) refined by the centroid
+//	of the response around them
+//
+static void	chessboardCandidates(
+				const ublas::matrix<double, ublas::column_major> &in_R,
+				std::vector<ChessboardCandidate> &out_list)
+{
+	int	x, y, xx, yy;
+	int	ny = in_R.size1();
+	int	nx = in_R.size2();
+	int	m = CHESSBOARD_RING_RADIUS;
+	int	r = CHESSBOARD_NMS_RADIUS;
+
+	out_list.clear();
+
+	double	resp_max = 0;
+	for (x = m; x < nx - m; x++)
+		for (y = m; y < ny - m; y++)
+			if (in_R(y, x) > resp_max)
+				resp_max = in_R(y, x);
+	if (resp_max < CHESSBOARD_RESPONSE_MIN)
+		return;
+
+	double	th = resp_max * CHESSBOARD_RESPONSE_RATIO;
+	if (th < CHESSBOARD_RESPONSE_MIN)
+		th = CHESSBOARD_RESPONSE_MIN;
+	for (x = m; x < nx - m; x++)
+		for (y = m; y < ny - m; y++)
+		{
+			double	v = in_R(y, x);
+			if (v <= th)
+				continue;
+
+			bool	is_max = true;
+			for (xx = x - r; xx <= x + r && is_max; xx++)
+				for (yy = y - r; yy <= y + r; yy++)
+				{
+					if (xx < 0 || xx >= nx || yy < 0 || yy >= ny)
+						continue;
+					//	ties are broken by the scan order
+					if (in_R(yy, xx) > v || (in_R(yy, xx) == v && (xx < x || (xx == x && yy < y))))
+					{
+						is_max = false;
+						break;
+					}
+				}
+			if (is_max == false)
+				continue;
+
+			double	w_sum = 0, x_sum = 0, y_sum = 0;
+			for (xx = x - 1; xx <= x + 1; xx++)
+				for (yy = y - 1; yy <= y + 1; yy++)
+					if (in_R(yy, xx) > 0)
+					{
+						w_sum += in_R(yy, xx);
+						x_sum += in_R(yy, xx) * xx;
+						y_sum += in_R(yy, xx) * yy;
+					}
+
+			ChessboardCandidate	c;
+			c.x = x_sum / w_sum;
+			c.y = y_sum / w_sum;
+			c.response = v;
+			out_list.push_back(c);
+		}
+
+	std::stable_sort(out_list.begin(), out_list.end(), compareCandidateResponse);
+	if ((int )out_list.size() > CHESSBOARD_CANDIDATE_MAX)
+		out_list.resize(CHESSBOARD_CANDIDATE_MAX);
+}
+
+
+// -----------------------------------------------------------------------------
+//	latticeIndex
+// -----------------------------------------------------------------------------
+//
+static int	latticeIndex(const ChessboardLattice &in_lattice, int in_i, int in_j)
+{
+	ChessboardLattice::const_iterator	it = in_lattice.find(std::make_pair(in_i, in_j));
+	if (it == in_lattice.end())
+		return -1;
+	return it->second;
+}
+
+
+// -----------------------------------------------------------------------------
+//	predictLatticePoint
+// -----------------------------------------------------------------------------
+//
+//	Predicts the position of the lattice point (i, j) by the linear extrapolation
+//	of the rows/columns and by the parallelograms of the neighbours.
+//	All the available predictions are averaged and the shortest grid step used
+//	for them is returned.
+//
+static bool	predictLatticePoint(
+				const std::vector<ChessboardCandidate> &in_list,
+				const ChessboardLattice &in_lattice,
+				int in_i, int in_j,
+				double *out_x, double *out_y, double *out_step)
+{
+	static const int	dir[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+	int	k, num = 0;
+	double	x = 0, y = 0, step = 0, len;
+
+	for (k = 0; k < 4; k++)
+	{
+		int	a = latticeIndex(in_lattice, in_i - dir[k][0], in_j - dir[k][1]);
+		int	b = latticeIndex(in_lattice, in_i - 2 * dir[k][0], in_j - 2 * dir[k][1]);
+		if (a < 0 || b < 0)
+			continue;
+
+		x += 2.0 * in_list[a].x - in_list[b].x;
+		y += 2.0 * in_list[a].y - in_list[b].y;
+		len = sqrt(	(in_list[a].x - in_list[b].x) * (in_list[a].x - in_list[b].x) +
+					(in_list[a].y - in_list[b].y) * (in_list[a].y - in_list[b].y));
+		if (num == 0 || len < step)
+			step = len;
+		num++;
+	}
+
+	for (k = 0; k < 4; k++)
+	{
+		int	di = (k & 1) ? 1 : -1;
+		int	dj = (k & 2) ? 1 : -1;
+		int	a = latticeIndex(in_lattice, in_i - di, in_j);
+		int	b = latticeIndex(in_lattice, in_i, in_j - dj);
+		int	c = latticeIndex(in_lattice, in_i - di, in_j - dj);
+		if (a < 0 || b < 0 || c < 0)
+			continue;
+
+		x += in_list[a].x + in_list[b].x - in_list[c].x;
+		y += in_list[a].y + in_list[b].y - in_list[c].y;
+		len = sqrt(	(in_list[a].x - in_list[c].x) * (in_list[a].x - in_list[c].x) +
+					(in_list[a].y - in_list[c].y) * (in_list[a].y - in_list[c].y));
+		if (num == 0 || len < step)
+			step = len;
+		len = sqrt(	(in_list[b].x - in_list[c].x) * (in_list[b].x - in_list[c].x) +
+					(in_list[b].y - in_list[c].y) * (in_list[b].y - in_list[c].y));
+		if (len < step)
+			step = len;
+		num++;
+	}
+
+	if (num == 0)
+		return false;
+
+	*out_x = x / num;
+	*out_y = y / num;
+	*out_step = step;
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+//	findNearestCandidate
+// -----------------------------------------------------------------------------
+//
+//	in_order is the candidate indices sorted by x and in_order_x is their x
+//
+static int	findNearestCandidate(
+				const std::vector<ChessboardCandidate> &in_list,
+				const std::vector<int> &in_order,
+				const std::vector<double> &in_order_x,
+				const std::vector<char> &in_used,
+				double in_x, double in_y, double in_tol)
+{
+	int	nearest = -1;
+	double	d_min = in_tol * in_tol;
+
+	std::vector<double>::const_iterator	it
+		= std::lower_bound(in_order_x.begin(), in_order_x.end(), in_x - in_tol);
+	for (int k = (int )(it - in_order_x.begin()); k < (int )in_order.size(); k++)
+	{
+		if (in_order_x[k] > in_x + in_tol)
+			break;
+
+		int	i = in_order[k];
+		if (in_used[i])
+			continue;
+
+		double	d =	(in_list[i].x - in_x) * (in_list[i].x - in_x) +
+					(in_list[i].y - in_y) * (in_list[i].y - in_y);
+		if (d <= d_min)
+		{
+			d_min = d;
+			nearest = i;
+		}
+	}
+	return nearest;
+}
+
+
+// -----------------------------------------------------------------------------
+//	growChessboardLattice
+// -----------------------------------------------------------------------------
+//
+//	Starts from the seed and its two nearest (roughly perpendicular) neighbours
+//	and adds the candidates found near the predicted lattice points until
+//	the lattice stops growing
+//
+static bool	growChessboardLattice(
+				const std::vector<ChessboardCandidate> &in_list,
+				const std::vector<int> &in_order,
+				const std::vector<double> &in_order_x,
+				int in_seed,
+				ChessboardLattice &out_lattice)
+{
+	static const int	dir[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+	int	i, k, n = (int )in_list.size();
+	const ChessboardCandidate	&s = in_list[in_seed];
+
+	int	u = -1, v = -1;
+	double	du = 0, dv = 0, d;
+	for (i = 0; i < n; i++)
+	{
+		if (i == in_seed)
+			continue;
+		d = (in_list[i].x - s.x) * (in_list[i].x - s.x) + (in_list[i].y - s.y) * (in_list[i].y - s.y);
+		if (u < 0 || d < du)
+		{
+			u = i;
+			du = d;
+		}
+	}
+	if (u < 0)
+		return false;
+
+	double	ux = in_list[u].x - s.x;
+	double	uy = in_list[u].y - s.y;
+	for (i = 0; i < n; i++)
+	{
+		if (i == in_seed || i == u)
+			continue;
+		double	vx = in_list[i].x - s.x;
+		double	vy = in_list[i].y - s.y;
+		d = vx * vx + vy * vy;
+		if (d > 4.0 * du || fabs(ux * vx + uy * vy) > 0.5 * sqrt(du * d))
+			continue;
+		if (v < 0 || d < dv)
+		{
+			v = i;
+			dv = d;
+		}
+	}
+	if (v < 0)
+		return false;
+
+	std::vector<char>	used(n, 0);
+	out_lattice.clear();
+	out_lattice[std::make_pair(0, 0)] = in_seed;
+	out_lattice[std::make_pair(1, 0)] = u;
+	out_lattice[std::make_pair(0, 1)] = v;
+	used[in_seed] = used[u] = used[v] = 1;
+
+	bool	added = true;
+	while (added)
+	{
+		added = false;
+
+		std::vector<std::pair<int, int> >	filled;
+		for (ChessboardLattice::const_iterator it = out_lattice.begin(); it != out_lattice.end(); it++)
+			filled.push_back(it->first);
+
+		for (i = 0; i < (int )filled.size(); i++)
+			for (k = 0; k < 4; k++)
+			{
+				int	pi = filled[i].first + dir[k][0];
+				int	pj = filled[i].second + dir[k][1];
+				if (pi > CHESSBOARD_GRID_MAX || pi < -CHESSBOARD_GRID_MAX ||
+					pj > CHESSBOARD_GRID_MAX || pj < -CHESSBOARD_GRID_MAX)
+					continue;
+				if (latticeIndex(out_lattice, pi, pj) >= 0)
+					continue;
+
+				double	px, py, step;
+				if (predictLatticePoint(in_list, out_lattice, pi, pj, &px, &py, &step) == false)
+					continue;
+
+				int	c = findNearestCandidate(in_list, in_order, in_order_x, used,
+									px, py, step * CHESSBOARD_GROW_TOLERANCE);
+				if (c < 0)
+					continue;
+
+				out_lattice[std::make_pair(pi, pj)] = c;
+				used[c] = 1;
+				added = true;
+			}
+	}
+
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+//	trimChessboardLattice
+// -----------------------------------------------------------------------------
+//
+//	Shrinks the bounding rectangle (i0, j0) - (i1, j1) of the lattice until
+//	all the lattice points in it are found. The boundary row/column with
+//	the most missing points is removed first.
+//
+static bool	trimChessboardLattice(
+				const ChessboardLattice &in_lattice,
+				int *io_i0, int *io_i1, int *io_j0, int *io_j1)
+{
+	int	i, j;
+
+	while (*io_i1 - *io_i0 >= CHESSBOARD_SQUARE_MIN && *io_j1 - *io_j0 >= CHESSBOARD_SQUARE_MIN)
+	{
+		//	missing points of the row i0, i1 and the column j0, j1
+		int	missing[4] = {0, 0, 0, 0};
+		for (j = *io_j0; j <= *io_j1; j++)
+		{
+			if (latticeIndex(in_lattice, *io_i0, j) < 0)
+				missing[0]++;
+			if (latticeIndex(in_lattice, *io_i1, j) < 0)
+				missing[1]++;
+		}
+		for (i = *io_i0; i <= *io_i1; i++)
+		{
+			if (latticeIndex(in_lattice, i, *io_j0) < 0)
+				missing[2]++;
+			if (latticeIndex(in_lattice, i, *io_j1) < 0)
+				missing[3]++;
+		}
+
+		if (missing[0] + missing[1] + missing[2] + missing[3] == 0)
+			return true;
+
+		double	len_i = *io_j1 - *io_j0 + 1;
+		double	len_j = *io_i1 - *io_i0 + 1;
+		double	ratio[4] = {missing[0] / len_i, missing[1] / len_i, missing[2] / len_j, missing[3] / len_j};
+		int	worst = 0;
+		for (i = 1; i < 4; i++)
+			if (ratio[i] > ratio[worst])
+				worst = i;
+
+		switch (worst)
+		{
+			case 0:	(*io_i0)++;	break;
+			case 1:	(*io_i1)--;	break;
+			case 2:	(*io_j0)++;	break;
+			case 3:	(*io_j1)--;	break;
+		}
+	}
+
+	return false;
+}
+
+
+// -----------------------------------------------------------------------------
+//	validateChessboardLattice
+// -----------------------------------------------------------------------------
+//
+//	Checks that the squares of the lattice are dark and bright alternately.
+//	The boundary rows/columns that do not alternate (e.g. the white margin
+//	of the board picked up by the lattice) are removed.
+//
+static bool	validateChessboardLattice(
+				const ImageBufferView &in_I,
+				const std::vector<ChessboardCandidate> &in_list,
+				const ChessboardLattice &in_lattice,
+				int *io_i0, int *io_i1, int *io_j0, int *io_j1)
+{
+	int	i, j, x, y;
+	int	ny = in_I.size1();
+	int	nx = in_I.size2();
+
+	//	mean intensity around the center of each square
+	int	ni = *io_i1 - *io_i0;
+	int	nj = *io_j1 - *io_j0;
+	ublas::matrix<double, ublas::column_major>	val(ni, nj);
+	for (i = 0; i < ni; i++)
+		for (j = 0; j < nj; j++)
+		{
+			int	a = latticeIndex(in_lattice, *io_i0 + i, *io_j0 + j);
+			int	b = latticeIndex(in_lattice, *io_i0 + i + 1, *io_j0 + j);
+			int	c = latticeIndex(in_lattice, *io_i0 + i + 1, *io_j0 + j + 1);
+			int	d = latticeIndex(in_lattice, *io_i0 + i, *io_j0 + j + 1);
+			int	cx = (int )floor((in_list[a].x + in_list[b].x + in_list[c].x + in_list[d].x) / 4.0 + 0.5);
+			int	cy = (int )floor((in_list[a].y + in_list[b].y + in_list[c].y + in_list[d].y) / 4.0 + 0.5);
+
+			double	sum = 0;
+			int	num = 0;
+			for (x = cx - 1; x <= cx + 1; x++)
+				for (y = cy - 1; y <= cy + 1; y++)
+					if (x >= 0 && x < nx && y >= 0 && y < ny)
+					{
+						sum += in_I(y, x);
+						num++;
+					}
+			val(i, j) = num != 0 ? sum / num : 0;
+		}
+
+	//	which parity is dark (majority of the neighbouring pairs)
+	int	vote = 0;
+	for (i = 0; i < ni; i++)
+		for (j = 0; j < nj; j++)
+		{
+			if ((i + j) % 2 != 0)
+				continue;
+			if (i + 1 < ni)	vote += val(i, j) < val(i + 1, j) ? 1 : -1;
+			if (j + 1 < nj)	vote += val(i, j) < val(i, j + 1) ? 1 : -1;
+			if (i > 0)		vote += val(i, j) < val(i - 1, j) ? 1 : -1;
+			if (j > 0)		vote += val(i, j) < val(i, j - 1) ? 1 : -1;
+		}
+	int	dark_parity = vote >= 0 ? 0 : 1;
+
+	//	i0, i1, j0, j1 here are the square indices in val
+	int	i0 = 0, i1 = ni - 1, j0 = 0, j1 = nj - 1;
+	ublas::matrix<int, ublas::column_major>	bad(ni, nj);
+	while (i1 - i0 + 1 >= CHESSBOARD_SQUARE_MIN && j1 - j0 + 1 >= CHESSBOARD_SQUARE_MIN)
+	{
+		int	bad_num = 0;
+		for (i = i0; i <= i1; i++)
+			for (j = j0; j <= j1; j++)
+			{
+				//	a dark square must be darker than all of its neighbours
+				double	sign = (i + j) % 2 == dark_parity ? 1.0 : -1.0;
+				bad(i, j) = 0;
+				if (i > i0 && sign * (val(i - 1, j) - val(i, j)) < CHESSBOARD_CONTRAST_MIN)	bad(i, j) = 1;
+				if (i < i1 && sign * (val(i + 1, j) - val(i, j)) < CHESSBOARD_CONTRAST_MIN)	bad(i, j) = 1;
+				if (j > j0 && sign * (val(i, j - 1) - val(i, j)) < CHESSBOARD_CONTRAST_MIN)	bad(i, j) = 1;
+				if (j < j1 && sign * (val(i, j + 1) - val(i, j)) < CHESSBOARD_CONTRAST_MIN)	bad(i, j) = 1;
+				bad_num += bad(i, j);
+			}
+
+		if (bad_num <= CHESSBOARD_MISMATCH_MAX * (i1 - i0 + 1) * (j1 - j0 + 1))
+		{
+			*io_i1 = *io_i0 + i1 + 1;
+			*io_i0 = *io_i0 + i0;
+			*io_j1 = *io_j0 + j1 + 1;
+			*io_j0 = *io_j0 + j0;
+			return true;
+		}
+
+		int	bad_line[4] = {0, 0, 0, 0};
+		for (j = j0; j <= j1; j++)
+		{
+			bad_line[0] += bad(i0, j);
+			bad_line[1] += bad(i1, j);
+		}
+		for (i = i0; i <= i1; i++)
+		{
+			bad_line[2] += bad(i, j0);
+			bad_line[3] += bad(i, j1);
+		}
+
+		double	len_i = j1 - j0 + 1;
+		double	len_j = i1 - i0 + 1;
+		double	ratio[4] = {bad_line[0] / len_i, bad_line[1] / len_i, bad_line[2] / len_j, bad_line[3] / len_j};
+		int	worst = 0;
+		for (i = 1; i < 4; i++)
+			if (ratio[i] > ratio[worst])
+				worst = i;
+
+		//	the squares inside the lattice do not alternate: not a checkerboard
+		if (ratio[worst] == 0)
+			return false;
+
+		switch (worst)
+		{
+			case 0:	i0++;	break;
+			case 1:	i1--;	break;
+			case 2:	j0++;	break;
+			case 3:	j1--;	break;
+		}
+	}
+
+	return false;
+}
+
+
+// -----------------------------------------------------------------------------
+//	findLattice
+// -----------------------------------------------------------------------------
+//
+//	Grows the lattices from the strongest candidates and returns the largest
+//	complete rectangle (i0, j0) - (i1, j1) of them. The squares are checked by
+//	validateChessboardLattice if in_I is given (NULL for the circle grids).
+//
+static bool	findLattice(
+				const ImageBufferView *in_I,
+				const std::vector<ChessboardCandidate> &in_list,
+				ChessboardLattice &out_lattice,
+				int *out_i0, int *out_i1, int *out_j0, int *out_j1)
+{
+	int	i, k;
+	int	n = (int )in_list.size();
+
+	std::vector<std::pair<double, int> >	sorted(n);
+	for (i = 0; i < n; i++)
+		sorted[i] = std::make_pair(in_list[i].x, i);
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<int>	order(n);
+	std::vector<double>	order_x(n);
+	for (i = 0; i < n; i++)
+	{
+		order[i] = sorted[i].second;
+		order_x[i] = sorted[i].first;
+	}
+
+	ChessboardLattice	lattice;
+	int	best_area = 0;
+	std::vector<char>	in_best(n, 0);
+
+	for (k = 0; k < n && k < CHESSBOARD_SEED_NUM; k++)
+	{
+		//	this seed will give the same lattice again
+		if (in_best[k])
+			continue;
+
+		if (growChessboardLattice(in_list, order, order_x, k, lattice) == false)
+			continue;
+
+		ChessboardLattice::const_iterator	it = lattice.begin();
+		int	i0 = it->first.first, i1 = i0;
+		int	j0 = it->first.second, j1 = j0;
+		for (; it != lattice.end(); it++)
+		{
+			if (it->first.first < i0)	i0 = it->first.first;
+			if (it->first.first > i1)	i1 = it->first.first;
+			if (it->first.second < j0)	j0 = it->first.second;
+			if (it->first.second > j1)	j1 = it->first.second;
+		}
+
+		if (trimChessboardLattice(lattice, &i0, &i1, &j0, &j1) == false)
+			continue;
+		if (in_I != NULL &&
+			validateChessboardLattice(*in_I, in_list, lattice, &i0, &i1, &j0, &j1) == false)
+			continue;
+
+		int	area = (i1 - i0) * (j1 - j0);
+		if (area <= best_area)
+			continue;
+
+		best_area = area;
+		out_lattice = lattice;
+		*out_i0 = i0; *out_i1 = i1;
+		*out_j0 = j0; *out_j1 = j1;
+		for (it = lattice.begin(); it != lattice.end(); it++)
+			if (it->first.first >= i0 && it->first.first <= i1 &&
+				it->first.second >= j0 && it->first.second <= j1)
+				in_best[it->second] = 1;
+	}
+
+	return best_area != 0;
+}
+
+
+// -----------------------------------------------------------------------------
+//	orderLatticeCorners
+// -----------------------------------------------------------------------------
+//
+//	The four corners of the rectangle (i0, j0) - (i1, j1) as the lattice
+//	positions in the order of findGrid (clockwise on the screen, starting from
+//	the upper left corner). out_n_sq_x/y are the number of the lattice steps
+//	along out_c[0] -> out_c[1] and out_c[1] -> out_c[2].
+//
+static void	orderLatticeCorners(
+				const std::vector<ChessboardCandidate> &in_list,
+				const ChessboardLattice &in_lattice,
+				int in_i0, int in_i1, int in_j0, int in_j1,
+				std::pair<int, int> out_c[4],
+				int	*out_n_sq_x, int *out_n_sq_y)
+{
+	int	i, c[4], n_sq[4];
+	std::pair<int, int>	pos[4];
+
+	pos[0] = std::make_pair(in_i0, in_j0);
+	pos[1] = std::make_pair(in_i1, in_j0);
+	pos[2] = std::make_pair(in_i1, in_j1);
+	pos[3] = std::make_pair(in_i0, in_j1);
+	for (i = 0; i < 4; i++)
+		c[i] = latticeIndex(in_lattice, pos[i].first, pos[i].second);
+	n_sq[0] = n_sq[2] = in_i1 - in_i0;
+	n_sq[1] = n_sq[3] = in_j1 - in_j0;
+
+	//	make the order clockwise on the screen (the y axis is pointing downward)
+	double	cross =	(in_list[c[1]].x - in_list[c[0]].x) * (in_list[c[3]].y - in_list[c[0]].y) -
+					(in_list[c[1]].y - in_list[c[0]].y) * (in_list[c[3]].x - in_list[c[0]].x);
+	if (cross < 0)
+	{
+		std::swap(c[1], c[3]);
+		std::swap(pos[1], pos[3]);
+		n_sq[0] = n_sq[2] = in_j1 - in_j0;
+		n_sq[1] = n_sq[3] = in_i1 - in_i0;
+	}
+
+	//	start from the upper left corner
+	int	o = 0;
+	for (i = 1; i < 4; i++)
+		if (in_list[c[i]].x + in_list[c[i]].y < in_list[c[o]].x + in_list[c[o]].y)
+			o = i;
+
+	for (i = 0; i < 4; i++)
+		out_c[i] = pos[(o + i) % 4];
+	*out_n_sq_x = n_sq[o];
+	*out_n_sq_y = n_sq[(o + 1) % 4];
+}
+
+
+//	Parameters of the circle grid detector (findCircleGrid)
+#define	CIRCLE_GRID_BLOCK_RATIO		8		//	radius of the local mean: (the larger image size) / BLOCK_RATIO
+#define	CIRCLE_GRID_THRESHOLD		10		//	the circles differ from the local mean by this
+#define	CIRCLE_GRID_AREA_MIN		12		//	[pixels]
+#define	CIRCLE_GRID_FILL_MIN		0.8		//	area / area of the ellipse of the same moments
+#define	CIRCLE_GRID_FILL_MAX		1.2
+#define	CIRCLE_GRID_ASPECT_MIN		0.2		//	minor / major axis
+#define	CIRCLE_GRID_AREA_RATIO		1.5		//	the areas of the similar blobs
+#define	CIRCLE_GRID_CONTRAST_MIN	16.0
+#define	CIRCLE_GRID_MARGIN			2		//	around the bounding box in the center refinement
+
+
+// -----------------------------------------------------------------------------
+// 	CircleGridRun struct
+// -----------------------------------------------------------------------------
+//
+//	Horizontal run of the foreground pixels (x0 <= x <= x1). The runs of
+//	a blob are connected by the union-find of the parent indices.
+//
+struct	CircleGridRun
+{
+	int		y, x0, x1;
+	int		parent;
+};
+
+
+// -----------------------------------------------------------------------------
+// 	CircleGridBlob struct
+// -----------------------------------------------------------------------------
+//
+//	Moments and the bounding box of a connected component
+//
+struct	CircleGridBlob
+{
+	double	n, sx, sy, sxx, sxy, syy;
+	int		x0, x1, y0, y1;
+};
+
+
+// -----------------------------------------------------------------------------
+//	compareBlobArea
+// -----------------------------------------------------------------------------
+//
+static bool	compareBlobArea(const CircleGridBlob &a, const CircleGridBlob &b)
+{
+	return a.n > b.n;
+}
+
+
+// -----------------------------------------------------------------------------
+//	findRun
+// -----------------------------------------------------------------------------
+//
+static int	findRun(std::vector<CircleGridRun> &io_runs, int in_index)
+{
+	int	root = in_index;
+	while (io_runs[root].parent != root)
+		root = io_runs[root].parent;
+	while (io_runs[in_index].parent != root)
+	{
+		int	next = io_runs[in_index].parent;
+		io_runs[in_index].parent = root;
+		in_index = next;
+	}
+	return root;
+}
+
+
+// -----------------------------------------------------------------------------
+//	circleGridBlobs
+// -----------------------------------------------------------------------------
+//
+//	Connected components (8-connected) of the pixels darker (in_dark) or
+//	brighter than the local mean by CIRCLE_GRID_THRESHOLD, in one raster pass.
+//	The local mean is a box filter of sliding sums (column sums of the rows
+//	in the window, then a running sum along the row), the foreground pixels are
+//	stored as runs and the runs overlapping the runs of the previous row are
+//	merged. Neither the binary image nor the label image is made.
+//
+static void	circleGridBlobs(
+				const ImageBufferView &in_I,
+				bool in_dark,
+				std::vector<CircleGridBlob> &out_list)
+{
+	int	x, y, k;
+	int	ny = in_I.size1();
+	int	nx = in_I.size2();
+	int	r = (nx > ny ? nx : ny) / CIRCLE_GRID_BLOCK_RATIO;
+	if (r < 1)
+		r = 1;
+
+	std::vector<int>	col_sum(nx, 0);
+	std::vector<CircleGridRun>	runs;
+	int	prev_begin = 0, prev_end = 0;
+
+	for (y = 0; y < r && y < ny; y++)
+		for (x = 0; x < nx; x++)
+			col_sum[x] += in_I(y, x);
+
+	for (y = 0; y < ny; y++)
+	{
+		if (y + r < ny)
+			for (x = 0; x < nx; x++)
+				col_sum[x] += in_I(y + r, x);
+		if (y - r - 1 >= 0)
+			for (x = 0; x < nx; x++)
+				col_sum[x] -= in_I(y - r - 1, x);
+		int	row_num = (y + r < ny ? y + r : ny - 1) - (y - r > 0 ? y - r : 0) + 1;
+
+		long long	sum = 0;
+		for (x = 0; x < r && x < nx; x++)
+			sum += col_sum[x];
+
+		const unsigned char	*p = in_I.ptr(y, 0);
+		int	step = in_I.columnStep();
+		int	cur_begin = (int )runs.size();
+		int	run_x0 = -1;
+		k = prev_begin;
+		for (x = 0; x <= nx; x++)
+		{
+			bool	fg = false;
+			if (x < nx)
+			{
+				if (x + r < nx)
+					sum += col_sum[x + r];
+				if (x - r - 1 >= 0)
+					sum -= col_sum[x - r - 1];
+				long long	num = (long long )row_num *
+					((x + r < nx ? x + r : nx - 1) - (x - r > 0 ? x - r : 0) + 1);
+
+				long long	v = p[x * step];
+				if (in_dark)
+					fg = (v + CIRCLE_GRID_THRESHOLD) * num < sum;
+				else
+					fg = (v - CIRCLE_GRID_THRESHOLD) * num > sum;
+			}
+
+			if (fg && run_x0 < 0)
+				run_x0 = x;
+			if (fg || run_x0 < 0)
+				continue;
+
+			CircleGridRun	run;
+			run.y = y;
+			run.x0 = run_x0;
+			run.x1 = x - 1;
+			run.parent = (int )runs.size();
+			runs.push_back(run);
+			run_x0 = -1;
+
+			//	the runs of the previous row touching this one (8-connected)
+			while (k < prev_end && runs[k].x1 < run.x0 - 1)
+				k++;
+			for (int kk = k; kk < prev_end && runs[kk].x0 <= run.x1 + 1; kk++)
+			{
+				int	a = findRun(runs, kk);
+				int	b = findRun(runs, (int )runs.size() - 1);
+				if (a < b)
+					runs[b].parent = a;
+				else if (b < a)
+					runs[a].parent = b;
+			}
+		}
+		prev_begin = cur_begin;
+		prev_end = (int )runs.size();
+	}
+
+	out_list.clear();
+	std::vector<int>	blob_index(runs.size(), -1);
+	for (k = 0; k < (int )runs.size(); k++)
+	{
+		int	root = findRun(runs, k);
+		if (blob_index[root] < 0)
+		{
+			CircleGridBlob	blob;
+			blob.n = blob.sx = blob.sy = blob.sxx = blob.sxy = blob.syy = 0;
+			blob.x0 = runs[k].x0;
+			blob.x1 = runs[k].x1;
+			blob.y0 = blob.y1 = runs[k].y;
+			blob_index[root] = (int )out_list.size();
+			out_list.push_back(blob);
+		}
+
+		CircleGridBlob	&blob = out_list[blob_index[root]];
+		const CircleGridRun	&run = runs[k];
+		double	n = run.x1 - run.x0 + 1;
+		double	sx = n * (run.x0 + run.x1) / 2.0;
+		//	sum of x^2 for x0 <= x <= x1
+		double	sxx = (	(double )run.x1 * (run.x1 + 1) * (2.0 * run.x1 + 1) -
+						(double )(run.x0 - 1) * run.x0 * (2.0 * run.x0 - 1)) / 6.0;
+		blob.n += n;
+		blob.sx += sx;
+		blob.sy += n * run.y;
+		blob.sxx += sxx;
+		blob.sxy += sx * run.y;
+		blob.syy += n * run.y * run.y;
+		if (run.x0 < blob.x0)	blob.x0 = run.x0;
+		if (run.x1 > blob.x1)	blob.x1 = run.x1;
+		if (run.y < blob.y0)	blob.y0 = run.y;
+		if (run.y > blob.y1)	blob.y1 = run.y;
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+//	refineCircleCenter
+// -----------------------------------------------------------------------------
+//
+//	Centroid of the coverage (I - bg) / (fg - bg) clipped to [0, 1] in the
+//	bounding box with CIRCLE_GRID_MARGIN. The partially covered pixels of the
+//	edge are weighted by the coverage, so the center does not depend on
+//	the threshold and the blur. bg is the mean of the border of the box and
+//	fg is the mean of the blob.
+//
+static bool	refineCircleCenter(
+				const ImageBufferView &in_I,
+				const CircleGridBlob &in_blob,
+				double *out_x, double *out_y)
+{
+	int	x, y;
+	int	ny = in_I.size1();
+	int	nx = in_I.size2();
+	int	x0 = in_blob.x0 - CIRCLE_GRID_MARGIN;
+	int	x1 = in_blob.x1 + CIRCLE_GRID_MARGIN;
+	int	y0 = in_blob.y0 - CIRCLE_GRID_MARGIN;
+	int	y1 = in_blob.y1 + CIRCLE_GRID_MARGIN;
+	if (x0 < 0)			x0 = 0;
+	if (x1 > nx - 1)	x1 = nx - 1;
+	if (y0 < 0)			y0 = 0;
+	if (y1 > ny - 1)	y1 = ny - 1;
+
+	double	bg = 0;
+	int	bg_num = 0;
+	for (x = x0; x <= x1; x++)
+	{
+		bg += (double )in_I(y0, x) + in_I(y1, x);
+		bg_num += 2;
+	}
+	for (y = y0 + 1; y < y1; y++)
+	{
+		bg += (double )in_I(y, x0) + in_I(y, x1);
+		bg_num += 2;
+	}
+	bg /= bg_num;
+
+	//	the blob pixels are the darkest (brightest) ones of the box
+	double	fg = 0;
+	int	fg_num = 0;
+	double	cx = in_blob.sx / in_blob.n;
+	double	cy = in_blob.sy / in_blob.n;
+	double	rx = (in_blob.x1 - in_blob.x0 + 1) / 4.0;
+	double	ry = (in_blob.y1 - in_blob.y0 + 1) / 4.0;
+	for (x = (int )ceil(cx - rx); x <= (int )floor(cx + rx); x++)
+		for (y = (int )ceil(cy - ry); y <= (int )floor(cy + ry); y++)
+		{
+			fg += in_I(y, x);
+			fg_num++;
+		}
+	if (fg_num == 0)
+		return false;
+	fg /= fg_num;
+	if (fabs(fg - bg) < CIRCLE_GRID_CONTRAST_MIN)
+		return false;
+
+	double	w_sum = 0, x_sum = 0, y_sum = 0;
+	for (x = x0; x <= x1; x++)
+		for (y = y0; y <= y1; y++)
+		{
+			double	w = (in_I(y, x) - bg) / (fg - bg);
+			if (w <= 0)
+				continue;
+			if (w > 1)
+				w = 1;
+			w_sum += w;
+			x_sum += w * x;
+			y_sum += w * y;
+		}
+
+	*out_x = x_sum / w_sum;
+	*out_y = y_sum / w_sum;
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+//	circleGridCandidates
+// -----------------------------------------------------------------------------
+//
+//	The blobs of the elliptic shape. out_list is the refined centers (response
+//	is the area) and out_centroid is the centroids of the blobs, in the same order.
+//
+static void	circleGridCandidates(
+				const ImageBufferView &in_I,
+				bool in_dark,
+				std::vector<ChessboardCandidate> &out_list,
+				std::vector<ChessboardCandidate> &out_centroid)
+{
+	int	ny = in_I.size1();
+	int	nx = in_I.size2();
+	std::vector<CircleGridBlob>	blobs;
+
+	circleGridBlobs(in_I, in_dark, blobs);
+	std::stable_sort(blobs.begin(), blobs.end(), compareBlobArea);
+
+	out_list.clear();
+	out_centroid.clear();
+	for (int i = 0; i < (int )blobs.size(); i++)
+	{
+		const CircleGridBlob	&b = blobs[i];
+		if (b.n < CIRCLE_GRID_AREA_MIN)
+			break;
+		if (b.x0 == 0 || b.y0 == 0 || b.x1 == nx - 1 || b.y1 == ny - 1)
+			continue;
+
+		//	second moments of the pixel squares (1/12 is the moment of a pixel)
+		double	mx = b.sx / b.n;
+		double	my = b.sy / b.n;
+		double	cxx = b.sxx / b.n - mx * mx + 1.0 / 12.0;
+		double	cxy = b.sxy / b.n - mx * my;
+		double	cyy = b.syy / b.n - my * my + 1.0 / 12.0;
+		double	t = (cxx + cyy) / 2.0;
+		double	d = sqrt((cxx - cyy) * (cxx - cyy) / 4.0 + cxy * cxy);
+		if (t - d <= 0)
+			continue;
+
+		//	the semi-axes of the solid ellipse are 2 * sqrt(eigenvalues)
+		double	a = 2.0 * sqrt(t + d);
+		double	c = 2.0 * sqrt(t - d);
+		double	fill = b.n / (3.141592 * a * c);
+		if (fill < CIRCLE_GRID_FILL_MIN || fill > CIRCLE_GRID_FILL_MAX || c < a * CIRCLE_GRID_ASPECT_MIN)
+			continue;
+
+		ChessboardCandidate	p, q;
+		if (refineCircleCenter(in_I, b, &p.x, &p.y) == false)
+			continue;
+		p.response = q.response = b.n;
+		q.x = mx;
+		q.y = my;
+		out_list.push_back(p);
+		out_centroid.push_back(q);
+	}
+
+	//	the circles of the grid are about the same size, so the seeds of the lattice
+	//	are the blobs with the most blobs of the similar area (the area is descending)
+	int	n = (int )out_list.size();
+	std::vector<std::pair<int, int> >	vote(n);
+	int	k0 = 0, k1 = 0;
+	for (int i = 0; i < n; i++)
+	{
+		double	area = out_list[i].response;
+		while (out_list[k0].response > area * CIRCLE_GRID_AREA_RATIO)
+			k0++;
+		while (k1 < n && out_list[k1].response * CIRCLE_GRID_AREA_RATIO >= area)
+			k1++;
+		vote[i] = std::make_pair(-(k1 - k0), i);
+	}
+	std::sort(vote.begin(), vote.end());
+
+	std::vector<ChessboardCandidate>	list(n), centroid(n);
+	for (int i = 0; i < n; i++)
+	{
+		list[i] = out_list[vote[i].second];
+		centroid[i] = out_centroid[vote[i].second];
+	}
+	out_list.swap(list);
+	out_centroid.swap(centroid);
+}
+
+
+#define	CORNER_FINDER_RESOLUTION	0.005
+#define	CORNER_FINDER_ITER_MAX		10
+#define	CORNER_FINDER_COND_MAX		50.0	//	the point is projected onto the edge above this
+
+
+// -----------------------------------------------------------------------------
+// 	CornerFinderMask class
+// -----------------------------------------------------------------------------
+//
+//	Gaussian weight of findCorner: exp(-(a / WIN)^2) for a = -WIN ... WIN
+//
+template <int WIN>
+class	CornerFinderMask
+{
+public:
+	CornerFinderMask()
+	{
+		for (int i = 0, a = -WIN; i < 2 * WIN + 1; i++, a++)
+			mask[i] = exp(-1.0 * pow((double )a / (double )WIN, 2));
+	}
+
+	//	The mask is built only once (the initialization of the local static is thread safe)
+	static const double	*get()
+	{
+		static const CornerFinderMask<WIN>	s_mask;
+		return s_mask.mask;
+	}
+
+	double	mask[2 * WIN + 1];
+};
+
+
+// -----------------------------------------------------------------------------
+// 	CornerFinderFixedWorkspace class
+// -----------------------------------------------------------------------------
+//
+//	Work area of findCorner for the window sizes known at compile time.
+//	It lives on the stack, and the loops of refineCorner are unrolled for it.
+//
+template <int WX, int WY>
+class	CornerFinderFixedWorkspace
+{
+public:
+	CornerFinderFixedWorkspace()
+		: mask_a(CornerFinderMask<WX>::get()), mask_b(CornerFinderMask<WY>::get())
+	{
+	}
+
+	int		wintx() const { return WX; }
+	int		winty() const { return WY; }
+
+	const double	*mask_a;
+	const double	*mask_b;
+	double	temp[(2 * WX + 3) * (2 * WY + 5)];
+	double	SI[(2 * WX + 3) * (2 * WY + 3)];
+};
+
+
+// -----------------------------------------------------------------------------
+//	getCornerFinderMask
+// -----------------------------------------------------------------------------
+//
+//	CornerFinderMask of the window sizes known only at run time. The mask of
+//	each size is built once per thread and kept, so the parallel findCorner
+//	calls share no lock (a mask is 2 * in_win + 1 doubles).
+//
+static const double	*getCornerFinderMask(int in_win)
+{
+	static thread_local std::map<int, std::vector<double> >	s_mask_map;
+
+	std::vector<double>	&mask = s_mask_map[in_win];
+	if (mask.empty())
+	{
+		mask.resize(2 * in_win + 1);
+		for (int i = 0, a = -in_win; i < 2 * in_win + 1; i++, a++)
+			mask[i] = exp(-1.0 * pow((double )a / (double )in_win, 2));
+	}
+	return &(mask[0]);
+}
+
+
+// -----------------------------------------------------------------------------
+// 	CornerFinderWorkspace class
+// -----------------------------------------------------------------------------
+//
+//	Work area of findCorner for the other window sizes. The masks are kept
+//	(getCornerFinderMask) and temp and SI are in a buffer of the thread that
+//	only grows, so the repeated calls do not allocate anything. Only one
+//	workspace can be used at a time on a thread.
+//
+class	CornerFinderWorkspace
+{
+public:
+	CornerFinderWorkspace(int in_wintx, int in_winty)
+		: mWintx(in_wintx), mWinty(in_winty)
+	{
+		size_t	temp_size = (2 * in_wintx + 3) * (2 * in_winty + 5);
+		size_t	SI_size = (2 * in_wintx + 3) * (2 * in_winty + 3);
+		std::vector<double>	&buffer = getThreadBuffer();
+
+		if (buffer.size() < temp_size + SI_size)
+			buffer.resize(temp_size + SI_size);
+
+		mask_a = getCornerFinderMask(in_wintx);
+		mask_b = getCornerFinderMask(in_winty);
+		temp = &(buffer[0]);
+		SI = temp + temp_size;
+	}
+
+	int		wintx() const { return mWintx; }
+	int		winty() const { return mWinty; }
+
+	const double	*mask_a;
+	const double	*mask_b;
+	double	*temp;
+	double	*SI;
+
+private:
+	int		mWintx, mWinty;
+
+	static std::vector<double>	&getThreadBuffer()
+	{
+		static thread_local std::vector<double>	s_buffer;
+		return s_buffer;
+	}
+};
+
+
+// -----------------------------------------------------------------------------
+//	refineCorner
+// -----------------------------------------------------------------------------
+//
+//	The body of findCorner. The arithmetic is done in the same order as
+//	the original implementation (mat_conv2_same, mat_gradient and mat_sum
+//	on the ublas matrices), but only the parts that are used are computed
+//	and the 2x2 structure tensor is solved in closed form instead of gesvd.
+//
+//	́Eo͂ƂMatlab̍Wn@_i1, 1j
+//	ł͍sicjxƂĂ̂ŗvӁifindCornerƓj
+//
+template <class Workspace>
+static bool	refineCorner(
+				const ImageBufferView &in_I,
+				double in_x, double in_y,
+				Workspace &ws,
+				double *out_x, double *out_y)
+{
+	const int	wintx = ws.wintx();
+	const int	winty = ws.winty();
+	const int	rx = 2 * wintx + 3;	//	size of the subpixel interpolated neighborhood
+	const int	ry = 2 * winty + 3;
+	int	i, j;
+
+	int	nx = in_I.size1();
+	int	ny = in_I.size2();
+
+	double	xt0 = in_y;
+	double	xt1 = in_x;
+
+	//	The neighborhood does not fit in the image
+	if (nx < 2 * wintx + 5 || ny < 2 * winty + 5)
+	{
+		*out_x = in_x;
+		*out_y = in_y;
+		return false;
+	}
+
+	//	the x axis here is the row of the image (see above)
+	const int	x_step = in_I.rowStep();
+
+	//	first guess... they don't move !!!
+	double	xc0 = xt0;
+	double	xc1 = xt1;
+
+	double	v_extra0 = 1 + CORNER_FINDER_RESOLUTION;
+	double	v_extra1 = 1 + CORNER_FINDER_RESOLUTION;
+
+	int	compt = 0;
+	bool	result = true;
+
+	while (sqrt(v_extra0 * v_extra0 + v_extra1 * v_extra1) > CORNER_FINDER_RESOLUTION &&
+			compt < CORNER_FINDER_ITER_MAX)
+	{
+		double	cIx = xc0;
+		double	cIy = xc1;
+		double	crIx = CameraCalibration::mat_round(cIx);
+		double	crIy = CameraCalibration::mat_round(cIy);
+		double	itIx = cIx - crIx;
+		double	itIy = cIy - crIy;
+
+		double	vIx[3], vIy[3];
+		if (itIx > 0.0)	// the sub pixel
+		{
+			vIx[0] = itIx;
+			vIx[1] = 1 - itIx;
+			vIx[2] = 0;
+		}
+		else
+		{
+			vIx[0] = 0;
+			vIx[1] = 1 + itIx;
+			vIx[2] = -itIx;
+		}
+		if (itIy > 0.0)	// the sub pixel
+		{
+			vIy[0] = itIy;
+			vIy[1] = 1 - itIy;
+			vIy[2] = 0;
+		}
+		else
+		{
+			vIy[0] = 0;
+			vIy[1] = 1 + itIy;
+			vIy[2] = -itIy;
+		}
+
+		//	What if the sub image is not in? (converted from matlab index)
+		int	xmin, ymin;
+		if (crIx - wintx - 2 < 1)
+			xmin = 0;
+		else if (crIx + wintx + 2 > nx)
+			xmin = nx - 2 * wintx - 5;
+		else
+			xmin = (int )crIx - wintx - 3;
+
+		if (crIy - winty - 2 < 1)
+			ymin = 0;
+		else if (crIy + winty + 2 > ny)
+			ymin = ny - 2 * winty - 5;
+		else
+			ymin = (int )crIy - winty - 3;
+
+		//	The subpixel interpolated neighborhood (conv2 with vIx, then with vIy)
+		for (j = 0; j < ry + 2; j++)
+		{
+			const unsigned char	*src = in_I.ptr(xmin, ymin + j);
+			double	*dst = ws.temp + j * rx;
+			for (i = 0; i < rx; i++, src += x_step)
+				dst[i] = src[0] * vIx[2] + src[x_step] * vIx[1] + src[2 * x_step] * vIx[0];
+		}
+		for (j = 0; j < ry; j++)
+		{
+			const double	*src = ws.temp + j * rx;
+			double	*dst = ws.SI + j * rx;
+			for (i = 0; i < rx; i++)
+				dst[i] = src[i] * vIy[2] + src[i + rx] * vIy[1] + src[i + 2 * rx] * vIy[0];
+		}
+
+		//	The gradients of the useful part only, weighted by the mask
+		double	bb_1 = 0, bb_2 = 0;
+		double	a = 0, b = 0, c = 0;
+		for (j = 0; j < 2 * winty + 1; j++)
+		{
+			const double	*s0 = ws.SI + j * rx + 1;
+			const double	*s1 = s0 + rx;
+			const double	*s2 = s1 + rx;
+			double	py = cIy + (j - winty);
+			double	sum_bb_1 = 0, sum_bb_2 = 0;
+			double	sum_a = 0, sum_b = 0, sum_c = 0;
+
+			for (i = 0; i < 2 * wintx + 1; i++)
+			{
+				double	gx = ((s1[i] - s1[i - 1]) + (s1[i + 1] - s1[i])) / 2.0;
+				double	gy = ((s1[i] - s0[i]) + (s2[i] - s1[i])) / 2.0;
+				double	mask = ws.mask_a[i] * ws.mask_b[j];
+				double	px = cIx + (i - wintx);
+
+				double	gxx = gx * gx * mask;
+				double	gyy = gy * gy * mask;
+				double	gxy = gx * gy * mask;
+
+				sum_bb_1 += gxx * px + gxy * py;
+				sum_bb_2 += gxy * px + gyy * py;
+				sum_a += gxx;
+				sum_b += gxy;
+				sum_c += gyy;
+			}
+
+			bb_1 += sum_bb_1;
+			bb_2 += sum_bb_2;
+			a += sum_a;
+			b += sum_b;
+			c += sum_c;
+		}
+
+		double	dt = a * c - b * b;
+
+		double	xc2_0 = (c * bb_1 - b * bb_2) / dt;
+		double	xc2_1 = (a * bb_2 - b * bb_1) / dt;
+
+		//	Singular values of G = [a b; b c] (G is positive semidefinite)
+		double	half_trace = (a + c) / 2.0;
+		double	r = sqrt((a - c) * (a - c) / 4.0 + b * b);
+		double	s_max = half_trace + r;
+		double	s_min = half_trace - r;
+		if (s_min < 0)
+			s_min = 0;
+
+		//	If non-invertible, then project the point onto the edge orthogonal:
+		if (s_max > CORNER_FINDER_COND_MAX * s_min)
+		{
+			//	the singular vector of s_min (the larger one of the two solutions)
+			double	v0 = b, v1 = s_min - a;
+			double	w0 = s_min - c, w1 = b;
+			if (w0 * w0 + w1 * w1 > v0 * v0 + v1 * v1)
+			{
+				v0 = w0;
+				v1 = w1;
+			}
+			double	len = sqrt(v0 * v0 + v1 * v1);
+
+			if (len != 0)
+			{
+				v0 /= len;
+				v1 /= len;
+
+				//	projection operation:
+				double	t = (xc0 - xc2_0) * v0 + (xc1 - xc2_1) * v1;
+
+				xc2_0 = xc2_0 + t * v0;
+				xc2_1 = xc2_1 + t * v1;
+			}
+		}
+
+		//	Flat region (the solution is not finite or far outside of the image)
+		if (!(fabs(xc2_0 - xt0) <= nx + ny && fabs(xc2_1 - xt1) <= nx + ny))
+		{
+			result = false;
+			break;
+		}
+
+		v_extra0 = xc0 - xc2_0;
+		v_extra1 = xc1 - xc2_1;
+		xc0 = xc2_0;
+		xc1 = xc2_1;
+		compt++;
+	}
+
+	if (result == false || fabs(xc0 - xt0) > wintx || fabs(xc1 - xt1) > winty)
+	{
+		xc0 = xt0;
+		xc1 = xt1;
+		result = false;
+	}
+
+	*out_x = xc1;	//	]Ă̂Œ
+	*out_y = xc0;
+	return result;
+}
+
+
+// -----------------------------------------------------------------------------
+// 	GridCornerTask class
+// -----------------------------------------------------------------------------
+//
+//	Refines one grid point of findGrid. findCorner does not share anything
+//	between the calls, so the points can be refined on any thread and
+//	the results are written by index.
+//
+class	GridCornerTask : public ParallelTask
+{
+public:
+	GridCornerTask(
+		const ImageBufferView &in_I,
+		const ublas::matrix<double, ublas::column_major> &in_XX,
+		int	in_wintx, int in_winty,
+		ublas::matrix<double, ublas::column_major> &out_XX,
+		ublas::matrix<double, ublas::column_major> &out_x,
+		ublas::vector<int> &out_result)
+		: I(in_I), XX(in_XX), wintx(in_wintx), winty(in_winty),
+		  XX_out(out_XX), x_out(out_x), result_out(out_result)
+	{
+	}
+
+	virtual void	ExecTask(int i)
+	{
+		double	grid_x, grid_y;
+		bool	isSuccess;
+
+		isSuccess = CornerFinder::findCorner(I, XX(0, i), XX(1, i), wintx, winty, &grid_x, &grid_y);
+		//	matlab̃R[hōsĂ鏈Ƃ킹邽߂-1
+		//	subtract 1 to bring the origin to (0,0) instead of (1,1) 
+		//	in matlab (not necessary in C)
+		XX_out(0, i) = XX(0, i) - 1;
+		XX_out(1, i) = XX(1, i) - 1;
+		x_out(0, i) = grid_x - 1;
+		x_out(1, i) = grid_y - 1;
+		result_out(i) = isSuccess;
+	}
+
+private:
+	const ImageBufferView	&I;
+	const ublas::matrix<double, ublas::column_major>	&XX;
+	int	wintx, winty;
+	ublas::matrix<double, ublas::column_major>	&XX_out;
+	ublas::matrix<double, ublas::column_major>	&x_out;
+	ublas::vector<int>	&result_out;
+};
+
+
+#define	CORNER_FINDER_PROPAGATION_SEED_SCALE	2	//	window scale of the first points of GRID_PREDICTION_PROPAGATION
+
+// -----------------------------------------------------------------------------
+// 	GridPropagationTask class
+// -----------------------------------------------------------------------------
+//
+//	Refines the grid points of findGrid with GRID_PREDICTION_PROPAGATION.
+//	The residual (refined point - homography) of a point is predicted from
+//	the residuals of its refined neighbors (i-1, j), (i, j-1) and (i-1, j-1),
+//	which follows the smooth displacement of the lens distortion. The points
+//	are processed along the anti-diagonals i + j = d, so the points of one
+//	diagonal depend only on the previous diagonals and are refined in parallel.
+//	The workers are started once and meet at a barrier after every diagonal
+//	(ExecTask is the loop of one worker, not of one point).
+//
+class	GridPropagationTask : public ParallelTask
+{
+public:
+	GridPropagationTask(
+		const ImageBufferView &in_I,
+		const ublas::matrix<double, ublas::column_major> &in_XX,
+		int	in_n_sq_x, int in_n_sq_y,
+		int	in_wintx, int in_winty,
+		ublas::matrix<double, ublas::column_major> &out_XX,
+		ublas::matrix<double, ublas::column_major> &out_x,
+		ublas::vector<int> &out_result)
+		: I(in_I), XX(in_XX), n_sq_x(in_n_sq_x), n_sq_y(in_n_sq_y), wintx(in_wintx), winty(in_winty),
+		  XX_out(out_XX), x_out(out_x), result_out(out_result), residual(2, in_XX.size2()),
+		  worker_num(1), arrived_num(0), generation(0), next_index(0)
+	{
+	}
+
+	//	Refines all the points (call this instead of ParallelTask::Run)
+	void	Exec(int in_worker_num)
+	{
+		//	No more workers than the points of the longest diagonal
+		if (in_worker_num <= 0)
+			in_worker_num = ParallelTask::GetDefaultWorkerNum();
+		if (in_worker_num > std::min(n_sq_x, n_sq_y) + 1)
+			in_worker_num = std::min(n_sq_x, n_sq_y) + 1;
+
+		worker_num = in_worker_num;
+		arrived_num = 0;
+		next_index = 0;
+		error = std::exception_ptr();
+		ParallelTask::Run(this, worker_num, worker_num);
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	virtual void	ExecTask(int /* in_worker_index */)
+	{
+		for (int d = 0; d <= n_sq_x + n_sq_y; d++)
+		{
+			int	i_min = d > n_sq_y ? d - n_sq_y : 0;
+			int	i_max = d < n_sq_x ? d : n_sq_x;
+			int	k;
+
+			while ((k = next_index++) <= i_max - i_min)
+			{
+				//	The other workers must still reach the barriers
+				try
+				{
+					refinePoint(i_min + k, d - i_min - k);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex>	lock(mutex);
+					if (!error)
+						error = std::current_exception();
+				}
+			}
+
+			waitOtherWorkers();
+		}
+	}
+
+private:
+	//	The last worker resets next_index for the next diagonal and releases the others
+	void	waitOtherWorkers()
+	{
+		if (worker_num <= 1)
+		{
+			next_index = 0;
+			return;
+		}
+
+		std::unique_lock<std::mutex>	lock(mutex);
+		int	current = generation;
+		if (++arrived_num == worker_num)
+		{
+			arrived_num = 0;
+			next_index = 0;
+			generation++;
+			condition.notify_all();
+			return;
+		}
+		while (generation == current)
+			condition.wait(lock);
+	}
+
+	void	refinePoint(int i, int j)
+	{
+		int	p = i + j * (n_sq_x + 1);
+		int	p_l = p - 1;
+		int	p_u = p - (n_sq_x + 1);
+		double	r_x = 0, r_y = 0;
+
+		if (i > 0 && j > 0)
+		{
+			r_x = residual(0, p_l) + residual(0, p_u) - residual(0, p_u - 1);
+			r_y = residual(1, p_l) + residual(1, p_u) - residual(1, p_u - 1);
+		}
+		else if (i > 1)	//	the first row (linear extrapolation)
+		{
+			r_x = 2 * residual(0, p_l) - residual(0, p_l - 1);
+			r_y = 2 * residual(1, p_l) - residual(1, p_l - 1);
+		}
+		else if (j > 1)	//	the first column
+		{
+			r_x = 2 * residual(0, p_u) - residual(0, p_u - (n_sq_x + 1));
+			r_y = 2 * residual(1, p_u) - residual(1, p_u - (n_sq_x + 1));
+		}
+		else if (i > 0)
+		{
+			r_x = residual(0, p_l);
+			r_y = residual(1, p_l);
+		}
+		else if (j > 0)
+		{
+			r_x = residual(0, p_u);
+			r_y = residual(1, p_u);
+		}
+
+		double	guess_x = XX(0, p) + r_x;
+		double	guess_y = XX(1, p) + r_y;
+		double	grid_x, grid_y;
+		bool	isSuccess;
+
+		//	(1, 0) and (0, 1) only have the residual of the corner (no slope yet)
+		int	scale = (i + j == 1) ? CORNER_FINDER_PROPAGATION_SEED_SCALE : 1;
+		isSuccess = CornerFinder::findCorner(I, guess_x, guess_y, wintx * scale, winty * scale, &grid_x, &grid_y);
+
+		//	a failed point keeps the predicted residual (findCorner returns the guess)
+		residual(0, p) = grid_x - XX(0, p);
+		residual(1, p) = grid_y - XX(1, p);
+
+		XX_out(0, p) = guess_x - 1;
+		XX_out(1, p) = guess_y - 1;
+		x_out(0, p) = grid_x - 1;
+		x_out(1, p) = grid_y - 1;
+		result_out(p) = isSuccess;
+	}
+
+	const ImageBufferView	&I;
+	const ublas::matrix<double, ublas::column_major>	&XX;
+	int	n_sq_x, n_sq_y;
+	int	wintx, winty;
+	ublas::matrix<double, ublas::column_major>	&XX_out;
+	ublas::matrix<double, ublas::column_major>	&x_out;
+	ublas::vector<int>	&result_out;
+	ublas::matrix<double, ublas::column_major>	residual;
+
+	int	worker_num;
+	int	arrived_num;		//	the workers at the barrier
+	int	generation;			//	the barriers passed
+	std::atomic<int>	next_index;		//	the next point of the current diagonal
+	std::mutex	mutex;
+	std::condition_variable	condition;
+	std::exception_ptr	error;	//	the first exception of refinePoint
+};
+
+
+// -----------------------------------------------------------------------------
+// 	macros (findGridPyramid)
+// -----------------------------------------------------------------------------
+#define	CORNER_FINDER_PYRAMID_SIZE_MIN	64		//	the smallest level (in pixels)
+#define	CORNER_FINDER_PYRAMID_WIN		5		//	the window of the levels other than the full resolution
+										//	(matches the 5x5 findCorner specialization)
+
+// -----------------------------------------------------------------------------
+// 	PyramidCornerTask class
+// -----------------------------------------------------------------------------
+//
+//	Propagates one grid point of findGridPyramid from the coarsest level
+//	down to the full resolution image, refining it at every level.
+//	Only the full resolution uses wintx, winty.
+//
+//	A pixel of the level l+1 covers 2x2 pixels of the level l, so the pixel
+//	center x (Matlab coordinates) of the level l+1 is at 2 * x - 0.5 in the level l.
+//
+class	PyramidCornerTask : public ParallelTask
+{
+public:
+	PyramidCornerTask(
+		const ImageBufferView &in_I,
+		const std::vector<ublas::matrix<unsigned char, ublas::column_major> > &in_levels,
+		const ublas::matrix<double, ublas::column_major> &in_x,
+		const ublas::vector<int> &in_result,
+		int	in_wintx, int in_winty,
+		ublas::matrix<double, ublas::column_major> &out_XX,
+		ublas::matrix<double, ublas::column_major> &out_x,
+		ublas::vector<int> &out_result)
+		: I(in_I), levels(in_levels), x(in_x), result(in_result), wintx(in_wintx), winty(in_winty),
+		  XX_out(out_XX), x_out(out_x), result_out(out_result)
+	{
+	}
+
+	virtual void	ExecTask(int i)
+	{
+		//	in_x is the output of findGrid (the origin is (0, 0))
+		double	grid_x = x(0, i) + 1;
+		double	grid_y = x(1, i) + 1;
+		double	guess_x = grid_x;
+		double	guess_y = grid_y;
+		bool	isSuccess = false;
+
+		for (int l = (int )levels.size() - 1; l >= 0; l--)
+		{
+			guess_x = 2 * grid_x - 0.5;
+			guess_y = 2 * grid_y - 0.5;
+			if (l == 0)
+				isSuccess = CornerFinder::findCorner(I, guess_x, guess_y, wintx, winty, &grid_x, &grid_y);
+			else
+				CornerFinder::findCorner(levels[l - 1], guess_x, guess_y,
+							CORNER_FINDER_PYRAMID_WIN, CORNER_FINDER_PYRAMID_WIN, &grid_x, &grid_y);
+		}
+
+		XX_out(0, i) = guess_x - 1;
+		XX_out(1, i) = guess_y - 1;
+		x_out(0, i) = grid_x - 1;
+		x_out(1, i) = grid_y - 1;
+		result_out(i) = (result(i) && isSuccess);
+	}
+
+private:
+	const ImageBufferView	&I;
+	const std::vector<ublas::matrix<unsigned char, ublas::column_major> >	&levels;
+	const ublas::matrix<double, ublas::column_major>	&x;
+	const ublas::vector<int>	&result;
+	int	wintx, winty;
+	ublas::matrix<double, ublas::column_major>	&XX_out;
+	ublas::matrix<double, ublas::column_major>	&x_out;
+	ublas::vector<int>	&result_out;
+};
+
+// -----------------------------------------------------------------------------
+//	roundPixelIndex
+// -----------------------------------------------------------------------------
+//
+//	CameraCalibration::mat_round for the pixel indices of count_squares
+//	(inlined, the rounding is exactly the same)
+//
+static inline int	roundPixelIndex(double in_value)
+{
+	if (in_value < 0)
+	{
+		double	result = floor(-in_value);
+		if (-in_value - result < 0.5)
+			return -(int )result;
+		return -(int )(result + 1);
+	}
+
+	double	result = floor(in_value);
+	if (in_value - result < 0.5)
+		return (int )result;
+	return (int )(result + 1);
+}
+
 //  CornerFinder class public member functions ===========================
 // -----------------------------------------------------------------------------
 //	CornerFinder
@@ -85,10 +1833,6 @@ CornerFinder::~CornerFinder()
 {
 }
 
-#define	CORNER_FINDER_RESOLUTION	0.005
-#define	CORNER_FINDER_ITER_MAX		10
-
-
 // -----------------------------------------------------------------------------
 //	findGrid
 // -----------------------------------------------------------------------------
@@ -98,8 +1842,13 @@ CornerFinder::~CornerFinder()
 //	o͕͂ʂ̍Wn@_i0, 0j@ĩLu[V̍Wnōs
 //	count_squares, findCorner, findCorner͂܂ႤdlȂ̂ŗv
 //
+//	The grid points are refined on in_worker_num threads
+//	(in_worker_num <= 0 means the number of the hardware threads)
+//	GRID_PREDICTION_PROPAGATION follows the lens distortion from the corners,
+//	so in_wintx, in_winty do not have to cover the distortion of the grid
+//
 void	CornerFinder::findGrid(
-		const ublas::matrix<unsigned char, ublas::column_major> &in_I,
+		const ImageBufferView &in_I,
 		const ublas::matrix<double, ublas::column_major> &in_x,
 		int	in_wintx, int in_winty,
 		double in_dX, double in_dY,
@@ -107,7 +1856,9 @@ void	CornerFinder::findGrid(
 		ublas::matrix<double, ublas::column_major> &out_XX,
 		ublas::matrix<double, ublas::column_major> &out_x,
 		ublas::matrix<double, ublas::column_major> &out_X,
-		ublas::vector<int> &out_result)
+		ublas::vector<int> &out_result,
+		int in_worker_num,
+		int in_prediction_method)
 {
 	int	i, j;
 	int	n = in_x.size2();
@@ -135,16 +1886,13 @@ void	CornerFinder::findGrid(
 	X(1, 0) = 0; X(1, 1) = 0; X(1, 2) = 1; X(1, 3) = 1;
 	X(2, 0) = 1; X(2, 1) = 1; X(2, 2) = 1; X(2, 3) = 1;
 
-std::cout << "hx " << hx << std::endl;
-std::cout << "X " << X << std::endl;
-
-	CameraCalibration	cameraObject(in_I.size2(), in_I.size1());	//	{͂ōKv͂Ȃ
-																	//iCD}gj
+//std::cout << "hx " << hx << std::endl;
+//std::cout << "X " << X << std::endl;
 
 	//	Compute the planar collineation: (return the normalization matrix as well)
-	cameraObject.computeHomography(hx, X, Homo);
+	computeHomography(hx, X, Homo);
 
-std::cout << "Homo " << Homo << std::endl;
+//std::cout << "Homo " << Homo << std::endl;
 
 	//	Build the grid using the planar collineation:
 	ublas::matrix<double, ublas::column_major>	x_l(in_n_sq_x + 1, in_n_sq_y + 1);
@@ -181,26 +1929,16 @@ std::cout << "Homo " << Homo << std::endl;
 //std::cout << "W " << W << std::endl;
 //std::cout << "L " << L << std::endl;
 
-	//	YЂ݂łȂƂ͂ŏsivj
-
-
-	int	Np = (in_n_sq_x + 1) * (in_n_sq_y + 1);
-	double	grid_x, grid_y;
-	bool	isSuccess;
-	//ublas::matrix<double, ublas::column_major>	grid_pts(2, XX.size2());
-	//ublas::vector<bool>	find_result(XX.size2());
-
-	for (i = 0; i < Np; i++)
+	//	YЂ݂łȂƂ͂ŏs
+	//	(the homography prediction is corrected by the refined neighbors)
+	if (in_prediction_method == GRID_PREDICTION_PROPAGATION)
 	{
-		isSuccess = findCorner(in_I, XX(0, i), XX(1, i), in_wintx, in_winty, &grid_x, &grid_y);
-		//	matlab̃R[hōsĂ鏈Ƃ킹邽߂-1
-		//	subtract 1 to bring the origin to (0,0) instead of (1,1) 
-		//	in matlab (not necessary in C)
-		out_XX(0, i) = XX(0, i) - 1;
-		out_XX(1, i) = XX(1, i) - 1;
-		out_x(0, i) = grid_x - 1;
-		out_x(1, i) = grid_y - 1;
-		out_result(i) = isSuccess;
+		GridPropagationTask	task(in_I, XX, in_n_sq_x, (int )in_n_sq_y, in_wintx, in_winty, out_XX, out_x, out_result);
+		task.Exec(in_worker_num);
+	}
+	else
+	{
+		findCorners(in_I, XX, in_wintx, in_winty, out_XX, out_x, out_result, in_worker_num);
 	}
 
 	//	_X,Y߂鏈DOłׂł낤
@@ -223,6 +1961,147 @@ std::cout << "Homo " << Homo << std::endl;
 
 
 
+// -----------------------------------------------------------------------------
+//	findCorners
+// -----------------------------------------------------------------------------
+//
+//	Refines the points in_XX by findCorner on in_worker_num threads
+//	(the coordinate systems are the same as findGrid: the input is Matlab's,
+//	out_XX and out_x are (0, 0) origin). in_XX can have more than 2 rows.
+//
+void	CornerFinder::findCorners(
+		const ImageBufferView &in_I,
+		const ublas::matrix<double, ublas::column_major> &in_XX,
+		int	in_wintx, int in_winty,
+		ublas::matrix<double, ublas::column_major> &out_XX,
+		ublas::matrix<double, ublas::column_major> &out_x,
+		ublas::vector<int> &out_result,
+		int in_worker_num)
+{
+	GridCornerTask	task(in_I, in_XX, in_wintx, in_winty, out_XX, out_x, out_result);
+	ParallelTask::Run(&task, (int )in_XX.size2(), in_worker_num);
+}
+
+
+// -----------------------------------------------------------------------------
+//	findGridPyramid
+// -----------------------------------------------------------------------------
+//
+//	Coarse to fine version of findGrid (the coordinate systems are the same as findGrid).
+//	The grid is extracted by findGrid at the coarsest level, then every point
+//	is refined level by level down to the full resolution. The levels other than
+//	the full resolution use CORNER_FINDER_PYRAMID_WIN, so the initial guess can be
+//	off by about CORNER_FINDER_PYRAMID_WIN * 2^in_level_num pixels while in_wintx,
+//	in_winty (the window at the full resolution) stay small.
+//	in_level_num is reduced if the image is too small.
+//
+void	CornerFinder::findGridPyramid(
+		const ImageBufferView &in_I,
+		const ublas::matrix<double, ublas::column_major> &in_x,
+		int	in_wintx, int in_winty,
+		double in_dX, double in_dY,
+		int in_n_sq_x, int in_n_sq_y,
+		ublas::matrix<double, ublas::column_major> &out_XX,
+		ublas::matrix<double, ublas::column_major> &out_x,
+		ublas::matrix<double, ublas::column_major> &out_X,
+		ublas::vector<int> &out_result,
+		int in_level_num,
+		int in_worker_num,
+		int in_prediction_method)
+{
+	int	i, l;
+
+	//	levels[l - 1] is the level l (1 / 2^l of in_I)
+	int	level_num = 0;
+	int	ny = in_I.size1();
+	int	nx = in_I.size2();
+	while (level_num < in_level_num &&
+			(ny >> (level_num + 1)) >= CORNER_FINDER_PYRAMID_SIZE_MIN &&
+			(nx >> (level_num + 1)) >= CORNER_FINDER_PYRAMID_SIZE_MIN)
+		level_num++;
+
+	if (level_num == 0)
+	{
+		findGrid(in_I, in_x, in_wintx, in_winty, in_dX, in_dY, in_n_sq_x, in_n_sq_y,
+				out_XX, out_x, out_X, out_result, in_worker_num, in_prediction_method);
+		return;
+	}
+
+	std::vector<ublas::matrix<unsigned char, ublas::column_major> >	levels(level_num);
+	pyrDown(in_I, levels[0]);
+	for (l = 1; l < level_num; l++)
+		pyrDown(levels[l - 1], levels[l]);
+
+	//	The input points at the coarsest level
+	double	scale = (double )(1 << level_num);
+	ublas::matrix<double, ublas::column_major>	x_c(2, in_x.size2());
+	for (i = 0; i < (int )in_x.size2(); i++)
+	{
+		x_c(0, i) = (in_x(0, i) + (scale - 1) / 2.0) / scale;
+		x_c(1, i) = (in_x(1, i) + (scale - 1) / 2.0) / scale;
+	}
+
+	int	Np = (in_n_sq_x + 1) * (in_n_sq_y + 1);
+	ublas::matrix<double, ublas::column_major>	XX_c(2, Np);
+	ublas::matrix<double, ublas::column_major>	grid_c(2, Np);
+	ublas::vector<int>	result_c(Np);
+
+	findGrid(levels[level_num - 1], x_c,
+			CORNER_FINDER_PYRAMID_WIN, CORNER_FINDER_PYRAMID_WIN,
+			in_dX, in_dY, in_n_sq_x, in_n_sq_y,
+			XX_c, grid_c, out_X, result_c, in_worker_num, in_prediction_method);
+
+	//	Propagate to the full resolution
+	PyramidCornerTask	task(in_I, levels, grid_c, result_c, in_wintx, in_winty, out_XX, out_x, out_result);
+	ParallelTask::Run(&task, Np, in_worker_num);
+}
+
+
+// -----------------------------------------------------------------------------
+//	pyrDown
+// -----------------------------------------------------------------------------
+//
+//	Halves the image by averaging 2x2 pixels (the last row and column of an odd size are dropped)
+//
+void	CornerFinder::pyrDown(
+		const ImageBufferView &in_I,
+		ublas::matrix<unsigned char, ublas::column_major> &out_I)
+{
+	int	ny = in_I.size1() / 2;
+	int	nx = in_I.size2() / 2;
+
+	out_I.resize(ny, nx, false);
+	if (ny == 0 || nx == 0)
+		return;
+
+	const int	row_step = in_I.rowStep();
+	const int	column_step = in_I.columnStep();
+	unsigned char	*dst = &(out_I(0, 0));
+
+	//	walk along the contiguous direction of in_I (a bitmap buffer is row major)
+	if (column_step == 1)
+	{
+		for (int i = 0; i < ny; i++)
+		{
+			const unsigned char	*src0 = in_I.ptr(2 * i, 0);
+			const unsigned char	*src1 = in_I.ptr(2 * i + 1, 0);
+			for (int j = 0; j < nx; j++, src0 += 2, src1 += 2)
+				dst[i + j * ny] = (unsigned char )((src0[0] + src0[1] + src1[0] + src1[1] + 2) / 4);
+		}
+	}
+	else
+	{
+		for (int j = 0; j < nx; j++)
+		{
+			const unsigned char	*src0 = in_I.ptr(0, 2 * j);
+			const unsigned char	*src1 = in_I.ptr(0, 2 * j + 1);
+			for (int i = 0; i < ny; i++, src0 += 2 * row_step, src1 += 2 * row_step)
+				dst[i + j * ny] = (unsigned char )((src0[0] + src0[row_step] + src1[0] + src1[row_step] + 2) / 4);
+		}
+	}
+}
+
+
 // -----------------------------------------------------------------------------
 //	findRectangle
 // -----------------------------------------------------------------------------
@@ -230,7 +2109,7 @@ std::cout << "Homo " << Homo << std::endl;
 //	́Eo͂ƂMatlab̍Wn@_i1, 1j
 //
 void	CornerFinder::findRectangle(
-		const ublas::matrix<unsigned char, ublas::column_major> &in_I,
+		const ImageBufferView &in_I,
 		ublas::matrix<double, ublas::column_major> &io_x,
 		int	in_wintx, int in_winty,
 		int	*out_n_sq_x1, int *out_n_sq_x2,
@@ -377,10 +2256,10 @@ std::cout << "p_center" << p_center << std::endl;*/
 	*out_n_sq_y1 = count_squares(in_I, x2, y2, x3, y3, in_wintx);
 	*out_n_sq_y2 = count_squares(in_I, x4, y4, x1, y1, in_wintx);
 
-std::cout << "out_n_sq_x1 " << *out_n_sq_x1 << std::endl;
-std::cout << "out_n_sq_x2 " << *out_n_sq_x2 << std::endl;
-std::cout << "out_n_sq_y1 " << *out_n_sq_y1 << std::endl;
-std::cout << "out_n_sq_y2 " << *out_n_sq_y2 << std::endl;
+//std::cout << "out_n_sq_x1 " << *out_n_sq_x1 << std::endl;
+//std::cout << "out_n_sq_x2 " << *out_n_sq_x2 << std::endl;
+//std::cout << "out_n_sq_y1 " << *out_n_sq_y1 << std::endl;
+//std::cout << "out_n_sq_y2 " << *out_n_sq_y2 << std::endl;
 
 	for (i = 0; i < 4; i++)
 	{
@@ -396,8 +2275,14 @@ std::cout << "out_n_sq_y2 " << *out_n_sq_y2 << std::endl;
 //
 //	́Eo͂ƂMatlab̍Wn@_i1, 1j
 //
+//	The band of 2 * in_win + 1 pixels across the edge is not stored as matrices
+//	(xs_mat, ys_mat, ind_mat, ima_patch, filtk in the toolbox). The signed sum of
+//	each column of the band (the edge intensity profile) is computed directly
+//	from the image and smoothed in place, so only the profile is allocated.
+//	The sampled pixels and the arithmetic are the same as the toolbox.
+//
 int	CornerFinder::count_squares(
-		const ublas::matrix<unsigned char, ublas::column_major> &in_I,
+		const ImageBufferView &in_I,
 		double in_x1, double in_y1,
 		double in_x2, double in_y2,
 		int	in_win)
@@ -406,161 +2291,95 @@ int	CornerFinder::count_squares(
 	int	ny = in_I.size1();
 	int	nx = in_I.size2();
 
-	ublas::vector<double>	lamda(3);
-	lamda(0) = in_y1 - in_y2;
-	lamda(1) = in_x2 - in_x1;
-	lamda(2) = in_x1 * in_y2 - in_x2 * in_y1;
+	double	lamda[3];
+	lamda[0] = in_y1 - in_y2;
+	lamda[1] = in_x2 - in_x1;
+	lamda[2] = in_x1 * in_y2 - in_x2 * in_y1;
 
-	double t = sqrt(lamda(0) * lamda(0) + lamda(1) * lamda(1));
+	double t = sqrt(lamda[0] * lamda[0] + lamda[1] * lamda[1]);
 	for (i = 0; i < 3; i++)
-		lamda(i) = 1.0 / t * lamda(i);
-
-	ublas::vector<double>	l1(3);
-	ublas::vector<double>	l2(3);
-	l1 = lamda;
-	l1(2) += in_win;
-	l2 = lamda;
-	l2(2) -= in_win;
+		lamda[i] = 1.0 / t * lamda[i];
 
 	double	dx = in_x2 - in_x1;
 	double	dy = in_y2 - in_y1;
 
-	ublas::vector<double>	xs;
-	ublas::vector<double>	ys;
-	if (fabs(dx) > fabs(dy))
-	{
-		xs = ublas::vector<double>(floor(fabs(dx)) + 1);
-		ys = ublas::vector<double>(floor(fabs(dx)) + 1);
+	//	The edge is sampled every pixel along its major axis
+	bool	along_x = (fabs(dx) > fabs(dy));
+	int	Np = (int )floor(along_x ? fabs(dx) : fabs(dy)) + 1;
+	double	step;
+	if (along_x)
+		step = (in_x2 > in_x1) ? 1.0 : -1.0;
+	else
+		step = (in_y2 > in_y1) ? 1.0 : -1.0;
 
-		if (in_x2 > in_x1)
-		{
-			for (i = 0, t = in_x1; i < (int )xs.size(); i++, t++) 
-				xs(i) = t;
-		}
-		else
-		{
-			for (i = 0, t = in_x1; i < (int )xs.size(); i++, t--) 
-				xs(i) = t;
-		}
+	if (Np - 2 * in_win < 1)
+		return 1;
 
-		for (i = 0; i < (int )ys.size(); i++) 
-			ys(i) = -1.0 * (lamda(2) + lamda(0) * xs(i)) / lamda(1);
-	}
-	else
+	//	out_f: the sum of one side of the band minus the other side
+	std::vector<double>	out_f(Np);
+	double	xs, ys;
+	for (j = 0, t = along_x ? in_x1 : in_y1; j < Np; j++, t += step)
 	{
-		xs = ublas::vector<double>(floor(fabs(dy)) + 1);
-		ys = ublas::vector<double>(floor(fabs(dy)) + 1);
-
-		if (in_y2 > in_y1)
+		if (along_x)
 		{
-			for (i = 0, t = in_y1; i < (int )ys.size(); i++, t++) 
-				ys(i) = t;
+			xs = t;
+			ys = -1.0 * (lamda[2] + lamda[0] * xs) / lamda[1];
 		}
 		else
 		{
-			for (i = 0, t = in_y1; i < (int )ys.size(); i++, t--) 
-				ys(i) = t;
-		}
-
-		for (i = 0; i < (int )xs.size(); i++) 
-			xs(i) = -1.0 * (lamda(2) + lamda(1) * ys(i)) / lamda(0);
-	}
-
-//std::cout << "lamda " << lamda << std::endl;
-//std::cout << "xs " << xs << std::endl;
-//std::cout << "ys " << ys << std::endl;
-
-	int	Np = xs.size();
-
-	ublas::matrix<double, ublas::column_major>	xs_mat(2 * in_win + 1, Np);
-	ublas::matrix<double, ublas::column_major>	ys_mat(2 * in_win + 1, Np);
-	for (i = 0; i < (int )xs_mat.size1(); i++)
-		for (j = 0; j < (int )xs_mat.size2(); j++)
-		{
-			xs_mat(i, j) = xs(j);
-			ys_mat(i, j) = ys(j);
+			ys = t;
+			xs = -1.0 * (lamda[2] + lamda[1] * ys) / lamda[0];
 		}
 
-	ublas::matrix<double, ublas::column_major>	win_mat(2 * in_win + 1, Np);
-	for (i = 0, t = -in_win; i < (int )win_mat.size1(); i++, t++)
-		for (j = 0; j < (int )win_mat.size2(); j++)
-			win_mat(i, j) = t;
-
-	ublas::matrix<int, ublas::column_major>	xs_mat2(2 * in_win + 1, Np);
-	ublas::matrix<int, ublas::column_major>	ys_mat2(2 * in_win + 1, Np);
-	for (i = 0; i < (int )xs_mat2.size1(); i++)
-		for (j = 0; j < (int )xs_mat2.size2(); j++)
+		double	sum = 0;
+		for (i = 0; i < 2 * in_win + 1; i++)
 		{
-			xs_mat2(i, j) = mat_round(xs_mat(i, j) - win_mat(i, j) * lamda(0));
-			ys_mat2(i, j) = mat_round(ys_mat(i, j) - win_mat(i, j) * lamda(1));
-		}
-
-	ublas::matrix<int, ublas::column_major>	ind_mat(2 * in_win + 1, Np);
-	for (i = 0; i < (int )ind_mat.size1(); i++)
-		for (j = 0; j < (int )ind_mat.size2(); j++)
-			ind_mat(i, j) = (xs_mat2(i, j) - 1) * ny + ys_mat2(i, j);
+			if (i == in_win)	//	the weight of the center is 0
+				continue;
 
-//std::cout << "ind_mat " << ind_mat << std::endl;
+			double	w = (double )(i - in_win);
+			int	xs2 = roundPixelIndex(xs - w * lamda[0]);
+			int	ys2 = roundPixelIndex(ys - w * lamda[1]);
 
-	ublas::matrix<double, ublas::column_major>	ima_patch(2 * in_win + 1, Np);
-	ima_patch.clear();
-	for (i = 0; i < (int )ind_mat.size1(); i++)
-		for (j = 0; j < (int )ind_mat.size2(); j++)
-		{
-			int	index = ind_mat(i, j) - 1;	// -1MATLABƂ̍(1ANZXȂ̂ŏ₱)
-			int	i_index = index % (int )in_I.size1();
-			int	j_index = index / (int )in_I.size1();
-			if (j_index < (int )in_I.size2())
-				ima_patch(i, j) = in_I(i_index, j_index);
+			double	value = 0;
+			if (ys2 >= 1 && ys2 <= ny && xs2 >= 1 && xs2 <= nx)
+				value = in_I(ys2 - 1, xs2 - 1);
 			else
-				ima_patch(i, j) = 0;
-		}
-
-//std::cout << "ima_patch " << ima_patch << std::endl;
+			{
+				//	Matlab linear index (a row out of the range wraps to the next column)
+				int	index = (xs2 - 1) * ny + ys2 - 1;
+				if (index >= 0 && index / ny < nx)
+					value = in_I(index % ny, index / ny);
+			}
 
-	ublas::matrix<double, ublas::column_major>	filtk(2 * in_win + 1, Np);
-	filtk.clear();
-	for (i = 0; i < in_win; i++)
-		for (j = 0; j < (int )filtk.size2(); j++)
-		{
-			filtk(i, j) = 1;
-			filtk(i + in_win + 1, j) = -1;
+			if (i < in_win)
+				sum += value;
+			else
+				sum += -1 * value;
 		}
+		out_f[j] = sum;
+	}
 
-	ublas::matrix<double, ublas::column_major>	out_f_mat(1, Np);
-	ublas::matrix_row<ublas::matrix<double, ublas::column_major> >	out_f(out_f_mat, 0);
-
-	for (i = 0; i < (int )ind_mat.size1(); i++)
-		for (j = 0; j < (int )ind_mat.size2(); j++)
-			ima_patch(i, j) = filtk(i, j) * ima_patch(i, j);
-
-	ublas::vector<double>	temp_vec(Np);		//	AhzbNȉ@DƂ
-	mat_sum(ima_patch, temp_vec);
-	out_f = temp_vec;
-
-//std::cout << "out_f_mat " << out_f_mat << std::endl;
-
-	ublas::matrix<double, ublas::column_major>	out_f_f(1, Np);
-	ublas::matrix<double, ublas::column_major>	filter(1, 3);
-	filter(0, 0) = 1 / 4.0; filter(0, 1) = 1 / 2.0; filter(0, 2) = 1 / 4.0;
-	mat_conv2_same(out_f_mat, filter, out_f_f);
-
-//std::cout << "filter " << filter << std::endl;
-//std::cout << "out_f_f " << out_f_f << std::endl;
-
-	ublas::vector<double>	out_f_f2(Np - 2 * in_win);
-	for (i = 0; i < (int )out_f_f2.size(); i++)
-		out_f_f2(i) = out_f_f(0, i + in_win);
-
+	//	conv2(out_f, [1/4 1/2 1/4], 'same') without the in_win samples of both ends
 	int	result = 1;
-	for (i = 0; i < (int )out_f_f2.size() - 1; i++)
-		if ((out_f_f2(i + 1) >= 0 && out_f_f2(i) < 0) ||
-			(out_f_f2(i + 1) <= 0 && out_f_f2(i) > 0))
+	double	prev = 0;
+	for (j = in_win; j < Np - in_win; j++)
+	{
+		double	f = 0;
+		if (j > 0)
+			f += out_f[j - 1] * (1 / 4.0);
+		f += out_f[j] * (1 / 2.0);
+		if (j + 1 < Np)
+			f += out_f[j + 1] * (1 / 4.0);
+
+		if (j > in_win &&
+			((f >= 0 && prev < 0) || (f <= 0 && prev > 0)))
 		{
 			result++;
 		}
+		prev = f;
+	}
 
-//std::cout << "out_f_f2 " << out_f_f2 << std::endl;
 //std::cout << "result " << result << std::endl;
 
 	return result;
@@ -574,7 +2393,7 @@ int	CornerFinder::count_squares(
 //	́Eo͂ƂMatlab̍Wn@_i1, 1j
 //
 bool	CornerFinder::findCorner(
-		const ublas::matrix<unsigned char, ublas::column_major> &in_I,
+		const ImageBufferView &in_I,
 		double in_x, double in_y,
 		int	in_wintx, int in_winty,
 		double *out_x, double *out_y)
@@ -582,269 +2401,162 @@ bool	CornerFinder::findCorner(
 	//int wx2 = -1;	//	̃R[hł͈łwDgpĂȂ
 	//int wy2 = -1;
 
-	ublas::vector<double>	xt(2);
-	xt(0) = in_y;	//	x,y𔽓]Ă̂ŗv
-	xt(1) = in_x;	//	in_I̍sicjxƂĒ`Ă邽
-
-	int	i, j;
-	int	a, b;
-	ublas::matrix<double, ublas::column_major>	mask_a(in_wintx * 2 + 1, 1);
-	ublas::matrix<double, ublas::column_major>	mask_b(1, in_winty * 2 + 1);
-
-	for (i = 0, a = -in_wintx; i < (int )mask_a.size1(); i++, a++)
-		mask_a(i, 0) = exp(-1.0 * pow((double )a / (double )in_wintx, 2));
-	for (i = 0, a = -in_winty; i < (int )mask_b.size2(); i++, a++)
-		mask_b(0, i) = exp(-1.0 * pow((double )a / (double )in_winty, 2));
-
-	ublas::matrix<double, ublas::column_major>	mask(mask_a.size1(), mask_b.size2());
-	mask = ublas::prod(mask_a, mask_b);
-
-	ublas::matrix<double, ublas::column_major>	offx(mask_a.size1(), mask_b.size2());
-	ublas::matrix<double, ublas::column_major>	offy(mask_a.size1(), mask_b.size2());
-
-	for (i = 0, a = -in_wintx; i < (int )offx.size1(); i++, a++)
-		for (j = 0, b = -in_winty; j < (int )offx.size2(); j++, b++)
-		{
-			offx(i, j) = a;
-			offy(i, j) = b;
-		}
-
-//std::cout << "offx" << offx << std::endl;
-//std::cout << "offy" << offy << std::endl;
-
-	int	nx = in_I.size1();
-	int	ny = in_I.size2();
-
-	//	first guess... they don't move !!!
-	ublas::vector<double>	xc(2);
-	xc = xt;
-
-	ublas::vector<double>	v_extra(2);
-	v_extra(0) = 1 + CORNER_FINDER_RESOLUTION;
-	v_extra(1) = 1 + CORNER_FINDER_RESOLUTION;
-
-	int	compt = 0;
-
-	while (mat_norm(v_extra) > CORNER_FINDER_RESOLUTION &&
-			compt < CORNER_FINDER_ITER_MAX)
+	//	The common window sizes are specialized (see refineCorner)
+	if (in_wintx == in_winty)
 	{
-		double	cIx = xc(0);
-		double	cIy = xc(1);
-		double	crIx = mat_round(cIx);
-		double	crIy = mat_round(cIy);
-		double	itIx = cIx - crIx;
-		double	itIy = cIy - crIy;
-		
-		ublas::matrix<double, ublas::column_major>	vIx(3, 1);
-		ublas::matrix<double, ublas::column_major>	vIy(1, 3);
-
-		if (itIx > 0.0)	// the sub pixel
-		{
-			vIx(0, 0) = itIx;
-			vIx(1, 0) = 1 - itIx;
-			vIx(2, 0) = 0;
-		}
-		else
-		{
-			vIx(0, 0) = 0;
-			vIx(1, 0) = 1 + itIx;
-			vIx(2, 0) = -itIx;
-		}
-		if (itIy > 0.0)	// the sub pixel
-		{
-			vIy(0, 0) = itIy;
-			vIy(0, 1) = 1 - itIy;
-			vIy(0, 2) = 0;
-		}
-		else
-		{
-			vIy(0, 0) = 0;
-			vIy(0, 1) = 1 + itIy;
-			vIy(0, 2) = -itIy;
-		}
-
-/*std::cout << "cIx" << cIx << std::endl;
-std::cout << "cIy" << cIy << std::endl;
-std::cout << "crIx" << crIx << std::endl;
-std::cout << "crIy" << crIy << std::endl;
-std::cout << "vIx" << vIx << std::endl;
-std::cout << "vIy" << vIy << std::endl;*/
-
-		//	What if the sub image is not in?
-		int	xmin, xmax;
-		if (crIx - in_wintx - 2 < 1)
-		{
-			xmin = 1;
-			xmax = 2 * in_wintx + 5;
-		}
-		else if (crIx + in_wintx + 2 > nx)
-		{
-			xmax = nx;
-			xmin = nx - 2 * in_wintx - 4;
-		}
-		else
-		{
-			xmin = crIx - in_wintx - 2;
-			xmax = crIx + in_wintx + 2;
-		}
-
-		int	ymin, ymax;
-		if (crIy - in_winty - 2 < 1)
-		{
-			ymin = 1;
-			ymax = 2 * in_winty + 5;
-		}
-		else if (crIy + in_winty + 2 > ny)
-		{
-			ymax = ny;
-			ymin = ny - 2 * in_winty - 4;
-		}
-		else
+		switch (in_wintx)
 		{
-			ymin = crIy - in_winty - 2;
-			ymax = crIy + in_winty + 2;
-		}
-
-/*std::cout << "xmin" << xmin << std::endl;
-std::cout << "xmax" << xmax << std::endl;
-std::cout << "ymin" << ymin << std::endl;
-std::cout << "ymax" << ymax << std::endl;*/
-
-		//	matlab index̕ϊ
-		//	̏邽߁C̊֐ׂ̏matlab̍WnŐi߂
-		xmin--; xmax--;
-		ymin--; ymax--;	
-
-		//	The necessary neighborhood
-		ublas::matrix<double, ublas::column_major>	SI(xmax - xmin + 1, ymax - ymin + 1);
-		for (i = 0, a = xmin; i < (int )SI.size1(); i++, a++)
-			for (j = 0, b = ymin; j < (int )SI.size2(); j++, b++)
-				SI(i, j) = in_I(a, b);
-
-//std::cout << "SI" << SI << std::endl;
-//std::cout << "vIx" << vIx << std::endl;
-
-		ublas::matrix<double, ublas::column_major>	temp_mat(SI.size1(), SI.size2());
-		mat_conv2_same(SI, vIx, temp_mat);
-//std::cout << "temp_mat" << temp_mat << std::endl;
-		mat_conv2_same(temp_mat, vIy, SI);
-
-//std::cout << "vIy" << vIy << std::endl;
-//std::cout << "SI" << SI << std::endl;
-
-		//	The subpixel interpolated neighborhood
-		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-						SI_r(SI,	ublas::range(1, 2 * in_wintx + 4),
-									ublas::range(1, 2 * in_winty + 4));
-
-//std::cout << "SI_r" << SI_r << std::endl;
-
-		ublas::matrix<double, ublas::column_major>	gx(SI_r.size1(), SI_r.size2());
-		ublas::matrix<double, ublas::column_major>	gy(SI_r.size1(), SI_r.size2());
-		mat_gradient(SI_r, gy, gx);
-
-		//	extraction of the useful parts only of the gradients
-		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-						gx_r(gx,	ublas::range(1, 2 * in_wintx + 2),
-									ublas::range(1, 2 * in_winty + 2));
-		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-						gy_r(gy,	ublas::range(1, 2 * in_wintx + 2),
-									ublas::range(1, 2 * in_winty + 2));
-
-		ublas::matrix<double, ublas::column_major>	px(mask_a.size1(), mask_b.size2());
-		ublas::matrix<double, ublas::column_major>	py(mask_a.size1(), mask_b.size2());
-
-		for (i = 0; i < (int )px.size1(); i++)
-			for (j = 0; j < (int )px.size2(); j++)
+			case 5:
 			{
-				px(i, j) = cIx + offx(i, j);
-				py(i, j) = cIy + offy(i, j);
+				CornerFinderFixedWorkspace<5, 5>	ws;
+				return refineCorner(in_I, in_x, in_y, ws, out_x, out_y);
 			}
-
-		ublas::matrix<double, ublas::column_major>	gxx(gx_r.size1(), gx_r.size2());
-		ublas::matrix<double, ublas::column_major>	gyy(gy_r.size1(), gy_r.size2());
-		ublas::matrix<double, ublas::column_major>	gxy(gx_r.size1(), gx_r.size2());
-
-		for (i = 0; i < (int )mask.size1(); i++)
-			for (j = 0; j < (int )mask.size2(); j++)
+			case 7:
 			{
-				gxx(i, j) = gx_r(i, j) * gx_r(i, j) * mask(i, j);
-				gyy(i, j) = gy_r(i, j) * gy_r(i, j) * mask(i, j);
-				gxy(i, j) = gx_r(i, j) * gy_r(i, j) * mask(i, j);
+				CornerFinderFixedWorkspace<7, 7>	ws;
+				return refineCorner(in_I, in_x, in_y, ws, out_x, out_y);
 			}
-
-		ublas::matrix<double, ublas::column_major>	gxx_temp(gx_r.size1(), gx_r.size2());
-		ublas::matrix<double, ublas::column_major>	gxy_temp(gy_r.size1(), gy_r.size2());
-
-		for (i = 0; i < (int )mask.size1(); i++)
-			for (j = 0; j < (int )mask.size2(); j++)
+			case 11:
 			{
-				gxx_temp(i, j) = gxx(i, j) * px(i, j) + gxy(i, j) * py(i, j);
-				gxy_temp(i, j) = gxy(i, j) * px(i, j) + gyy(i, j) * py(i, j);
+				CornerFinderFixedWorkspace<11, 11>	ws;
+				return refineCorner(in_I, in_x, in_y, ws, out_x, out_y);
 			}
+		}
+	}
 
-		ublas::vector<double>	temp_vec(gxx.size2());
-
-		mat_sum(gxx_temp, temp_vec);
-		double	bb_1 = mat_sum(temp_vec);
-		mat_sum(gxy_temp, temp_vec);
-		double	bb_2 = mat_sum(temp_vec);
-
-		mat_sum(gxx, temp_vec);
-		double	a = mat_sum(temp_vec);
-		mat_sum(gxy, temp_vec);
-		double	b = mat_sum(temp_vec);
-		mat_sum(gyy, temp_vec);
-		double	c = mat_sum(temp_vec);
-
-		double	dt = a * c - b * b;
+	CornerFinderWorkspace	ws(in_wintx, in_winty);
+	return refineCorner(in_I, in_x, in_y, ws, out_x, out_y);
+}
 
-		ublas::vector<double>	xc2(2);
-		xc2(0) = (c * bb_1 - b * bb_2) / dt;
-		xc2(1) = (a * bb_2 - b * bb_1) / dt;
 
-		ublas::matrix<double, ublas::column_major>	G(2, 2);
-		ublas::matrix<double, ublas::column_major>	U(2, 2);
-		ublas::matrix<double, ublas::column_major>	S(2, 2);
-		ublas::matrix<double, ublas::column_major>	V(2, 2);
+// -----------------------------------------------------------------------------
+//	findChessboard
+// -----------------------------------------------------------------------------
+//
+//	Detects the checkerboard in the whole image without the manual inputs.
+//	The X-corners are detected by the ChESS response, connected to a lattice
+//	from the strongest seeds and the largest complete lattice is taken.
+//	out_x is the four extreme corners of the lattice in the order of findGrid
+//	(clockwise on the screen, starting from the upper left corner), and
+//	out_n_sq_x/y are the number of the squares along out_x(:, 0) -> out_x(:, 1)
+//	and out_x(:, 1) -> out_x(:, 2). The corners are only roughly located,
+//	findGrid should be used to refine them.
+//
+//	o͂Matlab̍Wn@_i1, 1j@findGridɂ̂܂ܓn
+//
+bool	CornerFinder::findChessboard(
+		const ImageBufferView &in_I,
+		ublas::matrix<double, ublas::column_major> &out_x,
+		int	*out_n_sq_x, int *out_n_sq_y)
+{
+	int	i;
 
-		G(0, 0) = a; G(0, 1) = b;
-		G(1, 0) = b; G(1, 1) = c;
+	ublas::matrix<double, ublas::column_major>	R;
+	std::vector<ChessboardCandidate>	list;
+	chessboardResponse(in_I, R);
+	chessboardCandidates(R, list);
 
-		mat_svd(G, U, S, V);
+	int	n = (int )list.size();
+	if (n < (CHESSBOARD_SQUARE_MIN + 1) * (CHESSBOARD_SQUARE_MIN + 1))
+		return false;
 
-		//	If non-invertible, then project the point onto the edge orthogonal:
-		if (S(0, 0) / S(1, 1) > 50.0)
-		{
-			//	projection operation:
-			double	t = (xc(0) - xc2(0)) * V(0, 1) + (xc(1) - xc2(1)) * V(1, 1);
+	ChessboardLattice	lattice;
+	int	i0, i1, j0, j1;
+	if (findLattice(&in_I, list, lattice, &i0, &i1, &j0, &j1) == false)
+		return false;
 
-			xc2(0) = xc2(0) + t * V(0, 1);
-			xc2(1) = xc2(1) + t * V(1, 1);
-			//type(i) = 1;	gĂȂ悤Ȃ̂Ŗ
-//std::cout << "Warning:!! NO TEST PATH (CornerFinder)" << std::endl;
-		}
+	//	corners of the lattice and the number of the squares along each side
+	std::pair<int, int>	c[4];
+	orderLatticeCorners(list, lattice, i0, i1, j0, j1, c, out_n_sq_x, out_n_sq_y);
 
-		v_extra = xc - xc2;
-		xc = xc2;
-		compt++;
+	out_x.resize(2, 4);
+	for (i = 0; i < 4; i++)
+	{
+		int	k = latticeIndex(lattice, c[i].first, c[i].second);
+		out_x(0, i) = list[k].x + 1;	//	Matlab coordinate system
+		out_x(1, i) = list[k].y + 1;
+	}
 
-//std::cout << "compt" << compt << std::endl;
-//std::cout << "v_extra" << v_extra << std::endl;
-//std::cout << "norm(v_extra)" << mat_norm(v_extra) << std::endl;
+	return true;
+}
 
-	}
 
-	bool	result = true;
+// -----------------------------------------------------------------------------
+//	findCircleGrid
+// -----------------------------------------------------------------------------
+//
+//	Detects the grid of the circles (dark circles on a bright board if
+//	in_dark_circles) in the whole image. The circles are the elliptic blobs of
+//	the locally thresholded image (circleGridBlobs) and their centers are the
+//	centroids of the coverage (refineCircleCenter). The centers are connected
+//	to a lattice like findChessboard. The outputs are the same as findGrid:
+//	out_XX is the centroids of the blobs, out_x is the refined centers (origin
+//	is (0, 0)) and out_X is the world coordinates of the centers (in_dX, in_dY
+//	are the distances between the centers). out_n_sq_x/y are the number of
+//	the circles - 1 along each side, so that there are the same number of
+//	the points as findGrid.
+//
+//	The center of the ellipse is not exactly the projection of the center of
+//	the circle under the perspective, which is small for the circles much
+//	smaller than the distance to the camera.
+//
+bool	CornerFinder::findCircleGrid(
+		const ImageBufferView &in_I,
+		double in_dX, double in_dY,
+		ublas::matrix<double, ublas::column_major> &out_XX,
+		ublas::matrix<double, ublas::column_major> &out_x,
+		ublas::matrix<double, ublas::column_major> &out_X,
+		ublas::vector<int> &out_result,
+		int	*out_n_sq_x, int *out_n_sq_y,
+		bool in_dark_circles)
+{
+	int	i, j;
 
-	if (fabs(xc(0) - xt(0)) > in_wintx || fabs(xc(1) - xt(1)) > in_winty)
-	{
-//std::cout << "can't detect corner" << std::endl;
-		xc = xt;
-		result = false;
-	}
+	std::vector<ChessboardCandidate>	list, centroid;
+	circleGridCandidates(in_I, in_dark_circles, list, centroid);
+
+	int	n = (int )list.size();
+	if (n < (CHESSBOARD_SQUARE_MIN + 1) * (CHESSBOARD_SQUARE_MIN + 1))
+		return false;
+
+	ChessboardLattice	lattice;
+	int	i0, i1, j0, j1;
+	if (findLattice(NULL, list, lattice, &i0, &i1, &j0, &j1) == false)
+		return false;
+
+	std::pair<int, int>	c[4];
+	int	n_sq_x, n_sq_y;
+	orderLatticeCorners(list, lattice, i0, i1, j0, j1, c, &n_sq_x, &n_sq_y);
+
+	//	lattice steps along the x and y axes of the grid
+	int	xi = (c[1].first - c[0].first) / n_sq_x;
+	int	xj = (c[1].second - c[0].second) / n_sq_x;
+	int	yi = (c[3].first - c[0].first) / n_sq_y;
+	int	yj = (c[3].second - c[0].second) / n_sq_y;
+
+	int	Np = (n_sq_x + 1) * (n_sq_y + 1);
+	out_XX.resize(2, Np, false);
+	out_x.resize(2, Np, false);
+	out_X.resize(3, Np, false);
+	out_result.resize(Np, false);
+	for (i = 0; i < n_sq_y + 1; i++)
+		for (j = 0; j < n_sq_x + 1; j++)
+		{
+			int	p = j + i * (n_sq_x + 1);
+			int	k = latticeIndex(lattice, c[0].first + j * xi + i * yi, c[0].second + j * xj + i * yj);
+
+			out_XX(0, p) = centroid[k].x;
+			out_XX(1, p) = centroid[k].y;
+			out_x(0, p) = list[k].x;
+			out_x(1, p) = list[k].y;
+			out_result(p) = 1;
+
+			out_X(0, p) = j * in_dX;
+			out_X(1, p) = (n_sq_y - i) * in_dY;
+			out_X(2, p) = 0.0;	//	Z Axis is always 0
+		}
 
-	*out_x = xc(1);	//	]Ă̂Œ
-	*out_y = xc(0);
-	return result;
+	*out_n_sq_x = n_sq_x;
+	*out_n_sq_y = n_sq_y;
+	return true;
 }
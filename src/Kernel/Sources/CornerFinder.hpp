@@ -44,6 +44,7 @@
 // 	include files
 // -----------------------------------------------------------------------------
 #include "CameraCalibration.hpp"
+#include "ImageBufferView.hpp"
 
 
 // -----------------------------------------------------------------------------
@@ -52,6 +53,13 @@
 class	CornerFinder : public CameraCalibration
 {
 public:
+	//	prediction of the grid points of findGrid
+	enum GridPredictionMethod
+	{
+							GRID_PREDICTION_HOMOGRAPHY		= 0,	// the toolbox (the homography of the 4 corners)
+							GRID_PREDICTION_PROPAGATION				// corrected by the residuals of the refined neighbors
+	};
+
 	//	constructor/destructor
 							CornerFinder(int inImageWidth, int inImageHeight);
 	virtual					~CornerFinder();
@@ -59,7 +67,7 @@ public:
 	//	member variables
 	//	member functions
 	static void		findGrid(
-								const ublas::matrix<unsigned char, ublas::column_major> &in_I,
+								const ImageBufferView &in_I,
 								const ublas::matrix<double, ublas::column_major> &in_x,
 								int	in_wintx, int in_winty,
 								double in_dX, double in_dY,
@@ -67,26 +75,70 @@ public:
 								ublas::matrix<double, ublas::column_major> &out_XX,
 								ublas::matrix<double, ublas::column_major> &out_x,
 								ublas::matrix<double, ublas::column_major> &out_X,
-								ublas::vector<int> &out_result);
+								ublas::vector<int> &out_result,
+								int in_worker_num = 0,
+								int in_prediction_method = GRID_PREDICTION_HOMOGRAPHY);
+
+	static void		findCorners(
+								const ImageBufferView &in_I,
+								const ublas::matrix<double, ublas::column_major> &in_XX,
+								int	in_wintx, int in_winty,
+								ublas::matrix<double, ublas::column_major> &out_XX,
+								ublas::matrix<double, ublas::column_major> &out_x,
+								ublas::vector<int> &out_result,
+								int in_worker_num = 0);
+
+	static void		findGridPyramid(
+								const ImageBufferView &in_I,
+								const ublas::matrix<double, ublas::column_major> &in_x,
+								int	in_wintx, int in_winty,
+								double in_dX, double in_dY,
+								int in_n_sq_x, int in_n_sq_y,
+								ublas::matrix<double, ublas::column_major> &out_XX,
+								ublas::matrix<double, ublas::column_major> &out_x,
+								ublas::matrix<double, ublas::column_major> &out_X,
+								ublas::vector<int> &out_result,
+								int in_level_num,
+								int in_worker_num = 0,
+								int in_prediction_method = GRID_PREDICTION_HOMOGRAPHY);
+
+	static void		pyrDown(
+								const ImageBufferView &in_I,
+								ublas::matrix<unsigned char, ublas::column_major> &out_I);
 
 	static void		findRectangle(
-								const ublas::matrix<unsigned char, ublas::column_major> &in_I,
+								const ImageBufferView &in_I,
 								ublas::matrix<double, ublas::column_major> &io_x,
 								int	in_wintx, int in_winty,
 								int	*out_n_sq_x1, int *out_n_sq_x2,
 								int	*out_n_sq_y1, int *out_n_sq_y2);
 
 	static int		count_squares(
-								const ublas::matrix<unsigned char, ublas::column_major> &in_I,
+								const ImageBufferView &in_I,
 								double in_x1, double in_y1,
 								double in_x2, double in_y2,
 								int	in_win);
 
 	static bool		findCorner(
-								const ublas::matrix<unsigned char, ublas::column_major> &in_I,
+								const ImageBufferView &in_I,
 								double in_x, double in_y,
 								int	in_wintx, int in_winty,
 								double *out_x, double *out_y);
+
+	static bool		findChessboard(
+								const ImageBufferView &in_I,
+								ublas::matrix<double, ublas::column_major> &out_x,
+								int	*out_n_sq_x, int *out_n_sq_y);
+
+	static bool		findCircleGrid(
+								const ImageBufferView &in_I,
+								double in_dX, double in_dY,
+								ublas::matrix<double, ublas::column_major> &out_XX,
+								ublas::matrix<double, ublas::column_major> &out_x,
+								ublas::matrix<double, ublas::column_major> &out_X,
+								ublas::vector<int> &out_result,
+								int	*out_n_sq_x, int *out_n_sq_y,
+								bool in_dark_circles = true);
 protected:
 };
 
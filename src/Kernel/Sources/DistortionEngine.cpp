@@ -0,0 +1,591 @@
+// =============================================================================
+//  DistortionEngine.cpp
+//
+//  MIT License
+//
+//  Copyright (c) 2007-2018 Dairoku Sekiguchi
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+// =============================================================================
+/*!
+	\file		DistortionEngine.cpp
+	\author		Dairoku Sekiguchi
+	\version	1.0
+	\date		2018/06/09
+	\brief		This file is a part of CalibraKernel
+*/
+
+// -----------------------------------------------------------------------------
+// 	include files
+// -----------------------------------------------------------------------------
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define	DISTORTION_ENGINE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include "DistortionEngine.hpp"
+
+//	The kernel templates must be inlined into the AVX functions below so that
+//	gcc compiles them with the AVX target
+#ifdef __GNUC__
+#define	KERNEL_INLINE	inline __attribute__((always_inline))
+#else
+#define	KERNEL_INLINE	inline
+#endif
+
+
+// -----------------------------------------------------------------------------
+// 	Vector types
+// -----------------------------------------------------------------------------
+//
+//	The kernels below are written once as templates with these types.
+//	N is the number of the points processed at once.
+//
+struct	ScalarVec
+{
+	enum { N = 1 };
+	double	v;
+
+	ScalarVec(double a) : v(a) {}
+	static ScalarVec	load(const double *p) { return ScalarVec(*p); }
+	static ScalarVec	set1(double a) { return ScalarVec(a); }
+	void				store(double *p) const { *p = v; }
+
+	//	Masks (1.0: true, 0.0: false)
+	static ScalarVec	le(const ScalarVec &a, const ScalarVec &b) { return ScalarVec(a.v <= b.v ? 1.0 : 0.0); }
+	static ScalarVec	select(const ScalarVec &m, const ScalarVec &a, const ScalarVec &b) { return (m.v != 0.0) ? a : b; }
+	int					count() const { return (v != 0.0) ? 1 : 0; }
+};
+
+inline ScalarVec	operator+(const ScalarVec &a, const ScalarVec &b) { return ScalarVec(a.v + b.v); }
+inline ScalarVec	operator-(const ScalarVec &a, const ScalarVec &b) { return ScalarVec(a.v - b.v); }
+inline ScalarVec	operator*(const ScalarVec &a, const ScalarVec &b) { return ScalarVec(a.v * b.v); }
+inline ScalarVec	operator/(const ScalarVec &a, const ScalarVec &b) { return ScalarVec(a.v / b.v); }
+
+#ifdef DISTORTION_ENGINE_X86
+struct	SSE2Vec
+{
+	enum { N = 2 };
+	__m128d	v;
+
+	SSE2Vec(__m128d a) : v(a) {}
+	static SSE2Vec		load(const double *p) { return SSE2Vec(_mm_loadu_pd(p)); }
+	static SSE2Vec		set1(double a) { return SSE2Vec(_mm_set1_pd(a)); }
+	void				store(double *p) const { _mm_storeu_pd(p, v); }
+
+	//	Masks (all bits set: true)
+	static SSE2Vec		le(const SSE2Vec &a, const SSE2Vec &b) { return SSE2Vec(_mm_cmple_pd(a.v, b.v)); }
+	static SSE2Vec		select(const SSE2Vec &m, const SSE2Vec &a, const SSE2Vec &b)
+							{ return SSE2Vec(_mm_or_pd(_mm_and_pd(m.v, a.v), _mm_andnot_pd(m.v, b.v))); }
+	int					count() const { int m = _mm_movemask_pd(v); return (m & 1) + ((m >> 1) & 1); }
+};
+
+inline SSE2Vec	operator+(const SSE2Vec &a, const SSE2Vec &b) { return SSE2Vec(_mm_add_pd(a.v, b.v)); }
+inline SSE2Vec	operator-(const SSE2Vec &a, const SSE2Vec &b) { return SSE2Vec(_mm_sub_pd(a.v, b.v)); }
+inline SSE2Vec	operator*(const SSE2Vec &a, const SSE2Vec &b) { return SSE2Vec(_mm_mul_pd(a.v, b.v)); }
+inline SSE2Vec	operator/(const SSE2Vec &a, const SSE2Vec &b) { return SSE2Vec(_mm_div_pd(a.v, b.v)); }
+#endif
+
+
+// -----------------------------------------------------------------------------
+// 	distortPoints
+// -----------------------------------------------------------------------------
+//
+//	Processes the first (inNum / V::N) * V::N points and returns the number of
+//	the processed points. The expressions are the same as apply_distortion.
+//
+template <class V>
+static KERNEL_INLINE void	distortVec(const V &x, const V &y, const double *in_kc, V &xd, V &yd)
+{
+	V	k1 = V::set1(in_kc[0]), k2 = V::set1(in_kc[1]);
+	V	p1 = V::set1(in_kc[2]), p2 = V::set1(in_kc[3]), k3 = V::set1(in_kc[4]);
+	V	one = V::set1(1.0), two = V::set1(2.0);
+
+	V	r2 = x * x + y * y;
+	V	r4 = r2 * r2;
+	V	r6 = r2 * r2 * r2;
+
+	V	cdist = one + k1 * r2 + k2 * r4 + k3 * r6;
+
+	V	a1 = two * x * y;
+	V	a2 = r2 + two * x * x;
+	V	a3 = r2 + two * y * y;
+
+	xd = x * cdist + (p1 * a1 + p2 * a2);
+	yd = y * cdist + (p1 * a3 + p2 * a1);
+}
+
+template <class V>
+static KERNEL_INLINE int	distortPoints(
+				int inNum,
+				const double *in_x, const double *in_y,
+				const double *in_kc,
+				double *out_xd, double *out_yd)
+{
+	int	i;
+
+	for (i = 0; i + V::N <= inNum; i += V::N)
+	{
+		V	xd = V::set1(0.0), yd = V::set1(0.0);
+
+		distortVec(V::load(in_x + i), V::load(in_y + i), in_kc, xd, yd);
+		xd.store(out_xd + i);
+		yd.store(out_yd + i);
+	}
+
+	return i;
+}
+
+
+// -----------------------------------------------------------------------------
+// 	undistortPoints
+// -----------------------------------------------------------------------------
+//
+//	The fixed point iteration is the same as comp_distortion_oulu. With the
+//	Newton step, x is updated by the inverse of the 2x2 jacobian of the
+//	distortion instead. A point stops when its update becomes smaller than
+//	inTolerance (the other points of the same vector are masked), so the
+//	result of a point does not depend on the SIMD type.
+//	The iterations are done for UNDISTORT_CHUNK_SIZE points at a time (the
+//	iteration loop outside the point loop, as comp_distortion_oulu does) so
+//	that the divisions of the different points can overlap.
+//
+#define	UNDISTORT_CHUNK_SIZE	64
+
+template <class V>
+static KERNEL_INLINE void	undistortVec(
+				const V &x, const V &y, const V &xd, const V &yd,
+				const double *in_kc, bool inIsNewtonStep,
+				V &x_new, V &y_new)
+{
+	V	k1 = V::set1(in_kc[0]), k2 = V::set1(in_kc[1]);
+	V	p1 = V::set1(in_kc[2]), p2 = V::set1(in_kc[3]), k3 = V::set1(in_kc[4]);
+	V	one = V::set1(1.0), two = V::set1(2.0);
+
+	if (inIsNewtonStep == false)
+	{
+		V	r_2 = x * x + y * y;
+		V	k_radial = one + k1 * r_2 + k2 * r_2 * r_2 + k3 * r_2 * r_2 * r_2;
+		V	delta_x0 = two * p1 * x * y + p2 * (r_2 + two * x * x);
+		V	delta_x1 = p1 * (r_2 + two * y * y) + two * p2 * x * y;
+		x_new = (xd - delta_x0) / k_radial;
+		y_new = (yd - delta_x1) / k_radial;
+		return;
+	}
+
+	V	three = V::set1(3.0), six = V::set1(6.0);
+	V	r2 = x * x + y * y;
+	V	r4 = r2 * r2;
+	V	cdist = one + k1 * r2 + k2 * r4 + k3 * r4 * r2;
+	V	dcdist = k1 + two * k2 * r2 + three * k3 * r4;	// d(cdist)/d(r2)
+
+	//	Residual of the distortion model
+	V	fx = V::set1(0.0), fy = V::set1(0.0);
+	distortVec(x, y, in_kc, fx, fy);
+	fx = fx - xd;
+	fy = fy - yd;
+
+	//	Jacobian (J12 == J21)
+	V	J11 = cdist + two * x * x * dcdist + two * p1 * y + six * p2 * x;
+	V	J12 = two * x * y * dcdist + two * p1 * x + two * p2 * y;
+	V	J22 = cdist + two * y * y * dcdist + six * p1 * y + two * p2 * x;
+	V	det = J11 * J22 - J12 * J12;
+
+	x_new = x - (J22 * fx - J12 * fy) / det;
+	y_new = y - (J11 * fy - J12 * fx) / det;
+}
+
+template <class V>
+static KERNEL_INLINE int	undistortPoints(
+				int inNum,
+				const double *in_xd, const double *in_yd,
+				const double *in_kc,
+				int inIterMax, double inTolerance, bool inIsNewtonStep,
+				double *out_x, double *out_y,
+				int *ioFailedNum)
+{
+	V		tol2 = V::set1(inTolerance * inTolerance);
+	bool	check_conv = (inTolerance > 0.0);
+	double	xd_chunk[UNDISTORT_CHUNK_SIZE], yd_chunk[UNDISTORT_CHUNK_SIZE];
+	double	done_chunk[UNDISTORT_CHUNK_SIZE];	// masks of the converged points
+	bool	active_chunk[UNDISTORT_CHUNK_SIZE];	// per vector
+	int		done = (inNum / V::N) * V::N;
+
+	for (int i0 = 0; i0 < done; i0 += UNDISTORT_CHUNK_SIZE)
+	{
+		int	num = (done - i0 < UNDISTORT_CHUNK_SIZE) ? (done - i0) : UNDISTORT_CHUNK_SIZE;
+		int	active_num = num / V::N;
+		int	i;
+
+		//	in_xd and out_x can be the same array
+		for (i = 0; i < num; i++)
+		{
+			xd_chunk[i] = in_xd[i0 + i];
+			yd_chunk[i] = in_yd[i0 + i];
+			out_x[i0 + i] = xd_chunk[i];	//	initial guess
+			out_y[i0 + i] = yd_chunk[i];
+			done_chunk[i] = 0.0;
+		}
+		for (i = 0; i < active_num; i++)
+			active_chunk[i] = true;
+
+		for (int j = 0; j < inIterMax && active_num > 0; j++)
+			for (i = 0; i < num; i += V::N)
+			{
+				if (active_chunk[i / V::N] == false)
+					continue;
+
+				V	x = V::load(out_x + i0 + i);
+				V	y = V::load(out_y + i0 + i);
+				V	x_new = x, y_new = y;
+
+				undistortVec(x, y, V::load(xd_chunk + i), V::load(yd_chunk + i),
+								in_kc, inIsNewtonStep, x_new, y_new);
+
+				if (check_conv == false)
+				{
+					x_new.store(out_x + i0 + i);
+					y_new.store(out_y + i0 + i);
+					continue;
+				}
+
+				V	done_mask = V::load(done_chunk + i);
+				V	ex = x_new - x;
+				V	ey = y_new - y;
+				V	conv = V::le(ex * ex + ey * ey, tol2);
+
+				//	The points that have already converged are not updated
+				V::select(done_mask, x, x_new).store(out_x + i0 + i);
+				V::select(done_mask, y, y_new).store(out_y + i0 + i);
+				done_mask = V::select(done_mask, done_mask, conv);
+				done_mask.store(done_chunk + i);
+
+				if (done_mask.count() == V::N)
+				{
+					active_chunk[i / V::N] = false;
+					active_num--;
+				}
+			}
+
+		if (check_conv)
+			for (i = 0; i < num; i += V::N)
+				*ioFailedNum += V::N - V::load(done_chunk + i).count();
+	}
+
+	return done;
+}
+
+
+// -----------------------------------------------------------------------------
+// 	projectPoints
+// -----------------------------------------------------------------------------
+//
+//	The expressions are the same as project_points2.
+//
+template <class V>
+static KERNEL_INLINE int	projectPoints(
+				int inNum,
+				const double *in_X, const double *in_Y, const double *in_Z,
+				const double *in_R, const double *in_T,
+				const double *in_fc, const double *in_cc, const double *in_kc,
+				double in_alpha_c,
+				double *out_u, double *out_v)
+{
+	V	one = V::set1(1.0);
+	V	alpha_c = V::set1(in_alpha_c);
+	int	i;
+
+	for (i = 0; i + V::N <= inNum; i += V::N)
+	{
+		V	X = V::load(in_X + i);
+		V	Y = V::load(in_Y + i);
+		V	Z = V::load(in_Z + i);
+
+		V	Y0 = V::set1(in_R[0]) * X + V::set1(in_R[1]) * Y + V::set1(in_R[2]) * Z + V::set1(in_T[0]);
+		V	Y1 = V::set1(in_R[3]) * X + V::set1(in_R[4]) * Y + V::set1(in_R[5]) * Z + V::set1(in_T[1]);
+		V	Y2 = V::set1(in_R[6]) * X + V::set1(in_R[7]) * Y + V::set1(in_R[8]) * Z + V::set1(in_T[2]);
+
+		V	inv_Z = one / Y2;
+		V	x = Y0 * inv_Z;
+		V	y = Y1 * inv_Z;
+
+		V	xd = V::set1(0.0), yd = V::set1(0.0);
+		distortVec(x, y, in_kc, xd, yd);
+
+		V	xd3 = xd + alpha_c * yd;
+		(xd3 * V::set1(in_fc[0]) + V::set1(in_cc[0])).store(out_u + i);
+		(yd * V::set1(in_fc[1]) + V::set1(in_cc[1])).store(out_v + i);
+	}
+
+	return i;
+}
+
+
+#ifdef DISTORTION_ENGINE_X86
+// -----------------------------------------------------------------------------
+// 	AVX kernels
+// -----------------------------------------------------------------------------
+//
+//	Only this part is compiled for AVX (gcc needs the target option for the
+//	256bit intrinsics, MSVC does not). It is called only when the CPU and
+//	the OS support AVX.
+//
+#if defined(__GNUC__) && !defined(__AVX__)
+#pragma GCC push_options
+#pragma GCC target("avx")
+#define	DISTORTION_ENGINE_POP_OPTIONS
+#endif
+
+struct	AVXVec
+{
+	enum { N = 4 };
+	__m256d	v;
+
+	AVXVec(__m256d a) : v(a) {}
+	static AVXVec		load(const double *p) { return AVXVec(_mm256_loadu_pd(p)); }
+	static AVXVec		set1(double a) { return AVXVec(_mm256_set1_pd(a)); }
+	void				store(double *p) const { _mm256_storeu_pd(p, v); }
+
+	//	Masks (all bits set: true)
+	static AVXVec		le(const AVXVec &a, const AVXVec &b) { return AVXVec(_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)); }
+	static AVXVec		select(const AVXVec &m, const AVXVec &a, const AVXVec &b) { return AVXVec(_mm256_blendv_pd(b.v, a.v, m.v)); }
+	int					count() const
+	{
+		int m = _mm256_movemask_pd(v);
+		return (m & 1) + ((m >> 1) & 1) + ((m >> 2) & 1) + ((m >> 3) & 1);
+	}
+};
+
+inline AVXVec	operator+(const AVXVec &a, const AVXVec &b) { return AVXVec(_mm256_add_pd(a.v, b.v)); }
+inline AVXVec	operator-(const AVXVec &a, const AVXVec &b) { return AVXVec(_mm256_sub_pd(a.v, b.v)); }
+inline AVXVec	operator*(const AVXVec &a, const AVXVec &b) { return AVXVec(_mm256_mul_pd(a.v, b.v)); }
+inline AVXVec	operator/(const AVXVec &a, const AVXVec &b) { return AVXVec(_mm256_div_pd(a.v, b.v)); }
+
+static int	distortPointsAVX(
+				int inNum,
+				const double *in_x, const double *in_y,
+				const double *in_kc,
+				double *out_xd, double *out_yd)
+{
+	return distortPoints<AVXVec>(inNum, in_x, in_y, in_kc, out_xd, out_yd);
+}
+
+static int	undistortPointsAVX(
+				int inNum,
+				const double *in_xd, const double *in_yd,
+				const double *in_kc,
+				int inIterMax, double inTolerance, bool inIsNewtonStep,
+				double *out_x, double *out_y,
+				int *ioFailedNum)
+{
+	return undistortPoints<AVXVec>(inNum, in_xd, in_yd, in_kc, inIterMax, inTolerance, inIsNewtonStep,
+									out_x, out_y, ioFailedNum);
+}
+
+static int	projectPointsAVX(
+				int inNum,
+				const double *in_X, const double *in_Y, const double *in_Z,
+				const double *in_R, const double *in_T,
+				const double *in_fc, const double *in_cc, const double *in_kc,
+				double in_alpha_c,
+				double *out_u, double *out_v)
+{
+	return projectPoints<AVXVec>(inNum, in_X, in_Y, in_Z, in_R, in_T,
+									in_fc, in_cc, in_kc, in_alpha_c, out_u, out_v);
+}
+
+#ifdef DISTORTION_ENGINE_POP_OPTIONS
+#pragma GCC pop_options
+#undef	DISTORTION_ENGINE_POP_OPTIONS
+#endif
+#endif	// #ifdef DISTORTION_ENGINE_X86
+
+
+// -----------------------------------------------------------------------------
+// 	detectSimdType
+// -----------------------------------------------------------------------------
+//
+static DistortionEngine::SimdType	detectSimdType()
+{
+#if defined(DISTORTION_ENGINE_X86) && defined(_MSC_VER)
+	int	info[4];
+
+	__cpuid(info, 1);
+	bool	sse2 = ((info[3] & (1 << 26)) != 0);
+	bool	osxsave = ((info[2] & (1 << 27)) != 0);
+	bool	avx = ((info[2] & (1 << 28)) != 0);
+
+	//	AVX also needs the OS support of the YMM registers
+	if (avx && osxsave && (_xgetbv(0) & 6) == 6)
+		return DistortionEngine::SIMD_AVX;
+	if (sse2)
+		return DistortionEngine::SIMD_SSE2;
+#elif defined(DISTORTION_ENGINE_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx"))
+		return DistortionEngine::SIMD_AVX;
+	if (__builtin_cpu_supports("sse2"))
+		return DistortionEngine::SIMD_SSE2;
+#endif
+	return DistortionEngine::SIMD_NONE;
+}
+
+static int	sSimdType = -1;	// -1: not selected yet (use the supported one)
+
+
+//  DistortionEngine class public member functions =============================
+// -----------------------------------------------------------------------------
+//	Distort
+// -----------------------------------------------------------------------------
+//
+void	DistortionEngine::Distort(
+								int inNum,
+								const double *in_x, const double *in_y,
+								const double *in_kc,
+								double *out_xd, double *out_yd)
+{
+	int	done = 0;
+
+	switch (GetSimdType())
+	{
+#ifdef DISTORTION_ENGINE_X86
+		case SIMD_AVX:
+			done = distortPointsAVX(inNum, in_x, in_y, in_kc, out_xd, out_yd);
+			break;
+		case SIMD_SSE2:
+			done = distortPoints<SSE2Vec>(inNum, in_x, in_y, in_kc, out_xd, out_yd);
+			break;
+#endif
+		default:
+			break;
+	}
+
+	//	The rest of the points
+	distortPoints<ScalarVec>(inNum - done, in_x + done, in_y + done, in_kc, out_xd + done, out_yd + done);
+}
+
+
+// -----------------------------------------------------------------------------
+//	Undistort
+// -----------------------------------------------------------------------------
+//
+int		DistortionEngine::Undistort(
+								int inNum,
+								const double *in_xd, const double *in_yd,
+								const double *in_kc,
+								int inIterMax, double inTolerance, bool inIsNewtonStep,
+								double *out_x, double *out_y)
+{
+	int	done = 0;
+	int	failedNum = 0;
+
+	switch (GetSimdType())
+	{
+#ifdef DISTORTION_ENGINE_X86
+		case SIMD_AVX:
+			done = undistortPointsAVX(inNum, in_xd, in_yd, in_kc, inIterMax, inTolerance, inIsNewtonStep,
+										out_x, out_y, &failedNum);
+			break;
+		case SIMD_SSE2:
+			done = undistortPoints<SSE2Vec>(inNum, in_xd, in_yd, in_kc, inIterMax, inTolerance, inIsNewtonStep,
+										out_x, out_y, &failedNum);
+			break;
+#endif
+		default:
+			break;
+	}
+
+	undistortPoints<ScalarVec>(inNum - done, in_xd + done, in_yd + done, in_kc, inIterMax, inTolerance, inIsNewtonStep,
+										out_x + done, out_y + done, &failedNum);
+	return failedNum;
+}
+
+
+// -----------------------------------------------------------------------------
+//	Project
+// -----------------------------------------------------------------------------
+//
+void	DistortionEngine::Project(
+								int inNum,
+								const double *in_X, const double *in_Y, const double *in_Z,
+								const double *in_R, const double *in_T,
+								const double *in_fc, const double *in_cc, const double *in_kc,
+								double in_alpha_c,
+								double *out_u, double *out_v)
+{
+	int	done = 0;
+
+	switch (GetSimdType())
+	{
+#ifdef DISTORTION_ENGINE_X86
+		case SIMD_AVX:
+			done = projectPointsAVX(inNum, in_X, in_Y, in_Z, in_R, in_T,
+									in_fc, in_cc, in_kc, in_alpha_c, out_u, out_v);
+			break;
+		case SIMD_SSE2:
+			done = projectPoints<SSE2Vec>(inNum, in_X, in_Y, in_Z, in_R, in_T,
+									in_fc, in_cc, in_kc, in_alpha_c, out_u, out_v);
+			break;
+#endif
+		default:
+			break;
+	}
+
+	projectPoints<ScalarVec>(inNum - done, in_X + done, in_Y + done, in_Z + done, in_R, in_T,
+									in_fc, in_cc, in_kc, in_alpha_c, out_u + done, out_v + done);
+}
+
+
+// -----------------------------------------------------------------------------
+//	GetSupportedSimdType
+// -----------------------------------------------------------------------------
+//
+DistortionEngine::SimdType	DistortionEngine::GetSupportedSimdType()
+{
+	static const SimdType	supportedType = detectSimdType();
+
+	return supportedType;
+}
+
+
+// -----------------------------------------------------------------------------
+//	GetSimdType
+// -----------------------------------------------------------------------------
+//
+DistortionEngine::SimdType	DistortionEngine::GetSimdType()
+{
+	if (sSimdType < 0)
+		return GetSupportedSimdType();
+	return (SimdType )sSimdType;
+}
+
+
+// -----------------------------------------------------------------------------
+//	SetSimdType
+// -----------------------------------------------------------------------------
+//
+void	DistortionEngine::SetSimdType(SimdType inType)
+{
+	if (inType > GetSupportedSimdType())
+		inType = GetSupportedSimdType();
+	sSimdType = inType;
+}
@@ -0,0 +1,100 @@
+// =============================================================================
+//  DistortionEngine.hpp
+//
+//  MIT License
+//
+//  Copyright (c) 2007-2018 Dairoku Sekiguchi
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+// =============================================================================
+/*!
+	\file		DistortionEngine.hpp
+	\author		Dairoku Sekiguchi
+	\version	1.0
+	\date		2018/06/09
+	\brief		This file is a part of CalibraKernel
+
+	Structure of arrays (x[] and y[] in separate arrays) version of the
+	projection and the distortion model (fc, cc, kc, alpha_c) of
+	CameraCalibration, with SSE2 and AVX kernels.
+*/
+
+#ifndef __DISTORTION_ENGINE_HPP
+#define __DISTORTION_ENGINE_HPP
+
+
+// -----------------------------------------------------------------------------
+// 	DistortionEngine class
+// -----------------------------------------------------------------------------
+//
+//	The SIMD type is detected at runtime and falls back to the scalar code on
+//	the CPUs without SSE2/AVX. All the kernels do exactly the same operations
+//	in the same order as the scalar code (no FMA), so the results do not
+//	depend on the SIMD type. The output arrays may be the same as the input
+//	arrays.
+//
+//	fc: 2 elements, cc: 2 elements, kc: 5 elements (k1, k2, p1, p2, k3)
+//
+class	DistortionEngine
+{
+public:
+	enum SimdType
+	{
+							SIMD_NONE			= 0,
+							SIMD_SSE2,
+							SIMD_AVX
+	};
+
+	//	Same as CameraCalibration::apply_distortion
+	static void				Distort(
+								int inNum,
+								const double *in_x, const double *in_y,
+								const double *in_kc,
+								double *out_xd, double *out_yd);
+
+	//	Inverse of Distort by the fixed point iteration of comp_distortion_oulu
+	//	or by Newton steps. Each point stops when its update is smaller than
+	//	inTolerance, or after inIterMax iterations. Returns the number of the
+	//	points that did not converge (inTolerance <= 0: no convergence test,
+	//	always inIterMax iterations and returns 0).
+	static int				Undistort(
+								int inNum,
+								const double *in_xd, const double *in_yd,
+								const double *in_kc,
+								int inIterMax, double inTolerance, bool inIsNewtonStep,
+								double *out_x, double *out_y);
+
+	//	Same as CameraCalibration::project_points2 without the derivatives
+	//	(in_R: row major 3x3 rotation matrix)
+	static void				Project(
+								int inNum,
+								const double *in_X, const double *in_Y, const double *in_Z,
+								const double *in_R, const double *in_T,
+								const double *in_fc, const double *in_cc, const double *in_kc,
+								double in_alpha_c,
+								double *out_u, double *out_v);
+
+	static SimdType			GetSupportedSimdType();
+	static SimdType			GetSimdType();
+	//	The type is limited to the supported one (SIMD_NONE is always accepted)
+	static void				SetSimdType(SimdType inType);
+};
+
+
+#endif	// #ifdef __DISTORTION_ENGINE_HPP
@@ -0,0 +1,110 @@
+// =============================================================================
+//  ImageBufferView.hpp
+//
+//  MIT License
+//
+//  Copyright (c) 2007-2018 Dairoku Sekiguchi
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+// =============================================================================
+/*!
+	\file		ImageBufferView.hpp
+	\author		Dairoku Sekiguchi
+	\version	1.0
+	\date		2018/06/17
+	\brief		This file is a part of CalibraKernel
+
+	Non-owning 8bit image view used by CornerFinder, so the image buffer
+	does not have to be copied into a ublas matrix.
+*/
+
+#ifndef __IMAGE_BUFFER_VIEW_HPP
+#define __IMAGE_BUFFER_VIEW_HPP
+
+
+// -----------------------------------------------------------------------------
+// 	ImageBufferView class
+// -----------------------------------------------------------------------------
+//
+//	The view is indexed like the ublas matrix of the image, I(row, column),
+//	so size1() is the height and size2() is the width. The pixel (row, column)
+//	is at origin + row * rowStep + column * columnStep, which covers both
+//	a column major ublas matrix and a (top-down or bottom-up) bitmap buffer.
+//	The view does not own the buffer and must not outlive it.
+//
+class	ImageBufferView
+{
+public:
+	//	constructor/destructor
+	//	inStride is the byte count between two rows (>= inWidth)
+	ImageBufferView(const unsigned char *inBuffer, int inWidth, int inHeight,
+					int inStride, bool inIsBottomUp = false)
+	{
+		mHeight = inHeight;
+		mWidth = inWidth;
+		mColumnStep = 1;
+		if (inIsBottomUp)
+		{
+			mOrigin = inBuffer + (inHeight - 1) * inStride;
+			mRowStep = -inStride;
+		}
+		else
+		{
+			mOrigin = inBuffer;
+			mRowStep = inStride;
+		}
+	}
+
+	//	not explicit on purpose: the ublas matrix can be passed where a view is expected
+	ImageBufferView(const ublas::matrix<unsigned char, ublas::column_major> &inMatrix)
+	{
+		mHeight = (int )inMatrix.size1();
+		mWidth = (int )inMatrix.size2();
+		mOrigin = (mHeight != 0 && mWidth != 0) ? &(inMatrix(0, 0)) : NULL;
+		mRowStep = 1;
+		mColumnStep = mHeight;
+	}
+
+	//	member functions
+	unsigned char	operator()(int inRow, int inColumn) const
+	{
+		return mOrigin[inRow * mRowStep + inColumn * mColumnStep];
+	}
+
+	const unsigned char	*ptr(int inRow, int inColumn) const
+	{
+		return mOrigin + inRow * mRowStep + inColumn * mColumnStep;
+	}
+
+	int		size1() const { return mHeight; }
+	int		size2() const { return mWidth; }
+	int		rowStep() const { return mRowStep; }
+	int		columnStep() const { return mColumnStep; }
+
+private:
+	//	member variables
+	const unsigned char		*mOrigin;
+	int						mHeight;
+	int						mWidth;
+	int						mRowStep;
+	int						mColumnStep;
+};
+
+
+#endif	// #ifdef __IMAGE_BUFFER_VIEW_HPP
@@ -61,10 +61,80 @@ namespace lapack = boost::numeric::bindings::lapack;
 
 #include "MultiCameraCalibration.hpp"
 #include "StereoCalibration.hpp"
+#include "ParallelTask.hpp"
 
 //bool	g_debug_enabled = false;
 
 
+// -----------------------------------------------------------------------------
+// 	PairCalibrationTask class
+// -----------------------------------------------------------------------------
+class	PairCalibrationTask : public ParallelTask
+{
+public:
+	PairCalibrationTask(MultiCameraCalibration *inCalibration)
+	{
+		mCalibration = inCalibration;
+	}
+
+	virtual void	ExecTask(int inIndex)
+	{
+		mCalibration->calibrateOnePair(inIndex);
+	}
+
+private:
+	MultiCameraCalibration	*mCalibration;
+};
+
+
+// -----------------------------------------------------------------------------
+// 	RecomputeBoardPoseTask class
+// -----------------------------------------------------------------------------
+//
+//	Recomputes the board pose of one view from the center camera with its
+//	current intrinsic parameters (same as RecomputeExtrinsicTask of
+//	CameraCalibration). The views the center camera did not see keep the
+//	joint estimate.
+//
+class	RecomputeBoardPoseTask : public ParallelTask
+{
+public:
+	RecomputeBoardPoseTask(MultiCameraCalibration *inCalibration, const SingleCameraResult &inCenter)
+		: mCenter(inCenter)
+	{
+		mCalibration = inCalibration;
+		mFailedNumList.resize(inCenter.X_list.size(), 0);
+	}
+
+	int		GetFailedNum() const
+	{
+		int	num = 0;
+		for (size_t i = 0; i < mFailedNumList.size(); i++)
+			num += mFailedNumList[i];
+		return num;
+	}
+
+	virtual void	ExecTask(int kk)
+	{
+		if (mCenter.X_list[kk].size2() == 0 || mCenter.x_list[kk].size2() == 0)
+			return;
+
+		ublas::matrix<double, ublas::column_major>	Rckk(3, 3);
+		ublas::matrix<double, ublas::column_major>	JJ_kk(2 * mCenter.x_list[kk].size2(), 6);
+
+		mFailedNumList[kk] = mCalibration->computeExtrinsicInit(mCenter.x_list[kk], mCenter.X_list[kk],
+									mCalibration->omc_list[kk], mCalibration->Tc_list[kk], Rckk);
+		mCalibration->computeExtrinsicRefine(mCenter.x_list[kk], mCenter.X_list[kk],
+									mCalibration->omc_list[kk], mCalibration->Tc_list[kk], Rckk, JJ_kk);
+	}
+
+private:
+	MultiCameraCalibration		*mCalibration;
+	const SingleCameraResult	&mCenter;
+	std::vector<int>			mFailedNumList;
+};
+
+
 //  MultiCameraCalibration class public member functions ===========================
 // -----------------------------------------------------------------------------
 //	MultiCameraCalibration
@@ -74,6 +144,9 @@ MultiCameraCalibration::MultiCameraCalibration(int inImageWidth, int inImageHeig
 	: CameraCalibration(inImageWidth, inImageHeight)
 {
 	//	̃p[^
+	mCenterCameraIndex = 0;
+	mIsJointOptimization = true;
+	mCalibrationStatus = STATUS_NOT_CALIBRATED;
 }
 
 
@@ -90,19 +163,65 @@ MultiCameraCalibration::~MultiCameraCalibration()
 //	DoCalibration
 // -----------------------------------------------------------------------------
 //
+//	All the cameras are calibrated at once. The parameters are the intrinsics
+//	of every camera, the pose of every camera with respect to the center camera
+//	and the board poses (in the center camera coordinate) shared by all cameras.
+//
 void	MultiCameraCalibration::DoCalibration()
 {
 	int	cameraNum = mCalibrationResults.size();
-	if (mCenterCameraIndex >= cameraNum)
+	if (mCenterCameraIndex < 0 || mCenterCameraIndex >= cameraNum)
 	{
-		printf("ASSERT: mCenterCameraIndex >= cameraNum MultiCameraCalibration::doCalibration()\n");
+		mCalibrationStatus = STATUS_INVALID_CENTER_CAMERA;
+		printf("ERROR: %s in MultiCameraCalibration::DoCalibration()\n", GetStatusString(mCalibrationStatus));
 		return;
 	}
 
+	int	i, j, c;
+	int	n_ima = mCalibrationResults[mCenterCameraIndex].X_list.size();
+	for (c = 0; c < cameraNum; c++)
+	{
+		SingleCameraResult	&result = mCalibrationResults[c];
+		if ((int )result.X_list.size() != n_ima || (int )result.x_list.size() != n_ima ||
+			(int )result.omc_list.size() != n_ima || (int )result.Tc_list.size() != n_ima)
+		{
+			mCalibrationStatus = STATUS_VIEW_NUM_MISMATCH;
+			printf("ERROR: %s (camera %d) in MultiCameraCalibration::DoCalibration()\n",
+				GetStatusString(mCalibrationStatus), c);
+			return;
+		}
+	}
+
+	//	Every camera needs views in common with the center camera for its pose
+	std::vector<int>	commonNumList(cameraNum - 1, 0);
+	for (i = 0; i < cameraNum - 1; i++)
+	{
+		for (j = 0; j < n_ima; j++)
+			if (isViewSeen(0, j) && isViewSeen(i + 1, j))
+				commonNumList[i]++;
+		if (commonNumList[i] == 0)
+		{
+			mCalibrationStatus = STATUS_NO_COMMON_VIEW;
+			printf("ERROR: %s (camera %d) in MultiCameraCalibration::DoCalibration()\n",
+				GetStatusString(mCalibrationStatus), getPairCameraIndex(i));
+			return;
+		}
+	}
+
 	T_list.resize(cameraNum - 1);
 	om_list.resize(cameraNum - 1);
 	R_list.resize(cameraNum - 1);
 
+	fc_left_list.resize(cameraNum - 1);
+	cc_left_list.resize(cameraNum - 1);
+	kc_left_list.resize(cameraNum - 1);
+	alpha_c_left_list.resize(cameraNum - 1);
+
+	fc_right_list.resize(cameraNum - 1);
+	cc_right_list.resize(cameraNum - 1);
+	kc_right_list.resize(cameraNum - 1);
+	alpha_c_right_list.resize(cameraNum - 1);
+
 	fc_left_error_list.resize(cameraNum - 1);
 	cc_left_error_list.resize(cameraNum - 1);
 	kc_left_error_list.resize(cameraNum - 1);
@@ -116,75 +235,189 @@ void	MultiCameraCalibration::DoCalibration()
 	T_error_list.resize(cameraNum - 1);
 	om_error_list.resize(cameraNum - 1);
 
-	StereoCalibration	calibrationPair(mImageWidth, mImageHeight);
-	int	i, count;
+	if (mIsJointOptimization == false)
+	{
+		//	Calibrate each pair independently. The pairs do not share anything,
+		//	so they are dispatched to the worker threads
+		PairCalibrationTask	task(this);
+		ParallelTask::Run(&task, cameraNum - 1, mWorkerThreadNum);
 
-	if (mCenterCameraIndex != 0)
-		count = 0;
-	else
-		count = 1;
+		mCalibrationStatus = STATUS_SUCCEEDED;
+		DumpResults();
+		return;
+	}
 
-	for (i = 0; i < cameraNum - 1; i++, count++)
+	SingleCameraResult	&center = mCalibrationResults[mCenterCameraIndex];
+
+	//	Initial value of the camera poses (same as StereoCalibration::DoCalibration)
+	//	from the views seen by the both cameras
+	ublas::matrix<double, ublas::column_major>	R_left(3, 3);
+	ublas::matrix<double, ublas::column_major>	R_right(3, 3);
+	ublas::matrix<double, ublas::column_major>	R_ref(3, 3);
+	ublas::matrix<double, ublas::column_major>	jacobian(9, 3);
+	ublas::matrix<double, ublas::column_major>	T_ref(3, 1);
+	ublas::matrix<double, ublas::column_major>	om_ref(3, 1);
+
+	for (i = 0; i < cameraNum - 1; i++)
 	{
-		printf("Calibrating Camera Pair %d and %d\n", mCenterCameraIndex, count);
-
-		calibrationPair.x_left_list = mCalibrationResults[mCenterCameraIndex].x_list;
-		calibrationPair.X_left_list = mCalibrationResults[mCenterCameraIndex].X_list;
-		calibrationPair.omc_left_list = mCalibrationResults[mCenterCameraIndex].omc_list;
-		calibrationPair.Tc_left_list = mCalibrationResults[mCenterCameraIndex].Tc_list;
-		calibrationPair.fc_left = mCalibrationResults[mCenterCameraIndex].fc;
-		calibrationPair.cc_left = mCalibrationResults[mCenterCameraIndex].cc;
-		calibrationPair.kc_left = mCalibrationResults[mCenterCameraIndex].kc;
-		calibrationPair.alpha_c_left = mCalibrationResults[mCenterCameraIndex].alpha_c;
-
-		calibrationPair.x_right_list = mCalibrationResults[count].x_list;
-		calibrationPair.X_right_list = mCalibrationResults[count].X_list;
-		calibrationPair.omc_right_list = mCalibrationResults[count].omc_list;
-		calibrationPair.Tc_right_list = mCalibrationResults[count].Tc_list;
-		calibrationPair.fc_right = mCalibrationResults[count].fc;
-		calibrationPair.cc_right = mCalibrationResults[count].cc;
-		calibrationPair.kc_right = mCalibrationResults[count].kc;
-		calibrationPair.alpha_c_right = mCalibrationResults[count].alpha_c;
-
-		calibrationPair.DoCalibration();
-
-		T_list[i] = calibrationPair.T;
-		om_list[i] = calibrationPair.om;
-		R_list[i] = calibrationPair.R;
-
-		fc_left_list[i] = calibrationPair.fc_left;
-		cc_left_list[i] = calibrationPair.cc_left;
-		kc_left_list[i] = calibrationPair.kc_left;
-		alpha_c_left_list[i] = calibrationPair.alpha_c_left;
-
-		fc_right_list[i] = calibrationPair.fc_right;
-		cc_right_list[i] = calibrationPair.cc_right;
-		kc_right_list[i] = calibrationPair.kc_right;
-		alpha_c_right_list[i] = calibrationPair.alpha_c_right;
-
-		fc_left_error_list[i] = calibrationPair.fc_left_error;
-		cc_left_error_list[i] = calibrationPair.cc_left_error;
-		kc_left_error_list[i] = calibrationPair.kc_left_error;
-		alpha_c_left_error_list[i] = calibrationPair.alpha_c_left_error;
-
-		fc_right_error_list[i] = calibrationPair.fc_right_error;
-		cc_right_error_list[i] = calibrationPair.cc_right_error;
-		kc_right_error_list[i] = calibrationPair.kc_right_error;
-		alpha_c_right_error_list[i] = calibrationPair.alpha_c_right_error;
-
-		T_error_list[i] = calibrationPair.T_error;
-		om_error_list[i] = calibrationPair.om_error;
-
-		if (i + 1 != mCenterCameraIndex)
-			count++;
-		else
-			count+=2;
+		SingleCameraResult	&result = getCameraResult(i + 1);
+		ublas::matrix<double, ublas::column_major>	T_ref_list(3, commonNumList[i]);
+		ublas::matrix<double, ublas::column_major>	om_ref_list(3, commonNumList[i]);
+		int	n = 0;
+
+		for (j = 0; j < n_ima; j++)
+		{
+			if (isViewSeen(0, j) == false || isViewSeen(i + 1, j) == false)
+				continue;
+
+			rodrigues(center.omc_list[j], R_left, jacobian);
+			rodrigues(result.omc_list[j], R_right, jacobian);
+			R_ref = ublas::prod(R_right, ublas::trans(R_left));
+			T_ref = result.Tc_list[j] - ublas::prod(R_ref, center.Tc_list[j]);
+			rodrigues(R_ref, om_ref, jacobian);
+
+			for (c = 0; c < 3; c++)
+			{
+				om_ref_list(c, n) = om_ref(c, 0);
+				T_ref_list(c, n) = T_ref(c, 0);
+			}
+			n++;
+		}
+
+		//	Robust estimate of the initial value for rotation and translation between the two views:
+		om_list[i] = ublas::matrix<double, ublas::column_major>(3, 1);
+		T_list[i] = ublas::matrix<double, ublas::column_major>(3, 1);
+		mat_median(om_ref_list, om_list[i], 2);
+		mat_median(T_ref_list, T_list[i], 2);
+
+		fc_right_list[i] = result.fc;
+		cc_right_list[i] = result.cc;
+		kc_right_list[i] = result.kc;
+		alpha_c_right_list[i] = result.alpha_c;
 	}
 
+	//	The board poses are the ones of the center camera. The views the center
+	//	camera did not see are brought from the first camera that saw them
+	//	(X_i = R_i * X_c + T_i, so R_c = R_i' * R_board_i, T_c = R_i' * (T_board_i - T_i)).
+	//	The views no camera saw stay at zero and are not optimized.
+	omc_list.resize(n_ima);
+	Tc_list.resize(n_ima);
+	for (j = 0; j < n_ima; j++)
+	{
+		omc_list[j] = ublas::zero_matrix<double>(3, 1);
+		Tc_list[j] = ublas::zero_matrix<double>(3, 1);
+		if (isViewSeen(0, j))
+		{
+			omc_list[j] = center.omc_list[j];
+			Tc_list[j] = center.Tc_list[j];
+			continue;
+		}
+
+		for (i = 0; i < cameraNum - 1; i++)
+		{
+			if (isViewSeen(i + 1, j) == false)
+				continue;
+
+			SingleCameraResult	&result = getCameraResult(i + 1);
+			rodrigues(om_list[i], R_ref, jacobian);
+			rodrigues(result.omc_list[j], R_right, jacobian);
+			R_left = ublas::prod(ublas::trans(R_ref), R_right);
+			rodrigues(R_left, omc_list[j], jacobian);
+			T_ref = result.Tc_list[j] - T_list[i];
+			Tc_list[j] = ublas::prod(ublas::trans(R_ref), T_ref);
+			break;
+		}
+	}
+
+	fc = center.fc;
+	cc = center.cc;
+	kc = center.kc;
+	alpha_c = center.alpha_c;
+
+	mainOptimization();
+
+	mCalibrationStatus = STATUS_SUCCEEDED;
 	DumpResults();
 }
 
 
+// -----------------------------------------------------------------------------
+//	calibrateOnePair
+// -----------------------------------------------------------------------------
+//
+//	Calibrates the center camera and the inPairIndex-th camera as a stereo pair.
+//	This is called from the worker threads, so the result lists must be resized
+//	before and only the inPairIndex-th elements are written here.
+//
+void	MultiCameraCalibration::calibrateOnePair(int inPairIndex)
+{
+	int	i = inPairIndex;
+	int	pairCameraIndex = getPairCameraIndex(i);
+	StereoCalibration	calibrationPair(mImageWidth, mImageHeight);
+
+	printf("Calibrating Camera Pair %d and %d\n", mCenterCameraIndex, pairCameraIndex);
+
+	//	Only the views seen by the both cameras
+	SingleCameraResult	&left = mCalibrationResults[mCenterCameraIndex];
+	SingleCameraResult	&right = mCalibrationResults[pairCameraIndex];
+	for (int kk = 0; kk < (int )left.X_list.size(); kk++)
+	{
+		if (isViewSeen(0, kk) == false || isViewSeen(i + 1, kk) == false)
+			continue;
+
+		calibrationPair.x_left_list.push_back(left.x_list[kk]);
+		calibrationPair.X_left_list.push_back(left.X_list[kk]);
+		calibrationPair.omc_left_list.push_back(left.omc_list[kk]);
+		calibrationPair.Tc_left_list.push_back(left.Tc_list[kk]);
+
+		calibrationPair.x_right_list.push_back(right.x_list[kk]);
+		calibrationPair.X_right_list.push_back(right.X_list[kk]);
+		calibrationPair.omc_right_list.push_back(right.omc_list[kk]);
+		calibrationPair.Tc_right_list.push_back(right.Tc_list[kk]);
+	}
+
+	calibrationPair.fc_left = mCalibrationResults[mCenterCameraIndex].fc;
+	calibrationPair.cc_left = mCalibrationResults[mCenterCameraIndex].cc;
+	calibrationPair.kc_left = mCalibrationResults[mCenterCameraIndex].kc;
+	calibrationPair.alpha_c_left = mCalibrationResults[mCenterCameraIndex].alpha_c;
+
+	calibrationPair.fc_right = mCalibrationResults[pairCameraIndex].fc;
+	calibrationPair.cc_right = mCalibrationResults[pairCameraIndex].cc;
+	calibrationPair.kc_right = mCalibrationResults[pairCameraIndex].kc;
+	calibrationPair.alpha_c_right = mCalibrationResults[pairCameraIndex].alpha_c;
+
+	calibrationPair.mOptimizationMethod = mOptimizationMethod;
+	calibrationPair.DoCalibration();
+
+	T_list[i] = calibrationPair.T;
+	om_list[i] = calibrationPair.om;
+	R_list[i] = calibrationPair.R;
+
+	fc_left_list[i] = calibrationPair.fc_left;
+	cc_left_list[i] = calibrationPair.cc_left;
+	kc_left_list[i] = calibrationPair.kc_left;
+	alpha_c_left_list(i) = calibrationPair.alpha_c_left;
+
+	fc_right_list[i] = calibrationPair.fc_right;
+	cc_right_list[i] = calibrationPair.cc_right;
+	kc_right_list[i] = calibrationPair.kc_right;
+	alpha_c_right_list(i) = calibrationPair.alpha_c_right;
+
+	fc_left_error_list[i] = calibrationPair.fc_left_error;
+	cc_left_error_list[i] = calibrationPair.cc_left_error;
+	kc_left_error_list[i] = calibrationPair.kc_left_error;
+	alpha_c_left_error_list(i) = calibrationPair.alpha_c_left_error;
+
+	fc_right_error_list[i] = calibrationPair.fc_right_error;
+	cc_right_error_list[i] = calibrationPair.cc_right_error;
+	kc_right_error_list[i] = calibrationPair.kc_right_error;
+	alpha_c_right_error_list(i) = calibrationPair.alpha_c_right_error;
+
+	T_error_list[i] = calibrationPair.T_error;
+	om_error_list[i] = calibrationPair.om_error;
+}
+
+
 // -----------------------------------------------------------------------------
 //	DumpResults
 // -----------------------------------------------------------------------------
@@ -192,25 +425,47 @@ void	MultiCameraCalibration::DumpResults()
 {
 	//	łɃLu[VĂ邩ǂC`FbNׂ
 	
-	int	cameraNum = mCalibrationResults.size();
-	int	i, count;
+	if (mCalibrationStatus != STATUS_SUCCEEDED)
+	{
+		printf("%s\n", GetStatusString(mCalibrationStatus));
+		return;
+	}
 
-	if (mCenterCameraIndex != 0)
-		count = 0;
-	else
-		count = 1;
+	int	cameraNum = mCalibrationResults.size();
+	int	i;
 
-	for (i = 0; i < cameraNum - 1; i++, count++)
+	for (i = 0; i < cameraNum - 1; i++)
 	{
-		printf("Calibrating Camera Pair %d and %d\n", mCenterCameraIndex, count);
+		if (mIsJointOptimization)
+			printf("Joint Calibration: Camera %d wrt Camera %d (center)\n", getPairCameraIndex(i), mCenterCameraIndex);
+		else
+			printf("Calibrating Camera Pair %d and %d\n", mCenterCameraIndex, getPairCameraIndex(i));
 
 		dumpOnePairResults(i);
+	}
+}
 
-		if (i + 1 != mCenterCameraIndex)
-			count++;
-		else
-			count+=2;
+
+// -----------------------------------------------------------------------------
+//	GetStatusString
+// -----------------------------------------------------------------------------
+//
+const char	*MultiCameraCalibration::GetStatusString(int inStatus)
+{
+	switch (inStatus)
+	{
+		case STATUS_NOT_CALIBRATED:
+			return "Not calibrated yet";
+		case STATUS_SUCCEEDED:
+			return "Succeeded";
+		case STATUS_INVALID_CENTER_CAMERA:
+			return "The center camera index is out of range";
+		case STATUS_VIEW_NUM_MISMATCH:
+			return "The number of the views is different between the cameras";
+		case STATUS_NO_COMMON_VIEW:
+			return "The camera has no view in common with the center camera";
 	}
+	return "Unknown status";
 }
 
 
@@ -268,3 +523,659 @@ void	MultiCameraCalibration::dumpOnePairResults(int inIndex)
 std::cout << "Note: The numerical errors are approximately three times the standard deviations (for reference)." << std::endl;
 //std::cout << "Suggested threshold = " << std::endl;
 }
+
+
+#define	MAIN_OPTIMIZATION_CHANGE_MIN	5e-6
+#define	MAIN_OPTIMIZATION_ITER_MAX		100
+
+#define	LM_ITER_MAX			100
+#define	LM_MU_INIT			1e-3
+#define	LM_GRADIENT_MIN		1e-9
+#define	LM_STEP_MIN			1e-10
+
+
+//  MultiCameraCalibration class protected member functions ===================
+// -----------------------------------------------------------------------------
+//	mainOptimization
+// -----------------------------------------------------------------------------
+//
+//	Parameter layout (shared part):
+//		0 - 9						intrinsics of the center camera (fc, cc, alpha_c, kc)
+//		10 + 10 * i - 19 + 10 * i	intrinsics of the i-th pair camera
+//		10 * cameraNum + 6 * i		om and T of the i-th pair camera
+//	and omckk, Tckk of each board pose. J'*J is an arrow matrix like the one of
+//	StereoCalibration::mainOptimization, so it is solved by schur_solve.
+//
+void	MultiCameraCalibration::mainOptimization()
+{
+	int	i, j, kk, s;
+	int	cameraNum = mCalibrationResults.size();
+	int	n_ima = omc_list.size();
+	int	n_global = 10 * cameraNum + 6 * (cameraNum - 1);
+	int	n_param = n_global + 6 * n_ima;
+
+	ublas::vector<double>	selected_variables(n_global);
+	ublas::vector<double>	param(n_param);
+
+	selected_variables.clear();
+	for (s = 0; s < cameraNum; s++)
+	{
+		selected_variables(10 * s + 0) = 1.0;	// est_fc
+		selected_variables(10 * s + 1) = 1.0;	// est_fc
+		selected_variables(10 * s + 2) = 1.0;	// center optimizaion x
+		selected_variables(10 * s + 3) = 1.0;	// center optimizaion y
+		selected_variables(10 * s + 4) = 0.0;	// est_alpha
+		selected_variables(10 * s + 5) = 1.0;	// est_dist
+		selected_variables(10 * s + 6) = 1.0;	// est_dist
+		selected_variables(10 * s + 7) = 1.0;	// est_dist
+		selected_variables(10 * s + 8) = 1.0;	// est_dist
+		selected_variables(10 * s + 9) = 0.0;	// est_dist
+	}
+	for (i = 10 * cameraNum; i < n_global; i++)
+		selected_variables(i) = 1.0;
+
+	std::vector<int>	ind_global;
+	for (i = 0; i < n_global; i++)
+		if (selected_variables(i) != 0.0)
+			ind_global.push_back(i);
+	int	n_sel = (int )ind_global.size();
+
+	std::vector<ublas::matrix<double, ublas::column_major> >	J2_view_list(n_ima);
+	std::vector<ublas::matrix<double, ublas::column_major> >	Je_view_list(n_ima);
+
+	ublas::matrix<double, ublas::column_major>	J2_dash(n_sel, n_sel);
+	ublas::matrix<double, ublas::column_major>	Je_dash(n_sel, 1);
+	std::vector<ublas::matrix<double, ublas::column_major> >	J2_cross_dash_list(n_ima);
+	ublas::matrix<double, ublas::column_major>	param_update(n_sel, 1);
+	std::vector<ublas::matrix<double, ublas::column_major> >	param_update_view_list(n_ima);
+	ublas::matrix<double, ublas::column_major>	J2_inv(n_sel, n_sel);
+	std::vector<ublas::matrix<double, ublas::column_major> >	J2_view_inv_list(n_ima);
+
+	//	Running sums of e for sigma_x (std(e(:)))
+	int		e_num = 0;
+	double	e_sum = 0.0;
+	double	e_sum2 = 0.0;
+
+	double	change = 1.0;
+	int		iter = 0;
+
+	mUndistortFailedNum = 0;
+
+	if (mOptimizationMethod == OPTIMIZATION_LEVENBERG_MARQUARDT)
+	{
+		//	Levenberg-Marquardt (same as StereoCalibration::mainOptimization)
+		ublas::vector<double>	param_new(n_param);
+		ublas::matrix<double, ublas::column_major>	J2_damp(n_sel, n_sel);
+		std::vector<ublas::matrix<double, ublas::column_major> >	J2_view_damp_list(n_ima);
+		double	mu = LM_MU_INIT;
+		double	nu = 2.0;
+		double	e2, e2_new;
+
+		getParam(param);
+		buildNormalEquation(ind_global, J2_dash, Je_dash, J2_view_list, J2_cross_dash_list, Je_view_list,
+							e_num, e_sum, e_sum2);
+		e2 = e_sum2;
+
+		while (iter < LM_ITER_MAX)
+		{
+			//	Gradient (J'e) test
+			double	g_max = 0.0;
+			for (i = 0; i < n_sel; i++)
+				if (fabs(Je_dash(i, 0)) > g_max)
+					g_max = fabs(Je_dash(i, 0));
+			for (kk = 0; kk < n_ima; kk++)
+				for (j = 0; j < 6; j++)
+					if (fabs(Je_view_list[kk](j, 0)) > g_max)
+						g_max = fabs(Je_view_list[kk](j, 0));
+			if (g_max <= LM_GRADIENT_MIN)
+				break;
+
+			J2_damp = J2_dash;
+			for (i = 0; i < n_sel; i++)
+				J2_damp(i, i) += mu * J2_dash(i, i);
+			for (kk = 0; kk < n_ima; kk++)
+			{
+				J2_view_damp_list[kk] = J2_view_list[kk];
+				for (j = 0; j < 6; j++)
+					J2_view_damp_list[kk](j, j) += mu * J2_view_list[kk](j, j);
+			}
+
+			schur_solve(J2_damp, Je_dash, J2_view_damp_list, J2_cross_dash_list, Je_view_list,
+						param_update, param_update_view_list, J2_inv, J2_view_inv_list);
+
+			//	Trial parameters and the predicted reduction h' (J'e + mu * diag(J'J) h)
+			double	h_norm2 = 0.0;
+			double	p_norm2 = 0.0;
+			double	predicted = 0.0;
+			param_new = param;
+			for (i = 0; i < n_sel; i++)
+			{
+				double	h = param_update(i, 0);
+				param_new(ind_global[i]) += h;
+				h_norm2 += h * h;
+				p_norm2 += param(ind_global[i]) * param(ind_global[i]);
+				predicted += h * (Je_dash(i, 0) + mu * J2_dash(i, i) * h);
+			}
+			for (kk = 0; kk < n_ima; kk++)
+				for (j = 0; j < 6; j++)
+				{
+					double	h = param_update_view_list[kk](j, 0);
+					param_new(n_global + kk * 6 + j) += h;
+					h_norm2 += h * h;
+					p_norm2 += param(n_global + kk * 6 + j) * param(n_global + kk * 6 + j);
+					predicted += h * (Je_view_list[kk](j, 0) + mu * J2_view_list[kk](j, j) * h);
+				}
+
+			//	Step norm test
+			if (sqrt(h_norm2) <= LM_STEP_MIN * (sqrt(p_norm2) + LM_STEP_MIN))
+				break;
+
+			setParam(param_new);
+			e2_new = computeError2();
+
+			double	rho = (e2 - e2_new) / predicted;
+			if (rho > 0.0)
+			{
+				//	Accepted: the normal equation at the new parameters
+				param = param_new;
+				buildNormalEquation(ind_global, J2_dash, Je_dash, J2_view_list, J2_cross_dash_list, Je_view_list,
+									e_num, e_sum, e_sum2);
+				e2 = e_sum2;
+
+				double	scale = 1.0 - pow(2.0 * rho - 1.0, 3.0);
+				mu = mu * ((scale > 1.0 / 3.0) ? scale : 1.0 / 3.0);
+				nu = 2.0;
+			}
+			else
+			{
+				//	Rejected
+				setParam(param);
+				mu = mu * nu;
+				nu = nu * 2.0;
+			}
+
+			iter++;
+		}
+
+		//	inv(S) without the damping for the uncertainties
+		schur_solve(J2_dash, Je_dash, J2_view_list, J2_cross_dash_list, Je_view_list,
+					param_update, param_update_view_list, J2_inv, J2_view_inv_list);
+	}
+	else
+	{
+		while (	change > MAIN_OPTIMIZATION_CHANGE_MIN &&
+				iter < MAIN_OPTIMIZATION_ITER_MAX)
+		{
+			getParam(param);
+			buildNormalEquation(ind_global, J2_dash, Je_dash, J2_view_list, J2_cross_dash_list, Je_view_list,
+								e_num, e_sum, e_sum2);
+
+			schur_solve(J2_dash, Je_dash, J2_view_list, J2_cross_dash_list, Je_view_list,
+						param_update, param_update_view_list, J2_inv, J2_view_inv_list);
+
+			for (i = 0; i < n_sel; i++)
+				param(ind_global[i]) = param(ind_global[i]) + param_update(i, 0);
+			for (kk = 0; kk < n_ima; kk++)
+				for (j = 0; j < 6; j++)
+					param(n_global + kk * 6 + j) = param(n_global + kk * 6 + j) + param_update_view_list[kk](j, 0);
+
+			//	Change on the camera poses
+			ublas::vector<double>	temp_vec(6 * (cameraNum - 1));
+			ublas::vector<double>	temp_vec2(6 * (cameraNum - 1));
+			for (i = 0; i < cameraNum - 1; i++)
+				for (j = 0; j < 3; j++)
+				{
+					temp_vec(6 * i + j) = param(10 * cameraNum + 6 * i + 3 + j);
+					temp_vec(6 * i + 3 + j) = param(10 * cameraNum + 6 * i + j);
+					temp_vec2(6 * i + j) = temp_vec(6 * i + j) - T_list[i](j, 0);
+					temp_vec2(6 * i + 3 + j) = temp_vec(6 * i + 3 + j) - om_list[i](j, 0);
+				}
+
+			setParam(param);
+
+			change = mat_norm(temp_vec2) / mat_norm(temp_vec);
+
+			//	Second step: recompute the board poses from the center camera only
+			//	(same as the recompute_extrinsic step of CameraCalibration::mainOptimization)
+			recomputeBoardPoses();
+
+			iter++;
+		}
+	}
+
+	mOptimizationIterNum = iter;
+
+std::cout << "done" << std::endl;
+
+std::cout << "Estimation of uncertainties..." << std::endl;
+
+	//	sigma_x = std(e(:))
+	double	e_avg = e_sum / (double )e_num;
+	double	sigma_x = sqrt((e_sum2 - e_sum * e_avg) / (double )(e_num - 1));	// matlab̕W΍͕ꂪn-1
+
+	//	Only the shared block of inv(J2) is needed here (= inverse of the Schur complement)
+	ublas::vector<double>	param_error(n_global);
+	param_error.clear();
+	for (i = 0; i < n_sel; i++)
+		param_error(ind_global[i]) = 3.0 * sqrt(J2_inv(i, i)) * sigma_x;
+
+	fc_error = ublas::vector<double>(2);
+	cc_error = ublas::vector<double>(2);
+	kc_error = ublas::vector<double>(5);
+	fc_error(0) = param_error(0);
+	fc_error(1) = param_error(1);
+	cc_error(0) = param_error(2);
+	cc_error(1) = param_error(3);
+	alpha_c_error = param_error(4);
+	for (j = 0; j < 5; j++)
+		kc_error(j) = param_error(5 + j);
+
+	ublas::matrix<double, ublas::column_major>	jacobian(9, 3);
+
+	for (i = 0; i < cameraNum - 1; i++)
+	{
+		s = i + 1;
+
+		//	The center camera is the left camera of every pair
+		fc_left_list[i] = fc;
+		cc_left_list[i] = cc;
+		kc_left_list[i] = kc;
+		alpha_c_left_list(i) = alpha_c;
+
+		fc_left_error_list[i] = fc_error;
+		cc_left_error_list[i] = cc_error;
+		kc_left_error_list[i] = kc_error;
+		alpha_c_left_error_list(i) = alpha_c_error;
+
+		fc_right_error_list[i] = ublas::vector<double>(2);
+		cc_right_error_list[i] = ublas::vector<double>(2);
+		kc_right_error_list[i] = ublas::vector<double>(5);
+		fc_right_error_list[i](0) = param_error(10 * s + 0);
+		fc_right_error_list[i](1) = param_error(10 * s + 1);
+		cc_right_error_list[i](0) = param_error(10 * s + 2);
+		cc_right_error_list[i](1) = param_error(10 * s + 3);
+		alpha_c_right_error_list(i) = param_error(10 * s + 4);
+		for (j = 0; j < 5; j++)
+			kc_right_error_list[i](j) = param_error(10 * s + 5 + j);
+
+		om_error_list[i] = ublas::matrix<double, ublas::column_major>(3, 1);
+		T_error_list[i] = ublas::matrix<double, ublas::column_major>(3, 1);
+		for (j = 0; j < 3; j++)
+		{
+			om_error_list[i](j, 0) = param_error(10 * cameraNum + 6 * i + j);
+			T_error_list[i](j, 0) = param_error(10 * cameraNum + 6 * i + 3 + j);
+		}
+
+		R_list[i] = ublas::matrix<double, ublas::column_major>(3, 3);
+		rodrigues(om_list[i], R_list[i], jacobian);
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+//	getParam
+// -----------------------------------------------------------------------------
+//
+//	Parameter vector of mainOptimization: the shared part and omckk, Tckk of each view
+//
+void	MultiCameraCalibration::getParam(ublas::vector<double> &out_param)
+{
+	int	i, j, kk, s;
+	int	cameraNum = mCalibrationResults.size();
+	int	n_global = 10 * cameraNum + 6 * (cameraNum - 1);
+
+	for (s = 0; s < cameraNum; s++)
+	{
+		const ublas::vector<double>	&fc_s = (s == 0) ? fc : fc_right_list[s - 1];
+		const ublas::vector<double>	&cc_s = (s == 0) ? cc : cc_right_list[s - 1];
+		const ublas::vector<double>	&kc_s = (s == 0) ? kc : kc_right_list[s - 1];
+		double	alpha_c_s = (s == 0) ? alpha_c : alpha_c_right_list(s - 1);
+
+		out_param(10 * s + 0) = fc_s(0);
+		out_param(10 * s + 1) = fc_s(1);
+		out_param(10 * s + 2) = cc_s(0);
+		out_param(10 * s + 3) = cc_s(1);
+		out_param(10 * s + 4) = alpha_c_s;
+		for (j = 0; j < 5; j++)
+			out_param(10 * s + 5 + j) = kc_s(j);
+	}
+	for (i = 0; i < cameraNum - 1; i++)
+		for (j = 0; j < 3; j++)
+		{
+			out_param(10 * cameraNum + 6 * i + j) = om_list[i](j, 0);
+			out_param(10 * cameraNum + 6 * i + 3 + j) = T_list[i](j, 0);
+		}
+
+	for (kk = 0; kk < (int )omc_list.size(); kk++)
+		for (j = 0; j < 3; j++)
+		{
+			out_param(n_global + kk * 6 + j) = omc_list[kk](j, 0);
+			out_param(n_global + kk * 6 + 3 + j) = Tc_list[kk](j, 0);
+		}
+}
+
+
+// -----------------------------------------------------------------------------
+//	setParam
+// -----------------------------------------------------------------------------
+//
+void	MultiCameraCalibration::setParam(const ublas::vector<double> &in_param)
+{
+	int	i, j, kk, s;
+	int	cameraNum = mCalibrationResults.size();
+	int	n_global = 10 * cameraNum + 6 * (cameraNum - 1);
+
+	for (s = 0; s < cameraNum; s++)
+	{
+		ublas::vector<double>	&fc_s = (s == 0) ? fc : fc_right_list[s - 1];
+		ublas::vector<double>	&cc_s = (s == 0) ? cc : cc_right_list[s - 1];
+		ublas::vector<double>	&kc_s = (s == 0) ? kc : kc_right_list[s - 1];
+
+		fc_s(0) = in_param(10 * s + 0);
+		fc_s(1) = in_param(10 * s + 1);
+		cc_s(0) = in_param(10 * s + 2);
+		cc_s(1) = in_param(10 * s + 3);
+		if (s == 0)
+			alpha_c = in_param(10 * s + 4);
+		else
+			alpha_c_right_list(s - 1) = in_param(10 * s + 4);
+		for (j = 0; j < 5; j++)
+			kc_s(j) = in_param(10 * s + 5 + j);
+	}
+	for (i = 0; i < cameraNum - 1; i++)
+		for (j = 0; j < 3; j++)
+		{
+			om_list[i](j, 0) = in_param(10 * cameraNum + 6 * i + j);
+			T_list[i](j, 0) = in_param(10 * cameraNum + 6 * i + 3 + j);
+		}
+
+	for (kk = 0; kk < (int )omc_list.size(); kk++)
+		for (j = 0; j < 3; j++)
+		{
+			omc_list[kk](j, 0) = in_param(n_global + kk * 6 + j);
+			Tc_list[kk](j, 0) = in_param(n_global + kk * 6 + 3 + j);
+		}
+}
+
+
+// -----------------------------------------------------------------------------
+//	buildNormalEquation
+// -----------------------------------------------------------------------------
+//
+//	J'*J and J'*e of the current parameters, block by block: the selected shared
+//	block (out_J2_dash), the 6x6 block of each view and the cross blocks.
+//	The views no camera saw get an identity block (no update).
+//
+void	MultiCameraCalibration::buildNormalEquation(
+								const std::vector<int> &in_ind_global,
+								ublas::matrix<double, ublas::column_major> &out_J2_dash,
+								ublas::matrix<double, ublas::column_major> &out_Je_dash,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_J2_view_list,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_J2_cross_dash_list,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_Je_view_list,
+								int &out_e_num,
+								double &out_e_sum,
+								double &out_e_sum2)
+{
+	int	i, j, kk, s;
+	int	cameraNum = mCalibrationResults.size();
+	int	n_ima = omc_list.size();
+	int	n_global = 10 * cameraNum + 6 * (cameraNum - 1);
+	int	n_sel = (int )in_ind_global.size();
+
+	ublas::matrix<double, ublas::column_major>	J2_global(n_global, n_global);
+	ublas::matrix<double, ublas::column_major>	Je_global(n_global, 1);
+	ublas::matrix<double, ublas::column_major>	J2_cross(n_global, 6);
+
+	//	Columns of the shared part touched by one camera (intrinsics, om, T)
+	std::vector<int>	ind_cols(16);
+
+	J2_global.clear();
+	Je_global.clear();
+	out_e_num = 0;
+	out_e_sum = 0.0;
+	out_e_sum2 = 0.0;
+
+	for (kk = 0; kk < n_ima; kk++)
+	{
+		int	seenNum = 0;
+
+		out_J2_view_list[kk] = ublas::zero_matrix<double>(6, 6);
+		out_Je_view_list[kk] = ublas::zero_matrix<double>(6, 1);
+		J2_cross.clear();
+
+		for (s = 0; s < cameraNum; s++)
+		{
+			if (isViewSeen(s, kk) == false)
+				continue;
+			seenNum++;
+
+			SingleCameraResult	&result = getCameraResult(s);
+			int	Nckk = result.X_list[kk].size2();
+			int	n_cols = (s == 0) ? 10 : 16;
+
+			const ublas::vector<double>	&f = (s == 0) ? fc : fc_right_list[s - 1];
+			const ublas::vector<double>	&c = (s == 0) ? cc : cc_right_list[s - 1];
+			const ublas::vector<double>	&k = (s == 0) ? kc : kc_right_list[s - 1];
+			double	alpha = (s == 0) ? alpha_c : alpha_c_right_list(s - 1);
+
+			ublas::matrix<double, ublas::column_major>	Jkk(2 * Nckk, n_cols);
+			ublas::matrix<double, ublas::column_major>	Jkk_view(2 * Nckk, 6);
+			ublas::matrix<double, ublas::column_major>	ekk(2 * Nckk, 1);
+
+			ublas::matrix<double, ublas::column_major>	x(2, Nckk);
+			ublas::matrix<double, ublas::column_major>	dxdom(2 * Nckk, 3);
+			ublas::matrix<double, ublas::column_major>	dxdT(2 * Nckk, 3);
+			ublas::matrix<double, ublas::column_major>	dxdf(2 * Nckk, 2);
+			ublas::matrix<double, ublas::column_major>	dxdc(2 * Nckk, 2);
+			ublas::matrix<double, ublas::column_major>	dxdk(2 * Nckk, 5);
+			ublas::matrix<double, ublas::column_major>	dxdalpha(2 * Nckk, 1);
+
+			if (s == 0)
+			{
+				project_points2(
+					result.X_list[kk], omc_list[kk], Tc_list[kk], f, c, k, alpha,
+					x, dxdom, dxdT, dxdf, dxdc, dxdk, dxdalpha);
+
+				ublas::subrange(Jkk_view, 0, 2 * Nckk, 0, 3) = dxdom;
+				ublas::subrange(Jkk_view, 0, 2 * Nckk, 3, 6) = dxdT;
+			}
+			else
+			{
+				//	Project the structure onto the pair camera:
+				ublas::matrix<double, ublas::column_major>	omr(3, 1);
+				ublas::matrix<double, ublas::column_major>	Tr(3, 1);
+				ublas::matrix<double, ublas::column_major>	domrdomckk(3, 3);
+				ublas::matrix<double, ublas::column_major>	domrdTckk(3, 3);
+				ublas::matrix<double, ublas::column_major>	domrdom(3, 3);
+				ublas::matrix<double, ublas::column_major>	domrdT(3, 3);
+				ublas::matrix<double, ublas::column_major>	dTrdomckk(3, 3);
+				ublas::matrix<double, ublas::column_major>	dTrdTckk(3, 3);
+				ublas::matrix<double, ublas::column_major>	dTrdom(3, 3);
+				ublas::matrix<double, ublas::column_major>	dTrdT(3, 3);
+
+				StereoCalibration::compose_motion(omc_list[kk], Tc_list[kk], om_list[s - 1], T_list[s - 1],
+					omr, Tr, domrdomckk, domrdTckk, domrdom, domrdT, dTrdomckk, dTrdTckk, dTrdom, dTrdT);
+
+				project_points2(
+					result.X_list[kk], omr, Tr, f, c, k, alpha,
+					x, dxdom, dxdT, dxdf, dxdc, dxdk, dxdalpha);
+
+				ublas::subrange(Jkk, 0, 2 * Nckk, 10, 13) = ublas::prod(dxdom, domrdom) + ublas::prod(dxdT, dTrdom);
+				ublas::subrange(Jkk, 0, 2 * Nckk, 13, 16) = ublas::prod(dxdom, domrdT) + ublas::prod(dxdT, dTrdT);
+				ublas::subrange(Jkk_view, 0, 2 * Nckk, 0, 3) = ublas::prod(dxdom, domrdomckk) + ublas::prod(dxdT, dTrdomckk);
+				ublas::subrange(Jkk_view, 0, 2 * Nckk, 3, 6) = ublas::prod(dxdom, domrdTckk) + ublas::prod(dxdT, dTrdTckk);
+			}
+
+			ublas::subrange(Jkk, 0, 2 * Nckk, 0, 2) = dxdf;
+			ublas::subrange(Jkk, 0, 2 * Nckk, 2, 4) = dxdc;
+			ublas::subrange(Jkk, 0, 2 * Nckk, 4, 5) = dxdalpha;
+			ublas::subrange(Jkk, 0, 2 * Nckk, 5, 10) = dxdk;
+
+			for (i = 0; i < Nckk; i++)
+			{
+				ekk(i * 2, 0) = result.x_list[kk](0, i) - x(0, i);
+				ekk(i * 2 + 1, 0) = result.x_list[kk](1, i) - x(1, i);
+			}
+
+			for (i = 0; i < 10; i++)
+				ind_cols[i] = 10 * s + i;
+			for (i = 0; i < 6; i++)
+				ind_cols[10 + i] = 10 * cameraNum + 6 * (s - 1) + i;
+
+			//	J'*J and J'*e of this camera and view
+			ublas::matrix<double, ublas::column_major>	JJ(n_cols, n_cols);
+			ublas::matrix<double, ublas::column_major>	JJ_cross(n_cols, 6);
+			ublas::matrix<double, ublas::column_major>	Je(n_cols, 1);
+			JJ = ublas::prod(ublas::trans(Jkk), Jkk);
+			JJ_cross = ublas::prod(ublas::trans(Jkk), Jkk_view);
+			Je = ublas::prod(ublas::trans(Jkk), ekk);
+
+			for (i = 0; i < n_cols; i++)
+			{
+				for (j = 0; j < n_cols; j++)
+					J2_global(ind_cols[i], ind_cols[j]) += JJ(i, j);
+				for (j = 0; j < 6; j++)
+					J2_cross(ind_cols[i], j) += JJ_cross(i, j);
+				Je_global(ind_cols[i], 0) += Je(i, 0);
+			}
+			out_J2_view_list[kk] = out_J2_view_list[kk] + ublas::prod(ublas::trans(Jkk_view), Jkk_view);
+			out_Je_view_list[kk] = out_Je_view_list[kk] + ublas::prod(ublas::trans(Jkk_view), ekk);
+
+			for (i = 0; i < 2 * Nckk; i++)
+			{
+				out_e_sum += ekk(i, 0);
+				out_e_sum2 += ekk(i, 0) * ekk(i, 0);
+			}
+			out_e_num += 2 * Nckk;
+		}
+
+		if (seenNum == 0)
+			out_J2_view_list[kk] = ublas::identity_matrix<double>(6);
+
+		out_J2_cross_dash_list[kk].resize(n_sel, 6, false);
+		for (i = 0; i < n_sel; i++)
+			for (j = 0; j < 6; j++)
+				out_J2_cross_dash_list[kk](i, j) = J2_cross(in_ind_global[i], j);
+	}
+
+	//	Pick up the selected shared parameters
+	for (i = 0; i < n_sel; i++)
+	{
+		for (j = 0; j < n_sel; j++)
+			out_J2_dash(i, j) = J2_global(in_ind_global[i], in_ind_global[j]);
+		out_Je_dash(i, 0) = Je_global(in_ind_global[i], 0);
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+//	computeError2
+// -----------------------------------------------------------------------------
+//
+//	Sum of the squared reprojection errors of all the cameras with the current
+//	parameters (only the projection, for the trial steps of Levenberg-Marquardt)
+//
+double	MultiCameraCalibration::computeError2()
+{
+	int		i, j, kk, s;
+	int		cameraNum = mCalibrationResults.size();
+	int		n_ima = omc_list.size();
+	double	e2 = 0.0;
+
+	ublas::matrix<double, ublas::column_major>	omr(3, 1);
+	ublas::matrix<double, ublas::column_major>	Tr(3, 1);
+	ublas::matrix<double, ublas::column_major>	domrdomckk(3, 3);
+	ublas::matrix<double, ublas::column_major>	domrdTckk(3, 3);
+	ublas::matrix<double, ublas::column_major>	domrdom(3, 3);
+	ublas::matrix<double, ublas::column_major>	domrdT(3, 3);
+	ublas::matrix<double, ublas::column_major>	dTrdomckk(3, 3);
+	ublas::matrix<double, ublas::column_major>	dTrdTckk(3, 3);
+	ublas::matrix<double, ublas::column_major>	dTrdom(3, 3);
+	ublas::matrix<double, ublas::column_major>	dTrdT(3, 3);
+
+	for (kk = 0; kk < n_ima; kk++)
+		for (s = 0; s < cameraNum; s++)
+		{
+			if (isViewSeen(s, kk) == false)
+				continue;
+
+			SingleCameraResult	&result = getCameraResult(s);
+			int	Nckk = result.X_list[kk].size2();
+			ublas::matrix<double, ublas::column_major>	x(2, Nckk);
+
+			if (s == 0)
+			{
+				project_points2(result.X_list[kk], omc_list[kk], Tc_list[kk], fc, cc, kc, alpha_c, x);
+			}
+			else
+			{
+				StereoCalibration::compose_motion(omc_list[kk], Tc_list[kk], om_list[s - 1], T_list[s - 1],
+					omr, Tr, domrdomckk, domrdTckk, domrdom, domrdT, dTrdomckk, dTrdTckk, dTrdom, dTrdT);
+				project_points2(result.X_list[kk], omr, Tr,
+								fc_right_list[s - 1], cc_right_list[s - 1], kc_right_list[s - 1],
+								alpha_c_right_list(s - 1), x);
+			}
+
+			for (i = 0; i < Nckk; i++)
+				for (j = 0; j < 2; j++)
+				{
+					double	e = result.x_list[kk](j, i) - x(j, i);
+					e2 += e * e;
+				}
+		}
+
+	return e2;
+}
+
+
+// -----------------------------------------------------------------------------
+//	recomputeBoardPoses
+// -----------------------------------------------------------------------------
+//
+void	MultiCameraCalibration::recomputeBoardPoses()
+{
+	RecomputeBoardPoseTask	task(this, mCalibrationResults[mCenterCameraIndex]);
+	ParallelTask::Run(&task, omc_list.size(), mWorkerThreadNum);
+	mUndistortFailedNum = task.GetFailedNum();
+}
+
+
+//  MultiCameraCalibration class private member functions =====================
+// -----------------------------------------------------------------------------
+//	getPairCameraIndex
+// -----------------------------------------------------------------------------
+//
+int	MultiCameraCalibration::getPairCameraIndex(int inPairIndex)
+{
+	if (inPairIndex < mCenterCameraIndex)
+		return inPairIndex;
+	return inPairIndex + 1;
+}
+
+
+// -----------------------------------------------------------------------------
+//	getCameraResult
+// -----------------------------------------------------------------------------
+//
+//	inCamera is 0 for the center camera and i + 1 for the i-th pair camera
+//
+SingleCameraResult	&MultiCameraCalibration::getCameraResult(int inCamera)
+{
+	if (inCamera == 0)
+		return mCalibrationResults[mCenterCameraIndex];
+	return mCalibrationResults[getPairCameraIndex(inCamera - 1)];
+}
+
+
+// -----------------------------------------------------------------------------
+//	isViewSeen
+// -----------------------------------------------------------------------------
+//
+//	false if the camera (see getCameraResult) did not see the board of the view
+//
+bool	MultiCameraCalibration::isViewSeen(int inCamera, int inView)
+{
+	SingleCameraResult	&result = getCameraResult(inCamera);
+	return result.X_list[inView].size2() != 0 && result.x_list[inView].size2() != 0;
+}
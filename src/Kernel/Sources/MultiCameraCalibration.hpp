@@ -72,6 +72,16 @@ public:
 class	MultiCameraCalibration : public CameraCalibration
 {
 public:
+	//	result of DoCalibration
+	enum CalibrationStatus
+	{
+							STATUS_NOT_CALIBRATED			= 0,
+							STATUS_SUCCEEDED,
+							STATUS_INVALID_CENTER_CAMERA,	// mCenterCameraIndex is out of mCalibrationResults
+							STATUS_VIEW_NUM_MISMATCH,		// the cameras have different numbers of the views
+							STATUS_NO_COMMON_VIEW			// a camera shares no view with the center camera
+	};
+
 	//	constructor/destructor
 							MultiCameraCalibration(int inImageWidth, int inImageHeight);
 	virtual					~MultiCameraCalibration();
@@ -79,10 +89,18 @@ public:
 	//	member functions
 	virtual void			DoCalibration();
 	virtual void			DumpResults();
+	static const char		*GetStatusString(int inStatus);
 
 	//	member variables
+	//	(omc_list and Tc_list of CameraCalibration hold the board poses in the
+	//	 center camera coordinate, and fc, cc, kc, alpha_c the center camera intrinsics)
+	//	All the cameras have the same number of the views in the same order. The
+	//	views a camera did not see are empty x_list and X_list entries of the camera.
 	int									mCenterCameraIndex;
 	std::vector<SingleCameraResult>		mCalibrationResults;
+	int									mCalibrationStatus;		// CalibrationStatus of the last DoCalibration
+
+	bool								mIsJointOptimization;	// false: calibrate as independent stereo pairs
 
 	std::vector<ublas::matrix<double, ublas::column_major> >	T_list;
 	std::vector<ublas::matrix<double, ublas::column_major> >	om_list;
@@ -112,8 +130,29 @@ public:
 	std::vector<ublas::matrix<double, ublas::column_major> >	om_error_list;
 
 
+	void					calibrateOnePair(int inPairIndex);
+
 protected:
+	void					mainOptimization();
+	void					getParam(ublas::vector<double> &out_param);
+	void					setParam(const ublas::vector<double> &in_param);
+	void					buildNormalEquation(
+								const std::vector<int> &in_ind_global,
+								ublas::matrix<double, ublas::column_major> &out_J2_dash,
+								ublas::matrix<double, ublas::column_major> &out_Je_dash,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_J2_view_list,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_J2_cross_dash_list,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_Je_view_list,
+								int &out_e_num,
+								double &out_e_sum,
+								double &out_e_sum2);
+	double					computeError2();
+	void					recomputeBoardPoses();
+
 private:
+	int						getPairCameraIndex(int inPairIndex);
+	SingleCameraResult		&getCameraResult(int inCamera);
+	bool					isViewSeen(int inCamera, int inView);
 	void					dumpOnePairResults(int inIndex);
 };
 
@@ -0,0 +1,143 @@
+// =============================================================================
+//  ParallelTask.cpp
+//
+//  MIT License
+//
+//  Copyright (c) 2007-2018 Dairoku Sekiguchi
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+// =============================================================================
+/*!
+	\file		ParallelTask.cpp
+	\author		Dairoku Sekiguchi
+	\version	1.0
+	\date		2018/06/02
+	\brief		This file is a part of CalibraKernel
+*/
+
+// -----------------------------------------------------------------------------
+// 	include files
+// -----------------------------------------------------------------------------
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+
+#include "ParallelTask.hpp"
+
+
+// -----------------------------------------------------------------------------
+// 	WorkerError class
+// -----------------------------------------------------------------------------
+//
+//	The first exception thrown by ExecTask on any of the workers
+//
+class	WorkerError
+{
+public:
+	void	Set(std::exception_ptr inError)
+	{
+		std::lock_guard<std::mutex>	lock(mMutex);
+		if (!mError)
+			mError = inError;
+	}
+
+	std::exception_ptr	mError;
+
+private:
+	std::mutex			mMutex;
+};
+
+
+// -----------------------------------------------------------------------------
+// 	workerFunc
+// -----------------------------------------------------------------------------
+//
+//	An exception stops handing out the indices, so the other workers finish
+//	with their current tasks
+//
+static void	workerFunc(ParallelTask *inTask, int inTaskNum, std::atomic<int> *ioNextIndex, WorkerError *outError)
+{
+	int	index;
+
+	try
+	{
+		while ((index = (*ioNextIndex)++) < inTaskNum)
+			inTask->ExecTask(index);
+	}
+	catch (...)
+	{
+		outError->Set(std::current_exception());
+		*ioNextIndex = inTaskNum;
+	}
+}
+
+
+//  ParallelTask class public member functions =================================
+// -----------------------------------------------------------------------------
+//	Run
+// -----------------------------------------------------------------------------
+//
+void	ParallelTask::Run(ParallelTask *inTask, int inTaskNum, int inWorkerNum)
+{
+	if (inWorkerNum <= 0)
+		inWorkerNum = GetDefaultWorkerNum();
+	if (inWorkerNum > inTaskNum)
+		inWorkerNum = inTaskNum;
+
+	std::atomic<int>	nextIndex(0);
+	WorkerError			error;
+
+	//	No need to create threads
+	if (inWorkerNum <= 1)
+	{
+		for (int i = 0; i < inTaskNum; i++)
+			inTask->ExecTask(i);
+		return;
+	}
+
+	//	The calling thread works as one of the workers
+	std::vector<std::thread>	threads;
+	for (int i = 0; i < inWorkerNum - 1; i++)
+		threads.push_back(std::thread(workerFunc, inTask, inTaskNum, &nextIndex, &error));
+
+	workerFunc(inTask, inTaskNum, &nextIndex, &error);
+
+	for (int i = 0; i < (int )threads.size(); i++)
+		threads[i].join();
+
+	//	Rethrown on the calling thread after all the workers are joined
+	if (error.mError)
+		std::rethrow_exception(error.mError);
+}
+
+
+// -----------------------------------------------------------------------------
+//	GetDefaultWorkerNum
+// -----------------------------------------------------------------------------
+//
+int		ParallelTask::GetDefaultWorkerNum()
+{
+	int	num = (int )std::thread::hardware_concurrency();
+
+	if (num <= 0)
+		return 1;
+	return num;
+}
@@ -0,0 +1,68 @@
+// =============================================================================
+//  ParallelTask.hpp
+//
+//  MIT License
+//
+//  Copyright (c) 2007-2018 Dairoku Sekiguchi
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+// =============================================================================
+/*!
+	\file		ParallelTask.hpp
+	\author		Dairoku Sekiguchi
+	\version	1.0
+	\date		2018/06/02
+	\brief		This file is a part of CalibraKernel
+
+	Small worker pool used to run independent tasks (camera pairs, views,
+	images...) on several threads.
+*/
+
+#ifndef __PARALLEL_TASK_HPP
+#define __PARALLEL_TASK_HPP
+
+
+// -----------------------------------------------------------------------------
+// 	ParallelTask class
+// -----------------------------------------------------------------------------
+//
+//	Derive from this class and implement ExecTask(). Run() calls ExecTask()
+//	once for every index in [0, inTaskNum) from inWorkerNum threads. Each index
+//	is executed exactly once, so the results can be written by index without
+//	any lock and are the same as the serial execution.
+//	If ExecTask() throws, the remaining indices are skipped and Run() rethrows
+//	the first exception after all the workers are joined.
+//
+class	ParallelTask
+{
+public:
+	//	constructor/destructor
+							ParallelTask() {};
+	virtual					~ParallelTask() {};
+
+	//	member functions
+	virtual void			ExecTask(int inIndex) = 0;
+
+	//	inWorkerNum <= 0 means the number of the hardware threads
+	static void				Run(ParallelTask *inTask, int inTaskNum, int inWorkerNum = 0);
+	static int				GetDefaultWorkerNum();
+};
+
+
+#endif	// #ifdef __PARALLEL_TASK_HPP
@@ -0,0 +1,1093 @@
+// =============================================================================
+//  RectifyMap.cpp
+//
+//  MIT License
+//
+//  Copyright (c) 2007-2018 Dairoku Sekiguchi
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+// =============================================================================
+/*!
+	\file		RectifyMap.cpp
+	\author		Dairoku Sekiguchi
+	\version	1.0
+	\date		2018/06/20
+	\brief		This file is a part of CalibraKernel
+*/
+
+// -----------------------------------------------------------------------------
+// 	include files
+// -----------------------------------------------------------------------------
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define	RECTIFY_MAP_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include <math.h>
+#include <string.h>
+#include "RectifyMap.hpp"
+#include "ParallelTask.hpp"
+
+
+// -----------------------------------------------------------------------------
+// 	macros
+// -----------------------------------------------------------------------------
+#define	RECTIFY_MAP_TILE_ROWS		32		//	the output rows of one Remap (Encode, Decode) task
+#define	RECTIFY_MAP_CODE_ID			0x50414D52	//	"RMAP", the first word of the Encode data
+#define	RECTIFY_MAP_CODE_HEADER_LEN	8			//	words before the tile sizes
+#define	RECTIFY_MAP_CODE_PIXEL_MAX	(1 << 30)	//	the pixels of the map and the source image Decode accepts
+#define	RECTIFY_MAP_CODE_SIZE_MAX	(1 << 16)	//	the source width and height (the fixed point positions are int)
+
+
+// -----------------------------------------------------------------------------
+//	setWeights
+// -----------------------------------------------------------------------------
+//
+//	Bilinear weights of the fractions (ax, ay) in SHIFT bits. The rounding
+//	error is added to the largest weight, so the weights always sum up to
+//	1 << SHIFT and a uniform image stays uniform.
+//
+template <class ENTRY, int SHIFT>
+static void	setWeights(ENTRY &out_entry, double ax, double ay)
+{
+	double	a[4];
+	int		w[4];
+	int		k, sum = 0, largest = 0;
+
+	a[0] = (1 - ay) * (1 - ax);
+	a[1] = (1 - ay) * ax;
+	a[2] = ay * (1 - ax);
+	a[3] = ay * ax;
+	for (k = 0; k < 4; k++)
+	{
+		w[k] = (int )floor(a[k] * (1 << SHIFT) + 0.5);
+		sum += w[k];
+		if (w[k] > w[largest])
+			largest = k;
+	}
+	w[largest] += (1 << SHIFT) - sum;
+
+	for (k = 0; k < 4; k++)
+		out_entry.w[k] = w[k];
+}
+
+
+// -----------------------------------------------------------------------------
+//	remapPixels
+// -----------------------------------------------------------------------------
+//
+//	The scalar kernel. CH is the number of the channels (1: monochrome,
+//	3: BGR) and in_stride is the width of the source image in pixels.
+//
+template <class ENTRY, int SHIFT, int CH>
+static void	remapPixels(
+				const ENTRY *in_map, int in_num, int in_stride,
+				const unsigned char *in_image, unsigned char *out_image)
+{
+	for (int i = 0; i < in_num; i++, out_image += CH)
+	{
+		const ENTRY	&e = in_map[i];
+		if (e.offset < 0)
+		{
+			for (int c = 0; c < CH; c++)
+				out_image[c] = 0;
+			continue;
+		}
+
+		const unsigned char	*p = in_image + e.offset * CH;
+		for (int c = 0; c < CH; c++)
+		{
+			int	v =	e.w[0] * p[c] + e.w[1] * p[CH + c] +
+					e.w[2] * p[in_stride * CH + c] + e.w[3] * p[(in_stride + 1) * CH + c];
+			out_image[c] = (unsigned char )((v + (1 << (SHIFT - 1))) >> SHIFT);
+		}
+	}
+}
+
+
+#ifdef RECTIFY_MAP_X86
+// -----------------------------------------------------------------------------
+// 	SIMD kernels
+// -----------------------------------------------------------------------------
+//
+//	Each lane is one output pixel. The four source pixels of a lane are
+//	read as two 32 bit words (top and bottom rows), the two pixels of a word
+//	are spread to 16 bit by a byte shuffle and multiplied by the weight pairs
+//	with pmaddwd (the weights are at most 1 << 14, so they fit in int16).
+//	The words are read at:
+//
+//		CH == 1:	top: offset,				bottom: offset + stride - 2
+//		CH == 3:	top: offset * 3 + c,		bottom: (offset + stride) * 3 + c
+//
+//	so that the last word never goes beyond the end of the source image
+//	(the last valid offset is (srcH - 2) * srcW + srcW - 2). The pixels
+//	outside of the source image read the offset 0 and are masked to 0.
+//	The results are exactly the same as remapPixels.
+//
+//	The kernels return the number of the pixels done, remapPixels does the
+//	rest.
+//
+#define	RECTIFY_MAP_BOTTOM_SHIFT(CH)	((CH) == 1 ? 2 : 0)
+
+//	memcpy is the portable unaligned load (compiled to a single mov)
+static inline int	loadWord(const unsigned char *p)
+{
+	int	v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+//	SSE4.1 has no gather, the words are loaded one by one
+#if defined(__GNUC__) && !defined(__SSE4_1__)
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#define	RECTIFY_MAP_POP_OPTIONS
+#endif
+
+template <class ENTRY, int SHIFT, int CH>
+static int	remapPixelsSSE41(
+				const ENTRY *in_map, int in_num, int in_stride,
+				const unsigned char *in_image, unsigned char *out_image)
+{
+	const int		bottom = in_stride * CH - RECTIFY_MAP_BOTTOM_SHIFT(CH);
+	const __m128i	topShuffle = _mm_setr_epi8(
+						0, -1, CH, -1, 4, -1, 4 + CH, -1, 8, -1, 8 + CH, -1, 12, -1, 12 + CH, -1);
+	const int		b0 = RECTIFY_MAP_BOTTOM_SHIFT(CH);
+	const __m128i	bottomShuffle = _mm_setr_epi8(
+						b0, -1, b0 + CH, -1, 4 + b0, -1, 4 + b0 + CH, -1,
+						8 + b0, -1, 8 + b0 + CH, -1, 12 + b0, -1, 12 + b0 + CH, -1);
+	const __m128i	w01Shuffle = _mm_setr_epi8(0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1);
+	const __m128i	w23Shuffle = _mm_setr_epi8(2, -1, 3, -1, 6, -1, 7, -1, 10, -1, 11, -1, 14, -1, 15, -1);
+	const __m128i	round = _mm_set1_epi32(1 << (SHIFT - 1));
+
+	const __m128i	minusOne = _mm_set1_epi32(-1);
+	int				i, k, c;
+
+	for (i = 0; i + 4 <= in_num; i += 4, out_image += 4 * CH)
+	{
+		const ENTRY	*e = in_map + i;
+		__m128i		offset = _mm_setr_epi32(e[0].offset, e[1].offset, e[2].offset, e[3].offset);
+		__m128i		w01 = _mm_setr_epi32(
+						loadWord((const unsigned char *)&(e[0].w[0])), loadWord((const unsigned char *)&(e[1].w[0])),
+						loadWord((const unsigned char *)&(e[2].w[0])), loadWord((const unsigned char *)&(e[3].w[0])));
+		__m128i		w23;
+
+		if (sizeof(e[0].w[0]) == 2)
+		{
+			w23 = _mm_setr_epi32(
+						loadWord((const unsigned char *)&(e[0].w[2])), loadWord((const unsigned char *)&(e[1].w[2])),
+						loadWord((const unsigned char *)&(e[2].w[2])), loadWord((const unsigned char *)&(e[3].w[2])));
+		}
+		else
+		{
+			w23 = _mm_shuffle_epi8(w01, w23Shuffle);
+			w01 = _mm_shuffle_epi8(w01, w01Shuffle);
+		}
+
+		const __m128i	validMask = _mm_cmpgt_epi32(offset, minusOne);
+		offset = _mm_and_si128(offset, validMask);
+		if (CH == 3)
+			offset = _mm_add_epi32(offset, _mm_add_epi32(offset, offset));
+		const int	o0 = _mm_cvtsi128_si32(offset);
+		const int	o1 = _mm_extract_epi32(offset, 1);
+		const int	o2 = _mm_extract_epi32(offset, 2);
+		const int	o3 = _mm_extract_epi32(offset, 3);
+
+		int	result[CH];
+		for (c = 0; c < CH; c++)
+		{
+			const unsigned char	*top = in_image + c;
+			const unsigned char	*bot = top + bottom;
+			__m128i	t = _mm_setr_epi32(loadWord(top + o0), loadWord(top + o1), loadWord(top + o2), loadWord(top + o3));
+			__m128i	b = _mm_setr_epi32(loadWord(bot + o0), loadWord(bot + o1), loadWord(bot + o2), loadWord(bot + o3));
+			t = _mm_shuffle_epi8(t, topShuffle);
+			b = _mm_shuffle_epi8(b, bottomShuffle);
+
+			__m128i	v = _mm_add_epi32(_mm_madd_epi16(t, w01), _mm_madd_epi16(b, w23));
+			v = _mm_srli_epi32(_mm_add_epi32(v, round), SHIFT);
+			v = _mm_and_si128(v, validMask);
+			v = _mm_packus_epi32(v, v);
+			v = _mm_packus_epi16(v, v);
+			result[c] = _mm_cvtsi128_si32(v);
+		}
+
+		if (CH == 1)
+			memcpy(out_image, &(result[0]), 4);
+		else
+			for (k = 0; k < 4; k++)
+				for (c = 0; c < CH; c++)
+					out_image[k * CH + c] = (unsigned char )(result[c] >> (k * 8));
+	}
+
+	return i;
+}
+
+static int	remapSSE41(
+				int in_weight_type, int in_channel_num,
+				const void *in_map, int in_num, int in_stride,
+				const unsigned char *in_image, unsigned char *out_image)
+{
+	if (in_weight_type == RectifyMap::WEIGHT_8BIT)
+	{
+		const RectifyMapEntry8	*map = (const RectifyMapEntry8 *)in_map;
+		if (in_channel_num == 3)
+			return remapPixelsSSE41<RectifyMapEntry8, RECTIFY_MAP_8BIT_SHIFT, 3>(map, in_num, in_stride, in_image, out_image);
+		return remapPixelsSSE41<RectifyMapEntry8, RECTIFY_MAP_8BIT_SHIFT, 1>(map, in_num, in_stride, in_image, out_image);
+	}
+
+	const RectifyMapEntry16	*map = (const RectifyMapEntry16 *)in_map;
+	if (in_channel_num == 3)
+		return remapPixelsSSE41<RectifyMapEntry16, RECTIFY_MAP_16BIT_SHIFT, 3>(map, in_num, in_stride, in_image, out_image);
+	return remapPixelsSSE41<RectifyMapEntry16, RECTIFY_MAP_16BIT_SHIFT, 1>(map, in_num, in_stride, in_image, out_image);
+}
+
+#ifdef RECTIFY_MAP_POP_OPTIONS
+#pragma GCC pop_options
+#undef	RECTIFY_MAP_POP_OPTIONS
+#endif
+
+//	Only this part is compiled for AVX2 (gcc needs the target option for the
+//	256bit intrinsics, MSVC does not). It is called only when the CPU and
+//	the OS support AVX2.
+#if defined(__GNUC__) && !defined(__AVX2__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define	RECTIFY_MAP_POP_OPTIONS
+#endif
+
+//	The entries are gathered as the 32 bit words: offset is the word 0,
+//	the weights are the word 1 (RectifyMapEntry8) or the words 1 and 2
+//	(RectifyMapEntry16)
+template <class ENTRY, int SHIFT, int CH>
+static int	remapPixelsAVX2(
+				const ENTRY *in_map, int in_num, int in_stride,
+				const unsigned char *in_image, unsigned char *out_image)
+{
+	const int		entryWords = (int )(sizeof(ENTRY) / 4);
+	const __m256i	entryIndex = _mm256_mullo_epi32(
+						_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(entryWords));
+	const int		bottom = in_stride * CH - RECTIFY_MAP_BOTTOM_SHIFT(CH);
+	const __m256i	topShuffle = _mm256_setr_epi8(
+						0, -1, CH, -1, 4, -1, 4 + CH, -1, 8, -1, 8 + CH, -1, 12, -1, 12 + CH, -1,
+						0, -1, CH, -1, 4, -1, 4 + CH, -1, 8, -1, 8 + CH, -1, 12, -1, 12 + CH, -1);
+	const int		b0 = RECTIFY_MAP_BOTTOM_SHIFT(CH);
+	const __m256i	bottomShuffle = _mm256_setr_epi8(
+						b0, -1, b0 + CH, -1, 4 + b0, -1, 4 + b0 + CH, -1,
+						8 + b0, -1, 8 + b0 + CH, -1, 12 + b0, -1, 12 + b0 + CH, -1,
+						b0, -1, b0 + CH, -1, 4 + b0, -1, 4 + b0 + CH, -1,
+						8 + b0, -1, 8 + b0 + CH, -1, 12 + b0, -1, 12 + b0 + CH, -1);
+	const __m256i	w01Shuffle = _mm256_setr_epi8(
+						0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1,
+						0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1);
+	const __m256i	w23Shuffle = _mm256_setr_epi8(
+						2, -1, 3, -1, 6, -1, 7, -1, 10, -1, 11, -1, 14, -1, 15, -1,
+						2, -1, 3, -1, 6, -1, 7, -1, 10, -1, 11, -1, 14, -1, 15, -1);
+	const __m256i	packIndex = _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4);
+	const __m256i	round = _mm256_set1_epi32(1 << (SHIFT - 1));
+	const __m256i	minusOne = _mm256_set1_epi32(-1);
+	int				i, k, c;
+
+	for (i = 0; i + 8 <= in_num; i += 8, out_image += 8 * CH)
+	{
+		const int	*e = (const int *)(in_map + i);
+		__m256i		offset = _mm256_i32gather_epi32(e, entryIndex, 4);
+		__m256i		w01, w23;
+
+		if (entryWords == 3)
+		{
+			w01 = _mm256_i32gather_epi32(e + 1, entryIndex, 4);
+			w23 = _mm256_i32gather_epi32(e + 2, entryIndex, 4);
+		}
+		else
+		{
+			__m256i	w = _mm256_i32gather_epi32(e + 1, entryIndex, 4);
+			w01 = _mm256_shuffle_epi8(w, w01Shuffle);
+			w23 = _mm256_shuffle_epi8(w, w23Shuffle);
+		}
+
+		const __m256i	validMask = _mm256_cmpgt_epi32(offset, minusOne);
+		offset = _mm256_and_si256(offset, validMask);
+		if (CH == 3)
+			offset = _mm256_add_epi32(offset, _mm256_add_epi32(offset, offset));
+
+		unsigned char	result[CH][8];
+		for (c = 0; c < CH; c++)
+		{
+			const unsigned char	*top = in_image + c;
+			__m256i	t = _mm256_i32gather_epi32((const int *)top, offset, 1);
+			__m256i	b = _mm256_i32gather_epi32((const int *)(top + bottom), offset, 1);
+			t = _mm256_shuffle_epi8(t, topShuffle);
+			b = _mm256_shuffle_epi8(b, bottomShuffle);
+
+			__m256i	v = _mm256_add_epi32(_mm256_madd_epi16(t, w01), _mm256_madd_epi16(b, w23));
+			v = _mm256_srli_epi32(_mm256_add_epi32(v, round), SHIFT);
+			v = _mm256_and_si256(v, validMask);
+			v = _mm256_packus_epi32(v, v);
+			v = _mm256_packus_epi16(v, v);
+			v = _mm256_permutevar8x32_epi32(v, packIndex);
+			if (CH == 1)
+				_mm_storel_epi64((__m128i *)out_image, _mm256_castsi256_si128(v));
+			else
+				_mm_storel_epi64((__m128i *)result[c], _mm256_castsi256_si128(v));
+		}
+
+		if (CH != 1)
+			for (k = 0; k < 8; k++)
+				for (c = 0; c < CH; c++)
+					out_image[k * CH + c] = result[c][k];
+	}
+
+	return i;
+}
+
+static int	remapAVX2(
+				int in_weight_type, int in_channel_num,
+				const void *in_map, int in_num, int in_stride,
+				const unsigned char *in_image, unsigned char *out_image)
+{
+	if (in_weight_type == RectifyMap::WEIGHT_8BIT)
+	{
+		const RectifyMapEntry8	*map = (const RectifyMapEntry8 *)in_map;
+		if (in_channel_num == 3)
+			return remapPixelsAVX2<RectifyMapEntry8, RECTIFY_MAP_8BIT_SHIFT, 3>(map, in_num, in_stride, in_image, out_image);
+		return remapPixelsAVX2<RectifyMapEntry8, RECTIFY_MAP_8BIT_SHIFT, 1>(map, in_num, in_stride, in_image, out_image);
+	}
+
+	const RectifyMapEntry16	*map = (const RectifyMapEntry16 *)in_map;
+	if (in_channel_num == 3)
+		return remapPixelsAVX2<RectifyMapEntry16, RECTIFY_MAP_16BIT_SHIFT, 3>(map, in_num, in_stride, in_image, out_image);
+	return remapPixelsAVX2<RectifyMapEntry16, RECTIFY_MAP_16BIT_SHIFT, 1>(map, in_num, in_stride, in_image, out_image);
+}
+
+#ifdef RECTIFY_MAP_POP_OPTIONS
+#pragma GCC pop_options
+#undef	RECTIFY_MAP_POP_OPTIONS
+#endif
+#endif	// #ifdef RECTIFY_MAP_X86
+
+
+// -----------------------------------------------------------------------------
+// 	remapEntries
+// -----------------------------------------------------------------------------
+//
+//	in_num entries from in_map, out_image is the output pixel of in_map[0]
+//
+static void	remapEntries(
+				int in_weight_type, int in_channel_num,
+				const void *in_map, int in_num, int in_stride,
+				const unsigned char *in_image, unsigned char *out_image)
+{
+	int	done = 0;
+
+	switch (RectifyMap::GetSimdType())
+	{
+#ifdef RECTIFY_MAP_X86
+		case RectifyMap::SIMD_AVX2:
+			done = remapAVX2(in_weight_type, in_channel_num, in_map, in_num, in_stride, in_image, out_image);
+			break;
+		case RectifyMap::SIMD_SSE41:
+			done = remapSSE41(in_weight_type, in_channel_num, in_map, in_num, in_stride, in_image, out_image);
+			break;
+#endif
+		default:
+			break;
+	}
+
+	//	The rest of the pixels
+	out_image += done * in_channel_num;
+	if (in_weight_type == RectifyMap::WEIGHT_8BIT)
+	{
+		const RectifyMapEntry8	*map = (const RectifyMapEntry8 *)in_map + done;
+		if (in_channel_num == 3)
+			remapPixels<RectifyMapEntry8, RECTIFY_MAP_8BIT_SHIFT, 3>(map, in_num - done, in_stride, in_image, out_image);
+		else
+			remapPixels<RectifyMapEntry8, RECTIFY_MAP_8BIT_SHIFT, 1>(map, in_num - done, in_stride, in_image, out_image);
+	}
+	else
+	{
+		const RectifyMapEntry16	*map = (const RectifyMapEntry16 *)in_map + done;
+		if (in_channel_num == 3)
+			remapPixels<RectifyMapEntry16, RECTIFY_MAP_16BIT_SHIFT, 3>(map, in_num - done, in_stride, in_image, out_image);
+		else
+			remapPixels<RectifyMapEntry16, RECTIFY_MAP_16BIT_SHIFT, 1>(map, in_num - done, in_stride, in_image, out_image);
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// 	RemapTask class
+// -----------------------------------------------------------------------------
+//
+//	One task is RECTIFY_MAP_TILE_ROWS output rows. The tasks write the
+//	different rows, so they need no lock.
+//
+class	RemapTask : public ParallelTask
+{
+public:
+	RemapTask(const RectifyMap *inMap, int inChannelNum,
+				const unsigned char *inImage, unsigned char *outImage)
+	{
+		mMap = inMap;
+		mChannelNum = inChannelNum;
+		mInImage = inImage;
+		mOutImage = outImage;
+	}
+
+	int				GetTaskNum() const
+	{
+		return (mMap->GetHeight() + RECTIFY_MAP_TILE_ROWS - 1) / RECTIFY_MAP_TILE_ROWS;
+	}
+
+	virtual void	ExecTask(int inIndex)
+	{
+		int	y0 = inIndex * RECTIFY_MAP_TILE_ROWS;
+		int	y1 = y0 + RECTIFY_MAP_TILE_ROWS;
+		if (y1 > mMap->GetHeight())
+			y1 = mMap->GetHeight();
+
+		int	start = y0 * mMap->GetWidth();
+		const void	*map;
+		if (mMap->GetWeightType() == RectifyMap::WEIGHT_8BIT)
+			map = mMap->GetEntry8() + start;
+		else
+			map = mMap->GetEntry16() + start;
+
+		remapEntries(mMap->GetWeightType(), mChannelNum, map, (y1 - y0) * mMap->GetWidth(),
+			mMap->GetSourceWidth(), mInImage, mOutImage + start * mChannelNum);
+	}
+
+private:
+	const RectifyMap		*mMap;
+	int						mChannelNum;
+	const unsigned char		*mInImage;
+	unsigned char			*mOutImage;
+};
+
+
+// -----------------------------------------------------------------------------
+// 	Encode / Decode
+// -----------------------------------------------------------------------------
+//
+//	The Encode data is the header words (RECTIFY_MAP_CODE_ID, width, height,
+//	source width, source height, weight type, tile rows, tile number), the
+//	byte sizes of the tiles and the tiles. The tiles are independent, so
+//	they are encoded and decoded on the ParallelTask workers.
+//
+//	A tile is a sequence of the variable length codes (7 bits per byte,
+//	the lower bits first):
+//
+//		(n << 1) | 1:			n entries outside of the source image
+//		zigzag(d) << 1:			a valid entry, d is the offset minus
+//								(the previous valid offset + 1), followed by
+//		zigzag(x - x'):			x is the source x in fixed point (the pixel of
+//								the offset + w[1] + w[3]), x' is the linear
+//								prediction from the previous two valid entries
+//		zigzag(y - y'):			the same for y (w[2] + w[3])
+//		zigzag(w[3] - w3'):		w3' is the bilinear weight of the fractions
+//
+//	The other weights follow from the fractions and w[3] (they sum up to
+//	1 << SHIFT). The neighbouring output pixels move almost linearly in the
+//	source image, so a valid entry is mostly 4 bytes instead of 12
+//	(RectifyMapEntry16). The codes fit in 32 bits up to 2^30 source pixels
+//	(RECTIFY_MAP_CODE_PIXEL_MAX) and 2^16 source width and height.
+//
+static inline void	putCode(std::vector<unsigned char> &out_data, unsigned int in_code)
+{
+	while (in_code >= 0x80)
+	{
+		out_data.push_back((unsigned char )((in_code & 0x7F) | 0x80));
+		in_code >>= 7;
+	}
+	out_data.push_back((unsigned char )in_code);
+}
+
+static inline bool	getCode(const unsigned char *&io_ptr, const unsigned char *in_end, unsigned int *out_code)
+{
+	unsigned int	code = 0;
+
+	for (int shift = 0; shift < 32; shift += 7)
+	{
+		if (io_ptr >= in_end)
+			return false;
+		unsigned char	c = *io_ptr++;
+		code |= (unsigned int )(c & 0x7F) << shift;
+		if ((c & 0x80) == 0)
+		{
+			*out_code = code;
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline unsigned int	toZigzag(int in_value)
+{
+	return ((unsigned int )in_value << 1) ^ (unsigned int )(in_value >> 31);
+}
+
+static inline int	fromZigzag(unsigned int in_code)
+{
+	return (int )(in_code >> 1) ^ -(int )(in_code & 1);
+}
+
+//	The source position of an entry in SHIFT bits fixed point: the integer
+//	part is the pixel of the offset and the fraction is the sum of the
+//	weights of the right (lower) pixels
+struct	CodePosition
+{
+	int	x, y;
+};
+
+template <class ENTRY, int SHIFT>
+static void	encodeTile(const ENTRY *in_map, int in_num, int in_source_width, std::vector<unsigned char> &out_data)
+{
+	const int		one = 1 << SHIFT;
+	int				prev = -1;
+	CodePosition	prev_pos = {0, 0}, step = {0, 0};
+
+	for (int i = 0; i < in_num; i++)
+	{
+		const ENTRY	&e = in_map[i];
+		if (e.offset < 0)
+		{
+			int	n = 1;
+			while (i + n < in_num && in_map[i + n].offset < 0)
+				n++;
+			putCode(out_data, ((unsigned int )n << 1) | 1);
+			i += n - 1;
+			continue;
+		}
+
+		int	sx = e.w[1] + e.w[3];
+		int	sy = e.w[2] + e.w[3];
+		CodePosition	pos;
+		pos.x = (e.offset % in_source_width) * one + sx;
+		pos.y = (e.offset / in_source_width) * one + sy;
+
+		putCode(out_data, toZigzag(e.offset - (prev + 1)) << 1);
+		putCode(out_data, toZigzag(pos.x - (prev_pos.x + step.x)));
+		putCode(out_data, toZigzag(pos.y - (prev_pos.y + step.y)));
+		putCode(out_data, toZigzag(e.w[3] - (sx * sy + one / 2) / one));
+
+		step.x = pos.x - prev_pos.x;
+		step.y = pos.y - prev_pos.y;
+		prev_pos = pos;
+		prev = e.offset;
+	}
+}
+
+//	Returns false if the data is broken or an entry reads outside of the
+//	source image (Remap has no bounds checks)
+template <class ENTRY, int SHIFT>
+static bool	decodeTile(
+				const unsigned char *in_data, const unsigned char *in_end,
+				int in_source_width, int in_source_height,
+				ENTRY *out_map, int in_num)
+{
+	const int		one = 1 << SHIFT;
+	const int		max_offset = (in_source_height - 2) * in_source_width + in_source_width - 2;
+	int				prev = -1;
+	CodePosition	prev_pos = {0, 0}, step = {0, 0};
+	unsigned int	code[4];
+
+	for (int i = 0; i < in_num; )
+	{
+		if (getCode(in_data, in_end, &(code[0])) == false)
+			return false;
+
+		if (code[0] & 1)
+		{
+			unsigned int	n = code[0] >> 1;
+			if (n == 0 || n > (unsigned int )(in_num - i))
+				return false;
+			for (; n != 0; n--, i++)
+			{
+				out_map[i].offset = -1;
+				for (int k = 0; k < 4; k++)
+					out_map[i].w[k] = 0;
+			}
+			continue;
+		}
+
+		for (int k = 1; k < 4; k++)
+			if (getCode(in_data, in_end, &(code[k])) == false)
+				return false;
+
+		//	The broken codes can overflow int, so they are checked in 64 bits
+		long long	offset64 = (long long )prev + 1 + fromZigzag(code[0] >> 1);
+		if (offset64 < 0 || offset64 > max_offset)
+			return false;
+		int	offset = (int )offset64;
+		if (offset % in_source_width > in_source_width - 2)
+			return false;
+
+		long long	sx64 = (long long )prev_pos.x + step.x + fromZigzag(code[1]) - (long long )(offset % in_source_width) * one;
+		long long	sy64 = (long long )prev_pos.y + step.y + fromZigzag(code[2]) - (long long )(offset / in_source_width) * one;
+		if (sx64 < 0 || sx64 > one || sy64 < 0 || sy64 > one)
+			return false;
+
+		int	sx = (int )sx64;
+		int	sy = (int )sy64;
+		CodePosition	pos;
+		pos.x = (offset % in_source_width) * one + sx;
+		pos.y = (offset / in_source_width) * one + sy;
+
+		int	w3 = (sx * sy + one / 2) / one + fromZigzag(code[3]);
+		if (w3 < 0 || w3 > sx || w3 > sy || one - sx - sy + w3 < 0)
+			return false;
+
+		out_map[i].offset = offset;
+		out_map[i].w[0] = one - sx - sy + w3;
+		out_map[i].w[1] = sx - w3;
+		out_map[i].w[2] = sy - w3;
+		out_map[i].w[3] = w3;
+
+		step.x = pos.x - prev_pos.x;
+		step.y = pos.y - prev_pos.y;
+		prev_pos = pos;
+		prev = offset;
+		i++;
+	}
+
+	return in_data == in_end;
+}
+
+
+// -----------------------------------------------------------------------------
+// 	EncodeTask class
+// -----------------------------------------------------------------------------
+//
+class	EncodeTask : public ParallelTask
+{
+public:
+	EncodeTask(const RectifyMap *inMap, int inTileRows, int inTileNum)
+		: mTileData(inTileNum)
+	{
+		mMap = inMap;
+		mTileRows = inTileRows;
+	}
+
+	virtual void	ExecTask(int inIndex)
+	{
+		int	y0 = inIndex * mTileRows;
+		int	y1 = y0 + mTileRows;
+		if (y1 > mMap->GetHeight())
+			y1 = mMap->GetHeight();
+
+		int	start = y0 * mMap->GetWidth();
+		int	num = (y1 - y0) * mMap->GetWidth();
+		if (mMap->GetWeightType() == RectifyMap::WEIGHT_8BIT)
+			encodeTile<RectifyMapEntry8, RECTIFY_MAP_8BIT_SHIFT>(
+				mMap->GetEntry8() + start, num, mMap->GetSourceWidth(), mTileData[inIndex]);
+		else
+			encodeTile<RectifyMapEntry16, RECTIFY_MAP_16BIT_SHIFT>(
+				mMap->GetEntry16() + start, num, mMap->GetSourceWidth(), mTileData[inIndex]);
+	}
+
+	const RectifyMap	*mMap;
+	int					mTileRows;
+	std::vector<std::vector<unsigned char> >	mTileData;
+};
+
+
+// -----------------------------------------------------------------------------
+// 	DecodeTask class
+// -----------------------------------------------------------------------------
+//
+class	DecodeTask : public ParallelTask
+{
+public:
+	DecodeTask(int inWidth, int inHeight, int inSourceWidth, int inSourceHeight, int inTileRows,
+				RectifyMapEntry8 *outEntry8, RectifyMapEntry16 *outEntry16)
+	{
+		mWidth = inWidth;
+		mHeight = inHeight;
+		mSourceWidth = inSourceWidth;
+		mSourceHeight = inSourceHeight;
+		mTileRows = inTileRows;
+		mEntry8 = outEntry8;
+		mEntry16 = outEntry16;
+	}
+
+	virtual void	ExecTask(int inIndex)
+	{
+		int	y0 = inIndex * mTileRows;
+		int	y1 = y0 + mTileRows;
+		if (y1 > mHeight)
+			y1 = mHeight;
+
+		int	start = y0 * mWidth;
+		int	num = (y1 - y0) * mWidth;
+		if (mEntry8 != NULL)
+			mResult[inIndex] = decodeTile<RectifyMapEntry8, RECTIFY_MAP_8BIT_SHIFT>(
+									mTileBegin[inIndex], mTileEnd[inIndex],
+									mSourceWidth, mSourceHeight, mEntry8 + start, num);
+		else
+			mResult[inIndex] = decodeTile<RectifyMapEntry16, RECTIFY_MAP_16BIT_SHIFT>(
+									mTileBegin[inIndex], mTileEnd[inIndex],
+									mSourceWidth, mSourceHeight, mEntry16 + start, num);
+	}
+
+	int					mWidth, mHeight;
+	int					mSourceWidth, mSourceHeight;
+	int					mTileRows;
+	RectifyMapEntry8	*mEntry8;
+	RectifyMapEntry16	*mEntry16;
+	std::vector<const unsigned char *>	mTileBegin;
+	std::vector<const unsigned char *>	mTileEnd;
+	std::vector<char>	mResult;
+};
+
+
+// -----------------------------------------------------------------------------
+// 	detectSimdType
+// -----------------------------------------------------------------------------
+//
+static RectifyMap::SimdType	detectSimdType()
+{
+#if defined(RECTIFY_MAP_X86) && defined(_MSC_VER)
+	int	info[4];
+
+	__cpuid(info, 1);
+	bool	sse41 = ((info[2] & (1 << 19)) != 0);
+	bool	osxsave = ((info[2] & (1 << 27)) != 0);
+	bool	avx = ((info[2] & (1 << 28)) != 0);
+
+	__cpuid(info, 0);
+	bool	avx2 = false;
+	if (info[0] >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = ((info[1] & (1 << 5)) != 0);
+	}
+
+	//	AVX2 also needs the OS support of the YMM registers
+	if (avx2 && avx && osxsave && (_xgetbv(0) & 6) == 6)
+		return RectifyMap::SIMD_AVX2;
+	if (sse41)
+		return RectifyMap::SIMD_SSE41;
+#elif defined(RECTIFY_MAP_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return RectifyMap::SIMD_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return RectifyMap::SIMD_SSE41;
+#endif
+	return RectifyMap::SIMD_NONE;
+}
+
+static int	sSimdType = -1;	// -1: not selected yet (use the supported one)
+
+
+//  RectifyMap class public member functions =====================================
+
+// -----------------------------------------------------------------------------
+//	RectifyMap
+// -----------------------------------------------------------------------------
+//
+RectifyMap::RectifyMap()
+{
+	mWidth = 0;
+	mHeight = 0;
+	mSourceWidth = 0;
+	mSourceHeight = 0;
+	mWeightType = WEIGHT_16BIT;
+}
+
+
+// -----------------------------------------------------------------------------
+//	~RectifyMap
+// -----------------------------------------------------------------------------
+//
+RectifyMap::~RectifyMap()
+{
+}
+
+
+// -----------------------------------------------------------------------------
+//	Create
+// -----------------------------------------------------------------------------
+//
+void	RectifyMap::Create(int inWidth, int inHeight, int inSourceWidth, int inSourceHeight,
+							int inWeightType)
+{
+	mWidth = inWidth;
+	mHeight = inHeight;
+	mSourceWidth = inSourceWidth;
+	mSourceHeight = inSourceHeight;
+	mWeightType = inWeightType;
+
+	mEntry8.clear();
+	mEntry16.clear();
+	if (mWeightType == WEIGHT_8BIT)
+	{
+		RectifyMapEntry8	e = {-1, {0, 0, 0, 0}};
+		mEntry8.resize(mWidth * mHeight, e);
+	}
+	else
+	{
+		RectifyMapEntry16	e = {-1, {0, 0, 0, 0}};
+		mEntry16.resize(mWidth * mHeight, e);
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+//	Clear
+// -----------------------------------------------------------------------------
+//
+void	RectifyMap::Clear()
+{
+	mWidth = 0;
+	mHeight = 0;
+	mSourceWidth = 0;
+	mSourceHeight = 0;
+	std::vector<RectifyMapEntry8>().swap(mEntry8);
+	std::vector<RectifyMapEntry16>().swap(mEntry16);
+}
+
+
+// -----------------------------------------------------------------------------
+//	SetEntry
+// -----------------------------------------------------------------------------
+//
+//	The source position is valid if all the four pixels are in the source
+//	image (the same condition as rect_index)
+//
+bool	RectifyMap::SetEntry(int inX, int inY, double inSourceX, double inSourceY)
+{
+	int	i = inX + inY * mWidth;
+	int	x0 = (int )floor(inSourceX);
+	int	y0 = (int )floor(inSourceY);
+	int	offset = -1;
+
+	if (x0 >= 0 && x0 <= mSourceWidth - 2 &&
+		y0 >= 0 && y0 <= mSourceHeight - 2)
+		offset = x0 + y0 * mSourceWidth;
+
+	if (mWeightType == WEIGHT_8BIT)
+	{
+		mEntry8[i].offset = offset;
+		if (offset >= 0)
+			setWeights<RectifyMapEntry8, RECTIFY_MAP_8BIT_SHIFT>(mEntry8[i], inSourceX - x0, inSourceY - y0);
+	}
+	else
+	{
+		mEntry16[i].offset = offset;
+		if (offset >= 0)
+			setWeights<RectifyMapEntry16, RECTIFY_MAP_16BIT_SHIFT>(mEntry16[i], inSourceX - x0, inSourceY - y0);
+	}
+
+	return offset >= 0;
+}
+
+
+// -----------------------------------------------------------------------------
+//	Remap
+// -----------------------------------------------------------------------------
+//
+void	RectifyMap::Remap(const unsigned char *inImage, unsigned char *outImage,
+							int inChannelNum, int inWorkerNum) const
+{
+	if (IsEmpty() || (inChannelNum != 1 && inChannelNum != 3))
+		return;
+
+	RemapTask	task(this, inChannelNum, inImage, outImage);
+	ParallelTask::Run(&task, task.GetTaskNum(), inWorkerNum);
+}
+
+
+// -----------------------------------------------------------------------------
+//	Encode
+// -----------------------------------------------------------------------------
+//
+void	RectifyMap::Encode(std::vector<unsigned char> &outData, int inWorkerNum) const
+{
+	int	tileRows = RECTIFY_MAP_TILE_ROWS;
+	int	tileNum = (mHeight + tileRows - 1) / tileRows;
+
+	EncodeTask	task(this, tileRows, tileNum);
+	ParallelTask::Run(&task, tileNum, inWorkerNum);
+
+	std::vector<int>	words(RECTIFY_MAP_CODE_HEADER_LEN + tileNum);
+	words[0] = RECTIFY_MAP_CODE_ID;
+	words[1] = mWidth;
+	words[2] = mHeight;
+	words[3] = mSourceWidth;
+	words[4] = mSourceHeight;
+	words[5] = mWeightType;
+	words[6] = tileRows;
+	words[7] = tileNum;
+	size_t	size = words.size() * sizeof(int);
+	for (int i = 0; i < tileNum; i++)
+	{
+		words[RECTIFY_MAP_CODE_HEADER_LEN + i] = (int )task.mTileData[i].size();
+		size += task.mTileData[i].size();
+	}
+
+	outData.resize(size);
+	memcpy(&(outData[0]), &(words[0]), words.size() * sizeof(int));
+	size = words.size() * sizeof(int);
+	for (int i = 0; i < tileNum; i++)
+	{
+		if (task.mTileData[i].empty() == false)
+			memcpy(&(outData[size]), &(task.mTileData[i][0]), task.mTileData[i].size());
+		size += task.mTileData[i].size();
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+//	Decode
+// -----------------------------------------------------------------------------
+//
+bool	RectifyMap::Decode(const std::vector<unsigned char> &inData, int inWorkerNum)
+{
+	Clear();
+
+	if (inData.size() < RECTIFY_MAP_CODE_HEADER_LEN * sizeof(int))
+		return false;
+
+	int	words[RECTIFY_MAP_CODE_HEADER_LEN];
+	memcpy(words, &(inData[0]), sizeof(words));
+	int	width = words[1], height = words[2];
+	int	sourceWidth = words[3], sourceHeight = words[4];
+	int	weightType = words[5];
+	int	tileRows = words[6], tileNum = words[7];
+
+	if (words[0] != RECTIFY_MAP_CODE_ID ||
+		width <= 0 || height <= 0 || sourceWidth < 2 || sourceHeight < 2 ||
+		(size_t )width * height > RECTIFY_MAP_CODE_PIXEL_MAX ||
+		sourceWidth > RECTIFY_MAP_CODE_SIZE_MAX || sourceHeight > RECTIFY_MAP_CODE_SIZE_MAX ||
+		(size_t )sourceWidth * sourceHeight > RECTIFY_MAP_CODE_PIXEL_MAX ||
+		(weightType != WEIGHT_8BIT && weightType != WEIGHT_16BIT) ||
+		tileRows <= 0 || tileNum != (height + tileRows - 1) / tileRows)
+		return false;
+
+	//	Every tile has its size word and at least one code byte, so the
+	//	broken headers are rejected here before Create allocates the map
+	if ((inData.size() - RECTIFY_MAP_CODE_HEADER_LEN * sizeof(int)) / (sizeof(int) + 1) < (size_t )tileNum)
+		return false;
+	size_t	pos = (RECTIFY_MAP_CODE_HEADER_LEN + (size_t )tileNum) * sizeof(int);
+
+	Create(width, height, sourceWidth, sourceHeight, weightType);
+
+	DecodeTask	task(width, height, sourceWidth, sourceHeight, tileRows,
+					weightType == WEIGHT_8BIT ? &(mEntry8[0]) : NULL,
+					weightType == WEIGHT_8BIT ? NULL : &(mEntry16[0]));
+	const unsigned char	*data = &(inData[0]);
+	for (int i = 0; i < tileNum; i++)
+	{
+		int	tileSize;
+		memcpy(&tileSize, data + (RECTIFY_MAP_CODE_HEADER_LEN + i) * sizeof(int), sizeof(int));
+		if (tileSize < 0 || inData.size() - pos < (size_t )tileSize)
+		{
+			Clear();
+			return false;
+		}
+		task.mTileBegin.push_back(data + pos);
+		task.mTileEnd.push_back(data + pos + tileSize);
+		pos += tileSize;
+	}
+	if (pos != inData.size())
+	{
+		Clear();
+		return false;
+	}
+	task.mResult.resize(tileNum, 0);
+
+	ParallelTask::Run(&task, tileNum, inWorkerNum);
+
+	for (int i = 0; i < tileNum; i++)
+	{
+		if (task.mResult[i] == 0)
+		{
+			Clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+//	GetValidNum
+// -----------------------------------------------------------------------------
+//
+int		RectifyMap::GetValidNum() const
+{
+	int	num = 0;
+	for (int i = 0; i < (int )mEntry8.size(); i++)
+		if (mEntry8[i].offset >= 0)
+			num++;
+	for (int i = 0; i < (int )mEntry16.size(); i++)
+		if (mEntry16[i].offset >= 0)
+			num++;
+	return num;
+}
+
+
+// -----------------------------------------------------------------------------
+//	GetMemorySize
+// -----------------------------------------------------------------------------
+//
+size_t	RectifyMap::GetMemorySize() const
+{
+	return	mEntry8.size() * sizeof(RectifyMapEntry8) +
+			mEntry16.size() * sizeof(RectifyMapEntry16);
+}
+
+
+// -----------------------------------------------------------------------------
+//	GetSupportedSimdType
+// -----------------------------------------------------------------------------
+//
+RectifyMap::SimdType	RectifyMap::GetSupportedSimdType()
+{
+	static const SimdType	supportedType = detectSimdType();
+
+	return supportedType;
+}
+
+
+// -----------------------------------------------------------------------------
+//	GetSimdType
+// -----------------------------------------------------------------------------
+//
+RectifyMap::SimdType	RectifyMap::GetSimdType()
+{
+	if (sSimdType < 0)
+		return GetSupportedSimdType();
+	return (SimdType )sSimdType;
+}
+
+
+// -----------------------------------------------------------------------------
+//	SetSimdType
+// -----------------------------------------------------------------------------
+//
+void	RectifyMap::SetSimdType(SimdType inType)
+{
+	if (inType > GetSupportedSimdType())
+		inType = GetSupportedSimdType();
+	sSimdType = inType;
+}
@@ -0,0 +1,169 @@
+// =============================================================================
+//  RectifyMap.hpp
+//
+//  MIT License
+//
+//  Copyright (c) 2007-2018 Dairoku Sekiguchi
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+// =============================================================================
+/*!
+	\file		RectifyMap.hpp
+	\author		Dairoku Sekiguchi
+	\version	1.0
+	\date		2018/06/20
+	\brief		This file is a part of CalibraKernel
+
+	Row major fixed point remap table of the rectification
+	(the compact form of the indices and the weights of rect_index)
+*/
+
+#ifndef __RECTIFY_MAP_HPP
+#define __RECTIFY_MAP_HPP
+
+
+// -----------------------------------------------------------------------------
+// 	include files
+// -----------------------------------------------------------------------------
+#include <vector>
+#include <stddef.h>
+
+
+// -----------------------------------------------------------------------------
+// 	macros
+// -----------------------------------------------------------------------------
+#define	RECTIFY_MAP_8BIT_SHIFT		7		//	the weights of WEIGHT_8BIT sum up to 1 << 7
+#define	RECTIFY_MAP_16BIT_SHIFT		14		//	the weights of WEIGHT_16BIT sum up to 1 << 14
+
+
+// -----------------------------------------------------------------------------
+// 	RectifyMapEntry structs
+// -----------------------------------------------------------------------------
+//
+//	One entry per output pixel. offset is the source pixel (x, y) as
+//	y * (source width) + x, or -1 if the pixel is outside of the source image.
+//	The weights are of (x, y), (x + 1, y), (x, y + 1) and (x + 1, y + 1).
+//
+struct	RectifyMapEntry8
+{
+	int				offset;
+	unsigned char	w[4];
+};
+
+struct	RectifyMapEntry16
+{
+	int				offset;
+	unsigned short	w[4];
+};
+
+
+// -----------------------------------------------------------------------------
+// 	RectifyMap class
+// -----------------------------------------------------------------------------
+//
+//	The entries are stored in the order of the output pixels (row major), so
+//	Remap reads the table and writes the output image sequentially. The
+//	source pixels of the neighbouring output pixels are close to each other,
+//	and the pixels outside of the source image are written as 0 in the same
+//	pass. Remap has no divisions: the weights are fixed point numbers and
+//	the value is (sum of weight * pixel + 0.5) >> shift.
+//
+//	WEIGHT_8BIT is 8 bytes per pixel (1/128 steps), WEIGHT_16BIT is 12 bytes
+//	per pixel (1/16384 steps). The 14 bits of WEIGHT_16BIT fit in the signed
+//	16 bit multiply-add of SSE2.
+//
+//	Remap splits the output rows into the ParallelTask tasks. The SIMD type
+//	(AVX2 gather or SSE4.1) is detected at runtime and falls back to the
+//	scalar code, the results do not depend on the SIMD type nor on the
+//	number of the workers.
+//
+class	RectifyMap
+{
+public:
+	enum WeightType
+	{
+							WEIGHT_8BIT		= 0,
+							WEIGHT_16BIT
+	};
+
+	enum SimdType
+	{
+							SIMD_NONE		= 0,
+							SIMD_SSE41,
+							SIMD_AVX2
+	};
+
+	//	constructor/destructor
+							RectifyMap();
+	virtual					~RectifyMap();
+
+	//	member functions
+	//	All the entries are cleared to -1 (outside)
+	void					Create(int inWidth, int inHeight, int inSourceWidth, int inSourceHeight,
+									int inWeightType = WEIGHT_16BIT);
+	void					Clear();
+
+	//	(inSourceX, inSourceY) is the position in the source image of the output pixel (inX, inY)
+	//	(origin is (0, 0)). Returns false if it is outside (the entry is -1 then).
+	bool					SetEntry(int inX, int inY, double inSourceX, double inSourceY);
+
+	//	8bit monochrome (inChannelNum = 1) or 24bit BGR (inChannelNum = 3) images,
+	//	the rows are Width() and SourceWidth() pixels without padding.
+	//	inWorkerNum <= 0 means the number of the hardware threads
+	void					Remap(const unsigned char *inImage, unsigned char *outImage,
+									int inChannelNum = 1, int inWorkerNum = 0) const;
+
+	//	Lossless compact byte stream of the map (the tiles of the variable
+	//	length prediction errors, about 4 bytes per valid pixel)
+	void					Encode(std::vector<unsigned char> &outData, int inWorkerNum = 0) const;
+	//	Returns false (and the map is empty) if inData is broken
+	bool					Decode(const std::vector<unsigned char> &inData, int inWorkerNum = 0);
+
+	int						GetWidth() const { return mWidth; }
+	int						GetHeight() const { return mHeight; }
+	int						GetSourceWidth() const { return mSourceWidth; }
+	int						GetSourceHeight() const { return mSourceHeight; }
+	int						GetWeightType() const { return mWeightType; }
+	bool					IsEmpty() const { return mWidth == 0 || mHeight == 0; }
+	int						GetValidNum() const;
+	bool					IsValid(int inX, int inY) const
+							{
+								int	i = inX + inY * mWidth;
+								return (mWeightType == WEIGHT_8BIT) ? mEntry8[i].offset >= 0 : mEntry16[i].offset >= 0;
+							}
+	size_t					GetMemorySize() const;
+
+	const RectifyMapEntry8	*GetEntry8() const { return mEntry8.empty() ? NULL : &(mEntry8[0]); }
+	const RectifyMapEntry16	*GetEntry16() const { return mEntry16.empty() ? NULL : &(mEntry16[0]); }
+
+	static SimdType			GetSupportedSimdType();
+	static SimdType			GetSimdType();
+	//	The type is limited to the supported one (SIMD_NONE is always accepted)
+	static void				SetSimdType(SimdType inType);
+
+protected:
+	int						mWidth, mHeight;
+	int						mSourceWidth, mSourceHeight;
+	int						mWeightType;
+	std::vector<RectifyMapEntry8>	mEntry8;
+	std::vector<RectifyMapEntry16>	mEntry16;
+};
+
+
+#endif	// #ifdef __RECTIFY_MAP_HPP
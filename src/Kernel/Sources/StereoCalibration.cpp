@@ -64,6 +64,271 @@ namespace lapack = boost::numeric::bindings::lapack;
 
 //bool	g_debug_enabled = false;
 
+// -----------------------------------------------------------------------------
+//	hashValues
+// -----------------------------------------------------------------------------
+//
+//	64bit FNV-1a of the bytes of the values
+//
+static unsigned long long	hashValues(unsigned long long in_hash, const double *in_values, int in_num)
+{
+	const unsigned char	*p = (const unsigned char *)in_values;
+
+	for (size_t i = 0; i < in_num * sizeof(double); i++)
+	{
+		in_hash ^= p[i];
+		in_hash *= 0x100000001B3ULL;
+	}
+	return in_hash;
+}
+
+template <class T>
+static unsigned long long	hashElements(unsigned long long in_hash, const T &in_data)
+{
+	for (typename T::const_iterator it = in_data.begin(); it != in_data.end(); ++it)
+	{
+		double	v = *it;
+		in_hash = hashValues(in_hash, &v, 1);
+	}
+	return in_hash;
+}
+
+
+// -----------------------------------------------------------------------------
+//	RectifyBox
+// -----------------------------------------------------------------------------
+//
+//	Box on the normalized rectified image plane ([0]: x, [1]: y)
+//
+#define RECTIFY_BOX_SAMPLE_NUM		16	//	points per side of the image border
+
+struct RectifyBox
+{
+	double	min[2];
+	double	max[2];
+};
+
+
+// -----------------------------------------------------------------------------
+//	resolveRectifySize
+// -----------------------------------------------------------------------------
+//
+static void	resolveRectifySize(double in_image_width, double in_image_height,
+								int in_width, int in_height, double in_scale,
+								int &out_width, int &out_height)
+{
+	out_width = (in_width > 0) ? in_width : (int )floor(in_image_width * in_scale + 0.5);
+	out_height = (in_height > 0) ? in_height : (int )floor(in_image_height * in_scale + 0.5);
+	if (out_width < 1)
+		out_width = 1;
+	if (out_height < 1)
+		out_height = 1;
+}
+
+
+// -----------------------------------------------------------------------------
+//	calcRectifyBoxes
+// -----------------------------------------------------------------------------
+//
+//	Rectifies the border of the source image (nc x nr) and returns the box
+//	inside the border (out_inner) and the box around it (out_outer)
+//
+static void	calcRectifyBoxes(int nc, int nr,
+								const ublas::vector<double> &fc,
+								const ublas::vector<double> &cc,
+								const ublas::vector<double> &kc,
+								double alpha_c,
+								const ublas::matrix<double, ublas::column_major> &R,
+								RectifyBox &out_inner, RectifyBox &out_outer)
+{
+	int	n = RECTIFY_BOX_SAMPLE_NUM;
+	ublas::matrix<double, ublas::column_major>	x(2, 4 * n);
+	ublas::matrix<double, ublas::column_major>	xn(2, 4 * n);
+
+	//	top, bottom, left and right side
+	for (int i = 0; i < n; i++)
+	{
+		double	u = (nc - 1) * (double )i / (n - 1);
+		double	v = (nr - 1) * (double )i / (n - 1);
+		x(0, i) = u;			x(1, i) = 0;
+		x(0, n + i) = u;		x(1, n + i) = nr - 1;
+		x(0, 2 * n + i) = 0;	x(1, 2 * n + i) = v;
+		x(0, 3 * n + i) = nc - 1;	x(1, 3 * n + i) = v;
+	}
+	CameraCalibration::normalize_pixel(fc, cc, kc, alpha_c, x, xn);
+
+	for (int k = 0; k < 2; k++)
+	{
+		out_inner.min[k] = -1e300;
+		out_inner.max[k] = 1e300;
+		out_outer.min[k] = 1e300;
+		out_outer.max[k] = -1e300;
+	}
+
+	for (int i = 0; i < 4 * n; i++)
+	{
+		double	p[2], z;
+		for (int k = 0; k < 2; k++)
+			p[k] = R(k, 0) * xn(0, i) + R(k, 1) * xn(1, i) + R(k, 2);
+		z = R(2, 0) * xn(0, i) + R(2, 1) * xn(1, i) + R(2, 2);
+		if (z <= 0)
+			continue;
+		p[0] /= z;
+		p[1] /= z;
+
+		for (int k = 0; k < 2; k++)
+		{
+			out_outer.min[k] = __min(out_outer.min[k], p[k]);
+			out_outer.max[k] = __max(out_outer.max[k], p[k]);
+		}
+		switch (i / n)
+		{
+			case 0:	out_inner.min[1] = __max(out_inner.min[1], p[1]); break;
+			case 1:	out_inner.max[1] = __min(out_inner.max[1], p[1]); break;
+			case 2:	out_inner.min[0] = __max(out_inner.min[0], p[0]); break;
+			case 3:	out_inner.max[0] = __min(out_inner.max[0], p[0]); break;
+		}
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+//	calcAlphaCameraMatrix
+// -----------------------------------------------------------------------------
+//
+//	Picks the focal length and the principal points of the rectified images
+//	(width x height) from the boxes of calcRectifyBoxes. in_alpha = 0 fits
+//	the images into the inner boxes and 1 fits the outer boxes into the images.
+//	in_shared_axis is the axis shared by the both images (y for horizontal stereo).
+//
+static void	calcAlphaCameraMatrix(int in_width, int in_height, int in_shared_axis, double in_alpha,
+								const RectifyBox in_inner[2], const RectifyBox in_outer[2],
+								ublas::matrix<double, ublas::column_major> *out_KK[2])
+{
+	double	size[2] = {in_width - 1.0, in_height - 1.0};
+	RectifyBox	inner[2] = {in_inner[0], in_inner[1]};
+	RectifyBox	outer[2] = {in_outer[0], in_outer[1]};
+	int	k = in_shared_axis;
+
+	for (int i = 0; i < 2; i++)
+	{
+		inner[i].min[k] = __max(in_inner[0].min[k], in_inner[1].min[k]);
+		inner[i].max[k] = __min(in_inner[0].max[k], in_inner[1].max[k]);
+		outer[i].min[k] = __min(in_outer[0].min[k], in_outer[1].min[k]);
+		outer[i].max[k] = __max(in_outer[0].max[k], in_outer[1].max[k]);
+	}
+
+	double	f0 = 0, f1 = 1e300;
+	for (int i = 0; i < 2; i++)
+		for (int j = 0; j < 2; j++)
+		{
+			f0 = __max(f0, size[j] / (inner[i].max[j] - inner[i].min[j]));
+			f1 = __min(f1, size[j] / (outer[i].max[j] - outer[i].min[j]));
+		}
+	double	f = f0 + (f1 - f0) * in_alpha;
+
+	for (int i = 0; i < 2; i++)
+	{
+		double	c[2];
+		for (int j = 0; j < 2; j++)
+		{
+			double	mid0 = (inner[i].min[j] + inner[i].max[j]) / 2.0;
+			double	mid1 = (outer[i].min[j] + outer[i].max[j]) / 2.0;
+			c[j] = size[j] / 2.0 - f * (mid0 + (mid1 - mid0) * in_alpha);
+		}
+
+		ublas::matrix<double, ublas::column_major>	&KK = *(out_KK[i]);
+		KK(0, 0) = f;	KK(0, 1) = 0;	KK(0, 2) = c[0];
+		KK(1, 0) = 0;	KK(1, 1) = f;	KK(1, 2) = c[1];
+		KK(2, 0) = 0;	KK(2, 1) = 0;	KK(2, 2) = 1;
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+//	calcValidROI
+// -----------------------------------------------------------------------------
+//
+//	Starts from the inner box on the rectified image and shrinks it until
+//	every pixel on the edges is mapped to the source image (the edge with
+//	the most unmapped pixels is moved first)
+//
+static RectifyROI	calcValidROI(const RectifyMap &in_map, const RectifyBox &in_inner,
+								const ublas::matrix<double, ublas::column_major> &KK)
+{
+	RectifyROI	roi = {0, 0, 0, 0};
+	int	x0 = (int )ceil(KK(0, 0) * in_inner.min[0] + KK(0, 2));
+	int	x1 = (int )floor(KK(0, 0) * in_inner.max[0] + KK(0, 2));
+	int	y0 = (int )ceil(KK(1, 1) * in_inner.min[1] + KK(1, 2));
+	int	y1 = (int )floor(KK(1, 1) * in_inner.max[1] + KK(1, 2));
+
+	x0 = __max(x0, 0);
+	y0 = __max(y0, 0);
+	x1 = __min(x1, in_map.GetWidth() - 1);
+	y1 = __min(y1, in_map.GetHeight() - 1);
+
+	while (x0 <= x1 && y0 <= y1)
+	{
+		int	num[4] = {0, 0, 0, 0};	//	top, bottom, left and right
+		for (int x = x0; x <= x1; x++)
+		{
+			num[0] += !in_map.IsValid(x, y0);
+			num[1] += !in_map.IsValid(x, y1);
+		}
+		for (int y = y0; y <= y1; y++)
+		{
+			num[2] += !in_map.IsValid(x0, y);
+			num[3] += !in_map.IsValid(x1, y);
+		}
+
+		int	edge = 0;
+		for (int i = 1; i < 4; i++)
+			if (num[i] > num[edge])
+				edge = i;
+		if (num[edge] == 0)
+			break;
+		switch (edge)
+		{
+			case 0:	y0++; break;
+			case 1:	y1--; break;
+			case 2:	x0++; break;
+			case 3:	x1--; break;
+		}
+	}
+
+	if (x0 <= x1 && y0 <= y1)
+	{
+		roi.x = x0;
+		roi.y = y0;
+		roi.width = x1 - x0 + 1;
+		roi.height = y1 - y0 + 1;
+	}
+	return roi;
+}
+
+
+// -----------------------------------------------------------------------------
+//	intersectROI
+// -----------------------------------------------------------------------------
+//
+static RectifyROI	intersectROI(const RectifyROI &in_roi1, const RectifyROI &in_roi2)
+{
+	RectifyROI	roi = {0, 0, 0, 0};
+	int	x0 = __max(in_roi1.x, in_roi2.x);
+	int	y0 = __max(in_roi1.y, in_roi2.y);
+	int	x1 = __min(in_roi1.x + in_roi1.width, in_roi2.x + in_roi2.width);
+	int	y1 = __min(in_roi1.y + in_roi1.height, in_roi2.y + in_roi2.height);
+
+	if (x0 < x1 && y0 < y1)
+	{
+		roi.x = x0;
+		roi.y = y0;
+		roi.width = x1 - x0;
+		roi.height = y1 - y0;
+	}
+	return roi;
+}
+
 
 //  StereoCalibration class public member functions ===========================
 // -----------------------------------------------------------------------------
@@ -74,6 +339,12 @@ StereoCalibration::StereoCalibration(int inImageWidth, int inImageHeight)
 	: CameraCalibration(inImageWidth, inImageHeight)
 {
 	//	̃p[^
+	rect_map_hash = 0;
+	rect_width = rect_height = 0;
+	rect_scale = 1.0;
+	rect_alpha = -1.0;
+	rect_roi_left.x = rect_roi_left.y = rect_roi_left.width = rect_roi_left.height = 0;
+	rect_roi_right = rect_roi = rect_roi_left;
 }
 
 
@@ -145,8 +416,15 @@ void	StereoCalibration::DoCalibration()
 //	CalcRectifyIndex
 // -----------------------------------------------------------------------------
 //
-void	StereoCalibration::CalcRectifyIndex()
+void	StereoCalibration::CalcRectifyIndex(int inWidth, int inHeight, double inScale, double inAlpha)
 {
+	std::lock_guard<std::recursive_mutex>	lock(rect_map_mutex);
+
+	int	width, height;
+	resolveRectifySize(mImageWidth, mImageHeight, inWidth, inHeight, inScale, width, height);
+	if (inAlpha > 1)
+		inAlpha = 1;
+
 	ublas::matrix<double, ublas::column_major>	R(3, 3);
 	ublas::matrix<double, ublas::column_major>	jacobian(9, 3);
 
@@ -270,12 +548,6 @@ void	StereoCalibration::CalcRectifyIndex()
 	ublas::matrix<double, ublas::column_major>	xn(2, n);
 	ublas::matrix<double, ublas::column_major>	xnn(3, n);
 	ublas::matrix<double, ublas::column_major>	xnnn(2, n);
-	ublas::matrix<double, ublas::column_major>	dxdom(2 * n, 3);
-	ublas::matrix<double, ublas::column_major>	dxdT(2 * n, 3);
-	ublas::matrix<double, ublas::column_major>	dxdf(2 * n, 2);
-	ublas::matrix<double, ublas::column_major>	dxdc(2 * n, 2);
-	ublas::matrix<double, ublas::column_major>	dxdk(2 * n, 5);
-	ublas::matrix<double, ublas::column_major>	dxdalpha(2 * n, 1);
 
 	x(0, 0) = 0; x(0, 1) = mImageWidth - 1; x(0, 2) = mImageWidth - 1; x(0, 3) = 0;
 	x(1, 0) = 0; x(1, 1) = 0; x(1, 2) = mImageHeight - 1; x(1, 3) = mImageHeight - 1;
@@ -294,7 +566,7 @@ void	StereoCalibration::CalcRectifyIndex()
 	ublas::matrix<double, ublas::column_major>	z3(3, 1); z3.clear();
 	ublas::vector<double>	z5(5); z5.clear();
 
-	project_points2(xnn, R_Ln, z3, fc_left_new, z2, z5, 0, xnnn, dxdom, dxdT, dxdf, dxdc, dxdk, dxdalpha);
+	project_points2(xnn, R_Ln, z3, fc_left_new, z2, z5, 0, xnnn);
 
 //std::cout << "xnnn:" << xnnn << std::endl;
 
@@ -319,7 +591,7 @@ void	StereoCalibration::CalcRectifyIndex()
 	ublas::matrix<double, ublas::column_major>	R_Rn(3, 3);
 
 	rodrigues(R_R, R_Rn, jacobian);
-	project_points2(xnn, R_Rn, z3, fc_right_new, z2, z5, 0, xnnn, dxdom, dxdT, dxdf, dxdc, dxdk, dxdalpha);
+	project_points2(xnn, R_Rn, z3, fc_right_new, z2, z5, 0, xnnn);
 	mat_mean_dim(xnnn, mean_out, 2);
 
 	ublas::vector<double>	cc_right_new(2);
@@ -384,21 +656,118 @@ void	StereoCalibration::CalcRectifyIndex()
 //std::cout << "KK_left_new:" << KK_left_new << std::endl;
 //std::cout << "KK_right_new:" << KK_right_new << std::endl;
 
-	// The sizes of the images are the same:
-	double	nx_right_new = mImageWidth;
-	double	ny_right_new = mImageHeight;
-	double	nx_left_new = mImageWidth;
-	double	ny_left_new = mImageHeight;
+	// The sizes of the rectified images (only the pixels of the rectified images are mapped):
+	double	nx_right_new = width;
+	double	ny_right_new = height;
+	double	nx_left_new = width;
+	double	ny_left_new = height;
+
+	RectifyBox	inner[2], outer[2];
+	calcRectifyBoxes(mImageWidth, mImageHeight, fc_left, cc_left, kc_left, alpha_c_left, R_L,
+						inner[0], outer[0]);
+	calcRectifyBoxes(mImageWidth, mImageHeight, fc_right, cc_right, kc_right, alpha_c_right, R_R,
+						inner[1], outer[1]);
+
+	if (inAlpha < 0)
+	{
+		// Scale the camera matrices above (the pixel centers of the scaled image
+		// are (x + 0.5) * s - 0.5) and center them in the rectified images:
+		ublas::matrix<double, ublas::column_major>	*KK_new[2] = {&KK_left_new, &KK_right_new};
+		for (int i = 0; i < 2; i++)
+		{
+			ublas::matrix<double, ublas::column_major>	&KK = *(KK_new[i]);
+			KK(0, 0) *= inScale;
+			KK(0, 1) *= inScale;
+			KK(1, 1) *= inScale;
+			KK(0, 2) = KK(0, 2) * inScale + (inScale - 1) / 2 + (width - mImageWidth * inScale) / 2;
+			KK(1, 2) = KK(1, 2) * inScale + (inScale - 1) / 2 + (height - mImageHeight * inScale) / 2;
+		}
+	}
+	else
+	{
+		// Pick the focal length and the principal points by inAlpha instead:
+		ublas::matrix<double, ublas::column_major>	*KK_new[2] = {&KK_left_new, &KK_right_new};
+		calcAlphaCameraMatrix(width, height, (type_stereo == 0) ? 1 : 0, inAlpha,
+								inner, outer, KK_new);
+	}
 
 	// Let's rectify the entire set of calibration images:
 	printf("Pre-computing the necessary data to quickly rectify the images (may take a while depending on the image resolution, but needs to be done only once - even for color images)...\n\n");
 
 	// Pre-compute the necessary indices and blending coefficients to enable quick rectification:
+	//	(row major fixed point tables instead of the a1..a4 and ind_* vectors of the old rect_index)
 	rect_index(mImageWidth, mImageHeight, R_L, fc_left, cc_left, kc_left, alpha_c_left, KK_left_new,
-				a1_left, a2_left, a3_left, a4_left, ind_new_left, ind_1_left, ind_2_left, ind_3_left, ind_4_left);
-
+				rect_map_left, RectifyMap::WEIGHT_16BIT, width, height);
 	rect_index(mImageWidth, mImageHeight, R_R, fc_right, cc_right, kc_right, alpha_c_right, KK_right_new,
-				a1_right, a2_right, a3_right, a4_right, ind_new_right, ind_1_right, ind_2_right, ind_3_right, ind_4_right);
+				rect_map_right, RectifyMap::WEIGHT_16BIT, width, height);
+
+	// The regions of the valid pixels:
+	rect_roi_left = calcValidROI(rect_map_left, inner[0], KK_left_new);
+	rect_roi_right = calcValidROI(rect_map_right, inner[1], KK_right_new);
+	rect_roi = intersectROI(rect_roi_left, rect_roi_right);
+
+	printf("Rectified image size: %d x %d (scale %g, alpha %g)\n", width, height, inScale, inAlpha);
+	printf("Valid region: (%d, %d) %d x %d\n\n", rect_roi.x, rect_roi.y, rect_roi.width, rect_roi.height);
+
+	rect_width = width;
+	rect_height = height;
+	rect_scale = inScale;
+	rect_alpha = (inAlpha < 0) ? -1.0 : inAlpha;
+	rect_map_hash = CalcRectifyHash(rect_width, rect_height, rect_scale, rect_alpha);
+}
+
+
+// -----------------------------------------------------------------------------
+//	UpdateRectifyIndex
+// -----------------------------------------------------------------------------
+//
+bool	StereoCalibration::UpdateRectifyIndex(int inWidth, int inHeight, double inScale, double inAlpha)
+{
+	std::lock_guard<std::recursive_mutex>	lock(rect_map_mutex);
+
+	if (rect_map_hash != 0 && rect_map_hash == CalcRectifyHash(inWidth, inHeight, inScale, inAlpha) &&
+		rect_map_left.IsEmpty() == false && rect_map_right.IsEmpty() == false)
+		return false;
+
+	CalcRectifyIndex(inWidth, inHeight, inScale, inAlpha);
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+//	CalcRectifyHash
+// -----------------------------------------------------------------------------
+//
+unsigned long long	StereoCalibration::CalcRectifyHash(int inWidth, int inHeight,
+											double inScale, double inAlpha) const
+{
+	unsigned long long	hash = 0xCBF29CE484222325ULL;
+	int	width, height;
+
+	resolveRectifySize(mImageWidth, mImageHeight, inWidth, inHeight, inScale, width, height);
+	if (inAlpha > 1)
+		inAlpha = 1;
+	if (inAlpha < 0)
+		inAlpha = -1.0;
+
+	double	size[6] = {mImageWidth, mImageHeight, (double )width, (double )height, inScale, inAlpha};
+
+	hash = hashValues(hash, size, 6);
+	hash = hashElements(hash, om.data());
+	hash = hashElements(hash, T.data());
+	hash = hashElements(hash, fc_left);
+	hash = hashElements(hash, cc_left);
+	hash = hashElements(hash, kc_left);
+	hash = hashValues(hash, &alpha_c_left, 1);
+	hash = hashElements(hash, fc_right);
+	hash = hashElements(hash, cc_right);
+	hash = hashElements(hash, kc_right);
+	hash = hashValues(hash, &alpha_c_right, 1);
+
+	//	0 is "not made"
+	if (hash == 0)
+		hash = 1;
+	return hash;
 }
 
 
@@ -449,6 +818,11 @@ std::cout << "Note: The numerical errors are approximately three times the stand
 #define	MAIN_OPTIMIZATION_CHANGE_MIN	5e-6
 #define	MAIN_OPTIMIZATION_ITER_MAX		100
 
+#define	LM_ITER_MAX			100
+#define	LM_MU_INIT			1e-3
+#define	LM_GRADIENT_MIN		1e-9
+#define	LM_STEP_MIN			1e-10
+
 
 //  StreoCalibration class protected member functions ==========================
 // -----------------------------------------------------------------------------
@@ -457,7 +831,7 @@ std::cout << "Note: The numerical errors are approximately three times the stand
 //
 void	StereoCalibration::mainOptimization()
 {
-	int		i, j, kk, i_dash, j_dash;
+	int		i, j, kk;
 	int	n_ima = omc_left_list.size();
 
 	//	This threshold is used only to automatically
@@ -471,392 +845,239 @@ void	StereoCalibration::mainOptimization()
 	//kc_left = kc_left .* ~~est_dist_left;
 
 	//	Main Optimization
-	//	JɕKvȍšvZ...
-	int	J_rows = 0;
-	for (kk = 0; kk < n_ima; kk++)
-		J_rows += X_left_list[kk].size2() * 4;
+	//	The first 26 parameters (intrinsics of both cameras, om and T) are shared
+	//	by all the views and each view has its own 6 parameters (omckk and Tckk).
+	//	So J'*J is an arrow matrix. Instead of the dense J (MATLABłsparse),
+	//	J'*J and J'*e are accumulated block by block and solved by schur_solve.
+	int	n_global = 20 + 6;
+	int	n_param = n_global + n_ima * 6;
 
-	//	MATLABłsparseŊmۂĂ邪Cقǋȍs
-	//	łȂ̂ŕʂɊmۂĂ݂
-	ublas::matrix<double, ublas::column_major>	J(J_rows, 20 + (1 + n_ima) * 6);
-	ublas::matrix<double, ublas::column_major>	e(J_rows, 1);
-	ublas::vector<double>	selected_variables(J.size2());
-	ublas::vector<double>	param(J.size2());
+	ublas::vector<double>	selected_variables(n_param);
+	ublas::vector<double>	param(n_param);
 
-	J.clear();
-	e.clear();
 	selected_variables.clear();
 	param.clear();
 
-	ublas::matrix<double, ublas::column_major>	J2;
-	ublas::matrix<double, ublas::column_major>	J2_inv;
+	//	The following vector helps to select the variables to update (for only active images):
+	selected_variables(0) = 1.0;	// est_fc left
+	selected_variables(1) = 1.0;	// est_fc left
+	selected_variables(2) = 1.0;	// center optimizaion x left
+	selected_variables(3) = 1.0;	// center optimizaion y left
+	selected_variables(4) = 0.0;	// est_alpha left
+	//selected_variables(4) = 1.0;	// est_alpha left
+	selected_variables(5) = 1.0;	// est_dist left
+	selected_variables(6) = 1.0;	// est_dist left
+	selected_variables(7) = 1.0;	// est_dist left
+	selected_variables(8) = 1.0;	// est_dist left
+	selected_variables(9) = 0.0;	// est_dist left
+
+	selected_variables(10) = 1.0;	// est_fc right
+	selected_variables(11) = 1.0;	// est_fc right
+	selected_variables(12) = 1.0;	// center optimizaion x right
+	selected_variables(13) = 1.0;	// center optimizaion y right
+	selected_variables(14) = 0.0;	// est_alpha right
+	//selected_variables(14) = 1.0;	// est_alpha right
+	selected_variables(15) = 1.0;	// est_dist right
+	selected_variables(16) = 1.0;	// est_dist right
+	selected_variables(17) = 1.0;	// est_dist right
+	selected_variables(18) = 1.0;	// est_dist right
+	selected_variables(19) = 0.0;	// est_dist right
+
+	for (i = 0; i < 6; i++)
+		selected_variables(20 + i) = 1.0;
+
+	for (i = 0; i < 6 * n_ima; i++)
+		selected_variables(26 + i) = 1.0;	//	activeC[W1ɂق悢
+
+	//	Indices of the selected shared parameters (the view parameters are always selected)
+	std::vector<int>	ind_global;
+	for (i = 0; i < n_global; i++)
+		if (selected_variables(i) != 0.0)
+			ind_global.push_back(i);
+	int	n_sel = (int )ind_global.size();
+
+	std::vector<ublas::matrix<double, ublas::column_major> >	J2_view_list(n_ima);
+	std::vector<ublas::matrix<double, ublas::column_major> >	Je_view_list(n_ima);
+
+	ublas::matrix<double, ublas::column_major>	J2_dash(n_sel, n_sel);
+	ublas::matrix<double, ublas::column_major>	Je_dash(n_sel, 1);
+	std::vector<ublas::matrix<double, ublas::column_major> >	J2_cross_dash_list(n_ima);
+	ublas::matrix<double, ublas::column_major>	param_update(n_sel, 1);
+	std::vector<ublas::matrix<double, ublas::column_major> >	param_update_view_list(n_ima);
+	ublas::matrix<double, ublas::column_major>	J2_inv(n_sel, n_sel);
+	std::vector<ublas::matrix<double, ublas::column_major> >	J2_view_inv_list(n_ima);
+
+	//	Running sums of e for sigma_x (std(e(:)))
+	int		e_num = 0;
+	double	e_sum = 0.0;
+	double	e_sum2 = 0.0;
 
 	double	change = 1.0;
 	int		iter = 0;
 
-	while (	change > MAIN_OPTIMIZATION_CHANGE_MIN &&
-			iter < MAIN_OPTIMIZATION_ITER_MAX)
+	if (mOptimizationMethod == OPTIMIZATION_LEVENBERG_MARQUARDT)
 	{
-		param(0) = fc_left(0);
-		param(1) = fc_left(1);
-		param(2) = cc_left(0);
-		param(3) = cc_left(1);
-		param(4) = alpha_c_left;
-		for (i = 0; i < 5; i++)
-			param(5 + i) = kc_left(i);
-		param(10) = fc_right(0);
-		param(11) = fc_right(1);
-		param(12) = cc_right(0);
-		param(13) = cc_right(1);
-		param(14) = alpha_c_right;
-		for (i = 0; i < 5; i++)
-			param(15 + i) = kc_right(i);
-		for (i = 0; i < 3; i++)
-			param(20 + i) = om(i, 0);
-		for (i = 0; i < 3; i++)
-			param(23 + i) = T(i, 0);
-
-		//	must check active image first!
-		int	row_offset = 0;
-		for (kk = 0; kk < n_ima; kk++)
+		//	Levenberg-Marquardt (same as CameraCalibration::mainOptimization)
+		ublas::vector<double>	param_new(n_param);
+		ublas::matrix<double, ublas::column_major>	J2_damp(n_sel, n_sel);
+		std::vector<ublas::matrix<double, ublas::column_major> >	J2_view_damp_list(n_ima);
+		double	mu = LM_MU_INIT;
+		double	nu = 2.0;
+		double	e2, e2_new;
+
+		getParam(param);
+		buildNormalEquation(ind_global, J2_dash, Je_dash, J2_view_list, J2_cross_dash_list, Je_view_list,
+							e_num, e_sum, e_sum2);
+		e2 = e_sum2;
+
+		while (iter < LM_ITER_MAX)
 		{
-			//	Project the structure onto the left view:
-			for (i = 0; i < 3; i++)
-				param(26 + kk * 6 + i) = omc_left_list[kk](i, 0);
-			for (i = 0; i < 3; i++)
-				param(29 + kk * 6 + i) = Tc_left_list[kk](i, 0);
-
-			int	Nckk = X_left_list[kk].size2();
-
-			ublas::matrix<double, ublas::column_major>	Jkk(4 * Nckk, J.size2());
-			ublas::matrix<double, ublas::column_major>	ekk(4 * Nckk, 1);
-
-			Jkk.clear();
-			ekk.clear();
-
-			ublas::matrix<double, ublas::column_major>	xl(2, Nckk);
-			ublas::matrix<double, ublas::column_major>	dxldomckk(2 * Nckk, 3);
-			ublas::matrix<double, ublas::column_major>	dxldTckk(2 * Nckk, 3);
-			ublas::matrix<double, ublas::column_major>	dxldfl(2 * Nckk, 2);
-			ublas::matrix<double, ublas::column_major>	dxldcl(2 * Nckk, 2);
-			ublas::matrix<double, ublas::column_major>	dxldkl(2 * Nckk, 5);
-			ublas::matrix<double, ublas::column_major>	dxldalphal(2 * Nckk, 1);
-
-			// ToDo: mIsEstimateAspectRatio = falsêƂ̏lȂƃ_
-			project_points2(
-				X_left_list[kk], omc_left_list[kk], Tc_left_list[kk],
-				fc_left, cc_left, kc_left, alpha_c_left,
-				xl, dxldomckk, dxldTckk, dxldfl, dxldcl, dxldkl, dxldalphal);
-
-			for (i = 0; i < Nckk; i++)
+			//	Gradient (J'e) test
+			double	g_max = 0.0;
+			for (i = 0; i < n_sel; i++)
+				if (fabs(Je_dash(i, 0)) > g_max)
+					g_max = fabs(Je_dash(i, 0));
+			for (kk = 0; kk < n_ima; kk++)
+				for (j = 0; j < 6; j++)
+					if (fabs(Je_view_list[kk](j, 0)) > g_max)
+						g_max = fabs(Je_view_list[kk](j, 0));
+			if (g_max <= LM_GRADIENT_MIN)
+				break;
+
+			J2_damp = J2_dash;
+			for (i = 0; i < n_sel; i++)
+				J2_damp(i, i) += mu * J2_dash(i, i);
+			for (kk = 0; kk < n_ima; kk++)
 			{
-				ekk(i * 2, 0) = x_left_list[kk](0, i) - xl(0, i);
-				ekk(i * 2 + 1, 0) = x_left_list[kk](1, i) - xl(1, i);
+				J2_view_damp_list[kk] = J2_view_list[kk];
+				for (j = 0; j < 6; j++)
+					J2_view_damp_list[kk](j, j) += mu * J2_view_list[kk](j, j);
 			}
 
-			//	_DEF_MAT_RANGE(JJ3_r1, JJ3, 0, 10, 0, 10)@݂ȃ}Nق悢
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r1(Jkk, ublas::range(0, 2 * Nckk), ublas::range(6 * kk + 6 + 20, 6 * kk + 6 + 20 + 3));
-			Jkk_r1 = dxldomckk;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r2(Jkk, ublas::range(0, 2 * Nckk), ublas::range(6 * kk + 6 + 20 + 3, 6 * kk + 6 + 20 + 3 + 3));
-			Jkk_r2 = dxldTckk;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r3(Jkk, ublas::range(0, 2 * Nckk), ublas::range(0, 2));
-			Jkk_r3 = dxldfl;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r4(Jkk, ublas::range(0, 2 * Nckk), ublas::range(2, 4));
-			Jkk_r4 = dxldcl;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r5(Jkk, ublas::range(0, 2 * Nckk), ublas::range(4, 5));
-			Jkk_r5 = dxldalphal;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r6(Jkk, ublas::range(0, 2 * Nckk), ublas::range(5, 10));
-			Jkk_r6 = dxldkl;
-
-			//	Project the structure onto the right view:
-			ublas::matrix<double, ublas::column_major>	omr(3, 1);
-			ublas::matrix<double, ublas::column_major>	Tr(3, 1);
-			ublas::matrix<double, ublas::column_major>	domrdomckk(3, 3);
-			ublas::matrix<double, ublas::column_major>	domrdTckk(3, 3);
-			ublas::matrix<double, ublas::column_major>	domrdom(3, 3);
-			ublas::matrix<double, ublas::column_major>	domrdT(3, 3);
-			ublas::matrix<double, ublas::column_major>	dTrdomckk(3, 3);
-			ublas::matrix<double, ublas::column_major>	dTrdTckk(3, 3);
-			ublas::matrix<double, ublas::column_major>	dTrdom(3, 3);
-			ublas::matrix<double, ublas::column_major>	dTrdT(3, 3);
-
-			compose_motion(omc_left_list[kk], Tc_left_list[kk], om, T,
-				omr, Tr, domrdomckk, domrdTckk, domrdom, domrdT, dTrdomckk, dTrdTckk, dTrdom, dTrdT);
-
-/*std::cout << "omc_left_list[kk]" << omc_left_list[kk] << std::endl;
-std::cout << "Tc_left_list[kk]" << Tc_left_list[kk] << std::endl;
-std::cout << "om" << om << std::endl;
-std::cout << "T" << T << std::endl;
+			schur_solve(J2_damp, Je_dash, J2_view_damp_list, J2_cross_dash_list, Je_view_list,
+						param_update, param_update_view_list, J2_inv, J2_view_inv_list);
 
-std::cout << "omr" << omr << std::endl;
-std::cout << "Tr" << Tr << std::endl;
-std::cout << "domrdomckk" << domrdomckk << std::endl;
-std::cout << "domrdTckk" << domrdTckk << std::endl;
-std::cout << "domrdom" << domrdom << std::endl;
-std::cout << "domrdT" << domrdT << std::endl;
-std::cout << "dTrdomckk" << dTrdomckk << std::endl;
-std::cout << "dTrdTckk" << dTrdTckk << std::endl;
-std::cout << "dTrdom" << dTrdom << std::endl;
-std::cout << "dTrdT" << dTrdT << std::endl;*/
-
-			ublas::matrix<double, ublas::column_major>	xr(2, Nckk);
-			ublas::matrix<double, ublas::column_major>	dxrdomr(2 * Nckk, 3);
-			ublas::matrix<double, ublas::column_major>	dxrdTr(2 * Nckk, 3);
-			ublas::matrix<double, ublas::column_major>	dxrdfr(2 * Nckk, 2);
-			ublas::matrix<double, ublas::column_major>	dxrdcr(2 * Nckk, 2);
-			ublas::matrix<double, ublas::column_major>	dxrdkr(2 * Nckk, 5);
-			ublas::matrix<double, ublas::column_major>	dxrdalphar(2 * Nckk, 1);
-
-			// ToDo: mIsEstimateAspectRatio = falsêƂ̏lȂƃ_
-			project_points2(
-				X_left_list[kk], omr, Tr,
-				fc_right, cc_right, kc_right, alpha_c_right,
-				xr, dxrdomr, dxrdTr, dxrdfr, dxrdcr, dxrdkr, dxrdalphar);
-
-			for (i = 0; i < Nckk; i++)
+			//	Trial parameters and the predicted reduction h' (J'e + mu * diag(J'J) h)
+			double	h_norm2 = 0.0;
+			double	p_norm2 = 0.0;
+			double	predicted = 0.0;
+			param_new = param;
+			for (i = 0; i < n_sel; i++)
 			{
-				ekk(2 * Nckk + i * 2, 0) = x_right_list[kk](0, i) - xr(0, i);
-				ekk(2 * Nckk + i * 2 + 1, 0) = x_right_list[kk](1, i) - xr(1, i);
+				double	h = param_update(i, 0);
+				param_new(ind_global[i]) += h;
+				h_norm2 += h * h;
+				p_norm2 += param(ind_global[i]) * param(ind_global[i]);
+				predicted += h * (Je_dash(i, 0) + mu * J2_dash(i, i) * h);
 			}
+			for (kk = 0; kk < n_ima; kk++)
+				for (j = 0; j < 6; j++)
+				{
+					double	h = param_update_view_list[kk](j, 0);
+					param_new(26 + kk * 6 + j) += h;
+					h_norm2 += h * h;
+					p_norm2 += param(26 + kk * 6 + j) * param(26 + kk * 6 + j);
+					predicted += h * (Je_view_list[kk](j, 0) + mu * J2_view_list[kk](j, j) * h);
+				}
 
-			ublas::matrix<double, ublas::column_major>	dxrdom(2 * Nckk, 3);
-			ublas::matrix<double, ublas::column_major>	dxrdT(2 * Nckk, 3);
-
-			dxrdom = ublas::prod(dxrdomr, domrdom) + ublas::prod(dxrdTr, dTrdom);
-			dxrdT = ublas::prod(dxrdomr, domrdT) + ublas::prod(dxrdTr, dTrdT);
-
-			ublas::matrix<double, ublas::column_major>	dxrdomckk(2 * Nckk, 3);
-			ublas::matrix<double, ublas::column_major>	dxrdTckk(2 * Nckk, 3);
-
-			dxrdomckk = ublas::prod(dxrdomr, domrdomckk) + ublas::prod(dxrdTr, dTrdomckk);
-			dxrdTckk = ublas::prod(dxrdomr, domrdTckk) + ublas::prod(dxrdTr, dTrdTckk);
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r7(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(20, 20 + 3));
-			Jkk_r7 = dxrdom;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r8(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(23, 23 + 3));
-			Jkk_r8 = dxrdT;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r9(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(6 * kk + 6 + 20, 6 * kk + 6 + 20 + 3));
-			Jkk_r9 = dxrdomckk;
-
-//std::cout << "dxrdomckk.size1()" << dxrdomckk.size1() << std::endl;
-//std::cout << "dxrdomckk.size2()" << dxrdomckk.size2() << std::endl;
-//std::cout << "Jkk_r9.size1()" << Jkk_r9.size1() << std::endl;
-//std::cout << "Jkk_r9.size2()" << Jkk_r9.size2() << std::endl;
-
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r10(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(6 * kk + 6 + 20 + 3, 6 * kk + 6 + 20 + 3 + 3));
-			Jkk_r10 = dxrdTckk;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r11(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(10, 12));
-			Jkk_r11 = dxrdfr;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r12(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(12, 14));
-			Jkk_r12 = dxrdcr;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r13(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(14, 15));
-			Jkk_r13 = dxrdalphar;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				Jkk_r14(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(15, 20));
-			Jkk_r14 = dxrdkr;
-
-			//	ȉ̃WbN͎ĂȂ
-			//emax = max(abs(ekk));
-			//if emax >= threshold,
-			//	fprintf(1,'Disabling view %d - Reason: the left and right images are found inconsistent (try help calib_stereo for more information)\n',kk);
-
-//std::cout << "Jkk:" << Jkk << std::endl;
-//std::cout << "ekk:" << ekk << std::endl;
-
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				J_r(J, ublas::range(row_offset, row_offset + 4 * Nckk), ublas::range(0, J.size2()));
-			J_r = Jkk;
-			
-			ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
-				e_r(e, ublas::range(row_offset, row_offset + 4 * Nckk), ublas::range(0, 1));
-			e_r = ekk;
+			//	Step norm test
+			if (sqrt(h_norm2) <= LM_STEP_MIN * (sqrt(p_norm2) + LM_STEP_MIN))
+				break;
 
-			row_offset += 4 * Nckk;
-		}
+			setParam(param_new);
+			e2_new = computeError2();
 
-//std::cout << "J:" << J << std::endl;
-//std::cout << "e:" << e << std::endl;
-
-		//	The following vector helps to select the variables to update (for only active images):
-		selected_variables.clear();
-		selected_variables(0) = 1.0;	// est_fc left
-		selected_variables(1) = 1.0;	// est_fc left
-		selected_variables(2) = 1.0;	// center optimizaion x left
-		selected_variables(3) = 1.0;	// center optimizaion y left
-		selected_variables(4) = 0.0;	// est_alpha left
-		//selected_variables(4) = 1.0;	// est_alpha left
-		selected_variables(5) = 1.0;	// est_dist left
-		selected_variables(6) = 1.0;	// est_dist left
-		selected_variables(7) = 1.0;	// est_dist left
-		selected_variables(8) = 1.0;	// est_dist left
-		selected_variables(9) = 0.0;	// est_dist left
-
-		selected_variables(10) = 1.0;	// est_fc right
-		selected_variables(11) = 1.0;	// est_fc right
-		selected_variables(12) = 1.0;	// center optimizaion x right
-		selected_variables(13) = 1.0;	// center optimizaion y right
-		selected_variables(14) = 0.0;	// est_alpha right
-		//selected_variables(14) = 1.0;	// est_alpha right
-		selected_variables(15) = 1.0;	// est_dist right
-		selected_variables(16) = 1.0;	// est_dist right
-		selected_variables(17) = 1.0;	// est_dist right
-		selected_variables(18) = 1.0;	// est_dist right
-		selected_variables(19) = 0.0;	// est_dist right
-
-		for (i = 0; i < 6; i++)
-			selected_variables(20 + i) = 1.0;
-
-		for (i = 0; i < 6 * n_ima; i++)
-			selected_variables(26 + i) = 1.0;	//	activeC[W1ɂق悢
-
-		int	temp_num = 0;
-		for (i = 0; i < (int )selected_variables.size(); i++)
-			if (selected_variables(i) != 0.0)
-				temp_num++;
-
-		//	̂͏璷Ȃ̂ł܂Ƃ
-		ublas::matrix<double, ublas::column_major>	J_dash(J.size1(), temp_num);
-		for(i = 0; i < (int )J.size1(); i++)
-		{
-			for (j = 0, j_dash = 0; j < (int )J.size2(); j++)
+			double	rho = (e2 - e2_new) / predicted;
+			if (rho > 0.0)
 			{
-				if (selected_variables(j) != 0.0)
-				{
-					J_dash(i, j_dash) = J(i, j);
-					j_dash++;
-				}
+				//	Accepted: the normal equation at the new parameters
+				param = param_new;
+				buildNormalEquation(ind_global, J2_dash, Je_dash, J2_view_list, J2_cross_dash_list, Je_view_list,
+									e_num, e_sum, e_sum2);
+				e2 = e_sum2;
+
+				double	scale = 1.0 - pow(2.0 * rho - 1.0, 3.0);
+				mu = mu * ((scale > 1.0 / 3.0) ? scale : 1.0 / 3.0);
+				nu = 2.0;
 			}
+			else
+			{
+				//	Rejected
+				setParam(param);
+				mu = mu * nu;
+				nu = nu * 2.0;
+			}
+
+			iter++;
 		}
 
-		J2 = ublas::matrix<double, ublas::column_major>(temp_num, temp_num);
-		J2_inv = ublas::matrix<double, ublas::column_major>(temp_num, temp_num);
+		//	inv(S) without the damping for the uncertainties
+		schur_solve(J2_dash, Je_dash, J2_view_list, J2_cross_dash_list, Je_view_list,
+					param_update, param_update_view_list, J2_inv, J2_view_inv_list);
+	}
+	else
+	{
+		while (	change > MAIN_OPTIMIZATION_CHANGE_MIN &&
+				iter < MAIN_OPTIMIZATION_ITER_MAX)
+		{
+			getParam(param);
+			buildNormalEquation(ind_global, J2_dash, Je_dash, J2_view_list, J2_cross_dash_list, Je_view_list,
+								e_num, e_sum, e_sum2);
 
-		J2 = ublas::prod(ublas::trans(J_dash), J_dash);
-		J2_inv = J2;
-		mat_inv(J2_inv); 
+			//	Same as param_update = inv(J_dash'*J_dash) * J_dash' * e
+			schur_solve(J2_dash, Je_dash, J2_view_list, J2_cross_dash_list, Je_view_list,
+						param_update, param_update_view_list, J2_inv, J2_view_inv_list);
 
-//std::cout << "J2:" << J2 << std::endl;
-//std::cout << "J2_inv:" << J2_inv << std::endl;
+			for (i = 0; i < n_sel; i++)
+				param(ind_global[i]) = param(ind_global[i]) + param_update(i, 0);
+			for (kk = 0; kk < n_ima; kk++)
+				for (j = 0; j < 6; j++)
+					param(26 + kk * 6 + j) = param(26 + kk * 6 + j) + param_update_view_list[kk](j, 0);
 
-		ublas::matrix<double, ublas::column_major>	param_update(temp_num, 1);
+			ublas::matrix<double, ublas::column_major>	om_old(3, 1);
+			ublas::matrix<double, ublas::column_major>	T_old(3, 1);
 
-		param_update = ublas::prod(
-			ublas::matrix<double, ublas::column_major>(ublas::prod(J2_inv, ublas::trans(J_dash))), e);
+			om_old = om;
+			T_old = T;
 
-		for(i = 0, i_dash = 0; i < (int )param.size(); i++)
-		{
-			if (selected_variables(i) != 0.0)
-			{
-				param(i) = param(i) + param_update(i_dash, 0);
-				i_dash++;
-			}
-		}
+			setParam(param);
 
-		//	ŏ̑Ɗ܂߂Ă̂͏璷iœKłƎvj
-		fc_left(0) = param(0);
-		fc_left(1) = param(1);
-		cc_left(0) = param(2);
-		cc_left(1) = param(3);
-		alpha_c_left = param(4);
-		for (i = 0; i < 5; i++)
-			kc_left(i) = param(5 + i);
-		fc_right(0) = param(10);
-		fc_right(1) = param(11);
-		cc_right(0) = param(12);
-		cc_right(1) = param(13);
-		alpha_c_right = param(14);
-		for (i = 0; i < 5; i++)
-			kc_right(i) = param(15 + i);
-		
-		bool	est_aspect_ratio_left_st = true;
-		if (est_aspect_ratio_left_st == false)
-			fc_left(1) = fc_left(0);
-		bool	est_aspect_ratio_right_st = true;
-		if (est_aspect_ratio_right_st == false)
-			fc_right(1) = fc_right(0);
-
-		ublas::matrix<double, ublas::column_major>	om_old(3, 1);
-		ublas::matrix<double, ublas::column_major>	T_old(3, 1);
-		
-		om_old = om;
-		T_old = T;
-
-		for (i = 0; i < 3; i++)
-			om(i, 0) = param(20 + i);
-		for (i = 0; i < 3; i++)
-			T(i, 0) = param(23 + i);
-
-		for (kk = 0; kk < n_ima; kk++)
-		{
-			//	Project the structure onto the left view:
-			for (i = 0; i < 3; i++)
-				omc_left_list[kk](i, 0) = param(26 + kk * 6 + i);
-			for (i = 0; i < 3; i++)
-				Tc_left_list[kk](i, 0) = param(29 + kk * 6 + i);
-		}
-
-		ublas::vector<double>	temp_vec(6);
+			ublas::vector<double>	temp_vec(6);
 			for (i = 0; i < 3; i++)
 				temp_vec(i) = T(i, 0);
 			for (i = 0; i < 3; i++)
 				temp_vec(i + 3) = om(i, 0);
 
-		ublas::vector<double>	temp_vec2(6);
+			ublas::vector<double>	temp_vec2(6);
 			for (i = 0; i < 3; i++)
 				temp_vec2(i) = T(i, 0) - T_old(i, 0);
 			for (i = 0; i < 3; i++)
 				temp_vec2(i + 3) = om(i, 0) - om_old(i, 0);
 
-		change = mat_norm(temp_vec2) / mat_norm(temp_vec);
+			change = mat_norm(temp_vec2) / mat_norm(temp_vec);
 
 std::cout << "iter:" << iter << std::endl;
 std::cout << "change" << change << std::endl;
 
-		iter++;
+			iter++;
+		}
 	}
 
+	mOptimizationIterNum = iter;
+
 std::cout << "done" << std::endl;
 
 std::cout << "Estimation of uncertainties..." << std::endl;
 
-	ublas::matrix_column<ublas::matrix<double, ublas::column_major> >	e_vec(e, 0);
-	double	sigma_x = mat_std(e_vec);
+	//	sigma_x = std(e(:))
+	double	e_avg = e_sum / (double )e_num;
+	double	sigma_x = sqrt((e_sum2 - e_sum * e_avg) / (double )(e_num - 1));	// matlab̕W΍͕ꂪn-1
 
-	ublas::vector<double>	param_error(J.size2());
+	//	Only the shared block of inv(J2) is needed here (= inverse of the Schur complement)
+	ublas::vector<double>	param_error(n_param);
 	param_error.clear();
-	for (i = 0, i_dash = 0; i < (int )param_error.size(); i++)
-	{
-		if (selected_variables(i) != 0.0)
-		{
-			param_error(i) = 3.0 * sqrt(J2_inv(i_dash, i_dash)) * sigma_x;
-			i_dash++;
-		}
-	}
+	for (i = 0; i < n_sel; i++)
+		param_error(ind_global[i]) = 3.0 * sqrt(J2_inv(i, i)) * sigma_x;
 
 	//	omckk_error, Tckk, omc_left_error_list, Tc_left_error_list͂Ƃ肠XLbv
 
@@ -905,6 +1126,384 @@ std::cout << "done" << std::endl;
 }
 
 
+// -----------------------------------------------------------------------------
+//	getParam
+// -----------------------------------------------------------------------------
+//
+//	Parameter vector of mainOptimization: the intrinsics of the both cameras,
+//	om, T (26 shared parameters) and omckk, Tckk of each view
+//
+void	StereoCalibration::getParam(ublas::vector<double> &out_param)
+{
+	int	i, kk;
+
+	out_param(0) = fc_left(0);
+	out_param(1) = fc_left(1);
+	out_param(2) = cc_left(0);
+	out_param(3) = cc_left(1);
+	out_param(4) = alpha_c_left;
+	for (i = 0; i < 5; i++)
+		out_param(5 + i) = kc_left(i);
+	out_param(10) = fc_right(0);
+	out_param(11) = fc_right(1);
+	out_param(12) = cc_right(0);
+	out_param(13) = cc_right(1);
+	out_param(14) = alpha_c_right;
+	for (i = 0; i < 5; i++)
+		out_param(15 + i) = kc_right(i);
+	for (i = 0; i < 3; i++)
+		out_param(20 + i) = om(i, 0);
+	for (i = 0; i < 3; i++)
+		out_param(23 + i) = T(i, 0);
+
+	for (kk = 0; kk < (int )omc_left_list.size(); kk++)
+	{
+		for (i = 0; i < 3; i++)
+			out_param(26 + kk * 6 + i) = omc_left_list[kk](i, 0);
+		for (i = 0; i < 3; i++)
+			out_param(29 + kk * 6 + i) = Tc_left_list[kk](i, 0);
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+//	setParam
+// -----------------------------------------------------------------------------
+//
+void	StereoCalibration::setParam(const ublas::vector<double> &in_param)
+{
+	int	i, kk;
+
+	//	ŏ̑Ɗ܂߂Ă̂͏璷iœKłƎvj
+	fc_left(0) = in_param(0);
+	fc_left(1) = in_param(1);
+	cc_left(0) = in_param(2);
+	cc_left(1) = in_param(3);
+	alpha_c_left = in_param(4);
+	for (i = 0; i < 5; i++)
+		kc_left(i) = in_param(5 + i);
+	fc_right(0) = in_param(10);
+	fc_right(1) = in_param(11);
+	cc_right(0) = in_param(12);
+	cc_right(1) = in_param(13);
+	alpha_c_right = in_param(14);
+	for (i = 0; i < 5; i++)
+		kc_right(i) = in_param(15 + i);
+
+	bool	est_aspect_ratio_left_st = true;
+	if (est_aspect_ratio_left_st == false)
+		fc_left(1) = fc_left(0);
+	bool	est_aspect_ratio_right_st = true;
+	if (est_aspect_ratio_right_st == false)
+		fc_right(1) = fc_right(0);
+
+	for (i = 0; i < 3; i++)
+		om(i, 0) = in_param(20 + i);
+	for (i = 0; i < 3; i++)
+		T(i, 0) = in_param(23 + i);
+
+	for (kk = 0; kk < (int )omc_left_list.size(); kk++)
+	{
+		for (i = 0; i < 3; i++)
+			omc_left_list[kk](i, 0) = in_param(26 + kk * 6 + i);
+		for (i = 0; i < 3; i++)
+			Tc_left_list[kk](i, 0) = in_param(29 + kk * 6 + i);
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+//	buildNormalEquation
+// -----------------------------------------------------------------------------
+//
+//	J'*J and J'*e of the current parameters, as the blocks for schur_solve
+//	(only the selected shared parameters in_ind_global), and the sums of e
+//	and e^2 for sigma_x
+//
+void	StereoCalibration::buildNormalEquation(
+								const std::vector<int> &in_ind_global,
+								ublas::matrix<double, ublas::column_major> &out_J2_dash,
+								ublas::matrix<double, ublas::column_major> &out_Je_dash,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_J2_view_list,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_J2_cross_dash_list,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_Je_view_list,
+								int &out_e_num,
+								double &out_e_sum,
+								double &out_e_sum2)
+{
+	int		i, j, kk;
+	int		n_ima = omc_left_list.size();
+	int		n_global = 20 + 6;
+	int		n_sel = (int )in_ind_global.size();
+
+	ublas::matrix<double, ublas::column_major>	J2_global(n_global, n_global);
+	ublas::matrix<double, ublas::column_major>	Je_global(n_global, 1);
+	std::vector<ublas::matrix<double, ublas::column_major> >	J2_cross_list(n_ima);
+
+	J2_global.clear();
+	Je_global.clear();
+	out_e_num = 0;
+	out_e_sum = 0.0;
+	out_e_sum2 = 0.0;
+
+	//	must check active image first!
+	for (kk = 0; kk < n_ima; kk++)
+	{
+		int	Nckk = X_left_list[kk].size2();
+
+		//	Jkk is split into the shared part and the part of this view
+		ublas::matrix<double, ublas::column_major>	Jkk(4 * Nckk, n_global);
+		ublas::matrix<double, ublas::column_major>	Jkk_view(4 * Nckk, 6);
+		ublas::matrix<double, ublas::column_major>	ekk(4 * Nckk, 1);
+
+		Jkk.clear();
+		Jkk_view.clear();
+		ekk.clear();
+
+		ublas::matrix<double, ublas::column_major>	xl(2, Nckk);
+		ublas::matrix<double, ublas::column_major>	dxldomckk(2 * Nckk, 3);
+		ublas::matrix<double, ublas::column_major>	dxldTckk(2 * Nckk, 3);
+		ublas::matrix<double, ublas::column_major>	dxldfl(2 * Nckk, 2);
+		ublas::matrix<double, ublas::column_major>	dxldcl(2 * Nckk, 2);
+		ublas::matrix<double, ublas::column_major>	dxldkl(2 * Nckk, 5);
+		ublas::matrix<double, ublas::column_major>	dxldalphal(2 * Nckk, 1);
+
+		//	Project the structure onto the left view:
+		// ToDo: mIsEstimateAspectRatio = falsêƂ̏lȂƃ_
+		project_points2(
+			X_left_list[kk], omc_left_list[kk], Tc_left_list[kk],
+			fc_left, cc_left, kc_left, alpha_c_left,
+			xl, dxldomckk, dxldTckk, dxldfl, dxldcl, dxldkl, dxldalphal);
+
+		for (i = 0; i < Nckk; i++)
+		{
+			ekk(i * 2, 0) = x_left_list[kk](0, i) - xl(0, i);
+			ekk(i * 2 + 1, 0) = x_left_list[kk](1, i) - xl(1, i);
+		}
+
+		//	_DEF_MAT_RANGE(JJ3_r1, JJ3, 0, 10, 0, 10)@݂ȃ}Nق悢
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r1(Jkk_view, ublas::range(0, 2 * Nckk), ublas::range(0, 3));
+		Jkk_r1 = dxldomckk;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r2(Jkk_view, ublas::range(0, 2 * Nckk), ublas::range(3, 6));
+		Jkk_r2 = dxldTckk;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r3(Jkk, ublas::range(0, 2 * Nckk), ublas::range(0, 2));
+		Jkk_r3 = dxldfl;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r4(Jkk, ublas::range(0, 2 * Nckk), ublas::range(2, 4));
+		Jkk_r4 = dxldcl;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r5(Jkk, ublas::range(0, 2 * Nckk), ublas::range(4, 5));
+		Jkk_r5 = dxldalphal;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r6(Jkk, ublas::range(0, 2 * Nckk), ublas::range(5, 10));
+		Jkk_r6 = dxldkl;
+
+		//	Project the structure onto the right view:
+		ublas::matrix<double, ublas::column_major>	omr(3, 1);
+		ublas::matrix<double, ublas::column_major>	Tr(3, 1);
+		ublas::matrix<double, ublas::column_major>	domrdomckk(3, 3);
+		ublas::matrix<double, ublas::column_major>	domrdTckk(3, 3);
+		ublas::matrix<double, ublas::column_major>	domrdom(3, 3);
+		ublas::matrix<double, ublas::column_major>	domrdT(3, 3);
+		ublas::matrix<double, ublas::column_major>	dTrdomckk(3, 3);
+		ublas::matrix<double, ublas::column_major>	dTrdTckk(3, 3);
+		ublas::matrix<double, ublas::column_major>	dTrdom(3, 3);
+		ublas::matrix<double, ublas::column_major>	dTrdT(3, 3);
+
+		compose_motion(omc_left_list[kk], Tc_left_list[kk], om, T,
+			omr, Tr, domrdomckk, domrdTckk, domrdom, domrdT, dTrdomckk, dTrdTckk, dTrdom, dTrdT);
+
+/*std::cout << "omc_left_list[kk]" << omc_left_list[kk] << std::endl;
+std::cout << "Tc_left_list[kk]" << Tc_left_list[kk] << std::endl;
+std::cout << "om" << om << std::endl;
+std::cout << "T" << T << std::endl;
+
+std::cout << "omr" << omr << std::endl;
+std::cout << "Tr" << Tr << std::endl;
+std::cout << "domrdomckk" << domrdomckk << std::endl;
+std::cout << "domrdTckk" << domrdTckk << std::endl;
+std::cout << "domrdom" << domrdom << std::endl;
+std::cout << "domrdT" << domrdT << std::endl;
+std::cout << "dTrdomckk" << dTrdomckk << std::endl;
+std::cout << "dTrdTckk" << dTrdTckk << std::endl;
+std::cout << "dTrdom" << dTrdom << std::endl;
+std::cout << "dTrdT" << dTrdT << std::endl;*/
+
+		ublas::matrix<double, ublas::column_major>	xr(2, Nckk);
+		ublas::matrix<double, ublas::column_major>	dxrdomr(2 * Nckk, 3);
+		ublas::matrix<double, ublas::column_major>	dxrdTr(2 * Nckk, 3);
+		ublas::matrix<double, ublas::column_major>	dxrdfr(2 * Nckk, 2);
+		ublas::matrix<double, ublas::column_major>	dxrdcr(2 * Nckk, 2);
+		ublas::matrix<double, ublas::column_major>	dxrdkr(2 * Nckk, 5);
+		ublas::matrix<double, ublas::column_major>	dxrdalphar(2 * Nckk, 1);
+
+		// ToDo: mIsEstimateAspectRatio = falsêƂ̏lȂƃ_
+		project_points2(
+			X_left_list[kk], omr, Tr,
+			fc_right, cc_right, kc_right, alpha_c_right,
+			xr, dxrdomr, dxrdTr, dxrdfr, dxrdcr, dxrdkr, dxrdalphar);
+
+		for (i = 0; i < Nckk; i++)
+		{
+			ekk(2 * Nckk + i * 2, 0) = x_right_list[kk](0, i) - xr(0, i);
+			ekk(2 * Nckk + i * 2 + 1, 0) = x_right_list[kk](1, i) - xr(1, i);
+		}
+
+		ublas::matrix<double, ublas::column_major>	dxrdom(2 * Nckk, 3);
+		ublas::matrix<double, ublas::column_major>	dxrdT(2 * Nckk, 3);
+
+		dxrdom = ublas::prod(dxrdomr, domrdom) + ublas::prod(dxrdTr, dTrdom);
+		dxrdT = ublas::prod(dxrdomr, domrdT) + ublas::prod(dxrdTr, dTrdT);
+
+		ublas::matrix<double, ublas::column_major>	dxrdomckk(2 * Nckk, 3);
+		ublas::matrix<double, ublas::column_major>	dxrdTckk(2 * Nckk, 3);
+
+		dxrdomckk = ublas::prod(dxrdomr, domrdomckk) + ublas::prod(dxrdTr, dTrdomckk);
+		dxrdTckk = ublas::prod(dxrdomr, domrdTckk) + ublas::prod(dxrdTr, dTrdTckk);
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r7(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(20, 20 + 3));
+		Jkk_r7 = dxrdom;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r8(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(23, 23 + 3));
+		Jkk_r8 = dxrdT;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r9(Jkk_view, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(0, 3));
+		Jkk_r9 = dxrdomckk;
+
+//std::cout << "dxrdomckk.size1()" << dxrdomckk.size1() << std::endl;
+//std::cout << "dxrdomckk.size2()" << dxrdomckk.size2() << std::endl;
+//std::cout << "Jkk_r9.size1()" << Jkk_r9.size1() << std::endl;
+//std::cout << "Jkk_r9.size2()" << Jkk_r9.size2() << std::endl;
+
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r10(Jkk_view, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(3, 6));
+		Jkk_r10 = dxrdTckk;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r11(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(10, 12));
+		Jkk_r11 = dxrdfr;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r12(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(12, 14));
+		Jkk_r12 = dxrdcr;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r13(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(14, 15));
+		Jkk_r13 = dxrdalphar;
+
+		ublas::matrix_range<ublas::matrix<double, ublas::column_major> >
+			Jkk_r14(Jkk, ublas::range(2 * Nckk, 4 * Nckk), ublas::range(15, 20));
+		Jkk_r14 = dxrdkr;
+
+		//	ȉ̃WbN͎ĂȂ
+		//emax = max(abs(ekk));
+		//if emax >= threshold,
+		//	fprintf(1,'Disabling view %d - Reason: the left and right images are found inconsistent (try help calib_stereo for more information)\n',kk);
+
+//std::cout << "Jkk:" << Jkk << std::endl;
+//std::cout << "ekk:" << ekk << std::endl;
+
+		//	J'*J and J'*e of this view
+		J2_global = J2_global + ublas::prod(ublas::trans(Jkk), Jkk);
+		Je_global = Je_global + ublas::prod(ublas::trans(Jkk), ekk);
+		out_J2_view_list[kk] = ublas::prod(ublas::trans(Jkk_view), Jkk_view);
+		J2_cross_list[kk] = ublas::prod(ublas::trans(Jkk), Jkk_view);
+		out_Je_view_list[kk] = ublas::prod(ublas::trans(Jkk_view), ekk);
+
+		for (i = 0; i < 4 * Nckk; i++)
+		{
+			out_e_sum += ekk(i, 0);
+			out_e_sum2 += ekk(i, 0) * ekk(i, 0);
+		}
+		out_e_num += 4 * Nckk;
+	}
+
+	//	Pick up the selected shared parameters
+	for (i = 0; i < n_sel; i++)
+	{
+		for (j = 0; j < n_sel; j++)
+			out_J2_dash(i, j) = J2_global(in_ind_global[i], in_ind_global[j]);
+		out_Je_dash(i, 0) = Je_global(in_ind_global[i], 0);
+	}
+	for (kk = 0; kk < n_ima; kk++)
+	{
+		out_J2_cross_dash_list[kk].resize(n_sel, 6, false);
+		for (i = 0; i < n_sel; i++)
+			for (j = 0; j < 6; j++)
+				out_J2_cross_dash_list[kk](i, j) = J2_cross_list[kk](in_ind_global[i], j);
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+//	computeError2
+// -----------------------------------------------------------------------------
+//
+//	Sum of the squared reprojection errors of the both cameras with the current
+//	parameters (only the projection, for the trial steps of Levenberg-Marquardt)
+//
+double	StereoCalibration::computeError2()
+{
+	int		i, kk;
+	int		n_ima = omc_left_list.size();
+	double	e2 = 0.0;
+
+	ublas::matrix<double, ublas::column_major>	omr(3, 1);
+	ublas::matrix<double, ublas::column_major>	Tr(3, 1);
+	ublas::matrix<double, ublas::column_major>	domrdomckk(3, 3);
+	ublas::matrix<double, ublas::column_major>	domrdTckk(3, 3);
+	ublas::matrix<double, ublas::column_major>	domrdom(3, 3);
+	ublas::matrix<double, ublas::column_major>	domrdT(3, 3);
+	ublas::matrix<double, ublas::column_major>	dTrdomckk(3, 3);
+	ublas::matrix<double, ublas::column_major>	dTrdTckk(3, 3);
+	ublas::matrix<double, ublas::column_major>	dTrdom(3, 3);
+	ublas::matrix<double, ublas::column_major>	dTrdT(3, 3);
+
+	for (kk = 0; kk < n_ima; kk++)
+	{
+		int	Nckk = X_left_list[kk].size2();
+		ublas::matrix<double, ublas::column_major>	xl(2, Nckk);
+		ublas::matrix<double, ublas::column_major>	xr(2, Nckk);
+
+		project_points2(X_left_list[kk], omc_left_list[kk], Tc_left_list[kk],
+						fc_left, cc_left, kc_left, alpha_c_left, xl);
+
+		compose_motion(omc_left_list[kk], Tc_left_list[kk], om, T,
+			omr, Tr, domrdomckk, domrdTckk, domrdom, domrdT, dTrdomckk, dTrdTckk, dTrdom, dTrdT);
+		project_points2(X_left_list[kk], omr, Tr,
+						fc_right, cc_right, kc_right, alpha_c_right, xr);
+
+		//	Same order as ekk in buildNormalEquation
+		for (i = 0; i < Nckk; i++)
+			for (int j = 0; j < 2; j++)
+			{
+				double	e = x_left_list[kk](j, i) - xl(j, i);
+				e2 += e * e;
+			}
+		for (i = 0; i < Nckk; i++)
+			for (int j = 0; j < 2; j++)
+			{
+				double	e = x_right_list[kk](j, i) - xr(j, i);
+				e2 += e * e;
+			}
+	}
+
+	return e2;
+}
+
+
 // -----------------------------------------------------------------------------
 //	compose_motion
 // -----------------------------------------------------------------------------
@@ -43,9 +43,24 @@
 // -----------------------------------------------------------------------------
 // 	include files
 // -----------------------------------------------------------------------------
+#include <mutex>
 #include "CameraCalibration.hpp"
 
 
+// -----------------------------------------------------------------------------
+// 	RectifyROI
+// -----------------------------------------------------------------------------
+//
+//	The region of the rectified image where every pixel is mapped to the
+//	source image (width or height is 0 if there is no such region)
+//
+struct RectifyROI
+{
+	int		x, y;
+	int		width, height;
+};
+
+
 // -----------------------------------------------------------------------------
 // 	StereoCalibration class
 // -----------------------------------------------------------------------------
@@ -60,7 +75,23 @@ public:
 	virtual void			DoCalibration();
 	virtual void			DumpResults();
 
-	void					CalcRectifyIndex();
+	//	inWidth, inHeight:	size of the rectified images (0: the image size * inScale)
+	//	inScale:			scale of the rectified images (0.5: half resolution)
+	//						(with inAlpha >= 0, the focal length follows the size instead)
+	//	inAlpha:			< 0:	the focal length and the principal points of the toolbox
+	//						0..1:	0 keeps only the valid pixels (crop), 1 keeps all
+	//								the source pixels and the others are in between
+	void					CalcRectifyIndex(int inWidth = 0, int inHeight = 0,
+											double inScale = 1.0, double inAlpha = -1.0);
+	//	Calls CalcRectifyIndex only if the maps are not made for the current
+	//	parameters (CalcRectifyHash). Returns true if the maps are rebuilt.
+	//	Both lock rect_map_mutex. The users of the maps lock it too, from
+	//	UpdateRectifyIndex to the end of the use (the maps are rebuilt in place).
+	bool					UpdateRectifyIndex(int inWidth = 0, int inHeight = 0,
+											double inScale = 1.0, double inAlpha = -1.0);
+	//	Hash of the image size and the parameters of the rectification
+	unsigned long long		CalcRectifyHash(int inWidth = 0, int inHeight = 0,
+											double inScale = 1.0, double inAlpha = -1.0) const;
 
 	//	member variables
 	std::vector<ublas::matrix<double, ublas::column_major> >	X_left_list;
@@ -105,31 +136,17 @@ public:
 	ublas::matrix<double, ublas::column_major>	T_error;
 	ublas::matrix<double, ublas::column_major>	om_error;
 
-	ublas::vector<double>	a1_left;
-	ublas::vector<double>	a2_left;
-	ublas::vector<double>	a3_left;
-	ublas::vector<double>	a4_left;
+	//	The remap tables of the rectification (CalcRectifyIndex)
+	RectifyMap				rect_map_left;
+	RectifyMap				rect_map_right;
+	unsigned long long		rect_map_hash;		//	CalcRectifyHash of the maps (0: not made)
+	int						rect_width, rect_height;	//	size of the rectified images
+	double					rect_scale, rect_alpha;		//	inScale, inAlpha of CalcRectifyIndex
+	RectifyROI				rect_roi_left;		//	valid region of rect_map_left
+	RectifyROI				rect_roi_right;		//	valid region of rect_map_right
+	RectifyROI				rect_roi;			//	common valid region of the both
+	mutable std::recursive_mutex	rect_map_mutex;	//	guards the rect_* members above (per instance)
 
-	ublas::vector<int>		ind_new_left;
-	ublas::vector<int>		ind_1_left;
-	ublas::vector<int>		ind_2_left;
-	ublas::vector<int>		ind_3_left;
-	ublas::vector<int>		ind_4_left;
-
-	ublas::vector<double>	a1_right;
-	ublas::vector<double>	a2_right;
-	ublas::vector<double>	a3_right;
-	ublas::vector<double>	a4_right;
-
-	ublas::vector<int>		ind_new_right;
-	ublas::vector<int>		ind_1_right;
-	ublas::vector<int>		ind_2_right;
-	ublas::vector<int>		ind_3_right;
-	ublas::vector<int>		ind_4_right;
-
-
-protected:
-	void					mainOptimization();
 
 	static void				compose_motion(
 								const ublas::matrix<double, ublas::column_major> &in_om1,
@@ -153,6 +170,21 @@ protected:
 								ublas::matrix<double, ublas::column_major> &out_dABdA,
 								ublas::matrix<double, ublas::column_major> &out_dABdB);
 
+protected:
+	void					mainOptimization();
+	void					getParam(ublas::vector<double> &out_param);
+	void					setParam(const ublas::vector<double> &in_param);
+	void					buildNormalEquation(
+								const std::vector<int> &in_ind_global,
+								ublas::matrix<double, ublas::column_major> &out_J2_dash,
+								ublas::matrix<double, ublas::column_major> &out_Je_dash,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_J2_view_list,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_J2_cross_dash_list,
+								std::vector<ublas::matrix<double, ublas::column_major> > &out_Je_view_list,
+								int &out_e_num,
+								double &out_e_sum,
+								double &out_e_sum2);
+	double					computeError2();
 };
 
 
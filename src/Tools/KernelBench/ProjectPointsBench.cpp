@@ -0,0 +1,119 @@
+// =============================================================================
+//  ProjectPointsBench.cpp
+//
+//  MIT License
+//
+//  Copyright (c) 2007-2018 Dairoku Sekiguchi
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+// =============================================================================
+/*!
+	\file		ProjectPointsBench.cpp
+	\author		Dairoku Sekiguchi
+	\version	1.0
+	\date		2018/06/22
+	\brief		Benchmark of CameraCalibration::project_points2
+
+	Projects a 100 x 100 point board (10000 points) with all the jacobians,
+	the same call as the normal equations of mainOptimization, and prints
+	the time of one call.
+
+	Build (the same include path and lapack as CalibraKernel):
+		g++ -O2 -DNDEBUG -std=c++11 -pthread -I../../Kernel/Sources -DLAPACK_DGETRI=dgetri_
+			ProjectPointsBench.cpp ../../Kernel/Sources/CameraCalibration.cpp
+			../../Kernel/Sources/ParallelTask.cpp ../../Kernel/Sources/DistortionEngine.cpp
+			../../Kernel/Sources/RectifyMap.cpp -llapack -lblas -o ProjectPointsBench
+	Usage:
+		ProjectPointsBench [point number per side] [repeat number]
+*/
+
+// -----------------------------------------------------------------------------
+// 	include files
+// -----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <boost/numeric/ublas/vector.hpp>
+#include <boost/numeric/ublas/matrix.hpp>
+
+namespace ublas = boost::numeric::ublas;
+
+#include "CameraCalibration.hpp"
+
+
+// -----------------------------------------------------------------------------
+//	main
+// -----------------------------------------------------------------------------
+//
+int	main(int argc, char **argv)
+{
+	int	side = (argc > 1) ? atoi(argv[1]) : 100;
+	int	repeat = (argc > 2) ? atoi(argv[2]) : 200;
+	if (side < 2 || repeat < 1)
+	{
+		printf("Usage: ProjectPointsBench [point number per side] [repeat number]\n");
+		return 1;
+	}
+	int	Np = side * side;
+
+	//	A board of 10mm squares in front of the camera
+	ublas::matrix<double, ublas::column_major>	X(3, Np);
+	for (int i = 0; i < side; i++)
+		for (int j = 0; j < side; j++)
+		{
+			X(0, i * side + j) = j * 10.0;
+			X(1, i * side + j) = i * 10.0;
+			X(2, i * side + j) = 0;
+		}
+
+	ublas::matrix<double, ublas::column_major>	om(3, 1), T(3, 1);
+	om(0, 0) = 0.1;		om(1, 0) = -0.2;	om(2, 0) = 0.05;
+	T(0, 0) = -side * 5.0;	T(1, 0) = -side * 5.0;	T(2, 0) = side * 12.0;
+
+	ublas::vector<double>	fc(2), cc(2), kc(5);
+	fc(0) = 800;	fc(1) = 802;
+	cc(0) = 322;	cc(1) = 238;
+	kc.clear();
+	kc(0) = -0.2;	kc(1) = 0.05;	kc(2) = 0.001;	kc(3) = -0.001;
+	double	alpha_c = 0;
+
+	ublas::matrix<double, ublas::column_major>	x(2, Np);
+	ublas::matrix<double, ublas::column_major>	dxdom(2 * Np, 3), dxdT(2 * Np, 3);
+	ublas::matrix<double, ublas::column_major>	dxdf(2 * Np, 2), dxdc(2 * Np, 2);
+	ublas::matrix<double, ublas::column_major>	dxdk(2 * Np, 5), dxdalpha(2 * Np, 1);
+
+	//	warm up
+	CameraCalibration::project_points2(X, om, T, fc, cc, kc, alpha_c,
+										x, dxdom, dxdT, dxdf, dxdc, dxdk, dxdalpha);
+
+	double	checksum = 0;
+	std::chrono::steady_clock::time_point	start = std::chrono::steady_clock::now();
+	for (int n = 0; n < repeat; n++)
+	{
+		CameraCalibration::project_points2(X, om, T, fc, cc, kc, alpha_c,
+											x, dxdom, dxdT, dxdf, dxdc, dxdk, dxdalpha);
+		checksum += x(0, n % Np);
+	}
+	double	time = std::chrono::duration<double, std::milli>(
+						std::chrono::steady_clock::now() - start).count();
+
+	printf("project_points2: %d points, %.3f ms per call (%d calls, checksum %g)\n",
+		Np, time / repeat, repeat, checksum);
+	return 0;
+}
@@ -0,0 +1,180 @@
+// =============================================================================
+//  RemapBench.cpp
+//
+//  MIT License
+//
+//  Copyright (c) 2007-2018 Dairoku Sekiguchi
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+// =============================================================================
+/*!
+	\file		RemapBench.cpp
+	\author		Dairoku Sekiguchi
+	\version	1.0
+	\date		2018/06/24
+	\brief		Benchmark of RectifyMap::Remap
+
+	Builds the left and right rectification maps of a full HD (1920 x 1080)
+	stereo pair with CameraCalibration::rect_index and prints the time to
+	remap both images, for every SIMD type the CPU supports and for the
+	given worker numbers. The target is 2 ms per stereo pair.
+
+	Build (the same include path and lapack as CalibraKernel):
+		g++ -O2 -DNDEBUG -std=c++11 -pthread -I../../Kernel/Sources -DLAPACK_DGETRI=dgetri_
+			RemapBench.cpp ../../Kernel/Sources/CameraCalibration.cpp
+			../../Kernel/Sources/ParallelTask.cpp ../../Kernel/Sources/DistortionEngine.cpp
+			../../Kernel/Sources/RectifyMap.cpp -llapack -lblas -o RemapBench
+	Usage:
+		RemapBench [channel number (1 or 3)] [repeat number] [worker number ...]
+		(the worker numbers are 1, 2, 4, ... up to the hardware threads by default)
+*/
+
+// -----------------------------------------------------------------------------
+// 	include files
+// -----------------------------------------------------------------------------
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <boost/numeric/ublas/vector.hpp>
+#include <boost/numeric/ublas/matrix.hpp>
+
+namespace ublas = boost::numeric::ublas;
+
+#include "CameraCalibration.hpp"
+#include "RectifyMap.hpp"
+
+
+// -----------------------------------------------------------------------------
+// 	macros
+// -----------------------------------------------------------------------------
+#define	REMAP_BENCH_WIDTH		1920
+#define	REMAP_BENCH_HEIGHT		1080
+#define	REMAP_BENCH_TARGET_MS	2.0		//	per stereo pair
+
+
+// -----------------------------------------------------------------------------
+//	buildMap
+// -----------------------------------------------------------------------------
+//
+//	A camera of a typical wide lens, rotated by in_angle (rad) around the y axis
+//	as the rectification of a stereo camera does
+//
+static void	buildMap(double in_angle, int in_weight_type, RectifyMap &out_map)
+{
+	ublas::vector<double>	fc(2), cc(2), kc(5);
+	fc(0) = 1400;	fc(1) = 1402;
+	cc(0) = REMAP_BENCH_WIDTH / 2.0 + 12;	cc(1) = REMAP_BENCH_HEIGHT / 2.0 - 7;
+	kc.clear();
+	kc(0) = -0.25;	kc(1) = 0.08;	kc(2) = 0.0005;	kc(3) = -0.0008;
+
+	ublas::matrix<double, ublas::column_major>	R(3, 3), KK_new(3, 3);
+	R.clear();
+	R(0, 0) = cos(in_angle);	R(0, 2) = sin(in_angle);
+	R(1, 1) = 1;
+	R(2, 0) = -sin(in_angle);	R(2, 2) = cos(in_angle);
+
+	KK_new.clear();
+	KK_new(0, 0) = fc(0);	KK_new(0, 2) = cc(0);
+	KK_new(1, 1) = fc(0);	KK_new(1, 2) = cc(1);
+	KK_new(2, 2) = 1;
+
+	CameraCalibration::rect_index(REMAP_BENCH_WIDTH, REMAP_BENCH_HEIGHT,
+									R, fc, cc, kc, 0, KK_new, out_map, in_weight_type);
+}
+
+// -----------------------------------------------------------------------------
+//	main
+// -----------------------------------------------------------------------------
+//
+int	main(int argc, char **argv)
+{
+	int	channel = (argc > 1) ? atoi(argv[1]) : 1;
+	int	repeat = (argc > 2) ? atoi(argv[2]) : 50;
+	if ((channel != 1 && channel != 3) || repeat < 1)
+	{
+		printf("Usage: RemapBench [channel number (1 or 3)] [repeat number] [worker number ...]\n");
+		return 1;
+	}
+
+	std::vector<int>	workerNumList;
+	for (int i = 3; i < argc; i++)
+		workerNumList.push_back(atoi(argv[i]));
+	if (workerNumList.empty())
+	{
+		int	hardwareNum = (int )std::thread::hardware_concurrency();
+		for (int num = 1; num < hardwareNum; num *= 2)
+			workerNumList.push_back(num);
+		workerNumList.push_back((hardwareNum > 1) ? hardwareNum : 1);
+	}
+
+	size_t	imageSize = (size_t )REMAP_BENCH_WIDTH * REMAP_BENCH_HEIGHT * channel;
+	std::vector<unsigned char>	left(imageSize), right(imageSize);
+	std::vector<unsigned char>	leftOut(imageSize), rightOut(imageSize);
+	for (size_t i = 0; i < imageSize; i++)
+	{
+		left[i] = (unsigned char )((i * 7 + (i / REMAP_BENCH_WIDTH) * 3) & 0xFF);
+		right[i] = (unsigned char )((i * 5 + (i / REMAP_BENCH_WIDTH) * 11) & 0xFF);
+	}
+
+	RectifyMap::SimdType	supported = RectifyMap::GetSupportedSimdType();
+	const char	*simdName[] = {"none", "SSE4.1", "AVX2"};
+
+	printf("%d x %d stereo pair, %d channel(s), hardware threads %d, target %.1f ms\n",
+		REMAP_BENCH_WIDTH, REMAP_BENCH_HEIGHT, channel,
+		(int )std::thread::hardware_concurrency(), REMAP_BENCH_TARGET_MS);
+
+	for (int weightType = RectifyMap::WEIGHT_8BIT; weightType <= RectifyMap::WEIGHT_16BIT; weightType++)
+	{
+		RectifyMap	leftMap, rightMap;
+		buildMap(0.02, weightType, leftMap);
+		buildMap(-0.02, weightType, rightMap);
+
+		for (int simd = RectifyMap::SIMD_NONE; simd <= supported; simd++)
+		{
+			RectifyMap::SetSimdType((RectifyMap::SimdType )simd);
+			for (size_t n = 0; n < workerNumList.size(); n++)
+			{
+				int	workerNum = workerNumList[n];
+
+				//	warm up (the thread pool and the page faults of the output)
+				leftMap.Remap(&(left[0]), &(leftOut[0]), channel, workerNum);
+				rightMap.Remap(&(right[0]), &(rightOut[0]), channel, workerNum);
+
+				std::chrono::steady_clock::time_point	start = std::chrono::steady_clock::now();
+				for (int i = 0; i < repeat; i++)
+				{
+					leftMap.Remap(&(left[0]), &(leftOut[0]), channel, workerNum);
+					rightMap.Remap(&(right[0]), &(rightOut[0]), channel, workerNum);
+				}
+				double	time = std::chrono::duration<double, std::milli>(
+									std::chrono::steady_clock::now() - start).count() / repeat;
+
+				printf("%s weights, SIMD %-6s, %2d worker(s): %7.3f ms per pair %s\n",
+					(weightType == RectifyMap::WEIGHT_8BIT) ? "8bit " : "16bit",
+					simdName[simd], workerNum, time,
+					(time <= REMAP_BENCH_TARGET_MS) ? "(ok)" : "(over the target)");
+			}
+		}
+	}
+	RectifyMap::SetSimdType(supported);
+	return 0;
+}